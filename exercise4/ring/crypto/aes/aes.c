@@ -49,8 +49,10 @@
 #include <openssl/aes.h>
 
 #include <assert.h>
+#include <string.h>
 
 #include <openssl/cpu.h>
+#include <openssl/type_check.h>
 
 #include "../internal.h"
 
@@ -595,3 +597,669 @@ int GFp_AES_set_encrypt_key(const uint8_t *key, unsigned bits,
 }
 
 #endif  /* OPENSSL_NO_ASM || (!OPENSSL_X86 && !OPENSSL_X86_64 && !OPENSSL_ARM) */
+
+
+/* Constant-time, bitsliced AES.
+ *
+ * This is a portable implementation that uses no secret-dependent table
+ * lookups or branches, for CPUs that have neither AES instructions nor a
+ * vector unit that the asm implementations can use. It follows the 64-bit
+ * "ct64" design of BearSSL by Thomas Pornin (MIT license): four blocks are
+ * processed at once, with each of the eight |uint64_t| words holding one bit
+ * position of all 64 bytes of state, and the S-box is computed with the
+ * Boyar-Peralta circuit.
+ *
+ * The round keys are stored in |AES_KEY| in a compressed form, two words per
+ * round, which is exactly |sizeof(AES_KEY.rd_key)| for AES-256. They are
+ * expanded to the eight-word form on the stack for each call. */
+
+int GFp_aes_nohw_set_encrypt_key(const uint8_t *key, unsigned bits,
+                                 AES_KEY *aeskey);
+void GFp_aes_nohw_encrypt(const uint8_t *in, uint8_t *out, const AES_KEY *key);
+void GFp_aes_nohw_ctr32_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                       size_t blocks, const AES_KEY *key,
+                                       const uint8_t ivec[16]);
+void GFp_aes_nohw_ecb_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key);
+void GFp_aes_nohw_ecb_decrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key);
+
+/* AES_NOHW_BATCH_BLOCKS is the number of blocks that are encrypted together. */
+#define AES_NOHW_BATCH_BLOCKS 4
+
+/* aes_nohw_sub_bytes applies the AES S-box to every byte of the bitsliced
+ * state |q|. */
+static void aes_nohw_sub_bytes(uint64_t q[8]) {
+  uint64_t x0, x1, x2, x3, x4, x5, x6, x7;
+  uint64_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  uint64_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  uint64_t y20, y21;
+  uint64_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  uint64_t z10, z11, z12, z13, z14, z15, z16, z17;
+  uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  uint64_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  uint64_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  uint64_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  uint64_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  uint64_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  uint64_t t60, t61, t62, t63, t64, t65, t66, t67;
+  uint64_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+  x0 = q[7];
+  x1 = q[6];
+  x2 = q[5];
+  x3 = q[4];
+  x4 = q[3];
+  x5 = q[2];
+  x6 = q[1];
+  x7 = q[0];
+
+  /* Top linear transformation. */
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  /* Non-linear section. */
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  /* Bottom linear transformation. */
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+/* aes_nohw_swap exchanges the bits of |*a| selected by |mask_lo| with the
+ * bits of |*b| selected by |mask_lo| << |shift|. */
+static inline void aes_nohw_swap(uint64_t *a, uint64_t *b, uint64_t mask_lo,
+                                 unsigned shift) {
+  uint64_t x = *a, y = *b;
+  *a = (x & mask_lo) | ((y & mask_lo) << shift);
+  *b = ((x >> shift) & mask_lo) | (y & (mask_lo << shift));
+}
+
+/* aes_nohw_ortho transposes |q| between the interleaved and the bitsliced
+ * representations. It is its own inverse. */
+static void aes_nohw_ortho(uint64_t q[8]) {
+  static const uint64_t kMask1 = UINT64_C(0x5555555555555555);
+  static const uint64_t kMask2 = UINT64_C(0x3333333333333333);
+  static const uint64_t kMask4 = UINT64_C(0x0f0f0f0f0f0f0f0f);
+
+  aes_nohw_swap(&q[0], &q[1], kMask1, 1);
+  aes_nohw_swap(&q[2], &q[3], kMask1, 1);
+  aes_nohw_swap(&q[4], &q[5], kMask1, 1);
+  aes_nohw_swap(&q[6], &q[7], kMask1, 1);
+
+  aes_nohw_swap(&q[0], &q[2], kMask2, 2);
+  aes_nohw_swap(&q[1], &q[3], kMask2, 2);
+  aes_nohw_swap(&q[4], &q[6], kMask2, 2);
+  aes_nohw_swap(&q[5], &q[7], kMask2, 2);
+
+  aes_nohw_swap(&q[0], &q[4], kMask4, 4);
+  aes_nohw_swap(&q[1], &q[5], kMask4, 4);
+  aes_nohw_swap(&q[2], &q[6], kMask4, 4);
+  aes_nohw_swap(&q[3], &q[7], kMask4, 4);
+}
+
+/* aes_nohw_interleave_in spreads the four little-endian words of one block,
+ * |w|, across |*q0| and |*q1|, ready for |aes_nohw_ortho|. */
+static void aes_nohw_interleave_in(uint64_t *q0, uint64_t *q1,
+                                   const uint32_t w[4]) {
+  uint64_t x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+  x0 |= (x0 << 16);
+  x1 |= (x1 << 16);
+  x2 |= (x2 << 16);
+  x3 |= (x3 << 16);
+  x0 &= UINT64_C(0x0000ffff0000ffff);
+  x1 &= UINT64_C(0x0000ffff0000ffff);
+  x2 &= UINT64_C(0x0000ffff0000ffff);
+  x3 &= UINT64_C(0x0000ffff0000ffff);
+  x0 |= (x0 << 8);
+  x1 |= (x1 << 8);
+  x2 |= (x2 << 8);
+  x3 |= (x3 << 8);
+  x0 &= UINT64_C(0x00ff00ff00ff00ff);
+  x1 &= UINT64_C(0x00ff00ff00ff00ff);
+  x2 &= UINT64_C(0x00ff00ff00ff00ff);
+  x3 &= UINT64_C(0x00ff00ff00ff00ff);
+  *q0 = x0 | (x2 << 8);
+  *q1 = x1 | (x3 << 8);
+}
+
+/* aes_nohw_interleave_out is the inverse of |aes_nohw_interleave_in|. */
+static void aes_nohw_interleave_out(uint32_t w[4], uint64_t q0, uint64_t q1) {
+  uint64_t x0, x1, x2, x3;
+  x0 = q0 & UINT64_C(0x00ff00ff00ff00ff);
+  x1 = q1 & UINT64_C(0x00ff00ff00ff00ff);
+  x2 = (q0 >> 8) & UINT64_C(0x00ff00ff00ff00ff);
+  x3 = (q1 >> 8) & UINT64_C(0x00ff00ff00ff00ff);
+  x0 |= (x0 >> 8);
+  x1 |= (x1 >> 8);
+  x2 |= (x2 >> 8);
+  x3 |= (x3 >> 8);
+  x0 &= UINT64_C(0x0000ffff0000ffff);
+  x1 &= UINT64_C(0x0000ffff0000ffff);
+  x2 &= UINT64_C(0x0000ffff0000ffff);
+  x3 &= UINT64_C(0x0000ffff0000ffff);
+  w[0] = (uint32_t)x0 | (uint32_t)(x0 >> 16);
+  w[1] = (uint32_t)x1 | (uint32_t)(x1 >> 16);
+  w[2] = (uint32_t)x2 | (uint32_t)(x2 >> 16);
+  w[3] = (uint32_t)x3 | (uint32_t)(x3 >> 16);
+}
+
+static void aes_nohw_shift_rows(uint64_t q[8]) {
+  size_t i;
+  for (i = 0; i < 8; ++i) {
+    uint64_t x = q[i];
+    q[i] = (x & UINT64_C(0x000000000000ffff)) |
+           ((x & UINT64_C(0x00000000fff00000)) >> 4) |
+           ((x & UINT64_C(0x00000000000f0000)) << 12) |
+           ((x & UINT64_C(0x0000ff0000000000)) >> 8) |
+           ((x & UINT64_C(0x000000ff00000000)) << 8) |
+           ((x & UINT64_C(0xf000000000000000)) >> 12) |
+           ((x & UINT64_C(0x0fff000000000000)) << 4);
+  }
+}
+
+static inline uint64_t aes_nohw_rotr32(uint64_t x) {
+  return (x << 32) | (x >> 32);
+}
+
+static void aes_nohw_mix_columns(uint64_t q[8]) {
+  uint64_t q0, q1, q2, q3, q4, q5, q6, q7;
+  uint64_t r0, r1, r2, r3, r4, r5, r6, r7;
+
+  q0 = q[0];
+  q1 = q[1];
+  q2 = q[2];
+  q3 = q[3];
+  q4 = q[4];
+  q5 = q[5];
+  q6 = q[6];
+  q7 = q[7];
+  r0 = (q0 >> 16) | (q0 << 48);
+  r1 = (q1 >> 16) | (q1 << 48);
+  r2 = (q2 >> 16) | (q2 << 48);
+  r3 = (q3 >> 16) | (q3 << 48);
+  r4 = (q4 >> 16) | (q4 << 48);
+  r5 = (q5 >> 16) | (q5 << 48);
+  r6 = (q6 >> 16) | (q6 << 48);
+  r7 = (q7 >> 16) | (q7 << 48);
+
+  q[0] = q7 ^ r7 ^ r0 ^ aes_nohw_rotr32(q0 ^ r0);
+  q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ aes_nohw_rotr32(q1 ^ r1);
+  q[2] = q1 ^ r1 ^ r2 ^ aes_nohw_rotr32(q2 ^ r2);
+  q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ aes_nohw_rotr32(q3 ^ r3);
+  q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ aes_nohw_rotr32(q4 ^ r4);
+  q[5] = q4 ^ r4 ^ r5 ^ aes_nohw_rotr32(q5 ^ r5);
+  q[6] = q5 ^ r5 ^ r6 ^ aes_nohw_rotr32(q6 ^ r6);
+  q[7] = q6 ^ r6 ^ r7 ^ aes_nohw_rotr32(q7 ^ r7);
+}
+
+/* aes_nohw_inv_affine applies the inverse of the affine transformation of the
+ * S-box, including the XOR with 0x63. */
+static void aes_nohw_inv_affine(uint64_t q[8]) {
+  uint64_t q0 = ~q[0];
+  uint64_t q1 = ~q[1];
+  uint64_t q2 = q[2];
+  uint64_t q3 = q[3];
+  uint64_t q4 = q[4];
+  uint64_t q5 = ~q[5];
+  uint64_t q6 = ~q[6];
+  uint64_t q7 = q[7];
+  q[7] = q1 ^ q4 ^ q6;
+  q[6] = q0 ^ q3 ^ q5;
+  q[5] = q7 ^ q2 ^ q4;
+  q[4] = q6 ^ q1 ^ q3;
+  q[3] = q5 ^ q0 ^ q2;
+  q[2] = q4 ^ q7 ^ q1;
+  q[1] = q3 ^ q6 ^ q0;
+  q[0] = q2 ^ q5 ^ q7;
+}
+
+/* aes_nohw_inv_sub_bytes applies the inverse S-box. The S-box is the affine
+ * transformation of the inverse in GF(2^8), so wrapping the S-box circuit in
+ * the inverse affine transformation on both sides leaves just the inverse in
+ * GF(2^8) of the inverse affine transformation, which is the inverse S-box. */
+static void aes_nohw_inv_sub_bytes(uint64_t q[8]) {
+  aes_nohw_inv_affine(q);
+  aes_nohw_sub_bytes(q);
+  aes_nohw_inv_affine(q);
+}
+
+static void aes_nohw_inv_shift_rows(uint64_t q[8]) {
+  size_t i;
+  for (i = 0; i < 8; ++i) {
+    uint64_t x = q[i];
+    q[i] = (x & UINT64_C(0x000000000000ffff)) |
+           ((x & UINT64_C(0x000000000fff0000)) << 4) |
+           ((x & UINT64_C(0x00000000f0000000)) >> 12) |
+           ((x & UINT64_C(0x000000ff00000000)) << 8) |
+           ((x & UINT64_C(0x0000ff0000000000)) >> 8) |
+           ((x & UINT64_C(0x000f000000000000)) << 12) |
+           ((x & UINT64_C(0xfff0000000000000)) >> 4);
+  }
+}
+
+static void aes_nohw_inv_mix_columns(uint64_t q[8]) {
+  uint64_t q0, q1, q2, q3, q4, q5, q6, q7;
+  uint64_t r0, r1, r2, r3, r4, r5, r6, r7;
+
+  q0 = q[0];
+  q1 = q[1];
+  q2 = q[2];
+  q3 = q[3];
+  q4 = q[4];
+  q5 = q[5];
+  q6 = q[6];
+  q7 = q[7];
+  r0 = (q0 >> 16) | (q0 << 48);
+  r1 = (q1 >> 16) | (q1 << 48);
+  r2 = (q2 >> 16) | (q2 << 48);
+  r3 = (q3 >> 16) | (q3 << 48);
+  r4 = (q4 >> 16) | (q4 << 48);
+  r5 = (q5 >> 16) | (q5 << 48);
+  r6 = (q6 >> 16) | (q6 << 48);
+  r7 = (q7 >> 16) | (q7 << 48);
+
+  q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^
+         aes_nohw_rotr32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+  q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^
+         aes_nohw_rotr32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+  q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^
+         aes_nohw_rotr32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+  q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^
+         aes_nohw_rotr32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+  q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^
+         aes_nohw_rotr32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+  q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^
+         aes_nohw_rotr32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+  q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^
+         aes_nohw_rotr32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+  q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^
+         aes_nohw_rotr32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+static inline void aes_nohw_add_round_key(uint64_t q[8], const uint64_t sk[8]) {
+  size_t i;
+  for (i = 0; i < 8; ++i) {
+    q[i] ^= sk[i];
+  }
+}
+
+/* aes_nohw_sub_word applies the S-box to each byte of |x|. It is used by the
+ * key schedule, which must be constant-time too. */
+static uint32_t aes_nohw_sub_word(uint32_t x) {
+  uint64_t q[8] = { 0 };
+  q[0] = x;
+  aes_nohw_ortho(q);
+  aes_nohw_sub_bytes(q);
+  aes_nohw_ortho(q);
+  return (uint32_t)q[0];
+}
+
+int GFp_aes_nohw_set_encrypt_key(const uint8_t *key, unsigned bits,
+                                 AES_KEY *aeskey) {
+  static const uint32_t kRcon[10] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+  };
+  uint32_t skey[4 * (AES_MAXNR + 1)];
+  uint64_t comp_skey[2 * (AES_MAXNR + 1)];
+  unsigned rounds, nk, nkf, i, j, k;
+  uint32_t tmp;
+
+  if (!key || !aeskey) {
+    return -1;
+  }
+
+  switch (bits) {
+    case 128:
+      rounds = 10;
+      break;
+    case 256:
+      rounds = 14;
+      break;
+    default:
+      return -2;
+  }
+
+  nk = bits / 32;
+  nkf = 4 * (rounds + 1);
+  for (i = 0; i < nk; ++i) {
+    skey[i] = from_le_u32_ptr(key + (4 * i));
+  }
+  tmp = skey[nk - 1];
+  for (i = nk, j = 0, k = 0; i < nkf; ++i) {
+    if (j == 0) {
+      tmp = (tmp << 24) | (tmp >> 8);
+      tmp = aes_nohw_sub_word(tmp) ^ kRcon[k];
+    } else if (nk > 6 && j == 4) {
+      tmp = aes_nohw_sub_word(tmp);
+    }
+    tmp ^= skey[i - nk];
+    skey[i] = tmp;
+    if (++j == nk) {
+      j = 0;
+      ++k;
+    }
+  }
+
+  /* Bitslice each round key and keep one bit of each of the (identical) four
+   * copies, which is all |aes_nohw_expand_round_keys| needs. */
+  for (i = 0, j = 0; i < nkf; i += 4, j += 2) {
+    uint64_t q[8];
+    aes_nohw_interleave_in(&q[0], &q[4], skey + i);
+    q[1] = q[0];
+    q[2] = q[0];
+    q[3] = q[0];
+    q[5] = q[4];
+    q[6] = q[4];
+    q[7] = q[4];
+    aes_nohw_ortho(q);
+    comp_skey[j] = (q[0] & UINT64_C(0x1111111111111111)) |
+                   (q[1] & UINT64_C(0x2222222222222222)) |
+                   (q[2] & UINT64_C(0x4444444444444444)) |
+                   (q[3] & UINT64_C(0x8888888888888888));
+    comp_skey[j + 1] = (q[4] & UINT64_C(0x1111111111111111)) |
+                       (q[5] & UINT64_C(0x2222222222222222)) |
+                       (q[6] & UINT64_C(0x4444444444444444)) |
+                       (q[7] & UINT64_C(0x8888888888888888));
+  }
+
+  OPENSSL_COMPILE_ASSERT(sizeof(comp_skey) <= sizeof(aeskey->rd_key),
+                         aes_nohw_round_keys_fit_in_aes_key);
+  memcpy(aeskey->rd_key, comp_skey, 2 * (rounds + 1) * sizeof(comp_skey[0]));
+  aeskey->rounds = rounds;
+  return 0;
+}
+
+/* aes_nohw_expand_round_keys expands the compressed round keys in |key| into
+ * |sk|, eight words per round. */
+static void aes_nohw_expand_round_keys(uint64_t sk[8 * (AES_MAXNR + 1)],
+                                       const AES_KEY *key) {
+  uint64_t comp_skey[2 * (AES_MAXNR + 1)];
+  unsigned n = 2 * (key->rounds + 1);
+  unsigned u, v;
+
+  assert(key->rounds <= AES_MAXNR);
+  memcpy(comp_skey, key->rd_key, n * sizeof(comp_skey[0]));
+  for (u = 0, v = 0; u < n; ++u, v += 4) {
+    uint64_t x0 = comp_skey[u] & UINT64_C(0x1111111111111111);
+    uint64_t x1 = (comp_skey[u] & UINT64_C(0x2222222222222222)) >> 1;
+    uint64_t x2 = (comp_skey[u] & UINT64_C(0x4444444444444444)) >> 2;
+    uint64_t x3 = (comp_skey[u] & UINT64_C(0x8888888888888888)) >> 3;
+    /* Each nibble is now 0 or 1; this turns it into 0 or 0xf. */
+    sk[v] = (x0 << 4) - x0;
+    sk[v + 1] = (x1 << 4) - x1;
+    sk[v + 2] = (x2 << 4) - x2;
+    sk[v + 3] = (x3 << 4) - x3;
+  }
+}
+
+/* aes_nohw_encrypt_batch encrypts the |AES_NOHW_BATCH_BLOCKS| blocks in |w|,
+ * as little-endian words, in place. */
+static void aes_nohw_encrypt_batch(
+    uint32_t w[4 * AES_NOHW_BATCH_BLOCKS], unsigned rounds,
+    const uint64_t sk[8 * (AES_MAXNR + 1)]) {
+  uint64_t q[8];
+  unsigned i;
+
+  for (i = 0; i < AES_NOHW_BATCH_BLOCKS; ++i) {
+    aes_nohw_interleave_in(&q[i], &q[i + 4], w + (4 * i));
+  }
+  aes_nohw_ortho(q);
+
+  aes_nohw_add_round_key(q, sk);
+  for (i = 1; i < rounds; ++i) {
+    aes_nohw_sub_bytes(q);
+    aes_nohw_shift_rows(q);
+    aes_nohw_mix_columns(q);
+    aes_nohw_add_round_key(q, sk + (8 * i));
+  }
+  aes_nohw_sub_bytes(q);
+  aes_nohw_shift_rows(q);
+  aes_nohw_add_round_key(q, sk + (8 * rounds));
+
+  aes_nohw_ortho(q);
+  for (i = 0; i < AES_NOHW_BATCH_BLOCKS; ++i) {
+    aes_nohw_interleave_out(w + (4 * i), q[i], q[i + 4]);
+  }
+}
+
+/* aes_nohw_decrypt_batch decrypts the |AES_NOHW_BATCH_BLOCKS| blocks in |w|,
+ * as little-endian words, in place. It uses the encryption round keys in
+ * reverse order. */
+static void aes_nohw_decrypt_batch(
+    uint32_t w[4 * AES_NOHW_BATCH_BLOCKS], unsigned rounds,
+    const uint64_t sk[8 * (AES_MAXNR + 1)]) {
+  uint64_t q[8];
+  unsigned i;
+
+  for (i = 0; i < AES_NOHW_BATCH_BLOCKS; ++i) {
+    aes_nohw_interleave_in(&q[i], &q[i + 4], w + (4 * i));
+  }
+  aes_nohw_ortho(q);
+
+  aes_nohw_add_round_key(q, sk + (8 * rounds));
+  for (i = rounds - 1; i > 0; --i) {
+    aes_nohw_inv_shift_rows(q);
+    aes_nohw_inv_sub_bytes(q);
+    aes_nohw_add_round_key(q, sk + (8 * i));
+    aes_nohw_inv_mix_columns(q);
+  }
+  aes_nohw_inv_shift_rows(q);
+  aes_nohw_inv_sub_bytes(q);
+  aes_nohw_add_round_key(q, sk);
+
+  aes_nohw_ortho(q);
+  for (i = 0; i < AES_NOHW_BATCH_BLOCKS; ++i) {
+    aes_nohw_interleave_out(w + (4 * i), q[i], q[i + 4]);
+  }
+}
+
+void GFp_aes_nohw_encrypt(const uint8_t *in, uint8_t *out, const AES_KEY *key) {
+  GFp_aes_nohw_ecb_encrypt_blocks(in, out, 1, key);
+}
+
+void GFp_aes_nohw_ecb_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key) {
+  uint64_t sk[8 * (AES_MAXNR + 1)];
+  uint32_t w[4 * AES_NOHW_BATCH_BLOCKS];
+
+  aes_nohw_expand_round_keys(sk, key);
+  while (blocks > 0) {
+    size_t todo = blocks < AES_NOHW_BATCH_BLOCKS ? blocks
+                                                 : AES_NOHW_BATCH_BLOCKS;
+    size_t i;
+    memset(w, 0, sizeof(w));
+    for (i = 0; i < 4 * todo; ++i) {
+      w[i] = from_le_u32_ptr(in + (4 * i));
+    }
+    aes_nohw_encrypt_batch(w, key->rounds, sk);
+    for (i = 0; i < 4 * todo; ++i) {
+      to_le_u32_ptr(out + (4 * i), w[i]);
+    }
+    in += 16 * todo;
+    out += 16 * todo;
+    blocks -= todo;
+  }
+}
+
+/* GFp_aes_nohw_ecb_decrypt_blocks takes the same key schedule as
+ * |GFp_aes_nohw_ecb_encrypt_blocks|, i.e. there is no separate decryption key
+ * setup function. */
+void GFp_aes_nohw_ecb_decrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key) {
+  uint64_t sk[8 * (AES_MAXNR + 1)];
+  uint32_t w[4 * AES_NOHW_BATCH_BLOCKS];
+
+  aes_nohw_expand_round_keys(sk, key);
+  while (blocks > 0) {
+    size_t todo = blocks < AES_NOHW_BATCH_BLOCKS ? blocks
+                                                 : AES_NOHW_BATCH_BLOCKS;
+    size_t i;
+    memset(w, 0, sizeof(w));
+    for (i = 0; i < 4 * todo; ++i) {
+      w[i] = from_le_u32_ptr(in + (4 * i));
+    }
+    aes_nohw_decrypt_batch(w, key->rounds, sk);
+    for (i = 0; i < 4 * todo; ++i) {
+      to_le_u32_ptr(out + (4 * i), w[i]);
+    }
+    in += 16 * todo;
+    out += 16 * todo;
+    blocks -= todo;
+  }
+}
+
+void GFp_aes_nohw_ctr32_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                       size_t blocks, const AES_KEY *key,
+                                       const uint8_t ivec[16]) {
+  uint64_t sk[8 * (AES_MAXNR + 1)];
+  uint32_t w[4 * AES_NOHW_BATCH_BLOCKS];
+  uint32_t iv0 = from_le_u32_ptr(ivec);
+  uint32_t iv1 = from_le_u32_ptr(ivec + 4);
+  uint32_t iv2 = from_le_u32_ptr(ivec + 8);
+  uint32_t ctr = from_be_u32_ptr(ivec + 12);
+
+  aes_nohw_expand_round_keys(sk, key);
+  while (blocks > 0) {
+    size_t todo = blocks < AES_NOHW_BATCH_BLOCKS ? blocks
+                                                 : AES_NOHW_BATCH_BLOCKS;
+    size_t i;
+    for (i = 0; i < AES_NOHW_BATCH_BLOCKS; ++i) {
+      uint8_t ctr_bytes[4];
+      to_be_u32_ptr(ctr_bytes, ctr + (uint32_t)i);
+      w[4 * i] = iv0;
+      w[4 * i + 1] = iv1;
+      w[4 * i + 2] = iv2;
+      w[4 * i + 3] = from_le_u32_ptr(ctr_bytes);
+    }
+    aes_nohw_encrypt_batch(w, key->rounds, sk);
+    for (i = 0; i < 4 * todo; ++i) {
+      to_le_u32_ptr(out + (4 * i), from_le_u32_ptr(in + (4 * i)) ^ w[i]);
+    }
+    in += 16 * todo;
+    out += 16 * todo;
+    blocks -= todo;
+    ctr += AES_NOHW_BATCH_BLOCKS;
+  }
+}
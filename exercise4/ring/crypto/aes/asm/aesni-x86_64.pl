@@ -550,6 +550,210 @@ ___
 &aesni_generate4("enc") if ($PREFIX eq "aesni");
 &aesni_generate6("enc") if ($PREFIX eq "aesni");
 &aesni_generate8("enc") if ($PREFIX eq "aesni");
+&aesni_generate2("dec") if ($PREFIX eq "aesni");
+&aesni_generate3("dec") if ($PREFIX eq "aesni");
+&aesni_generate4("dec") if ($PREFIX eq "aesni");
+&aesni_generate6("dec") if ($PREFIX eq "aesni");
+&aesni_generate8("dec") if ($PREFIX eq "aesni");
+
+if ($PREFIX eq "aesni") {
+######################################################################
+# void GFp_aesni_ecb_[en|de]crypt_blocks (const void *in, void *out,
+#                                         size_t blocks, const AES_KEY *key);
+#
+# Encrypts or decrypts |blocks| independent blocks, eight at a time.
+# Encryption is used to encrypt counter blocks that are gathered from
+# several messages, e.g. when sealing a batch of short AES-GCM records,
+# so that the aesenc pipeline is kept full even when no single message
+# is long enough to fill it. Both are used for XTS. Decryption takes
+# the key schedule computed by GFp_aesni_set_decrypt_key.
+foreach my $dir ("enc","dec") {
+$code.=<<___;
+.globl	GFp_aesni_ecb_${dir}rypt_blocks
+.type	GFp_aesni_ecb_${dir}rypt_blocks,\@function,4
+.align	16
+GFp_aesni_ecb_${dir}rypt_blocks:
+___
+$code.=<<___ if ($win64);
+	lea	-0x58(%rsp),%rsp
+	movaps	%xmm6,(%rsp)		# offload $inout4..7
+	movaps	%xmm7,0x10(%rsp)
+	movaps	%xmm8,0x20(%rsp)
+	movaps	%xmm9,0x30(%rsp)
+.Lecb_${dir}_body:
+___
+$code.=<<___;
+	shl	\$4,$len		# blocks to bytes
+	jz	.Lecb_${dir}_ret		# if ($len==0) return
+
+	mov	240($key),$rounds	# key->rounds
+	$movkey	($key),$rndkey0
+	mov	$key,$key_		# backup $key
+	mov	$rounds,$rnds_		# backup $rounds
+
+	cmp	\$0x80,$len		# if ($len<8*16)
+	jb	.Lecb_${dir}_tail		# short input
+
+	movdqu	($inp),$inout0		# load 8 input blocks
+	movdqu	0x10($inp),$inout1
+	movdqu	0x20($inp),$inout2
+	movdqu	0x30($inp),$inout3
+	movdqu	0x40($inp),$inout4
+	movdqu	0x50($inp),$inout5
+	movdqu	0x60($inp),$inout6
+	movdqu	0x70($inp),$inout7
+	lea	0x80($inp),$inp		# $inp+=8*16
+	sub	\$0x80,$len		# $len-=8*16 (can be zero)
+	jmp	.Lecb_${dir}_loop8_enter
+.align	16
+.Lecb_${dir}_loop8:
+	movups	$inout0,($out)		# store 8 output blocks
+	mov	$key_,$key		# restore $key
+	movdqu	($inp),$inout0		# load 8 input blocks
+	mov	$rnds_,$rounds		# restore $rounds
+	movups	$inout1,0x10($out)
+	movdqu	0x10($inp),$inout1
+	movups	$inout2,0x20($out)
+	movdqu	0x20($inp),$inout2
+	movups	$inout3,0x30($out)
+	movdqu	0x30($inp),$inout3
+	movups	$inout4,0x40($out)
+	movdqu	0x40($inp),$inout4
+	movups	$inout5,0x50($out)
+	movdqu	0x50($inp),$inout5
+	movups	$inout6,0x60($out)
+	movdqu	0x60($inp),$inout6
+	movups	$inout7,0x70($out)
+	lea	0x80($out),$out		# $out+=8*16
+	movdqu	0x70($inp),$inout7
+	lea	0x80($inp),$inp		# $inp+=8*16
+.Lecb_${dir}_loop8_enter:
+
+	call	_aesni_${dir}rypt8
+
+	sub	\$0x80,$len
+	jnc	.Lecb_${dir}_loop8		# loop if $len-=8*16 didn't borrow
+
+	movups	$inout0,($out)		# store 8 output blocks
+	mov	$key_,$key		# restore $key
+	movups	$inout1,0x10($out)
+	mov	$rnds_,$rounds		# restore $rounds
+	movups	$inout2,0x20($out)
+	movups	$inout3,0x30($out)
+	movups	$inout4,0x40($out)
+	movups	$inout5,0x50($out)
+	movups	$inout6,0x60($out)
+	movups	$inout7,0x70($out)
+	lea	0x80($out),$out		# $out+=8*16
+	add	\$0x80,$len		# restore real remaining $len
+	jz	.Lecb_${dir}_ret		# done if ($len==0)
+
+.Lecb_${dir}_tail:				# $len is less than 8*16
+	movups	($inp),$inout0
+	cmp	\$0x20,$len
+	jb	.Lecb_${dir}_one
+	movups	0x10($inp),$inout1
+	je	.Lecb_${dir}_two
+	movups	0x20($inp),$inout2
+	cmp	\$0x40,$len
+	jb	.Lecb_${dir}_three
+	movups	0x30($inp),$inout3
+	je	.Lecb_${dir}_four
+	movups	0x40($inp),$inout4
+	cmp	\$0x60,$len
+	jb	.Lecb_${dir}_five
+	movups	0x50($inp),$inout5
+	je	.Lecb_${dir}_six
+	movdqu	0x60($inp),$inout6
+	xorps	$inout7,$inout7
+	call	_aesni_${dir}rypt8
+	movups	$inout0,($out)		# store 7 output blocks
+	movups	$inout1,0x10($out)
+	movups	$inout2,0x20($out)
+	movups	$inout3,0x30($out)
+	movups	$inout4,0x40($out)
+	movups	$inout5,0x50($out)
+	movups	$inout6,0x60($out)
+	jmp	.Lecb_${dir}_ret
+.align	16
+.Lecb_${dir}_one:
+___
+	&aesni_generate1($dir,$key,$rounds);
+$code.=<<___;
+	movups	$inout0,($out)		# store one output block
+	jmp	.Lecb_${dir}_ret
+.align	16
+.Lecb_${dir}_two:
+	call	_aesni_${dir}rypt2
+	movups	$inout0,($out)		# store 2 output blocks
+	movups	$inout1,0x10($out)
+	jmp	.Lecb_${dir}_ret
+.align	16
+.Lecb_${dir}_three:
+	call	_aesni_${dir}rypt3
+	movups	$inout0,($out)		# store 3 output blocks
+	movups	$inout1,0x10($out)
+	movups	$inout2,0x20($out)
+	jmp	.Lecb_${dir}_ret
+.align	16
+.Lecb_${dir}_four:
+	call	_aesni_${dir}rypt4
+	movups	$inout0,($out)		# store 4 output blocks
+	movups	$inout1,0x10($out)
+	movups	$inout2,0x20($out)
+	movups	$inout3,0x30($out)
+	jmp	.Lecb_${dir}_ret
+.align	16
+.Lecb_${dir}_five:
+	xorps	$inout5,$inout5
+	call	_aesni_${dir}rypt6
+	movups	$inout0,($out)		# store 5 output blocks
+	movups	$inout1,0x10($out)
+	movups	$inout2,0x20($out)
+	movups	$inout3,0x30($out)
+	movups	$inout4,0x40($out)
+	jmp	.Lecb_${dir}_ret
+.align	16
+.Lecb_${dir}_six:
+	call	_aesni_${dir}rypt6
+	movups	$inout0,($out)		# store 6 output blocks
+	movups	$inout1,0x10($out)
+	movups	$inout2,0x20($out)
+	movups	$inout3,0x30($out)
+	movups	$inout4,0x40($out)
+	movups	$inout5,0x50($out)
+
+.Lecb_${dir}_ret:
+	xorps	$rndkey0,$rndkey0	# %xmm0, clear register bank
+	pxor	$rndkey1,$rndkey1
+	pxor	$inout0,$inout0
+	pxor	$inout1,$inout1
+	pxor	$inout2,$inout2
+	pxor	$inout3,$inout3
+___
+$code.=<<___ if (!$win64);
+	pxor	$inout4,$inout4
+	pxor	$inout5,$inout5
+	pxor	$inout6,$inout6
+	pxor	$inout7,$inout7
+___
+$code.=<<___ if ($win64);
+	movaps	(%rsp),%xmm6
+	movaps	%xmm0,(%rsp)		# clear stack
+	movaps	0x10(%rsp),%xmm7
+	movaps	%xmm0,0x10(%rsp)
+	movaps	0x20(%rsp),%xmm8
+	movaps	%xmm0,0x20(%rsp)
+	movaps	0x30(%rsp),%xmm9
+	movaps	%xmm0,0x30(%rsp)
+	lea	0x58(%rsp),%rsp
+.Lecb_${dir}_epilogue:
+___
+$code.=<<___;
+	ret
+.size	GFp_aesni_ecb_${dir}rypt_blocks,.-GFp_aesni_ecb_${dir}rypt_blocks
+___
+}}
 
 if ($PREFIX eq "aesni") {
 {
@@ -1126,8 +1330,58 @@ ___
 } }}
 
 { my ($inp,$bits,$key) = @_4args;
+  my $bits64 = $bits;
   $bits =~ s/%r/%e/;
 
+# int GFp_${PREFIX}_set_decrypt_key(const unsigned char *inp,
+#				                    int bits, AES_KEY * const key);
+#
+# Computes the encryption key schedule, then reverses the order of the
+# round keys and applies InvMixColumns to all but the first and last,
+# as aesdec expects.
+$code.=<<___ if ($PREFIX eq "aesni");
+.globl	GFp_${PREFIX}_set_decrypt_key
+.type	GFp_${PREFIX}_set_decrypt_key,\@abi-omnipotent
+.align	16
+GFp_${PREFIX}_set_decrypt_key:
+	.byte	0x48,0x83,0xEC,0x08	# sub rsp,8
+	call	__aesni_set_encrypt_key
+	shl	\$4,$bits		# rounds-1 after __aesni_set_encrypt_key
+	test	%eax,%eax
+	jnz	.Ldec_key_ret
+	lea	16($key,$bits64),$inp	# points at the end of key schedule
+
+	$movkey	($key),%xmm0		# just swap
+	$movkey	($inp),%xmm1
+	$movkey	%xmm0,($inp)
+	$movkey	%xmm1,($key)
+	lea	16($key),$key
+	lea	-16($inp),$inp
+
+.Ldec_key_inverse:
+	$movkey	($key),%xmm0		# swap and inverse
+	$movkey	($inp),%xmm1
+	aesimc	%xmm0,%xmm0
+	aesimc	%xmm1,%xmm1
+	lea	16($key),$key
+	lea	-16($inp),$inp
+	$movkey	%xmm0,16($inp)
+	$movkey	%xmm1,-16($key)
+	cmp	$key,$inp
+	ja	.Ldec_key_inverse
+
+	$movkey	($key),%xmm0		# inverse middle
+	aesimc	%xmm0,%xmm0
+	pxor	%xmm1,%xmm1
+	$movkey	%xmm0,($inp)
+	pxor	%xmm0,%xmm0
+.Ldec_key_ret:
+	add	\$8,%rsp
+	ret
+.LSEH_end_GFp_set_decrypt_key:
+.size	GFp_${PREFIX}_set_decrypt_key,.-GFp_${PREFIX}_set_decrypt_key
+___
+
 # This is based on submission by
 #
 #	Huang Ying <ying.huang@intel.com>
@@ -1563,6 +1817,47 @@ $code.=<<___;
 .extern	__imp_RtlVirtualUnwind
 ___
 $code.=<<___ if ($PREFIX eq "aesni");
+.type	ecb_se_handler,\@abi-omnipotent
+.align	16
+ecb_se_handler:
+	push	%rsi
+	push	%rdi
+	push	%rbx
+	push	%rbp
+	push	%r12
+	push	%r13
+	push	%r14
+	push	%r15
+	pushfq
+	sub	\$64,%rsp
+
+	mov	120($context),%rax	# pull context->Rax
+	mov	248($context),%rbx	# pull context->Rip
+
+	mov	8($disp),%rsi		# disp->ImageBase
+	mov	56($disp),%r11		# disp->HandlerData
+
+	mov	0(%r11),%r10d		# HandlerData[0]
+	lea	(%rsi,%r10),%r10	# prologue label
+	cmp	%r10,%rbx		# context->Rip<prologue label
+	jb	.Lcommon_seh_tail
+
+	mov	152($context),%rax	# pull context->Rsp
+
+	mov	4(%r11),%r10d		# HandlerData[1]
+	lea	(%rsi,%r10),%r10	# epilogue label
+	cmp	%r10,%rbx		# context->Rip>=epilogue label
+	jae	.Lcommon_seh_tail
+
+	lea	0(%rax),%rsi		# %xmm save area
+	lea	512($context),%rdi	# &context.Xmm6
+	mov	\$8,%ecx		# 4*sizeof(%xmm0)/sizeof(%rax)
+	.long	0xa548f3fc		# cld; rep movsq
+	lea	0x58(%rax),%rax		# adjust stack pointer
+
+	jmp	.Lcommon_seh_tail
+.size	ecb_se_handler,.-ecb_se_handler
+
 .type	ctr_se_handler,\@abi-omnipotent
 .align	16
 ctr_se_handler:
@@ -1650,9 +1945,21 @@ ctr_se_handler:
 .align	4
 ___
 $code.=<<___ if ($PREFIX eq "aesni");
+	.rva	.LSEH_begin_GFp_aesni_ecb_encrypt_blocks
+	.rva	.LSEH_end_GFp_aesni_ecb_encrypt_blocks
+	.rva	.LSEH_info_GFp_ecb
+
+	.rva	.LSEH_begin_GFp_aesni_ecb_decrypt_blocks
+	.rva	.LSEH_end_GFp_aesni_ecb_decrypt_blocks
+	.rva	.LSEH_info_GFp_ecb_dec
+
 	.rva	.LSEH_begin_GFp_aesni_ctr32_encrypt_blocks
 	.rva	.LSEH_end_GFp_aesni_ctr32_encrypt_blocks
 	.rva	.LSEH_info_GFp_ctr32
+
+	.rva	GFp_${PREFIX}_set_decrypt_key
+	.rva	.LSEH_end_GFp_set_decrypt_key
+	.rva	.LSEH_info_GFp_key
 ___
 $code.=<<___;
 	.rva	GFp_${PREFIX}_set_encrypt_key
@@ -1662,6 +1969,14 @@ $code.=<<___;
 .align	8
 ___
 $code.=<<___ if ($PREFIX eq "aesni");
+.LSEH_info_GFp_ecb:
+	.byte	9,0,0,0
+	.rva	ecb_se_handler
+	.rva	.Lecb_enc_body,.Lecb_enc_epilogue	# HandlerData[]
+.LSEH_info_GFp_ecb_dec:
+	.byte	9,0,0,0
+	.rva	ecb_se_handler
+	.rva	.Lecb_dec_body,.Lecb_dec_epilogue	# HandlerData[]
 .LSEH_info_GFp_ctr32:
 	.byte	9,0,0,0
 	.rva	ctr_se_handler
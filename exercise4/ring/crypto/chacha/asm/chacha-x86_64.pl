@@ -662,6 +662,124 @@ my @x=map("\"$_\"",@xx);
 	);
 }
 
+########################################################################
+# GFp_ChaCha20_core_4x(out, in) computes four independent ChaCha20 blocks.
+# |in| holds the four input states "smashed by lanes", i.e. 16 vectors of
+# the same word of each lane, and |out| receives the output words laid out
+# the same way. Both must be 16-byte aligned. Each lane may have its own key,
+# counter and nonce, which is what QUIC header protection needs; the caller
+# checks for SSSE3.
+{
+my $xframe = $win64 ? 0xa0 : 0;
+
+$code.=<<___;
+.globl	GFp_ChaCha20_core_4x
+.type	GFp_ChaCha20_core_4x,\@function,2
+.align	32
+GFp_ChaCha20_core_4x:
+	sub		\$0x48+$xframe,%rsp
+___
+$code.=<<___	if ($win64);
+	movaps		%xmm6,0x40(%rsp)
+	movaps		%xmm7,0x50(%rsp)
+	movaps		%xmm8,0x60(%rsp)
+	movaps		%xmm9,0x70(%rsp)
+	movaps		%xmm10,0x80(%rsp)
+	movaps		%xmm11,0x90(%rsp)
+	movaps		%xmm12,0xa0(%rsp)
+	movaps		%xmm13,0xb0(%rsp)
+	movaps		%xmm14,0xc0(%rsp)
+	movaps		%xmm15,0xd0(%rsp)
+___
+$code.=<<___;
+	movdqa		0x00(%rsi),$xa0
+	movdqa		0x10(%rsi),$xa1
+	movdqa		0x20(%rsi),$xa2
+	movdqa		0x30(%rsi),$xa3
+	movdqa		0x40(%rsi),$xb0
+	movdqa		0x50(%rsi),$xb1
+	movdqa		0x60(%rsi),$xb2
+	movdqa		0x70(%rsi),$xb3
+	movdqa		0x80(%rsi),$xt0		# "$xc0"
+	movdqa		0x90(%rsi),$xt1		# "$xc1"
+	movdqa		0xa0(%rsi),$xt2
+	movdqa		0xb0(%rsi),$xt3
+	movdqa		0xc0(%rsi),$xd0
+	movdqa		0xd0(%rsi),$xd1
+	movdqa		0xe0(%rsi),$xd2
+	movdqa		0xf0(%rsi),$xd3
+	lea		.Lrot16(%rip),%r10
+	lea		.Lrot24(%rip),%r11
+	movdqa		$xt2,0x20(%rsp)		# SIMD equivalent of "@x[10]"
+	movdqa		$xt3,0x30(%rsp)		# SIMD equivalent of "@x[11]"
+	movdqa		(%r10),$xt3		# .Lrot16(%rip)
+	mov		\$10,%eax
+	jmp		.Loop_core4x
+
+.align	32
+.Loop_core4x:
+___
+	foreach (&SSSE3_lane_ROUND(0, 4, 8,12)) { eval; }
+	foreach (&SSSE3_lane_ROUND(0, 5,10,15)) { eval; }
+$code.=<<___;
+	dec		%eax
+	jnz		.Loop_core4x
+
+	paddd		0x00(%rsi),$xa0		# accumulate input
+	paddd		0x10(%rsi),$xa1
+	paddd		0x20(%rsi),$xa2
+	paddd		0x30(%rsi),$xa3
+	paddd		0x40(%rsi),$xb0
+	paddd		0x50(%rsi),$xb1
+	paddd		0x60(%rsi),$xb2
+	paddd		0x70(%rsi),$xb3
+	movdqa		0x20(%rsp),$xt2		# "$xc2"
+	movdqa		0x30(%rsp),$xt3		# "$xc3"
+	paddd		0x80(%rsi),$xt0
+	paddd		0x90(%rsi),$xt1
+	paddd		0xa0(%rsi),$xt2
+	paddd		0xb0(%rsi),$xt3
+	paddd		0xc0(%rsi),$xd0
+	paddd		0xd0(%rsi),$xd1
+	paddd		0xe0(%rsi),$xd2
+	paddd		0xf0(%rsi),$xd3
+
+	movdqa		$xa0,0x00(%rdi)
+	movdqa		$xa1,0x10(%rdi)
+	movdqa		$xa2,0x20(%rdi)
+	movdqa		$xa3,0x30(%rdi)
+	movdqa		$xb0,0x40(%rdi)
+	movdqa		$xb1,0x50(%rdi)
+	movdqa		$xb2,0x60(%rdi)
+	movdqa		$xb3,0x70(%rdi)
+	movdqa		$xt0,0x80(%rdi)
+	movdqa		$xt1,0x90(%rdi)
+	movdqa		$xt2,0xa0(%rdi)
+	movdqa		$xt3,0xb0(%rdi)
+	movdqa		$xd0,0xc0(%rdi)
+	movdqa		$xd1,0xd0(%rdi)
+	movdqa		$xd2,0xe0(%rdi)
+	movdqa		$xd3,0xf0(%rdi)
+___
+$code.=<<___	if ($win64);
+	movaps		0x40(%rsp),%xmm6
+	movaps		0x50(%rsp),%xmm7
+	movaps		0x60(%rsp),%xmm8
+	movaps		0x70(%rsp),%xmm9
+	movaps		0x80(%rsp),%xmm10
+	movaps		0x90(%rsp),%xmm11
+	movaps		0xa0(%rsp),%xmm12
+	movaps		0xb0(%rsp),%xmm13
+	movaps		0xc0(%rsp),%xmm14
+	movaps		0xd0(%rsp),%xmm15
+___
+$code.=<<___;
+	add		\$0x48+$xframe,%rsp
+	ret
+.size	GFp_ChaCha20_core_4x,.-GFp_ChaCha20_core_4x
+___
+}
+
 my $xframe = $win64 ? 0xa0 : 0;
 
 $code.=<<___;
@@ -0,0 +1,318 @@
+/* Copyright (c) 2014, Google Inc.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
+
+/* Adapted from the public domain, estream code by D. Bernstein. */
+
+#include <openssl/base.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include <openssl/cpu.h>
+
+#include "../internal.h"
+
+
+/* Declarations for extern functions only called by Rust code, to avoid
+ * -Wmissing-prototypes warnings. */
+void GFp_chacha20_hp_masks(const uint32_t *const keys[],
+                           const uint8_t *samples, uint8_t *masks,
+                           size_t num);
+
+
+#if defined(OPENSSL_NO_ASM) || \
+    (!defined(OPENSSL_X86) && !defined(OPENSSL_X86_64) && \
+     !defined(OPENSSL_ARM) && !defined(OPENSSL_AARCH64))
+#define CHACHA20_CTR32_C
+void GFp_ChaCha20_ctr32(uint8_t *out, const uint8_t *in, size_t in_len,
+                        const uint32_t key[8], const uint32_t counter[4]);
+#endif
+
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+#define CHACHA20_CORE_4X_ASM
+void GFp_ChaCha20_core_4x(uint32_t out[64], const uint32_t in[64]);
+#endif
+
+
+#define CHACHA20_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA20_LANES_QUARTERROUND(a, b, c, d)                          \
+  for (size_t l = 0; l < 4; ++l) {                                       \
+    x[4 * (a) + l] += x[4 * (b) + l];                                    \
+    x[4 * (d) + l] = CHACHA20_ROTL(x[4 * (d) + l] ^ x[4 * (a) + l], 16); \
+    x[4 * (c) + l] += x[4 * (d) + l];                                    \
+    x[4 * (b) + l] = CHACHA20_ROTL(x[4 * (b) + l] ^ x[4 * (c) + l], 12); \
+    x[4 * (a) + l] += x[4 * (b) + l];                                    \
+    x[4 * (d) + l] = CHACHA20_ROTL(x[4 * (d) + l] ^ x[4 * (a) + l], 8);  \
+    x[4 * (c) + l] += x[4 * (d) + l];                                    \
+    x[4 * (b) + l] = CHACHA20_ROTL(x[4 * (b) + l] ^ x[4 * (c) + l], 7);  \
+  }
+
+/* chacha20_core_4x_c computes four independent ChaCha20 blocks. Word |i| of
+ * the input state of lane |l| is |in[4 * i + l]|, and the output is laid out
+ * the same way. This is the layout that the 4x SIMD code works with
+ * internally, so |GFp_ChaCha20_core_4x| can be used instead where the CPU has
+ * SSSE3. */
+static void chacha20_core_4x_c(uint32_t out[64], const uint32_t in[64]) {
+  uint32_t x[64];
+  memcpy(x, in, sizeof(x));
+  for (size_t i = 0; i < 10; ++i) {
+    CHACHA20_LANES_QUARTERROUND(0, 4, 8, 12)
+    CHACHA20_LANES_QUARTERROUND(1, 5, 9, 13)
+    CHACHA20_LANES_QUARTERROUND(2, 6, 10, 14)
+    CHACHA20_LANES_QUARTERROUND(3, 7, 11, 15)
+    CHACHA20_LANES_QUARTERROUND(0, 5, 10, 15)
+    CHACHA20_LANES_QUARTERROUND(1, 6, 11, 12)
+    CHACHA20_LANES_QUARTERROUND(2, 7, 8, 13)
+    CHACHA20_LANES_QUARTERROUND(3, 4, 9, 14)
+  }
+  for (size_t i = 0; i < 64; ++i) {
+    out[i] = x[i] + in[i];
+  }
+}
+
+/* chacha20_core_4x is the implementation chosen by
+ * |GFp_chacha20_dispatch_setup|. */
+static void (*chacha20_core_4x)(uint32_t out[64], const uint32_t in[64]) =
+    chacha20_core_4x_c;
+
+void GFp_chacha20_dispatch_setup(void) {
+#if defined(CHACHA20_CORE_4X_ASM)
+  if ((GFp_ia32cap_P[1] & (1 << (41 - 32))) != 0) { /* SSSE3 */
+    chacha20_core_4x = GFp_ChaCha20_core_4x;
+    return;
+  }
+#endif
+  chacha20_core_4x = chacha20_core_4x_c;
+}
+
+
+/* QUIC header protection (RFC 9001, Section 5.4.4).
+ *
+ * Each packet needs the first five bytes of one ChaCha20 block, with the
+ * block counter and nonce taken from a 16-byte sample of the packet. Every
+ * block has a different nonce and, usually, a different key, so
+ * |GFp_ChaCha20_ctr32| would have to be called once per packet, and its
+ * SIMD code paths only pay off for several consecutive blocks under one
+ * nonce. Instead the blocks of four packets at a time are computed together
+ * by |chacha20_core_4x|, whatever their keys. */
+
+#define CHACHA20_HP_MASK_LEN 5
+
+/* chacha20_hp_4x computes the masks for |num| <= 4 packets. Unused lanes are
+ * computed from an all-zero state and discarded. */
+static void chacha20_hp_4x(const uint32_t *const keys[],
+                           const uint8_t *samples, uint8_t *masks,
+                           size_t num) {
+  static const uint32_t sigma[4] = {
+    0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+  };
+
+  assert(num <= 4);
+
+  alignas(16) uint32_t in[64] = { 0 };
+  for (size_t l = 0; l < num; ++l) {
+    for (size_t i = 0; i < 4; ++i) {
+      in[4 * i + l] = sigma[i];
+    }
+    for (size_t i = 0; i < 8; ++i) {
+      in[4 * (4 + i) + l] = keys[l][i];
+    }
+    for (size_t i = 0; i < 4; ++i) {
+      in[4 * (12 + i) + l] = from_le_u32_ptr(samples + (16 * l) + (4 * i));
+    }
+  }
+
+  alignas(16) uint32_t out[64];
+  (*chacha20_core_4x)(out, in);
+
+  /* Only the first five bytes of each block are needed. */
+  for (size_t l = 0; l < num; ++l) {
+    uint8_t *mask = masks + (CHACHA20_HP_MASK_LEN * l);
+    to_le_u32_ptr(mask, out[l]);
+    mask[4] = (uint8_t)out[4 + l];
+  }
+}
+
+/* GFp_chacha20_hp_masks computes the QUIC header protection masks of |num|
+ * packets. |keys[i]| is the header protection key of packet |i|, in the form
+ * that |GFp_ChaCha20_ctr32| takes, and |samples + 16 * i| is its sample. The
+ * five-byte mask of packet |i| is written to |masks + 5 * i|. */
+void GFp_chacha20_hp_masks(const uint32_t *const keys[],
+                           const uint8_t *samples, uint8_t *masks,
+                           size_t num) {
+  assert(keys != NULL || num == 0);
+  assert(samples != NULL || num == 0);
+  assert(masks != NULL || num == 0);
+
+  while (num > 0) {
+    size_t todo = num < 4 ? num : 4;
+    chacha20_hp_4x(keys, samples, masks, todo);
+    keys += todo;
+    samples += 16 * todo;
+    masks += CHACHA20_HP_MASK_LEN * todo;
+    num -= todo;
+  }
+}
+
+
+#if defined(CHACHA20_CTR32_C)
+
+/* Portable ChaCha20, for targets without assembly language code.
+ *
+ * Several consecutive blocks are computed together, with each word of the
+ * state held in a vector of that word of every block. With GCC and Clang's
+ * vector extensions the compiler maps that onto whatever SIMD registers the
+ * target has, like the 4x and 8x assembly language code does by hand: 8
+ * blocks at a time with AVX2 and 4 otherwise. Without vector extensions, and
+ * for the last block of the input, one block is computed at a time. */
+
+#if defined(__GNUC__) && defined(__AVX2__)
+#define CHACHA20_LANES 8
+typedef uint32_t chacha20_lanes __attribute__((vector_size(4 * CHACHA20_LANES)));
+#define CHACHA20_LANE(v, l) ((v)[l])
+static const chacha20_lanes kChaCha20LaneOffsets = { 0, 1, 2, 3, 4, 5, 6, 7 };
+#elif defined(__GNUC__)
+#define CHACHA20_LANES 4
+typedef uint32_t chacha20_lanes __attribute__((vector_size(4 * CHACHA20_LANES)));
+#define CHACHA20_LANE(v, l) ((v)[l])
+static const chacha20_lanes kChaCha20LaneOffsets = { 0, 1, 2, 3 };
+#else
+#define CHACHA20_LANES 1
+typedef uint32_t chacha20_lanes;
+#define CHACHA20_LANE(v, l) (v)
+static const chacha20_lanes kChaCha20LaneOffsets = 0;
+#endif
+
+static const chacha20_lanes kChaCha20Zero = { 0 };
+#define CHACHA20_BROADCAST(v) (kChaCha20Zero + (v))
+
+#define CHACHA20_QUARTERROUND(a, b, c, d)     \
+  x[a] += x[b];                               \
+  x[d] = CHACHA20_ROTL(x[d] ^ x[a], 16);      \
+  x[c] += x[d];                               \
+  x[b] = CHACHA20_ROTL(x[b] ^ x[c], 12);      \
+  x[a] += x[b];                               \
+  x[d] = CHACHA20_ROTL(x[d] ^ x[a], 8);       \
+  x[c] += x[d];                               \
+  x[b] = CHACHA20_ROTL(x[b] ^ x[c], 7);
+
+#define CHACHA20_ROUNDS                       \
+  for (size_t i = 0; i < 10; ++i) {           \
+    CHACHA20_QUARTERROUND(0, 4, 8, 12)        \
+    CHACHA20_QUARTERROUND(1, 5, 9, 13)        \
+    CHACHA20_QUARTERROUND(2, 6, 10, 14)       \
+    CHACHA20_QUARTERROUND(3, 7, 11, 15)       \
+    CHACHA20_QUARTERROUND(0, 5, 10, 15)       \
+    CHACHA20_QUARTERROUND(1, 6, 11, 12)       \
+    CHACHA20_QUARTERROUND(2, 7, 8, 13)        \
+    CHACHA20_QUARTERROUND(3, 4, 9, 14)        \
+  }
+
+static const uint32_t kChaCha20Sigma[4] = {
+  0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+};
+
+/* chacha20_block_xor encrypts |len| <= 64 bytes from |in| to |out| with
+ * block |counter[0]|. */
+static void chacha20_block_xor(uint8_t *out, const uint8_t *in, size_t len,
+                               const uint32_t key[8],
+                               const uint32_t counter[4]) {
+  assert(len <= 64);
+
+  uint32_t s[16];
+  memcpy(s, kChaCha20Sigma, sizeof(kChaCha20Sigma));
+  memcpy(s + 4, key, 8 * sizeof(uint32_t));
+  memcpy(s + 12, counter, 4 * sizeof(uint32_t));
+
+  uint32_t x[16];
+  memcpy(x, s, sizeof(x));
+  CHACHA20_ROUNDS
+
+  uint8_t block[64];
+  for (size_t i = 0; i < 16; ++i) {
+    to_le_u32_ptr(block + 4 * i, x[i] + s[i]);
+  }
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = in[i] ^ block[i];
+  }
+}
+
+/* chacha20_lanes_xor encrypts |len| <= 64 * |CHACHA20_LANES| bytes from |in|
+ * to |out|, starting at block |counter[0]|. |out| may be equal to or below
+ * |in|, as each word of input is read before the same word of output is
+ * written. */
+static void chacha20_lanes_xor(uint8_t *out, const uint8_t *in, size_t len,
+                               const uint32_t key[8],
+                               const uint32_t counter[4]) {
+  assert(len <= 64 * CHACHA20_LANES);
+
+  chacha20_lanes s[16];
+  for (size_t i = 0; i < 4; ++i) {
+    s[i] = CHACHA20_BROADCAST(kChaCha20Sigma[i]);
+  }
+  for (size_t i = 0; i < 8; ++i) {
+    s[4 + i] = CHACHA20_BROADCAST(key[i]);
+  }
+  s[12] = kChaCha20LaneOffsets + counter[0];
+  for (size_t i = 1; i < 4; ++i) {
+    s[12 + i] = CHACHA20_BROADCAST(counter[i]);
+  }
+
+  chacha20_lanes x[16];
+  memcpy(x, s, sizeof(x));
+  CHACHA20_ROUNDS
+  for (size_t i = 0; i < 16; ++i) {
+    x[i] += s[i];
+  }
+
+  for (size_t l = 0; l < CHACHA20_LANES && len > 0; ++l) {
+    size_t i = 0;
+    for (; i < 16 && len >= 4; ++i) {
+      to_le_u32_ptr(out, from_le_u32_ptr(in) ^ CHACHA20_LANE(x[i], l));
+      out += 4;
+      in += 4;
+      len -= 4;
+    }
+    if (i < 16 && len > 0) {
+      uint8_t buf[4];
+      to_le_u32_ptr(buf, CHACHA20_LANE(x[i], l));
+      for (size_t j = 0; j < len; ++j) {
+        out[j] = in[j] ^ buf[j];
+      }
+      len = 0;
+    }
+  }
+}
+
+void GFp_ChaCha20_ctr32(uint8_t *out, const uint8_t *in, size_t in_len,
+                        const uint32_t key[8], const uint32_t counter[4]) {
+  assert(out <= in || in + in_len <= out);
+
+  uint32_t counter_lanes[4];
+  memcpy(counter_lanes, counter, sizeof(counter_lanes));
+  while (in_len > 64) {
+    size_t todo = in_len < 64 * CHACHA20_LANES ? in_len : 64 * CHACHA20_LANES;
+    chacha20_lanes_xor(out, in, todo, key, counter_lanes);
+    counter_lanes[0] += CHACHA20_LANES;
+    out += todo;
+    in += todo;
+    in_len -= todo;
+  }
+  if (in_len > 0) {
+    chacha20_block_xor(out, in, in_len, key, counter_lanes);
+  }
+}
+
+#endif
@@ -65,6 +65,19 @@
 #define EVP_AEAD_AES_GCM_NONCE_LEN 12
 #define EVP_AEAD_AES_GCM_TAG_LEN 16
 
+/* AES_GCM_RECORD describes one message of a batch passed to
+ * |GFp_aes_gcm_seal_batch| or |GFp_aes_gcm_open_batch|. |in| and |out| may be
+ * equal for in-place operation. */
+typedef struct {
+  const uint8_t *nonce; /* EVP_AEAD_AES_GCM_NONCE_LEN bytes. */
+  const uint8_t *ad;
+  size_t ad_len;
+  const uint8_t *in;
+  uint8_t *out;
+  size_t in_out_len;
+  uint8_t *tag_out; /* EVP_AEAD_AES_GCM_TAG_LEN bytes. */
+} AES_GCM_RECORD;
+
  /* Declarations for extern functions only called by Rust code, to avoid
  * -Wmissing-prototypes warnings. */
 int GFp_aes_gcm_init(void *ctx_buf, size_t ctx_buf_len, const uint8_t *key,
@@ -77,6 +90,120 @@ int GFp_aes_gcm_seal(const void *ctx_buf, uint8_t *in_out, size_t in_out_len,
                      uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
                      const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
                      const uint8_t *ad, size_t ad_len);
+int GFp_aes_gcm_seal_out_of_place(
+    const void *ctx_buf, uint8_t *out, size_t in_out_len,
+    uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+    const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN], const uint8_t *in,
+    const uint8_t *ad, size_t ad_len);
+int GFp_aes_gcm_compact_init(void *ctx_buf, size_t ctx_buf_len,
+                             const uint8_t *key, size_t key_len);
+int GFp_aes_gcm_compact_seal(const void *ctx_buf, uint8_t *out,
+                             size_t in_out_len,
+                             uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                             const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                             const uint8_t *in, const uint8_t *ad,
+                             size_t ad_len);
+int GFp_aes_gcm_compact_open(const void *ctx_buf, uint8_t *out,
+                             size_t in_out_len,
+                             uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                             const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                             const uint8_t *in, const uint8_t *ad,
+                             size_t ad_len);
+int GFp_aes_gcm_seal_batch(const void *ctx_buf,
+                           const AES_GCM_RECORD records[], size_t num_records);
+int GFp_aes_gcm_open_batch(const void *ctx_buf,
+                           const AES_GCM_RECORD records[], size_t num_records);
+int GFp_aes_gcm_seal_sg(const void *ctx_buf, const AEAD_SEGMENT out[],
+                        size_t num_out,
+                        uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                        const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                        const AEAD_CONST_SEGMENT in[], size_t num_in,
+                        const AEAD_CONST_SEGMENT ad[], size_t num_ad);
+int GFp_aes_gcm_open_sg(const void *ctx_buf, const AEAD_SEGMENT out[],
+                        size_t num_out,
+                        uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                        const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                        const AEAD_CONST_SEGMENT in[], size_t num_in,
+                        const AEAD_CONST_SEGMENT ad[], size_t num_ad);
+int GFp_aes_gcm_stream_init(void *stream_buf, size_t stream_buf_len,
+                            const void *ctx_buf,
+                            const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN]);
+int GFp_aes_gcm_stream_aad(void *stream_buf, const uint8_t *ad,
+                           size_t ad_len);
+int GFp_aes_gcm_stream_encrypt(void *stream_buf, const uint8_t *in,
+                               uint8_t *out, size_t len);
+int GFp_aes_gcm_stream_decrypt(void *stream_buf, const uint8_t *in,
+                               uint8_t *out, size_t len);
+void GFp_aes_gcm_stream_finish(void *stream_buf,
+                               uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN]);
+int GFp_aes_gcm_stream_verify(void *stream_buf,
+                              const uint8_t tag[EVP_AEAD_AES_GCM_TAG_LEN]);
+int GFp_aes_gcm_stream_fork(void *chunk_buf, size_t chunk_buf_len,
+                            const void *stream_buf, uint64_t block_offset);
+int GFp_aes_gcm_stream_join(void *stream_buf, const void *chunk_buf);
+int GFp_aes_gcm_seal_parallel(const void *ctx_buf, uint8_t *in_out,
+                              size_t in_out_len,
+                              uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                              const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                              const uint8_t *ad, size_t ad_len,
+                              size_t max_threads,
+                              GFp_parallel_for_f parallel_for, void *executor);
+int GFp_aes_gcm_open_parallel(const void *ctx_buf, uint8_t *out,
+                              size_t in_out_len,
+                              uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                              const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                              const uint8_t *in, const uint8_t *ad,
+                              size_t ad_len, size_t max_threads,
+                              GFp_parallel_for_f parallel_for, void *executor);
+int GFp_aes_gmac(const void *ctx_buf,
+                 uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                 const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                 const uint8_t *data, size_t data_len);
+int GFp_aes_gcm_precompute(void *precomputed_buf, size_t precomputed_buf_len,
+                           const void *ctx_buf,
+                           const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                           size_t max_in_out_len);
+int GFp_aes_gcm_seal_precomputed(void *precomputed_buf, uint8_t *out,
+                                 size_t in_out_len,
+                                 uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                                 const uint8_t *in, const uint8_t *ad,
+                                 size_t ad_len);
+int GFp_aes_gcm_open_precomputed(void *precomputed_buf, uint8_t *out,
+                                 size_t in_out_len,
+                                 uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                                 const uint8_t *in, const uint8_t *ad,
+                                 size_t ad_len);
+int GFp_aes_gcm_siv_init(void *ctx_buf, size_t ctx_buf_len,
+                         const uint8_t *key, size_t key_len);
+int GFp_aes_gcm_siv_seal(const void *ctx_buf, uint8_t *in_out,
+                         size_t in_out_len,
+                         uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                         const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                         const uint8_t *ad, size_t ad_len);
+int GFp_aes_gcm_siv_open(const void *ctx_buf, uint8_t *out, size_t in_out_len,
+                         const uint8_t tag[EVP_AEAD_AES_GCM_TAG_LEN],
+                         const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                         const uint8_t *in, const uint8_t *ad, size_t ad_len);
+int GFp_aes_ctr_init(void *ctx_buf, size_t ctx_buf_len, const uint8_t *key,
+                     size_t key_len);
+void GFp_aes_ctr_encrypt(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                         size_t len, uint8_t counter[16]);
+void GFp_aes_ctr_keystream(const void *ctx_buf, uint8_t *out, size_t len,
+                           uint8_t counter[16]);
+void GFp_aes_hp_masks(const void *const ctx_bufs[], const uint8_t *samples,
+                      uint8_t *masks, size_t num);
+int GFp_aes_xts_init(void *ctx_buf, size_t ctx_buf_len, const uint8_t *key,
+                     size_t key_len);
+int GFp_aes_xts_encrypt(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                        size_t len, const uint8_t tweak[16]);
+int GFp_aes_xts_decrypt(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                        size_t len, const uint8_t tweak[16]);
+int GFp_aes_xts_encrypt_sectors(const void *ctx_buf, const uint8_t *in,
+                                uint8_t *out, size_t sector_len,
+                                size_t num_sectors, uint64_t first_sector);
+int GFp_aes_xts_decrypt_sectors(const void *ctx_buf, const uint8_t *in,
+                                uint8_t *out, size_t sector_len,
+                                size_t num_sectors, uint64_t first_sector);
 int GFp_has_aes_hardware(void);
 
 
@@ -139,91 +266,159 @@ void GFp_vpaes_encrypt(const uint8_t *in, uint8_t *out, const AES_KEY *key);
 int GFp_aesni_set_encrypt_key(const uint8_t *userKey, unsigned bits, AES_KEY *key);
 void GFp_aesni_encrypt(const uint8_t *in, uint8_t *out, const AES_KEY *key);
 static char aesni_capable(void);
+#if defined(OPENSSL_X86_64)
+int GFp_aesni_set_decrypt_key(const uint8_t *userKey, unsigned bits,
+                              AES_KEY *key);
+void GFp_aesni_ecb_decrypt_blocks(const uint8_t *in, uint8_t *out,
+                                  size_t blocks, const AES_KEY *key);
+#endif
 #endif
 
+/* These are provided by aes.c and work on every CPU. */
+int GFp_aes_nohw_set_encrypt_key(const uint8_t *key, unsigned bits,
+                                 AES_KEY *aeskey);
+void GFp_aes_nohw_encrypt(const uint8_t *in, uint8_t *out, const AES_KEY *key);
+void GFp_aes_nohw_ctr32_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                       size_t blocks, const AES_KEY *key,
+                                       const uint8_t ivec[16]);
+void GFp_aes_nohw_ecb_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key);
+void GFp_aes_nohw_ecb_decrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key);
+
 typedef int (*aes_set_key_f)(const uint8_t *userKey, unsigned bits,
                              AES_KEY *key);
 
-static aes_set_key_f aes_set_key(void) {
+/* AES_IMPL is one AES implementation: the key setup, single-block and (where
+ * available) multi-block functions that go together. Decryption is only
+ * needed by XTS; |ecb_decrypt| takes the key schedule computed by
+ * |set_decrypt_key|. */
+typedef struct {
+  aes_set_key_f set_key;
+  aes_block_f block;
+  aes_ctr_f ctr; /* NULL if there is no CTR implementation. */
+  aes_ecb_f ecb; /* NULL if there is no multi-block ECB implementation. */
+  aes_set_key_f set_decrypt_key; /* NULL if there is no decryption. */
+  aes_ecb_f ecb_decrypt;
+  const char *name;
+} AES_IMPL;
+
 #if defined(AESNI)
-  if (aesni_capable()) {
-    return GFp_aesni_set_encrypt_key;
-  }
+static const AES_IMPL kAesImplAesni = {
+  GFp_aesni_set_encrypt_key,
+  GFp_aesni_encrypt,
+  GFp_aesni_ctr32_encrypt_blocks,
+#if defined(OPENSSL_X86_64)
+  GFp_aesni_ecb_encrypt_blocks,
+  GFp_aesni_set_decrypt_key,
+  GFp_aesni_ecb_decrypt_blocks,
+#else
+  NULL,
+  NULL,
+  NULL,
+#endif
+  "aesni",
+};
 #endif
 
 #if defined(HWAES)
-  if (hwaes_capable()) {
-    return GFp_aes_v8_set_encrypt_key;
-  }
+static const AES_IMPL kAesImplHw = {
+  GFp_aes_v8_set_encrypt_key,
+  GFp_aes_v8_encrypt,
+  GFp_aes_v8_ctr32_encrypt_blocks,
+  NULL,
+  NULL,
+  NULL,
+  "aesv8",
+};
 #endif
 
 #if defined(BSAES)
-  if (bsaes_capable()) {
-    return GFp_AES_set_encrypt_key;
-  }
+static const AES_IMPL kAesImplBsaes = {
+  GFp_AES_set_encrypt_key,
+  GFp_AES_encrypt,
+  GFp_bsaes_ctr32_encrypt_blocks,
+  NULL,
+  NULL,
+  NULL,
+  "bsaes",
+};
 #endif
 
 #if defined(VPAES)
-  if (vpaes_capable()) {
-    return GFp_vpaes_set_encrypt_key;
-  }
+static const AES_IMPL kAesImplVpaes = {
+  GFp_vpaes_set_encrypt_key,
+  GFp_vpaes_encrypt,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  "vpaes",
+};
 #endif
 
-  return GFp_AES_set_encrypt_key;
-}
+/* kAesImplNoHw is the constant-time bitsliced implementation in aes.c. It is
+ * used when none of the above are available, instead of the table-based
+ * |GFp_AES_encrypt|, which leaks the key through cache timing. */
+static const AES_IMPL kAesImplNoHw = {
+  GFp_aes_nohw_set_encrypt_key,
+  GFp_aes_nohw_encrypt,
+  GFp_aes_nohw_ctr32_encrypt_blocks,
+  GFp_aes_nohw_ecb_encrypt_blocks,
+  GFp_aes_nohw_set_encrypt_key,
+  GFp_aes_nohw_ecb_decrypt_blocks,
+  "nohw",
+};
 
-static aes_block_f aes_block(void) {
-  /* Keep this in sync with |set_set_key| and |aes_ctr|. */
+/* aes_impl is the implementation chosen by |GFp_aes_dispatch_setup|. The CPU
+ * capabilities are only inspected there, once; everything else uses
+ * |aes_impl|. Until |GFp_aes_dispatch_setup| is called, the nohw
+ * implementation, which works on every CPU, is used. */
+static const AES_IMPL *aes_impl = &kAesImplNoHw;
 
+void GFp_aes_dispatch_setup(void) {
 #if defined(AESNI)
   if (aesni_capable()) {
-    return GFp_aesni_encrypt;
+    aes_impl = &kAesImplAesni;
+    return;
   }
 #endif
 
 #if defined(HWAES)
   if (hwaes_capable()) {
-    return GFp_aes_v8_encrypt;
+    aes_impl = &kAesImplHw;
+    return;
   }
 #endif
 
-#if defined(VPAES)
 #if defined(BSAES)
   if (bsaes_capable()) {
-    return GFp_AES_encrypt;
+    aes_impl = &kAesImplBsaes;
+    return;
   }
 #endif
 
+#if defined(VPAES)
   if (vpaes_capable()) {
-    return GFp_vpaes_encrypt;
+    aes_impl = &kAesImplVpaes;
+    return;
   }
 #endif
 
-  return GFp_AES_encrypt;
+  aes_impl = &kAesImplNoHw;
 }
 
-static aes_ctr_f aes_ctr(void) {
-  /* Keep this in sync with |set_set_key| and |aes_block|. */
-
-#if defined(AESNI)
-  if (aesni_capable()) {
-    return GFp_aesni_ctr32_encrypt_blocks;
-  }
-#endif
+const char *GFp_aes_impl_name(void) {
+  return aes_impl->name;
+}
 
-#if defined(HWAES)
-  if (hwaes_capable()) {
-    return GFp_aes_v8_ctr32_encrypt_blocks;
+const char *GFp_aes_gcm_impl_name(void) {
+#if defined(AESNI) && defined(OPENSSL_X86_64)
+  if (aes_impl == &kAesImplAesni && GFp_gcm_aesni_sse_stitch_enabled()) {
+    return "aesni-sse4.1";
   }
 #endif
-
-#if defined(BSAES)
-  if (bsaes_capable()) {
-    return GFp_bsaes_ctr32_encrypt_blocks;
-  }
-#endif
-
-  return NULL;
+  return "separate";
 }
 
 #if defined(AESNI)
@@ -232,30 +427,48 @@ static char aesni_capable(void) {
 }
 #endif
 
+/* AES_GCM_KEY is the key context that |GFp_aes_gcm_init| constructs in the
+ * caller's |ctx_buf|. Seal and open use it in place: the key schedule and the
+ * GHASH table are never copied, and the implementation functions are copied
+ * into it when the key is set up. */
+typedef struct {
+  AES_KEY ks;
+  GCM128_KEY gcm_key;
+  aes_ctr_f ctr; /* NULL if there is no CTR implementation. */
+} AES_GCM_KEY;
+
+const size_t GFp_AES_GCM_KEY_LEN = sizeof(AES_GCM_KEY);
+
+static void aes_gcm_key_init(AES_GCM_KEY *gcm_key, const uint8_t *key,
+                             size_t key_len) {
+  /* XXX: Ignores return value. TODO: These functions should return |void|
+   * anyway. */
+  const AES_IMPL *impl = aes_impl;
+  (void)(impl->set_key)(key, key_len * 8, &gcm_key->ks);
+
+  GFp_gcm128_init_key(&gcm_key->gcm_key, &gcm_key->ks, impl->block,
+                      impl->ecb);
+  gcm_key->ctr = impl->ctr;
+}
+
 int GFp_aes_gcm_init(void *ctx_buf, size_t ctx_buf_len, const uint8_t *key,
                      size_t key_len) {
-  alignas(16) AES_KEY ks;
-  assert(ctx_buf_len >= sizeof(ks) + GCM128_SERIALIZED_LEN);
-  if (ctx_buf_len < sizeof(ks) + GCM128_SERIALIZED_LEN) {
+  aead_assert_init_preconditions(alignof(AES_GCM_KEY), sizeof(AES_GCM_KEY),
+                                 ctx_buf, ctx_buf_len, key);
+  if (ctx_buf_len < sizeof(AES_GCM_KEY)) {
     return 0;
   }
 
-  /* XXX: Ignores return value. TODO: These functions should return |void|
-   * anyway. */
-  (void)(aes_set_key())(key, key_len * 8, &ks);
-
-  GFp_gcm128_init_serialized((uint8_t *)ctx_buf + sizeof(ks), &ks, aes_block());
-  memcpy(ctx_buf, &ks, sizeof(ks));
+  aes_gcm_key_init(ctx_buf, key, key_len);
   return 1;
 }
 
-static int gfp_aes_gcm_init_and_aad(GCM128_CONTEXT *gcm, AES_KEY *ks,
-                                    const void *ctx_buf, const uint8_t nonce[],
-                                    const uint8_t ad[], size_t ad_len) {
+static int gfp_aes_gcm_init_and_aad(GCM128_CONTEXT *gcm,
+                                    const AES_GCM_KEY *gcm_key,
+                                    const uint8_t nonce[], const uint8_t ad[],
+                                    size_t ad_len) {
   assert(ad != NULL || ad_len == 0);
-  memcpy(ks, ctx_buf, sizeof(*ks));
-  GFp_gcm128_init(gcm, ks, aes_block(), (const uint8_t *)ctx_buf + sizeof(*ks),
-                  nonce);
+  GFp_gcm128_init(gcm, &gcm_key->gcm_key, &gcm_key->ks, nonce);
   if (ad_len > 0) {
     if (!GFp_gcm128_aad(gcm, ad, ad_len)) {
       return 0;
@@ -264,30 +477,58 @@ static int gfp_aes_gcm_init_and_aad(GCM128_CONTEXT *gcm, AES_KEY *ks,
   return 1;
 }
 
+static int gfp_aes_gcm_encrypt(GCM128_CONTEXT *gcm,
+                               const AES_GCM_KEY *gcm_key, const uint8_t *in,
+                               uint8_t *out, size_t len) {
+  if (gcm_key->ctr != NULL) {
+    return GFp_gcm128_encrypt_ctr32(gcm, &gcm_key->ks, in, out, len,
+                                    gcm_key->ctr);
+  }
+  return GFp_gcm128_encrypt(gcm, &gcm_key->ks, in, out, len);
+}
+
+static int gfp_aes_gcm_decrypt(GCM128_CONTEXT *gcm,
+                               const AES_GCM_KEY *gcm_key, const uint8_t *in,
+                               uint8_t *out, size_t len) {
+  if (gcm_key->ctr != NULL) {
+    return GFp_gcm128_decrypt_ctr32(gcm, &gcm_key->ks, in, out, len,
+                                    gcm_key->ctr);
+  }
+  return GFp_gcm128_decrypt(gcm, &gcm_key->ks, in, out, len);
+}
+
 int GFp_aes_gcm_seal(const void *ctx_buf, uint8_t *in_out, size_t in_out_len,
                      uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
                      const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
                      const uint8_t *ad, size_t ad_len) {
-  assert(in_out != NULL || in_out_len == 0);
+  return GFp_aes_gcm_seal_out_of_place(ctx_buf, in_out, in_out_len, tag_out,
+                                       nonce, in_out, ad, ad_len);
+}
+
+/* GFp_aes_gcm_seal_out_of_place is like |GFp_aes_gcm_seal| but reads the
+ * plaintext from |in| and writes the ciphertext to |out|, so a caller that
+ * keeps the plaintext doesn't have to copy it into the output buffer first.
+ * As with |GFp_aes_gcm_open|, |out| may equal |in| but must not otherwise
+ * point into the input. */
+int GFp_aes_gcm_seal_out_of_place(
+    const void *ctx_buf, uint8_t *out, size_t in_out_len,
+    uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+    const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN], const uint8_t *in,
+    const uint8_t *ad, size_t ad_len) {
+  assert(out != NULL || in_out_len == 0);
   assert(aead_check_in_len(in_out_len));
+  assert(aead_check_alias(in, in_out_len, out));
+  assert(in != NULL || in_out_len == 0);
   assert(ad != NULL || ad_len == 0);
 
+  const AES_GCM_KEY *gcm_key = ctx_buf;
   GCM128_CONTEXT gcm;
-  alignas(16) AES_KEY ks;
-  if (!gfp_aes_gcm_init_and_aad(&gcm, &ks, ctx_buf, nonce, ad, ad_len)) {
+  if (!gfp_aes_gcm_init_and_aad(&gcm, gcm_key, nonce, ad, ad_len)) {
     return 0;
   }
   if (in_out_len > 0) {
-    aes_ctr_f ctr = aes_ctr();
-    if (ctr != NULL) {
-      if (!GFp_gcm128_encrypt_ctr32(&gcm, &ks, in_out, in_out, in_out_len,
-                                    ctr)) {
-        return 0;
-      }
-    } else {
-      if (!GFp_gcm128_encrypt(&gcm, &ks, in_out, in_out, in_out_len)) {
-        return 0;
-      }
+    if (!gfp_aes_gcm_encrypt(&gcm, gcm_key, in, out, in_out_len)) {
+      return 0;
     }
   }
   GFp_gcm128_tag(&gcm, tag_out);
@@ -304,33 +545,1365 @@ int GFp_aes_gcm_open(const void *ctx_buf, uint8_t *out, size_t in_out_len,
   assert(in != NULL || in_out_len == 0);
   assert(ad != NULL || ad_len == 0);
 
+  const AES_GCM_KEY *gcm_key = ctx_buf;
   GCM128_CONTEXT gcm;
-  alignas(16) AES_KEY ks;
-  if (!gfp_aes_gcm_init_and_aad(&gcm, &ks, ctx_buf, nonce, ad, ad_len)) {
+  if (!gfp_aes_gcm_init_and_aad(&gcm, gcm_key, nonce, ad, ad_len)) {
     return 0;
   }
   if (in_out_len > 0) {
-    aes_ctr_f ctr = aes_ctr();
-    if (ctr != NULL) {
-      if (!GFp_gcm128_decrypt_ctr32(&gcm, &ks, in, out, in_out_len, ctr)) {
+    if (!gfp_aes_gcm_decrypt(&gcm, gcm_key, in, out, in_out_len)) {
+      return 0;
+    }
+  }
+  GFp_gcm128_tag(&gcm, tag_out);
+  return 1;
+}
+
+/* Compact keys.
+ *
+ * An |AES_GCM_KEY| is over 500 bytes, most of it the expanded key schedule
+ * and the table of powers of H. A server that keeps a key for each of many
+ * mostly-idle connections can instead keep an |AES_GCM_COMPACT_KEY|, which
+ * holds only the raw key. Each seal or open then expands the key schedule and
+ * the GHASH table on the stack before processing the message. With AES-NI and
+ * CLMUL that costs roughly as much as sealing a few hundred bytes, so it is a
+ * good trade for connections that are usually idle and a bad one for bulk
+ * transfers, which should use the normal key. */
+
+typedef struct {
+  uint8_t key[32];
+  size_t key_len;
+} AES_GCM_COMPACT_KEY;
+
+const size_t GFp_AES_GCM_COMPACT_KEY_LEN = sizeof(AES_GCM_COMPACT_KEY);
+
+int GFp_aes_gcm_compact_init(void *ctx_buf, size_t ctx_buf_len,
+                             const uint8_t *key, size_t key_len) {
+  aead_assert_init_preconditions(alignof(AES_GCM_COMPACT_KEY),
+                                 sizeof(AES_GCM_COMPACT_KEY), ctx_buf,
+                                 ctx_buf_len, key);
+  if (ctx_buf_len < sizeof(AES_GCM_COMPACT_KEY) ||
+      (key_len != 16 && key_len != 32)) {
+    return 0;
+  }
+
+  AES_GCM_COMPACT_KEY *compact_key = ctx_buf;
+  memcpy(compact_key->key, key, key_len);
+  compact_key->key_len = key_len;
+  return 1;
+}
+
+int GFp_aes_gcm_compact_seal(const void *ctx_buf, uint8_t *out,
+                             size_t in_out_len,
+                             uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                             const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                             const uint8_t *in, const uint8_t *ad,
+                             size_t ad_len) {
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(AES_GCM_COMPACT_KEY) == 0);
+
+  const AES_GCM_COMPACT_KEY *compact_key = ctx_buf;
+  AES_GCM_KEY gcm_key;
+  aes_gcm_key_init(&gcm_key, compact_key->key, compact_key->key_len);
+  int ret = GFp_aes_gcm_seal_out_of_place(&gcm_key, out, in_out_len, tag_out,
+                                          nonce, in, ad, ad_len);
+  /* The expanded key must not outlive the call. */
+  OPENSSL_cleanse(&gcm_key, sizeof(gcm_key));
+  return ret;
+}
+
+int GFp_aes_gcm_compact_open(const void *ctx_buf, uint8_t *out,
+                             size_t in_out_len,
+                             uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                             const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                             const uint8_t *in, const uint8_t *ad,
+                             size_t ad_len) {
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(AES_GCM_COMPACT_KEY) == 0);
+
+  const AES_GCM_COMPACT_KEY *compact_key = ctx_buf;
+  AES_GCM_KEY gcm_key;
+  aes_gcm_key_init(&gcm_key, compact_key->key, compact_key->key_len);
+  int ret = GFp_aes_gcm_open(&gcm_key, out, in_out_len, tag_out, nonce, in,
+                             ad, ad_len);
+  /* The expanded key must not outlive the call. */
+  OPENSSL_cleanse(&gcm_key, sizeof(gcm_key));
+  return ret;
+}
+
+/* gfp_aes_gcm_crypt_sg encrypts or decrypts the concatenation of the |in|
+ * segments into the concatenation of the |out| segments, which may be split
+ * differently. Each piece is passed to |GFp_gcm128_[en|de]crypt*|, which carry
+ * any partial block over to the next piece. It returns zero if the total
+ * lengths of |in| and |out| differ. */
+static int gfp_aes_gcm_crypt_sg(GCM128_CONTEXT *gcm,
+                                const AES_GCM_KEY *gcm_key,
+                                const AEAD_SEGMENT out[], size_t num_out,
+                                const AEAD_CONST_SEGMENT in[], size_t num_in,
+                                int is_seal) {
+  assert(out != NULL || num_out == 0);
+  assert(in != NULL || num_in == 0);
+
+  size_t i = 0, in_off = 0;
+  size_t o = 0, out_off = 0;
+  for (;;) {
+    while (i < num_in && in_off == in[i].len) {
+      ++i;
+      in_off = 0;
+    }
+    while (o < num_out && out_off == out[o].len) {
+      ++o;
+      out_off = 0;
+    }
+    if (i == num_in || o == num_out) {
+      break;
+    }
+
+    size_t todo = in[i].len - in_off;
+    if (todo > out[o].len - out_off) {
+      todo = out[o].len - out_off;
+    }
+    const uint8_t *in_ptr = in[i].base + in_off;
+    uint8_t *out_ptr = out[o].base + out_off;
+    assert(aead_check_alias(in_ptr, todo, out_ptr));
+
+    int ok = is_seal
+                 ? gfp_aes_gcm_encrypt(gcm, gcm_key, in_ptr, out_ptr, todo)
+                 : gfp_aes_gcm_decrypt(gcm, gcm_key, in_ptr, out_ptr, todo);
+    if (!ok) {
+      return 0;
+    }
+    in_off += todo;
+    out_off += todo;
+  }
+
+  return i == num_in && o == num_out;
+}
+
+static int gfp_aes_gcm_sg(const void *ctx_buf, const AEAD_SEGMENT out[],
+                          size_t num_out,
+                          uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                          const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                          const AEAD_CONST_SEGMENT in[], size_t num_in,
+                          const AEAD_CONST_SEGMENT ad[], size_t num_ad,
+                          int is_seal) {
+  assert(ad != NULL || num_ad == 0);
+
+  const AES_GCM_KEY *gcm_key = ctx_buf;
+  GCM128_CONTEXT gcm;
+  GFp_gcm128_init(&gcm, &gcm_key->gcm_key, &gcm_key->ks, nonce);
+  for (size_t i = 0; i < num_ad; ++i) {
+    assert(ad[i].base != NULL || ad[i].len == 0);
+    if (ad[i].len > 0 && !GFp_gcm128_aad(&gcm, ad[i].base, ad[i].len)) {
+      return 0;
+    }
+  }
+  if (!gfp_aes_gcm_crypt_sg(&gcm, gcm_key, out, num_out, in, num_in,
+                            is_seal)) {
+    return 0;
+  }
+  GFp_gcm128_tag(&gcm, tag_out);
+  return 1;
+}
+
+int GFp_aes_gcm_seal_sg(const void *ctx_buf, const AEAD_SEGMENT out[],
+                        size_t num_out,
+                        uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                        const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                        const AEAD_CONST_SEGMENT in[], size_t num_in,
+                        const AEAD_CONST_SEGMENT ad[], size_t num_ad) {
+  return gfp_aes_gcm_sg(ctx_buf, out, num_out, tag_out, nonce, in, num_in, ad,
+                        num_ad, 1);
+}
+
+int GFp_aes_gcm_open_sg(const void *ctx_buf, const AEAD_SEGMENT out[],
+                        size_t num_out,
+                        uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                        const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                        const AEAD_CONST_SEGMENT in[], size_t num_in,
+                        const AEAD_CONST_SEGMENT ad[], size_t num_ad) {
+  return gfp_aes_gcm_sg(ctx_buf, out, num_out, tag_out, nonce, in, num_in, ad,
+                        num_ad, 0);
+}
+
+/* AES_GCM_STREAM is the state of one message that is sealed or opened
+ * incrementally, constructed by |GFp_aes_gcm_stream_init| in the caller's
+ * |stream_buf|. Its size does not depend on the length of the message, and it
+ * refers to the key context rather than copying it, so the key context must
+ * outlive it.
+ *
+ * A stream is used by passing all of the AAD, in any number of calls to
+ * |GFp_aes_gcm_stream_aad|, then all of the input, in any number of calls to
+ * either |GFp_aes_gcm_stream_encrypt| or |GFp_aes_gcm_stream_decrypt| (but not
+ * both), and then calling |GFp_aes_gcm_stream_finish| or
+ * |GFp_aes_gcm_stream_verify| once. The pieces may have any length; partial
+ * blocks are carried over between calls, and the rest is processed by the
+ * same bulk code as |GFp_aes_gcm_seal| and |GFp_aes_gcm_open|. */
+typedef struct {
+  GCM128_CONTEXT gcm;
+  const AES_GCM_KEY *key;
+} AES_GCM_STREAM;
+
+const size_t GFp_AES_GCM_STREAM_LEN = sizeof(AES_GCM_STREAM);
+
+int GFp_aes_gcm_stream_init(void *stream_buf, size_t stream_buf_len,
+                            const void *ctx_buf,
+                            const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN]) {
+  assert(stream_buf != NULL);
+  assert(((uintptr_t)stream_buf) % alignof(AES_GCM_STREAM) == 0);
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(AES_GCM_KEY) == 0);
+  assert(nonce != NULL);
+  if (stream_buf_len < sizeof(AES_GCM_STREAM)) {
+    return 0;
+  }
+
+  AES_GCM_STREAM *stream = stream_buf;
+  stream->key = ctx_buf;
+  GFp_gcm128_init(&stream->gcm, &stream->key->gcm_key, &stream->key->ks,
+                  nonce);
+  return 1;
+}
+
+int GFp_aes_gcm_stream_aad(void *stream_buf, const uint8_t *ad,
+                           size_t ad_len) {
+  assert(ad != NULL || ad_len == 0);
+
+  AES_GCM_STREAM *stream = stream_buf;
+  if (ad_len == 0) {
+    return 1;
+  }
+  return GFp_gcm128_aad(&stream->gcm, ad, ad_len);
+}
+
+int GFp_aes_gcm_stream_encrypt(void *stream_buf, const uint8_t *in,
+                               uint8_t *out, size_t len) {
+  assert(in != NULL || len == 0);
+  assert(out != NULL || len == 0);
+  assert(aead_check_alias(in, len, out));
+
+  AES_GCM_STREAM *stream = stream_buf;
+  if (len == 0) {
+    return 1;
+  }
+  return gfp_aes_gcm_encrypt(&stream->gcm, stream->key, in, out, len);
+}
+
+int GFp_aes_gcm_stream_decrypt(void *stream_buf, const uint8_t *in,
+                               uint8_t *out, size_t len) {
+  assert(in != NULL || len == 0);
+  assert(out != NULL || len == 0);
+  assert(aead_check_alias(in, len, out));
+
+  AES_GCM_STREAM *stream = stream_buf;
+  if (len == 0) {
+    return 1;
+  }
+  return gfp_aes_gcm_decrypt(&stream->gcm, stream->key, in, out, len);
+}
+
+/* GFp_aes_gcm_stream_finish writes the tag of the message to |tag_out|. The
+ * stream must not be used again afterwards except to pass it to
+ * |GFp_aes_gcm_stream_init|. */
+void GFp_aes_gcm_stream_finish(void *stream_buf,
+                               uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN]) {
+  AES_GCM_STREAM *stream = stream_buf;
+  GFp_gcm128_tag(&stream->gcm, tag_out);
+}
+
+/* GFp_aes_gcm_stream_verify is like |GFp_aes_gcm_stream_finish| except that
+ * it compares the tag with |tag|, in constant time, and returns one if they
+ * are equal and zero otherwise. */
+int GFp_aes_gcm_stream_verify(void *stream_buf,
+                              const uint8_t tag[EVP_AEAD_AES_GCM_TAG_LEN]) {
+  uint8_t calculated[EVP_AEAD_AES_GCM_TAG_LEN];
+  GFp_aes_gcm_stream_finish(stream_buf, calculated);
+  return GFp_memcmp(calculated, tag, sizeof(calculated)) == 0;
+}
+
+/* GFp_aes_gcm_stream_fork and GFp_aes_gcm_stream_join split the rest of a
+ * stream's input into chunks that can be encrypted or decrypted on different
+ * threads; see |GFp_gcm128_fork| and |GFp_gcm128_join|. Each chunk is itself
+ * a stream, forked from the (unmodified, shareable) parent at the given block
+ * offset and passed to |GFp_aes_gcm_stream_encrypt| or
+ * |GFp_aes_gcm_stream_decrypt|. Once every chunk is done, they are joined
+ * back into the parent in order, and the tag is then computed from the parent
+ * as usual; it is identical to the tag of serial processing.
+ *
+ * Each join costs a few hundred GHASH multiplications' worth of work, so
+ * short messages should be processed serially. */
+int GFp_aes_gcm_stream_fork(void *chunk_buf, size_t chunk_buf_len,
+                            const void *stream_buf, uint64_t block_offset) {
+  assert(chunk_buf != NULL);
+  assert(((uintptr_t)chunk_buf) % alignof(AES_GCM_STREAM) == 0);
+  assert(stream_buf != NULL);
+  if (chunk_buf_len < sizeof(AES_GCM_STREAM)) {
+    return 0;
+  }
+
+  AES_GCM_STREAM *chunk = chunk_buf;
+  const AES_GCM_STREAM *stream = stream_buf;
+  if (stream->gcm.mres != 0) {
+    return 0;
+  }
+  chunk->key = stream->key;
+  GFp_gcm128_fork(&chunk->gcm, &stream->gcm, block_offset);
+  return 1;
+}
+
+int GFp_aes_gcm_stream_join(void *stream_buf, const void *chunk_buf) {
+  AES_GCM_STREAM *stream = stream_buf;
+  const AES_GCM_STREAM *chunk = chunk_buf;
+  assert(chunk->key == stream->key);
+  return GFp_gcm128_join(&stream->gcm, &chunk->gcm);
+}
+
+/* Parallel sealing and opening.
+ *
+ * |GFp_aes_gcm_seal_parallel| and |GFp_aes_gcm_open_parallel| split a message
+ * into chunks, run the chunks through the caller's |GFp_parallel_for_f| with
+ * |GFp_gcm128_fork|ed contexts, and join them in order. Joining a chunk of n
+ * blocks costs about 2 * log2(n) slow GF(2^128) multiplications on the
+ * calling thread, so only messages longer than
+ * |AES_GCM_PARALLEL_MIN_CHUNK_LEN| are split; shorter ones are processed
+ * exactly as by |GFp_aes_gcm_seal| and |GFp_aes_gcm_open|. */
+
+/* The shortest chunk worth handing to another thread. */
+#define AES_GCM_PARALLEL_MIN_CHUNK_LEN (64 * 1024)
+
+/* The most chunks that a message is split into. */
+#define AES_GCM_PARALLEL_MAX_CHUNKS 16
+
+typedef struct {
+  GCM128_CONTEXT chunks[AES_GCM_PARALLEL_MAX_CHUNKS];
+  int ok[AES_GCM_PARALLEL_MAX_CHUNKS];
+  const GCM128_CONTEXT *gcm;
+  const AES_GCM_KEY *gcm_key;
+  uint8_t *out;
+  const uint8_t *in;
+  size_t len;
+  size_t chunk_len;
+  int seal;
+} AES_GCM_PARALLEL;
+
+static void aes_gcm_parallel_task(void *task_arg, size_t i) {
+  AES_GCM_PARALLEL *p = task_arg;
+  size_t offset = i * p->chunk_len;
+  size_t todo = p->len - offset < p->chunk_len ? p->len - offset
+                                                : p->chunk_len;
+  GFp_gcm128_fork(&p->chunks[i], p->gcm, offset / 16);
+  p->ok[i] = p->seal ? gfp_aes_gcm_encrypt(&p->chunks[i], p->gcm_key,
+                                           p->in + offset, p->out + offset,
+                                           todo)
+                     : gfp_aes_gcm_decrypt(&p->chunks[i], p->gcm_key,
+                                           p->in + offset, p->out + offset,
+                                           todo);
+}
+
+/* gfp_aes_gcm_parallel seals or opens the message in up to |max_threads|
+ * chunks using |parallel_for|. It returns -1, without doing anything, if the
+ * message should be processed in one piece instead. */
+static int gfp_aes_gcm_parallel(
+    const void *ctx_buf, uint8_t *out, size_t in_out_len,
+    uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+    const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN], const uint8_t *in,
+    const uint8_t *ad, size_t ad_len, size_t max_threads,
+    GFp_parallel_for_f parallel_for, void *executor, int seal) {
+  if (parallel_for == NULL || max_threads <= 1 ||
+      in_out_len <= AES_GCM_PARALLEL_MIN_CHUNK_LEN) {
+    return -1;
+  }
+  if (max_threads > AES_GCM_PARALLEL_MAX_CHUNKS) {
+    max_threads = AES_GCM_PARALLEL_MAX_CHUNKS;
+  }
+  size_t chunk_len = in_out_len / max_threads + (in_out_len % max_threads != 0);
+  chunk_len = (chunk_len + 15) & ~(size_t)15;
+  if (chunk_len < AES_GCM_PARALLEL_MIN_CHUNK_LEN) {
+    chunk_len = AES_GCM_PARALLEL_MIN_CHUNK_LEN;
+  }
+  size_t num_chunks = in_out_len / chunk_len + (in_out_len % chunk_len != 0);
+  assert(num_chunks >= 2 && num_chunks <= AES_GCM_PARALLEL_MAX_CHUNKS);
+
+  const AES_GCM_KEY *gcm_key = ctx_buf;
+  GCM128_CONTEXT gcm;
+  if (!gfp_aes_gcm_init_and_aad(&gcm, gcm_key, nonce, ad, ad_len)) {
+    return 0;
+  }
+
+  AES_GCM_PARALLEL p;
+  p.gcm = &gcm;
+  p.gcm_key = gcm_key;
+  p.out = out;
+  p.in = in;
+  p.len = in_out_len;
+  p.chunk_len = chunk_len;
+  p.seal = seal;
+  parallel_for(executor, num_chunks, aes_gcm_parallel_task, &p);
+
+  for (size_t i = 0; i < num_chunks; ++i) {
+    if (!p.ok[i] || !GFp_gcm128_join(&gcm, &p.chunks[i])) {
+      return 0;
+    }
+  }
+  GFp_gcm128_tag(&gcm, tag_out);
+  return 1;
+}
+
+/* GFp_aes_gcm_seal_parallel is like |GFp_aes_gcm_seal|, but messages longer
+ * than |AES_GCM_PARALLEL_MIN_CHUNK_LEN| are split into up to |max_threads|
+ * chunks, of at least that length except for the last, that are encrypted
+ * through |parallel_for|. |parallel_for| may be NULL to disable that. */
+int GFp_aes_gcm_seal_parallel(const void *ctx_buf, uint8_t *in_out,
+                              size_t in_out_len,
+                              uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                              const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                              const uint8_t *ad, size_t ad_len,
+                              size_t max_threads,
+                              GFp_parallel_for_f parallel_for, void *executor) {
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(AES_GCM_KEY) == 0);
+  if (!aead_check_in_len(in_out_len)) {
+    return 0;
+  }
+  int ret = gfp_aes_gcm_parallel(ctx_buf, in_out, in_out_len, tag_out, nonce,
+                                 in_out, ad, ad_len, max_threads,
+                                 parallel_for, executor, 1);
+  if (ret >= 0) {
+    return ret;
+  }
+  return GFp_aes_gcm_seal(ctx_buf, in_out, in_out_len, tag_out, nonce, ad,
+                          ad_len);
+}
+
+/* GFp_aes_gcm_open_parallel is the opening counterpart of
+ * |GFp_aes_gcm_seal_parallel|. Unlike |GFp_aes_gcm_open|, |out| must either
+ * equal |in| or not overlap it at all, as the chunks are decrypted
+ * concurrently. */
+int GFp_aes_gcm_open_parallel(const void *ctx_buf, uint8_t *out,
+                              size_t in_out_len,
+                              uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                              const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                              const uint8_t *in, const uint8_t *ad,
+                              size_t ad_len, size_t max_threads,
+                              GFp_parallel_for_f parallel_for, void *executor) {
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(AES_GCM_KEY) == 0);
+  if (!aead_check_in_len(in_out_len) ||
+      (out != in && out + in_out_len > in && in + in_out_len > out)) {
+    return 0;
+  }
+  int ret = gfp_aes_gcm_parallel(ctx_buf, out, in_out_len, tag_out, nonce, in,
+                                 ad, ad_len, max_threads, parallel_for,
+                                 executor, 0);
+  if (ret >= 0) {
+    return ret;
+  }
+  return GFp_aes_gcm_open(ctx_buf, out, in_out_len, tag_out, nonce, in, ad,
+                          ad_len);
+}
+
+/* GFp_aes_gmac computes the GMAC tag of |data|, i.e. the AES-GCM tag of an
+ * empty message with |data| as its AAD, using the same key context as
+ * |GFp_aes_gcm_seal|. To authenticate data that arrives in pieces, use
+ * |GFp_aes_gcm_stream_aad| followed by |GFp_aes_gcm_stream_finish| or
+ * |GFp_aes_gcm_stream_verify|. */
+int GFp_aes_gmac(const void *ctx_buf,
+                 uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                 const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                 const uint8_t *data, size_t data_len) {
+  assert(ctx_buf != NULL);
+  assert(data != NULL || data_len == 0);
+
+  const AES_GCM_KEY *gcm_key = ctx_buf;
+  GCM128_CONTEXT gcm;
+  if (!gfp_aes_gcm_init_and_aad(&gcm, gcm_key, nonce, data, data_len)) {
+    return 0;
+  }
+  GFp_gcm128_tag(&gcm, tag_out);
+  return 1;
+}
+
+/* AES_CTR_MIN_BLOCKS is the number of blocks below which the bsaes CTR
+ * functions fall back to the table-based |GFp_AES_encrypt|. Where only a CTR
+ * function is available, keystream for fewer blocks is generated over this
+ * many so that it stays constant-time. */
+#define AES_CTR_MIN_BLOCKS 8
+
+/* aes_gcm_keystream_blocks writes EK0 and the following |num_blocks| - 1
+ * blocks of keystream for |nonce| to |blocks|, which must have room for at
+ * least |AES_CTR_MIN_BLOCKS| blocks. */
+static void aes_gcm_keystream_blocks(const AES_GCM_KEY *gcm_key,
+                                     uint8_t blocks[][16], size_t num_blocks,
+                                     const uint8_t nonce[]) {
+  if (gcm_key->gcm_key.ecb == NULL && gcm_key->ctr != NULL) {
+    alignas(16) uint8_t counter[16];
+    memcpy(counter, nonce, EVP_AEAD_AES_GCM_NONCE_LEN);
+    to_be_u32_ptr(counter + 12, 1);
+    if (num_blocks < AES_CTR_MIN_BLOCKS) {
+      num_blocks = AES_CTR_MIN_BLOCKS;
+    }
+    memset(blocks, 0, num_blocks * 16);
+    (*gcm_key->ctr)(blocks[0], blocks[0], num_blocks, &gcm_key->ks, counter);
+    return;
+  }
+
+  for (size_t i = 0; i < num_blocks; ++i) {
+    memcpy(blocks[i], nonce, EVP_AEAD_AES_GCM_NONCE_LEN);
+    to_be_u32_ptr(blocks[i] + 12, (uint32_t)(i + 1));
+  }
+  if (gcm_key->gcm_key.ecb != NULL) {
+    (*gcm_key->gcm_key.ecb)(blocks[0], blocks[0], num_blocks, &gcm_key->ks);
+  } else {
+    for (size_t i = 0; i < num_blocks; ++i) {
+      (*gcm_key->gcm_key.block)(blocks[i], blocks[i], &gcm_key->ks);
+    }
+  }
+}
+
+/* AES_GCM_BATCH_MAX_LEN is the length of the longest record that
+ * |gfp_aes_gcm_batch| batches. Gathering the keystream of longer records
+ * doesn't pay: |gfp_aes_gcm_encrypt| and |gfp_aes_gcm_decrypt| already
+ * interleave enough blocks for them, and stitch the AES and GHASH work where
+ * the CPU allows it. */
+#define AES_GCM_BATCH_MAX_LEN (8 * 16)
+
+/* AES_GCM_BATCH_BLOCKS is the number of counter blocks, gathered from as many
+ * records as fit, that |gfp_aes_gcm_batch| encrypts in one call. */
+#define AES_GCM_BATCH_BLOCKS 64
+
+static size_t aes_gcm_record_blocks(const AES_GCM_RECORD *record) {
+  /* One block for EK0 plus one per (partial) block of input. */
+  return 1 + (record->in_out_len + 15) / 16;
+}
+
+/* gfp_aes_gcm_batch seals or opens |records| under the key in |ctx_buf|. The
+ * counter blocks of consecutive short records, including their EK0 blocks,
+ * are encrypted together so that the AES implementation can interleave eight
+ * or more blocks even when every record is only a few blocks long; the
+ * GHASH and tag work of each record then consumes its slice of the resulting
+ * keystream. Records longer than |AES_GCM_BATCH_MAX_LEN| are sealed or opened
+ * on their own. */
+static int gfp_aes_gcm_batch(const void *ctx_buf,
+                             const AES_GCM_RECORD records[],
+                             size_t num_records, int is_seal) {
+  assert(records != NULL || num_records == 0);
+
+  const AES_GCM_KEY *gcm_key = ctx_buf;
+  GCM128_CONTEXT gcm;
+  /* Room for |aes_gcm_keystream_blocks| to round the last record up. */
+  alignas(16) uint8_t blocks[AES_GCM_BATCH_BLOCKS + AES_CTR_MIN_BLOCKS][16];
+
+  size_t i = 0;
+  while (i < num_records) {
+    size_t first = i;
+    size_t num_blocks = 0;
+    while (i < num_records) {
+      const AES_GCM_RECORD *record = &records[i];
+      assert(record->nonce != NULL);
+      assert(record->ad != NULL || record->ad_len == 0);
+      assert(record->in != NULL || record->in_out_len == 0);
+      assert(record->out != NULL || record->in_out_len == 0);
+      assert(aead_check_in_len(record->in_out_len));
+      assert(aead_check_alias(record->in, record->in_out_len, record->out));
+
+      size_t record_blocks = aes_gcm_record_blocks(record);
+      if (record->in_out_len > AES_GCM_BATCH_MAX_LEN ||
+          record_blocks > AES_GCM_BATCH_BLOCKS - num_blocks) {
+        break;
+      }
+      if (gcm_key->gcm_key.ecb != NULL) {
+        for (size_t j = 0; j < record_blocks; ++j) {
+          memcpy(blocks[num_blocks + j], record->nonce,
+                 EVP_AEAD_AES_GCM_NONCE_LEN);
+          to_be_u32_ptr(blocks[num_blocks + j] + 12, (uint32_t)(j + 1));
+        }
+      }
+      num_blocks += record_blocks;
+      ++i;
+    }
+
+    if (num_blocks == 0) {
+      /* |records[i]| is too long to be batched. */
+      const AES_GCM_RECORD *record = &records[i];
+      if (!gfp_aes_gcm_init_and_aad(&gcm, gcm_key, record->nonce, record->ad,
+                                    record->ad_len)) {
         return 0;
       }
+      if (is_seal) {
+        if (!gfp_aes_gcm_encrypt(&gcm, gcm_key, record->in, record->out,
+                                 record->in_out_len)) {
+          return 0;
+        }
+      } else {
+        if (!gfp_aes_gcm_decrypt(&gcm, gcm_key, record->in, record->out,
+                                 record->in_out_len)) {
+          return 0;
+        }
+      }
+      GFp_gcm128_tag(&gcm, record->tag_out);
+      ++i;
+      continue;
+    }
+
+    if (gcm_key->gcm_key.ecb != NULL) {
+      (*gcm_key->gcm_key.ecb)(blocks[0], blocks[0], num_blocks, &gcm_key->ks);
     } else {
-      if (!GFp_gcm128_decrypt(&gcm, &ks, in, out, in_out_len)) {
+      /* Each record has its own nonce, so without a multi-block ECB function
+       * the records' keystreams are generated one after another. A record
+       * rounded up to |AES_CTR_MIN_BLOCKS| overwrites the start of the next
+       * record's slice, which is generated afterwards. */
+      num_blocks = 0;
+      for (size_t r = first; r < i; ++r) {
+        aes_gcm_keystream_blocks(gcm_key, &blocks[num_blocks],
+                                 aes_gcm_record_blocks(&records[r]),
+                                 records[r].nonce);
+        num_blocks += aes_gcm_record_blocks(&records[r]);
+      }
+    }
+
+    num_blocks = 0;
+    for (size_t r = first; r < i; ++r) {
+      const AES_GCM_RECORD *record = &records[r];
+      GFp_gcm128_init_with_ek0(&gcm, &gcm_key->gcm_key, record->nonce,
+                               blocks[num_blocks]);
+      if (record->ad_len > 0 &&
+          !GFp_gcm128_aad(&gcm, record->ad, record->ad_len)) {
         return 0;
       }
+      if (is_seal) {
+        if (!GFp_gcm128_encrypt_keystream(&gcm, record->in, record->out,
+                                          record->in_out_len,
+                                          blocks[num_blocks + 1])) {
+          return 0;
+        }
+      } else {
+        if (!GFp_gcm128_decrypt_keystream(&gcm, record->in, record->out,
+                                          record->in_out_len,
+                                          blocks[num_blocks + 1])) {
+          return 0;
+        }
+      }
+      GFp_gcm128_tag(&gcm, record->tag_out);
+      num_blocks += aes_gcm_record_blocks(record);
+    }
+  }
+
+  return 1;
+}
+
+int GFp_aes_gcm_seal_batch(const void *ctx_buf,
+                           const AES_GCM_RECORD records[], size_t num_records) {
+  return gfp_aes_gcm_batch(ctx_buf, records, num_records, 1);
+}
+
+int GFp_aes_gcm_open_batch(const void *ctx_buf,
+                           const AES_GCM_RECORD records[], size_t num_records) {
+  return gfp_aes_gcm_batch(ctx_buf, records, num_records, 0);
+}
+
+/* AES_GCM_PRECOMPUTED_MAX_LEN is the length of the longest message whose
+ * keystream |GFp_aes_gcm_precompute| can compute ahead of time. */
+#define AES_GCM_PRECOMPUTED_MAX_LEN 256
+
+/* AES_GCM_PRECOMPUTED is the EK0 block and the keystream of one message,
+ * constructed by |GFp_aes_gcm_precompute| in the caller's |precomputed_buf|.
+ * When the nonces are known before the messages, e.g. because they are
+ * sequential, all of the AES work can be done before the message arrives and
+ * |GFp_aes_gcm_seal_precomputed| or |GFp_aes_gcm_open_precomputed| then only
+ * do the XOR and the GHASH. Like |AES_GCM_STREAM|, it refers to the key
+ * context rather than copying it, so the key context must outlive it. */
+typedef struct {
+  alignas(16) uint8_t blocks[1 + AES_GCM_PRECOMPUTED_MAX_LEN / 16][16];
+  const AES_GCM_KEY *key; /* NULL once the keystream has been used. */
+  uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN];
+  size_t max_in_out_len;
+} AES_GCM_PRECOMPUTED;
+
+const size_t GFp_AES_GCM_PRECOMPUTED_LEN = sizeof(AES_GCM_PRECOMPUTED);
+
+OPENSSL_COMPILE_ASSERT(1 + AES_GCM_PRECOMPUTED_MAX_LEN / 16 >=
+                           AES_CTR_MIN_BLOCKS,
+                       aes_gcm_precomputed_blocks_too_small);
+
+int GFp_aes_gcm_precompute(void *precomputed_buf, size_t precomputed_buf_len,
+                           const void *ctx_buf,
+                           const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                           size_t max_in_out_len) {
+  assert(precomputed_buf != NULL);
+  assert(((uintptr_t)precomputed_buf) % alignof(AES_GCM_PRECOMPUTED) == 0);
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(AES_GCM_KEY) == 0);
+  assert(nonce != NULL);
+  if (precomputed_buf_len < sizeof(AES_GCM_PRECOMPUTED) ||
+      max_in_out_len > AES_GCM_PRECOMPUTED_MAX_LEN) {
+    return 0;
+  }
+
+  AES_GCM_PRECOMPUTED *precomputed = precomputed_buf;
+  const AES_GCM_KEY *gcm_key = ctx_buf;
+  aes_gcm_keystream_blocks(gcm_key, precomputed->blocks,
+                           1 + (max_in_out_len + 15) / 16, nonce);
+  precomputed->key = gcm_key;
+  memcpy(precomputed->nonce, nonce, EVP_AEAD_AES_GCM_NONCE_LEN);
+  precomputed->max_in_out_len = max_in_out_len;
+  return 1;
+}
+
+/* gfp_aes_gcm_precomputed seals or opens one message of at most
+ * |precomputed->max_in_out_len| bytes with the keystream in |precomputed|,
+ * which is then cleared so that it can't be used for a second message. */
+static int gfp_aes_gcm_precomputed(AES_GCM_PRECOMPUTED *precomputed,
+                                   uint8_t *out, size_t in_out_len,
+                                   uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                                   const uint8_t *in, const uint8_t *ad,
+                                   size_t ad_len, int is_seal) {
+  assert(out != NULL || in_out_len == 0);
+  assert(aead_check_in_len(in_out_len));
+  assert(aead_check_alias(in, in_out_len, out));
+  assert(in != NULL || in_out_len == 0);
+  assert(ad != NULL || ad_len == 0);
+
+  const AES_GCM_KEY *gcm_key = precomputed->key;
+  if (gcm_key == NULL || in_out_len > precomputed->max_in_out_len) {
+    return 0;
+  }
+  precomputed->key = NULL;
+
+  GCM128_CONTEXT gcm;
+  int ok = 0;
+  GFp_gcm128_init_with_ek0(&gcm, &gcm_key->gcm_key, precomputed->nonce,
+                           precomputed->blocks[0]);
+  if (ad_len > 0 && !GFp_gcm128_aad(&gcm, ad, ad_len)) {
+    goto err;
+  }
+  if (is_seal) {
+    if (!GFp_gcm128_encrypt_keystream(&gcm, in, out, in_out_len,
+                                      precomputed->blocks[1])) {
+      goto err;
+    }
+  } else {
+    if (!GFp_gcm128_decrypt_keystream(&gcm, in, out, in_out_len,
+                                      precomputed->blocks[1])) {
+      goto err;
     }
   }
   GFp_gcm128_tag(&gcm, tag_out);
+  ok = 1;
+
+err:
+  memset(precomputed->blocks, 0, sizeof(precomputed->blocks));
+  return ok;
+}
+
+int GFp_aes_gcm_seal_precomputed(void *precomputed_buf, uint8_t *out,
+                                 size_t in_out_len,
+                                 uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                                 const uint8_t *in, const uint8_t *ad,
+                                 size_t ad_len) {
+  return gfp_aes_gcm_precomputed(precomputed_buf, out, in_out_len, tag_out,
+                                 in, ad, ad_len, 1);
+}
+
+int GFp_aes_gcm_open_precomputed(void *precomputed_buf, uint8_t *out,
+                                 size_t in_out_len,
+                                 uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                                 const uint8_t *in, const uint8_t *ad,
+                                 size_t ad_len) {
+  return gfp_aes_gcm_precomputed(precomputed_buf, out, in_out_len, tag_out,
+                                 in, ad, ad_len, 0);
+}
+
+
+/* AES-GCM-SIV (RFC 8452). */
+
+/* AES_GCM_SIV_KEY is the key context that |GFp_aes_gcm_siv_init| constructs in
+ * the caller's |ctx_buf|. It holds the key-generating key; the authentication
+ * and encryption keys are derived from it and the nonce for each message. */
+typedef struct {
+  AES_KEY ks;
+  const AES_IMPL *impl;
+  size_t key_len;
+} AES_GCM_SIV_KEY;
+
+/* AES_GCM_SIV_CTR_BLOCKS is the number of counter blocks that are encrypted
+ * together. The counter of AES-GCM-SIV is little-endian and in the first word
+ * of the block, so the CTR functions can't be used. Instead the counter
+ * blocks are built here and encrypted with the multi-block ECB function,
+ * which is why |GFp_aes_gcm_siv_init| uses the nohw implementation when
+ * |aes_impl| has none. */
+#define AES_GCM_SIV_CTR_BLOCKS 32
+
+int GFp_aes_gcm_siv_init(void *ctx_buf, size_t ctx_buf_len,
+                         const uint8_t *key, size_t key_len) {
+  aead_assert_init_preconditions(alignof(AES_GCM_SIV_KEY),
+                                 sizeof(AES_GCM_SIV_KEY), ctx_buf, ctx_buf_len,
+                                 key);
+  if (ctx_buf_len < sizeof(AES_GCM_SIV_KEY) ||
+      (key_len != 16 && key_len != 32)) {
+    return 0;
+  }
+
+  AES_GCM_SIV_KEY *siv_key = ctx_buf;
+  siv_key->impl = aes_impl->ecb != NULL ? aes_impl : &kAesImplNoHw;
+  (void)(siv_key->impl->set_key)(key, key_len * 8, &siv_key->ks);
+  siv_key->key_len = key_len;
+  return 1;
+}
+
+/* gfp_aes_gcm_siv_derive_keys derives the message authentication key, as a
+ * POLYVAL key, and the message encryption key for |nonce|. */
+static void gfp_aes_gcm_siv_derive_keys(
+    const AES_GCM_SIV_KEY *siv_key,
+    const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN], GCM128_KEY *auth_key,
+    AES_KEY *enc_ks) {
+  alignas(16) uint8_t in[6 * 16];
+  alignas(16) uint8_t out[6 * 16];
+  size_t blocks = siv_key->key_len == 16 ? 4 : 6;
+  for (size_t i = 0; i < blocks; ++i) {
+    to_le_u32_ptr(in + (i * 16), (uint32_t)i);
+    memcpy(in + (i * 16) + 4, nonce, EVP_AEAD_AES_GCM_NONCE_LEN);
+  }
+  (*siv_key->impl->ecb)(in, out, blocks, &siv_key->ks);
+
+  /* Only the first half of each output block is used. */
+  uint8_t keys[16 + 32];
+  for (size_t i = 0; i < blocks; ++i) {
+    memcpy(keys + (i * 8), out + (i * 16), 8);
+  }
+  GFp_polyval_init_key(auth_key, keys);
+  (void)(siv_key->impl->set_key)(keys + 16, (unsigned)siv_key->key_len * 8,
+                                 enc_ks);
+}
+
+static void gfp_aes_gcm_siv_tag(const AES_GCM_SIV_KEY *siv_key,
+                                const GCM128_KEY *auth_key,
+                                const AES_KEY *enc_ks,
+                                const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                                const uint8_t *ad, size_t ad_len,
+                                const uint8_t *plaintext, size_t len,
+                                uint8_t tag[EVP_AEAD_AES_GCM_TAG_LEN]) {
+  uint8_t lengths[16];
+  to_le_u64_ptr(lengths, (uint64_t)ad_len * 8);
+  to_le_u64_ptr(lengths + 8, (uint64_t)len * 8);
+
+  POLYVAL_CONTEXT polyval;
+  GFp_polyval_init(&polyval, auth_key);
+  GFp_polyval_update_padded(&polyval, ad, ad_len);
+  GFp_polyval_update_padded(&polyval, plaintext, len);
+  GFp_polyval_update_padded(&polyval, lengths, sizeof(lengths));
+
+  alignas(16) uint8_t S[16];
+  GFp_polyval_finish(&polyval, S);
+  for (size_t i = 0; i < EVP_AEAD_AES_GCM_NONCE_LEN; ++i) {
+    S[i] ^= nonce[i];
+  }
+  S[15] &= 0x7f;
+  (*siv_key->impl->block)(S, tag, enc_ks);
+}
+
+static void gfp_aes_gcm_siv_ctr(const AES_GCM_SIV_KEY *siv_key,
+                                const AES_KEY *enc_ks,
+                                const uint8_t tag[EVP_AEAD_AES_GCM_TAG_LEN],
+                                const uint8_t *in, uint8_t *out, size_t len) {
+  alignas(16) uint8_t counters[AES_GCM_SIV_CTR_BLOCKS * 16];
+  alignas(16) uint8_t keystream[AES_GCM_SIV_CTR_BLOCKS * 16];
+
+  uint8_t counter_block[16];
+  memcpy(counter_block, tag, 16);
+  counter_block[15] |= 0x80;
+  uint32_t counter = from_le_u32_ptr(counter_block);
+
+  while (len > 0) {
+    size_t todo = len < sizeof(keystream) ? len : sizeof(keystream);
+    size_t blocks = (todo + 15) / 16;
+    for (size_t i = 0; i < blocks; ++i) {
+      memcpy(counters + (i * 16), counter_block, 16);
+      to_le_u32_ptr(counters + (i * 16), counter);
+      ++counter;
+    }
+    (*siv_key->impl->ecb)(counters, keystream, blocks, enc_ks);
+    for (size_t i = 0; i < todo; ++i) {
+      out[i] = in[i] ^ keystream[i];
+    }
+    in += todo;
+    out += todo;
+    len -= todo;
+  }
+}
+
+/* aes_gcm_siv_check_len returns one if |len| is no more than the limit of
+ * 2^36 bytes that RFC 8452 places on the plaintext and on the AAD. */
+static int aes_gcm_siv_check_len(size_t len) {
+  /* See |aead_check_in_len| for why |len_64| is needed. */
+  const uint64_t len_64 = len;
+  return len_64 <= (UINT64_C(1) << 36);
+}
+
+int GFp_aes_gcm_siv_seal(const void *ctx_buf, uint8_t *in_out,
+                         size_t in_out_len,
+                         uint8_t tag_out[EVP_AEAD_AES_GCM_TAG_LEN],
+                         const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                         const uint8_t *ad, size_t ad_len) {
+  assert(in_out != NULL || in_out_len == 0);
+  assert(ad != NULL || ad_len == 0);
+
+  if (!aes_gcm_siv_check_len(in_out_len) || !aes_gcm_siv_check_len(ad_len)) {
+    return 0;
+  }
+
+  const AES_GCM_SIV_KEY *siv_key = ctx_buf;
+  GCM128_KEY auth_key;
+  AES_KEY enc_ks;
+  gfp_aes_gcm_siv_derive_keys(siv_key, nonce, &auth_key, &enc_ks);
+  gfp_aes_gcm_siv_tag(siv_key, &auth_key, &enc_ks, nonce, ad, ad_len, in_out,
+                      in_out_len, tag_out);
+  gfp_aes_gcm_siv_ctr(siv_key, &enc_ks, tag_out, in_out, in_out, in_out_len);
+  return 1;
+}
+
+/* GFp_aes_gcm_siv_open decrypts |in| to |out| and checks |tag|. Unlike
+ * |GFp_aes_gcm_open|, it has to check the tag itself, because the tag is an
+ * input to the decryption. If the tag is wrong, |out| is zeroed and zero is
+ * returned. */
+int GFp_aes_gcm_siv_open(const void *ctx_buf, uint8_t *out, size_t in_out_len,
+                         const uint8_t tag[EVP_AEAD_AES_GCM_TAG_LEN],
+                         const uint8_t nonce[EVP_AEAD_AES_GCM_NONCE_LEN],
+                         const uint8_t *in, const uint8_t *ad, size_t ad_len) {
+  assert(out != NULL || in_out_len == 0);
+  assert(in != NULL || in_out_len == 0);
+  assert(aead_check_alias(in, in_out_len, out));
+  assert(ad != NULL || ad_len == 0);
+
+  if (!aes_gcm_siv_check_len(in_out_len) || !aes_gcm_siv_check_len(ad_len)) {
+    return 0;
+  }
+
+  const AES_GCM_SIV_KEY *siv_key = ctx_buf;
+  GCM128_KEY auth_key;
+  AES_KEY enc_ks;
+  gfp_aes_gcm_siv_derive_keys(siv_key, nonce, &auth_key, &enc_ks);
+  gfp_aes_gcm_siv_ctr(siv_key, &enc_ks, tag, in, out, in_out_len);
+
+  uint8_t expected_tag[EVP_AEAD_AES_GCM_TAG_LEN];
+  gfp_aes_gcm_siv_tag(siv_key, &auth_key, &enc_ks, nonce, ad, ad_len, out,
+                      in_out_len, expected_tag);
+  if (GFp_memcmp(expected_tag, tag, sizeof(expected_tag)) != 0) {
+    if (in_out_len > 0) {
+      memset(out, 0, in_out_len);
+    }
+    return 0;
+  }
+  return 1;
+}
+
+
+/* AES-CTR. */
+
+/* AES_CTR_KEY is the key context that |GFp_aes_ctr_init| constructs in the
+ * caller's |ctx_buf|. */
+typedef struct {
+  AES_KEY ks;
+  const AES_IMPL *impl;
+} AES_CTR_KEY;
+
+const size_t GFp_AES_CTR_KEY_LEN = sizeof(AES_CTR_KEY);
+
+int GFp_aes_ctr_init(void *ctx_buf, size_t ctx_buf_len, const uint8_t *key,
+                     size_t key_len) {
+  aead_assert_init_preconditions(alignof(AES_CTR_KEY), sizeof(AES_CTR_KEY),
+                                 ctx_buf, ctx_buf_len, key);
+  if (ctx_buf_len < sizeof(AES_CTR_KEY) || (key_len != 16 && key_len != 32)) {
+    return 0;
+  }
+
+  AES_CTR_KEY *ctr_key = ctx_buf;
+  ctr_key->impl = aes_impl;
+  (void)(ctr_key->impl->set_key)(key, key_len * 8, &ctr_key->ks);
   return 1;
 }
 
+/* ctr96_inc increments the upper 96 bits of the big-endian |counter|. */
+static void ctr96_inc(uint8_t counter[16]) {
+  for (size_t i = 12; i > 0; --i) {
+    if (++counter[i - 1] != 0) {
+      return;
+    }
+  }
+}
+
+/* ctr128_inc increments the big-endian |counter|. */
+static void ctr128_inc(uint8_t counter[16]) {
+  uint32_t ctr32 = from_be_u32_ptr(counter + 12) + 1;
+  to_be_u32_ptr(counter + 12, ctr32);
+  if (ctr32 == 0) {
+    ctr96_inc(counter);
+  }
+}
+
+/* GFp_aes_ctr_encrypt XORs |len| bytes from |in| with the AES-CTR keystream
+ * starting at the big-endian 128-bit |counter| and writes the result to
+ * |out|, which may equal |in|. |counter| is advanced past every block that
+ * was used, including a final partial block, so consecutive calls with
+ * lengths that are multiples of 16 produce one continuous keystream. Unlike
+ * the |aes_ctr_f| functions, which only increment the low 32 bits, the
+ * counter carries across all 128 bits: the bulk function is called on runs
+ * of blocks that end where the low 32 bits wrap. */
+void GFp_aes_ctr_encrypt(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                         size_t len, uint8_t counter[16]) {
+  assert(ctx_buf != NULL);
+  assert(in != NULL || len == 0);
+  assert(out != NULL || len == 0);
+  assert(aead_check_alias(in, len, out));
+
+  const AES_CTR_KEY *ctr_key = ctx_buf;
+  const AES_IMPL *impl = ctr_key->impl;
+
+  size_t blocks = len / 16;
+  if (impl->ctr != NULL) {
+    while (blocks > 0) {
+      uint32_t ctr32 = from_be_u32_ptr(counter + 12);
+      /* The number of blocks before the low 32 bits wrap, 2^32 - |ctr32|. */
+      uint64_t until_wrap = (UINT64_C(1) << 32) - ctr32;
+      size_t todo = blocks;
+      if ((uint64_t)todo > until_wrap) {
+        todo = (size_t)until_wrap;
+      }
+      (*impl->ctr)(in, out, todo, &ctr_key->ks, counter);
+      ctr32 += (uint32_t)todo;
+      to_be_u32_ptr(counter + 12, ctr32);
+      if (ctr32 == 0) {
+        ctr96_inc(counter);
+      }
+      in += todo * 16;
+      out += todo * 16;
+      blocks -= todo;
+    }
+  } else {
+    for (; blocks > 0; --blocks) {
+      alignas(16) uint8_t keystream[16];
+      (*impl->block)(counter, keystream, &ctr_key->ks);
+      for (size_t i = 0; i < 16; ++i) {
+        out[i] = in[i] ^ keystream[i];
+      }
+      ctr128_inc(counter);
+      in += 16;
+      out += 16;
+    }
+  }
+
+  len &= 15;
+  if (len != 0) {
+    alignas(16) uint8_t keystream[16];
+    (*impl->block)(counter, keystream, &ctr_key->ks);
+    for (size_t i = 0; i < len; ++i) {
+      out[i] = in[i] ^ keystream[i];
+    }
+    ctr128_inc(counter);
+  }
+}
+
+/* GFp_aes_ctr_keystream writes |len| bytes of the AES-CTR keystream starting
+ * at |counter| to |out|, advancing |counter| like |GFp_aes_ctr_encrypt|. */
+void GFp_aes_ctr_keystream(const void *ctx_buf, uint8_t *out, size_t len,
+                           uint8_t counter[16]) {
+  if (len == 0) {
+    return;
+  }
+  memset(out, 0, len);
+  GFp_aes_ctr_encrypt(ctx_buf, out, out, len, counter);
+}
+
+
+/* QUIC header protection (RFC 9001, Section 5.4.3). */
+
+#define AES_HP_BATCH_BLOCKS 32
+#define AES_HP_MASK_LEN 5
+
+/* GFp_aes_hp_masks computes the QUIC header protection masks of |num|
+ * packets. |ctx_bufs[i]| is a context that |GFp_aes_ctr_init| constructed
+ * from the header protection key of packet |i| and |samples + 16 * i| is its
+ * sample. The five-byte mask of packet |i| is written to |masks + 5 * i|.
+ *
+ * The AES kernels take one key schedule per call, so consecutive packets
+ * under the same context are encrypted together, |AES_HP_BATCH_BLOCKS| at a
+ * time, through the multi-block ECB function. Callers get the most out of
+ * this by grouping the packets of each connection.
+ *
+ * Without an ECB function but with a CTR function, i.e. bsaes or aesv8, each
+ * sample is encrypted as the first counter block of a CTR run of
+ * |AES_CTR_MIN_BLOCKS| zero blocks. The single-block function of bsaes is
+ * the table-based |GFp_AES_encrypt|, which would leak the header protection
+ * key through cache timing. */
+void GFp_aes_hp_masks(const void *const ctx_bufs[], const uint8_t *samples,
+                      uint8_t *masks, size_t num) {
+  assert(ctx_bufs != NULL || num == 0);
+  assert(samples != NULL || num == 0);
+  assert(masks != NULL || num == 0);
+
+  alignas(16) uint8_t blocks[AES_HP_BATCH_BLOCKS * 16];
+  size_t i = 0;
+  while (i < num) {
+    const AES_CTR_KEY *ctr_key = ctx_bufs[i];
+    size_t todo = 1;
+    while (i + todo < num && todo < AES_HP_BATCH_BLOCKS &&
+           ctx_bufs[i + todo] == ctx_bufs[i]) {
+      ++todo;
+    }
+
+    const uint8_t *in = samples + (16 * i);
+    if (ctr_key->impl->ecb != NULL) {
+      (*ctr_key->impl->ecb)(in, blocks, todo, &ctr_key->ks);
+    } else if (ctr_key->impl->ctr != NULL) {
+      alignas(16) uint8_t keystream[AES_CTR_MIN_BLOCKS * 16];
+      for (size_t j = 0; j < todo; ++j) {
+        alignas(16) uint8_t counter[16];
+        memcpy(counter, in + (16 * j), 16);
+        memset(keystream, 0, sizeof(keystream));
+        (*ctr_key->impl->ctr)(keystream, keystream, AES_CTR_MIN_BLOCKS,
+                              &ctr_key->ks, counter);
+        memcpy(blocks + (16 * j), keystream, 16);
+      }
+    } else {
+      for (size_t j = 0; j < todo; ++j) {
+        (*ctr_key->impl->block)(in + (16 * j), blocks + (16 * j),
+                                &ctr_key->ks);
+      }
+    }
+    for (size_t j = 0; j < todo; ++j) {
+      memcpy(masks + (AES_HP_MASK_LEN * (i + j)), blocks + (16 * j),
+             AES_HP_MASK_LEN);
+    }
+    i += todo;
+  }
+}
+
+
+/* AES-XTS (IEEE 1619). */
+
+/* AES_XTS_KEY is the key context that |GFp_aes_xts_init| constructs in the
+ * caller's |ctx_buf|. The first half of the key encrypts the data and the
+ * second half encrypts the tweak. |impl| is |aes_impl| if it has multi-block
+ * ECB encryption and decryption, and the nohw implementation otherwise, for
+ * all three key schedules: the single-block fallback of the other
+ * implementations may be the table-based |GFp_AES_encrypt|. */
+typedef struct {
+  AES_KEY data_ks;
+  AES_KEY data_dec_ks;
+  AES_KEY tweak_ks;
+  const AES_IMPL *impl;
+} AES_XTS_KEY;
+
+const size_t GFp_AES_XTS_KEY_LEN = sizeof(AES_XTS_KEY);
+
+/* AES_XTS_BATCH_BLOCKS is the number of blocks that are XORed with their
+ * tweaks and then encrypted or decrypted in one call to the ECB function. */
+#define AES_XTS_BATCH_BLOCKS 32
+
+/* AES_XTS_MAX_BLOCKS is the limit of IEEE 1619 on the length of one data
+ * unit, in blocks. */
+#define AES_XTS_MAX_BLOCKS (1 << 20)
+
+int GFp_aes_xts_init(void *ctx_buf, size_t ctx_buf_len, const uint8_t *key,
+                     size_t key_len) {
+  aead_assert_init_preconditions(alignof(AES_XTS_KEY), sizeof(AES_XTS_KEY),
+                                 ctx_buf, ctx_buf_len, key);
+  if (ctx_buf_len < sizeof(AES_XTS_KEY) || (key_len != 32 && key_len != 64)) {
+    return 0;
+  }
+  size_t half = key_len / 2;
+  /* IEEE 1619 requires the two keys to differ. */
+  if (GFp_memcmp(key, key + half, half) == 0) {
+    return 0;
+  }
+
+  AES_XTS_KEY *xts_key = ctx_buf;
+  xts_key->impl = aes_impl->ecb != NULL && aes_impl->ecb_decrypt != NULL
+                      ? aes_impl
+                      : &kAesImplNoHw;
+  (void)(xts_key->impl->set_key)(key, half * 8, &xts_key->data_ks);
+  (void)(xts_key->impl->set_decrypt_key)(key, half * 8,
+                                         &xts_key->data_dec_ks);
+  (void)(xts_key->impl->set_key)(key + half, half * 8, &xts_key->tweak_ks);
+  return 1;
+}
+
+/* xts_double multiplies the tweak |t|, as a little-endian 128-bit number, by
+ * x in GF(2^128). */
+static inline void xts_double(uint64_t t[2]) {
+  uint64_t carry = t[1] >> 63;
+  t[1] = (t[1] << 1) | (t[0] >> 63);
+  t[0] = (t[0] << 1) ^ ((0 - carry) & 0x87);
+}
+
+static inline void xts_xor_tweak(uint8_t out[16], const uint8_t in[16],
+                                 const uint64_t t[2]) {
+  to_le_u64_ptr(out, from_le_u64_ptr(in) ^ t[0]);
+  to_le_u64_ptr(out + 8, from_le_u64_ptr(in + 8) ^ t[1]);
+}
+
+/* xts_ecb encrypts or decrypts |blocks| blocks of |in| with the data key. */
+static void xts_ecb(const AES_XTS_KEY *xts_key, const uint8_t *in,
+                    uint8_t *out, size_t blocks, int is_encrypt) {
+  if (is_encrypt) {
+    (*xts_key->impl->ecb)(in, out, blocks, &xts_key->data_ks);
+  } else {
+    (*xts_key->impl->ecb_decrypt)(in, out, blocks, &xts_key->data_dec_ks);
+  }
+}
+
+/* gfp_aes_xts_crypt encrypts or decrypts one data unit of |len| bytes, which
+ * must be at least one block, with the encrypted tweak |t|. All the tweaks
+ * of a batch are computed first, so that the blocks can go through the ECB
+ * function together; a final partial block is handled with ciphertext
+ * stealing. */
+static void gfp_aes_xts_crypt(const AES_XTS_KEY *xts_key, const uint8_t *in,
+                              uint8_t *out, size_t len, uint64_t t[2],
+                              int is_encrypt) {
+  alignas(16) uint8_t buf[AES_XTS_BATCH_BLOCKS * 16];
+  uint64_t tweaks[AES_XTS_BATCH_BLOCKS][2];
+
+  assert(len >= 16);
+  size_t tail = len % 16;
+  /* With a partial block, the last full block is stolen from below. */
+  size_t blocks = len / 16 - (tail != 0 ? 1 : 0);
+
+  while (blocks > 0) {
+    size_t todo = blocks < AES_XTS_BATCH_BLOCKS ? blocks
+                                                : AES_XTS_BATCH_BLOCKS;
+    for (size_t i = 0; i < todo; ++i) {
+      tweaks[i][0] = t[0];
+      tweaks[i][1] = t[1];
+      xts_xor_tweak(buf + (i * 16), in + (i * 16), t);
+      xts_double(t);
+    }
+    xts_ecb(xts_key, buf, buf, todo, is_encrypt);
+    for (size_t i = 0; i < todo; ++i) {
+      xts_xor_tweak(out + (i * 16), buf + (i * 16), tweaks[i]);
+    }
+    in += todo * 16;
+    out += todo * 16;
+    blocks -= todo;
+  }
+
+  if (tail == 0) {
+    return;
+  }
+
+  /* Ciphertext stealing. When encrypting, the last full block is processed
+   * with the current tweak and the partial block with the next one; when
+   * decrypting, it is the other way around. */
+  uint64_t t_next[2] = { t[0], t[1] };
+  xts_double(t_next);
+  const uint64_t *t_first = is_encrypt ? t : t_next;
+  const uint64_t *t_second = is_encrypt ? t_next : t;
+
+  alignas(16) uint8_t block[16];
+  uint8_t last[16];
+  memcpy(last, in + 16, tail);
+  xts_xor_tweak(block, in, t_first);
+  xts_ecb(xts_key, block, block, 1, is_encrypt);
+  xts_xor_tweak(block, block, t_first);
+  memcpy(out + 16, block, tail);
+  memcpy(block, last, tail);
+  xts_xor_tweak(block, block, t_second);
+  xts_ecb(xts_key, block, block, 1, is_encrypt);
+  xts_xor_tweak(out, block, t_second);
+}
+
+static int gfp_aes_xts(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                       size_t len, const uint8_t tweak[16], int is_encrypt) {
+  assert(ctx_buf != NULL);
+  assert(in != NULL || len == 0);
+  assert(out != NULL || len == 0);
+  assert(aead_check_alias(in, len, out));
+  assert(tweak != NULL);
+  if (len < 16 || len / 16 > AES_XTS_MAX_BLOCKS) {
+    return 0;
+  }
+
+  const AES_XTS_KEY *xts_key = ctx_buf;
+  alignas(16) uint8_t encrypted_tweak[16];
+  (*xts_key->impl->ecb)(tweak, encrypted_tweak, 1, &xts_key->tweak_ks);
+  uint64_t t[2] = { from_le_u64_ptr(encrypted_tweak),
+                    from_le_u64_ptr(encrypted_tweak + 8) };
+  gfp_aes_xts_crypt(xts_key, in, out, len, t, is_encrypt);
+  return 1;
+}
+
+/* GFp_aes_xts_encrypt encrypts one data unit of |len| bytes, at least 16,
+ * from |in| to |out|, which may equal |in|. |tweak| is the unencrypted
+ * tweak, e.g. the little-endian sector number. */
+int GFp_aes_xts_encrypt(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                        size_t len, const uint8_t tweak[16]) {
+  return gfp_aes_xts(ctx_buf, in, out, len, tweak, 1);
+}
+
+int GFp_aes_xts_decrypt(const void *ctx_buf, const uint8_t *in, uint8_t *out,
+                        size_t len, const uint8_t tweak[16]) {
+  return gfp_aes_xts(ctx_buf, in, out, len, tweak, 0);
+}
+
+static int gfp_aes_xts_sectors(const void *ctx_buf, const uint8_t *in,
+                               uint8_t *out, size_t sector_len,
+                               size_t num_sectors, uint64_t first_sector,
+                               int is_encrypt) {
+  assert(ctx_buf != NULL);
+  assert(in != NULL || num_sectors == 0);
+  assert(out != NULL || num_sectors == 0);
+  if (sector_len < 16 || sector_len / 16 > AES_XTS_MAX_BLOCKS) {
+    return 0;
+  }
+  assert(aead_check_alias(in, sector_len * num_sectors, out));
+
+  const AES_XTS_KEY *xts_key = ctx_buf;
+  alignas(16) uint8_t tweaks[AES_XTS_BATCH_BLOCKS * 16];
+  uint64_t sector = first_sector;
+
+  while (num_sectors > 0) {
+    size_t todo = num_sectors < AES_XTS_BATCH_BLOCKS ? num_sectors
+                                                     : AES_XTS_BATCH_BLOCKS;
+    /* The tweaks of a batch of sectors are encrypted together too. */
+    for (size_t i = 0; i < todo; ++i) {
+      to_le_u64_ptr(tweaks + (i * 16), sector + i);
+      to_le_u64_ptr(tweaks + (i * 16) + 8, 0);
+    }
+    (*xts_key->impl->ecb)(tweaks, tweaks, todo, &xts_key->tweak_ks);
+    for (size_t i = 0; i < todo; ++i) {
+      uint64_t t[2] = { from_le_u64_ptr(tweaks + (i * 16)),
+                        from_le_u64_ptr(tweaks + (i * 16) + 8) };
+      gfp_aes_xts_crypt(xts_key, in, out, sector_len, t, is_encrypt);
+      in += sector_len;
+      out += sector_len;
+    }
+    sector += todo;
+    num_sectors -= todo;
+  }
+  return 1;
+}
+
+/* GFp_aes_xts_encrypt_sectors encrypts |num_sectors| consecutive sectors of
+ * |sector_len| bytes each, whose tweaks are the little-endian sector numbers
+ * starting at |first_sector|. */
+int GFp_aes_xts_encrypt_sectors(const void *ctx_buf, const uint8_t *in,
+                                uint8_t *out, size_t sector_len,
+                                size_t num_sectors, uint64_t first_sector) {
+  return gfp_aes_xts_sectors(ctx_buf, in, out, sector_len, num_sectors,
+                             first_sector, 1);
+}
+
+int GFp_aes_xts_decrypt_sectors(const void *ctx_buf, const uint8_t *in,
+                                uint8_t *out, size_t sector_len,
+                                size_t num_sectors, uint64_t first_sector) {
+  return gfp_aes_xts_sectors(ctx_buf, in, out, sector_len, num_sectors,
+                             first_sector, 0);
+}
+
 
 int GFp_has_aes_hardware(void) {
 #if defined(AESNI)
-  return aesni_capable() && GFp_gcm_clmul_enabled();
+  return aes_impl == &kAesImplAesni && GFp_gcm_clmul_enabled();
 #elif defined(HWAES)
-  return hwaes_capable() && GFp_is_ARMv8_PMULL_capable();
+  return aes_impl == &kAesImplHw && GFp_is_ARMv8_PMULL_capable();
 #else
   return 0;
 #endif
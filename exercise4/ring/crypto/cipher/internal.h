@@ -75,6 +75,32 @@ extern "C" {
 #endif
 
 
+/* GFp_aes_dispatch_setup chooses the AES implementation for this CPU. It is
+ * called once, by |GFp_dispatch_setup|. */
+void GFp_aes_dispatch_setup(void);
+
+/* GFp_aes_impl_name returns the name of the chosen AES implementation. */
+const char *GFp_aes_impl_name(void);
+
+/* GFp_aes_gcm_impl_name returns "aesni-sse4.1" if AES-GCM computes CTR and
+ * GHASH together, with the stitched SSE4.1 code, and "separate" if it makes
+ * separate passes with the chosen AES and GHASH implementations. */
+const char *GFp_aes_gcm_impl_name(void);
+
+
+/* AEAD_SEGMENT and AEAD_CONST_SEGMENT are one (pointer, length) element of a
+ * scatter-gather list, for output and for input respectively. */
+typedef struct {
+  uint8_t *base;
+  size_t len;
+} AEAD_SEGMENT;
+
+typedef struct {
+  const uint8_t *base;
+  size_t len;
+} AEAD_CONST_SEGMENT;
+
+
 /* Preconditions for AEAD implementation methods. */
 
 /* aead_check_alias returns 0 if |out| points within the buffer determined by
@@ -17,6 +17,9 @@
 #include <openssl/cpu.h>
 
 #include "internal.h"
+#include "cipher/internal.h"
+#include "modes/internal.h"
+#include "poly1305/internal.h"
 
 
 #if !defined(OPENSSL_NO_ASM) && !defined(OPENSSL_STATIC_ARMCAP) && \
@@ -77,6 +80,109 @@ uint32_t GFp_armcap_P = 0;
 
 #endif
 
+/* The implementations of ChaCha20, Poly1305, P-256 and Montgomery
+ * multiplication are chosen inside the assembly code, from the same
+ * capability bits that are tested here; these functions only describe those
+ * choices. The MULX/ADX code paths in the x86-64 P-256 and Montgomery
+ * assembly are disabled with |$addx = 0|, so the MULQ code is always used
+ * there. */
+
+static const char *chacha20_impl_name(void) {
+#if defined(OPENSSL_NO_ASM)
+  return "c";
+#elif defined(OPENSSL_X86_64)
+  if ((GFp_ia32cap_P[1] & (1 << (41 - 32))) == 0) { /* SSSE3 */
+    return "x86_64";
+  }
+  return (GFp_ia32cap_P[2] & (1 << 5)) ? "avx2" : "ssse3";
+#elif defined(OPENSSL_X86)
+  return (GFp_ia32cap_P[1] & (1 << (41 - 32))) ? "ssse3" : "x86";
+#elif defined(OPENSSL_ARM)
+  return GFp_is_NEON_capable() ? "neon" : "armv4";
+#elif defined(OPENSSL_AARCH64)
+  return GFp_is_NEON_capable() ? "neon" : "armv8";
+#else
+  return "c";
+#endif
+}
+
+static const char *poly1305_impl_name(void) {
+#if defined(OPENSSL_NO_ASM)
+  return "c";
+#elif defined(OPENSSL_X86_64)
+  if (GFp_ia32cap_P[2] & (1 << 5)) {
+    return "avx2";
+  }
+  return (GFp_ia32cap_P[1] & (1 << 28)) ? "avx" : "x86_64";
+#elif defined(OPENSSL_X86)
+  if ((GFp_ia32cap_P[0] & ((1 << 26) | (1 << 24))) !=
+      ((1 << 26) | (1 << 24))) { /* SSE2 and FXSR */
+    return "x86";
+  }
+  return (GFp_ia32cap_P[2] & (1 << 5)) ? "avx2" : "sse2";
+#elif defined(OPENSSL_ARM)
+  return GFp_is_NEON_capable() ? "neon" : "armv4";
+#elif defined(OPENSSL_AARCH64)
+  return GFp_is_NEON_capable() ? "neon" : "armv8";
+#else
+  return "c";
+#endif
+}
+
+static const char *p256_impl_name(void) {
+#if defined(OPENSSL_NO_ASM)
+  return "c";
+#elif defined(OPENSSL_X86_64)
+  return "mulq";
+#elif defined(OPENSSL_X86)
+  if ((GFp_ia32cap_P[0] & ((1 << 26) | (1 << 24))) !=
+      ((1 << 26) | (1 << 24))) { /* SSE2 and FXSR */
+    return "x86";
+  }
+  return "sse2";
+#elif defined(OPENSSL_ARM)
+  return "armv4";
+#elif defined(OPENSSL_AARCH64)
+  return "armv8";
+#else
+  return "c";
+#endif
+}
+
+static const char *bn_mul_mont_impl_name(void) {
+#if defined(OPENSSL_NO_ASM)
+  return "c";
+#elif defined(OPENSSL_X86_64)
+  return "mulq";
+#elif defined(OPENSSL_X86)
+  return (GFp_ia32cap_P[0] & (1 << 26)) ? "sse2" : "x86"; /* SSE2 */
+#elif defined(OPENSSL_ARM)
+  return GFp_is_NEON_capable() ? "neon" : "armv4";
+#elif defined(OPENSSL_AARCH64)
+  return "armv8";
+#else
+  return "c";
+#endif
+}
+
+void GFp_dispatch_setup(void) {
+  GFp_aes_dispatch_setup();
+  GFp_gcm128_dispatch_setup();
+  GFp_chacha20_dispatch_setup();
+  GFp_poly1305_dispatch_setup();
+}
+
+void GFp_implementation_names(IMPLEMENTATION_NAMES *out) {
+  out->aes = GFp_aes_impl_name();
+  out->ghash = GFp_gcm128_impl_name();
+  out->aes_gcm = GFp_aes_gcm_impl_name();
+  out->chacha20 = chacha20_impl_name();
+  out->poly1305 = poly1305_impl_name();
+  out->p256 = p256_impl_name();
+  out->bn_mul_mont = bn_mul_mont_impl_name();
+}
+
+
 /* These allow tests in other languages to verify that their understanding of
  * the C types matches the C compiler's understanding. */
 
@@ -961,18 +961,6 @@ static void fe_pow22523(fe out, const fe z) {
   fe_mul(out, t0, z);
 }
 
-static void x25519_ge_tobytes(uint8_t *s, const ge_p2 *h) {
-  fe recip;
-  fe x;
-  fe y;
-
-  fe_invert(recip, h->Z);
-  fe_mul(x, h->X, recip);
-  fe_mul(y, h->Y, recip);
-  fe_tobytes(s, y);
-  s[31] ^= fe_isnegative(x) << 7;
-}
-
 static void ge_p3_tobytes(uint8_t *s, const ge_p3 *h) {
   fe recip;
   fe x;
@@ -3539,10 +3527,13 @@ static void x25519_ge_scalarmult_base(ge_p3 *h, const uint8_t *a) {
 
 #endif
 
-static void slide(signed char *r, const uint8_t *a) {
+/* slide writes the width-|width| NAF of |a| to |r|: each nonzero digit is odd
+ * and in [-(2^(width - 1) - 1), 2^(width - 1) - 1]. */
+static void slide(signed char *r, const uint8_t *a, int width) {
   int i;
   int b;
   int k;
+  int max = (1 << (width - 1)) - 1;
 
   for (i = 0; i < 256; ++i) {
     r[i] = 1 & (a[i >> 3] >> (i & 7));
@@ -3550,12 +3541,12 @@ static void slide(signed char *r, const uint8_t *a) {
 
   for (i = 0; i < 256; ++i) {
     if (r[i]) {
-      for (b = 1; b <= 6 && i + b < 256; ++b) {
+      for (b = 1; b <= width + 1 && i + b < 256; ++b) {
         if (r[i + b]) {
-          if (r[i] + (r[i + b] << b) <= 15) {
+          if (r[i] + (r[i + b] << b) <= max) {
             r[i] += r[i + b] << b;
             r[i + b] = 0;
-          } else if (r[i] - (r[i + b] << b) >= -15) {
+          } else if (r[i] - (r[i + b] << b) >= -max) {
             r[i] -= r[i + b] << b;
             for (k = i + b; k < 256; ++k) {
               if (!r[k]) {
@@ -3640,58 +3631,55 @@ static const ge_precomp Bi[8] = {
     },
 };
 
+/* ge_odd_multiples sets |Ai| to A, 3A, 5A, ..., (2 * |num| - 1)A. */
+static void ge_odd_multiples(ge_cached *Ai, size_t num, const ge_p3 *A) {
+  ge_p1p1 t;
+  ge_p3 u;
+  ge_p3 A2;
+
+  x25519_ge_p3_to_cached(&Ai[0], A);
+  ge_p3_dbl(&t, A);
+  x25519_ge_p1p1_to_p3(&A2, &t);
+  for (size_t i = 1; i < num; ++i) {
+    x25519_ge_add(&t, &A2, &Ai[i - 1]);
+    x25519_ge_p1p1_to_p3(&u, &t);
+    x25519_ge_p3_to_cached(&Ai[i], &u);
+  }
+}
+
 /* r = a * A + b * B
  * where a = a[0]+256*a[1]+...+256^31 a[31].
  * and b = b[0]+256*b[1]+...+256^31 b[31].
- * B is the Ed25519 base point (x,4/5) with x positive. */
-static void ge_double_scalarmult_vartime(ge_p2 *r, const uint8_t *a,
-                                         const ge_p3 *A, const uint8_t *b) {
+ * B is the Ed25519 base point (x,4/5) with x positive.
+ * |Ai| holds the odd multiples of A from |ge_odd_multiples|, 2^(a_width - 2)
+ * of them. */
+static void ge_double_scalarmult_vartime(ge_p3 *r, const uint8_t *a,
+                                         const ge_cached *Ai, int a_width,
+                                         const uint8_t *b) {
   signed char aslide[256];
   signed char bslide[256];
-  ge_cached Ai[8]; /* A,3A,5A,7A,9A,11A,13A,15A */
   ge_p1p1 t;
+  ge_p2 r2;
   ge_p3 u;
-  ge_p3 A2;
   int i;
 
-  slide(aslide, a);
-  slide(bslide, b);
+  slide(aslide, a, a_width);
+  slide(bslide, b, 5);
 
-  x25519_ge_p3_to_cached(&Ai[0], A);
-  ge_p3_dbl(&t, A);
-  x25519_ge_p1p1_to_p3(&A2, &t);
-  x25519_ge_add(&t, &A2, &Ai[0]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[1], &u);
-  x25519_ge_add(&t, &A2, &Ai[1]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[2], &u);
-  x25519_ge_add(&t, &A2, &Ai[2]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[3], &u);
-  x25519_ge_add(&t, &A2, &Ai[3]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[4], &u);
-  x25519_ge_add(&t, &A2, &Ai[4]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[5], &u);
-  x25519_ge_add(&t, &A2, &Ai[5]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[6], &u);
-  x25519_ge_add(&t, &A2, &Ai[6]);
-  x25519_ge_p1p1_to_p3(&u, &t);
-  x25519_ge_p3_to_cached(&Ai[7], &u);
-
-  ge_p2_0(r);
+  ge_p3_0(r);
 
   for (i = 255; i >= 0; --i) {
     if (aslide[i] || bslide[i]) {
       break;
     }
   }
+  if (i < 0) {
+    return;
+  }
 
+  ge_p2_0(&r2);
   for (; i >= 0; --i) {
-    ge_p2_dbl(&t, r);
+    ge_p2_dbl(&t, &r2);
 
     if (aslide[i] > 0) {
       x25519_ge_p1p1_to_p3(&u, &t);
@@ -3709,8 +3697,9 @@ static void ge_double_scalarmult_vartime(ge_p2 *r, const uint8_t *a,
       ge_msub(&t, &u, &Bi[(-bslide[i]) / 2]);
     }
 
-    x25519_ge_p1p1_to_p2(r, &t);
+    x25519_ge_p1p1_to_p2(&r2, &t);
   }
+  x25519_ge_p1p1_to_p3(r, &t);
 }
 
 /* The set of scalars is \Z/l
@@ -4553,6 +4542,19 @@ void GFp_ed25519_sign(uint8_t *out_sig, const uint8_t *message,
 int GFp_ed25519_verify(const uint8_t *message, size_t message_len,
                        const uint8_t signature[64],
                        const uint8_t public_key[32]);
+int GFp_ed25519_prepare_public_key(void *ctx_buf, size_t ctx_buf_len,
+                                   const uint8_t public_key[32]);
+int GFp_ed25519_verify_prepared(const uint8_t *message, size_t message_len,
+                                const uint8_t signature[64],
+                                const void *ctx_buf);
+size_t GFp_ed25519_verify_batch_scratch_len(size_t num);
+int GFp_ed25519_verify_batch(uint8_t *out_valid, uint8_t *scratch,
+                             size_t scratch_len,
+                             const uint8_t *const messages[],
+                             const size_t message_lens[],
+                             const uint8_t *const signatures[],
+                             const uint8_t *const public_keys[],
+                             const uint8_t *weights, size_t num);
 
 
 void GFp_ed25519_public_from_private(uint8_t out[32], const uint8_t in[32]) {
@@ -4594,20 +4596,55 @@ void GFp_ed25519_sign(uint8_t *out_sig, const uint8_t *message,
   sc_muladd(out_sig + 32, hram, az, nonce);
 }
 
-int GFp_ed25519_verify(const uint8_t *message, size_t message_len,
-                       const uint8_t signature[64],
-                       const uint8_t public_key[32]) {
-  ge_p3 A;
-  if ((signature[63] & 224) != 0 ||
-      x25519_ge_frombytes_vartime(&A, public_key) != 0) {
+/* ed25519_is_canonical_point returns one if |s| is the canonical encoding of
+ * |p|, which was decoded from it. */
+static int ed25519_is_canonical_point(const uint8_t s[32], const ge_p3 *p) {
+  /* y >= 2^255 - 19. */
+  if ((s[31] & 0x7f) == 0x7f && s[0] >= 0xed) {
+    size_t i;
+    for (i = 1; i < 31; ++i) {
+      if (s[i] != 0xff) {
+        break;
+      }
+    }
+    if (i == 31) {
+      return 0;
+    }
+  }
+  /* The sign bit is set but x is zero. */
+  if ((s[31] >> 7) != 0 && !fe_isnonzero(p->X)) {
     return 0;
   }
+  return 1;
+}
 
-  fe_neg(A.X, A.X);
-  fe_neg(A.T, A.T);
+/* ed25519_is_identity returns one if (|X| : |Y| : |Z|) is the identity. */
+static int ed25519_is_identity(const fe X, const fe Y, const fe Z) {
+  fe y_minus_z;
+  fe_sub(y_minus_z, Y, Z);
+  return !fe_isnonzero(X) && !fe_isnonzero(y_minus_z);
+}
+
+/* ed25519_is_small_order returns one if 8 * |p| is the identity. */
+static int ed25519_is_small_order(const ge_p3 *p) {
+  ge_p1p1 t;
+  ge_p2 p2;
+  ge_p3_dbl(&t, p);
+  x25519_ge_p1p1_to_p2(&p2, &t);
+  ge_p2_dbl(&t, &p2);
+  x25519_ge_p1p1_to_p2(&p2, &t);
+  ge_p2_dbl(&t, &p2);
+  x25519_ge_p1p1_to_p2(&p2, &t);
+  return ed25519_is_identity(p2.X, p2.Y, p2.Z);
+}
 
-  uint8_t pkcopy[32];
-  memcpy(pkcopy, public_key, 32);
+/* ed25519_verify_table verifies |signature| given the odd multiples of -A,
+ * where A is |public_key|, in |Ai|. It accepts only when s * B - h * A
+ * encodes to R, without multiplying by the cofactor. */
+static int ed25519_verify_table(const uint8_t *message, size_t message_len,
+                                const uint8_t signature[64],
+                                const uint8_t public_key[32],
+                                const ge_cached *Ai, int a_width) {
   uint8_t rcopy[32];
   memcpy(rcopy, signature, 32);
   uint8_t scopy[32];
@@ -4619,15 +4656,361 @@ int GFp_ed25519_verify(const uint8_t *message, size_t message_len,
 
   x25519_sc_reduce(h);
 
-  ge_p2 R;
-  ge_double_scalarmult_vartime(&R, h, &A, scopy);
+  ge_p3 R;
+  ge_double_scalarmult_vartime(&R, h, Ai, a_width, scopy);
 
   uint8_t rcheck[32];
-  x25519_ge_tobytes(rcheck, &R);
+  ge_p3_tobytes(rcheck, &R);
 
   return GFp_memcmp(rcheck, rcopy, sizeof(rcheck)) == 0;
 }
 
+int GFp_ed25519_verify(const uint8_t *message, size_t message_len,
+                       const uint8_t signature[64],
+                       const uint8_t public_key[32]) {
+  ge_p3 A;
+  if ((signature[63] & 224) != 0 ||
+      x25519_ge_frombytes_vartime(&A, public_key) != 0) {
+    return 0;
+  }
+
+  fe_neg(A.X, A.X);
+  fe_neg(A.T, A.T);
+
+  ge_cached Ai[8]; /* -A,-3A,-5A,-7A,-9A,-11A,-13A,-15A */
+  ge_odd_multiples(Ai, 8, &A);
+  return ed25519_verify_table(message, message_len, signature, public_key, Ai,
+                              5);
+}
+
+/* Prepared public keys.
+ *
+ * |GFp_ed25519_verify| decompresses the public key, which costs a square root,
+ * and builds a table of eight odd multiples of it for every signature. A
+ * verifier that checks many signatures under the same few keys can instead
+ * keep an |ED25519_PREPARED_PUBLIC_KEY| for each, which holds a wider table
+ * of the decompressed point. That saves the decompression, the table and
+ * about a quarter of the additions for the public-key half of the
+ * verification, for about 5 KiB per key. */
+
+#define ED25519_PREPARED_WIDTH 7
+
+typedef struct {
+  ge_cached Ai[1 << (ED25519_PREPARED_WIDTH - 2)]; /* -A, -3A, ..., -63A */
+  uint8_t public_key[32];
+} ED25519_PREPARED_PUBLIC_KEY;
+
+const size_t GFp_ED25519_PREPARED_PUBLIC_KEY_LEN =
+    sizeof(ED25519_PREPARED_PUBLIC_KEY);
+
+int GFp_ed25519_prepare_public_key(void *ctx_buf, size_t ctx_buf_len,
+                                   const uint8_t public_key[32]) {
+  assert(ctx_buf != NULL);
+  assert(((uintptr_t)ctx_buf) % alignof(ED25519_PREPARED_PUBLIC_KEY) == 0);
+  ge_p3 A;
+  if (ctx_buf_len < sizeof(ED25519_PREPARED_PUBLIC_KEY) ||
+      x25519_ge_frombytes_vartime(&A, public_key) != 0) {
+    return 0;
+  }
+
+  fe_neg(A.X, A.X);
+  fe_neg(A.T, A.T);
+
+  ED25519_PREPARED_PUBLIC_KEY *prepared = ctx_buf;
+  ge_odd_multiples(prepared->Ai,
+                   sizeof(prepared->Ai) / sizeof(prepared->Ai[0]), &A);
+  memcpy(prepared->public_key, public_key, 32);
+  return 1;
+}
+
+int GFp_ed25519_verify_prepared(const uint8_t *message, size_t message_len,
+                                const uint8_t signature[64],
+                                const void *ctx_buf) {
+  const ED25519_PREPARED_PUBLIC_KEY *prepared = ctx_buf;
+  if ((signature[63] & 224) != 0) {
+    return 0;
+  }
+  return ed25519_verify_table(message, message_len, signature,
+                              prepared->public_key, prepared->Ai,
+                              ED25519_PREPARED_WIDTH);
+}
+
+
+/* Batch verification.
+ *
+ * For signatures (R_i, s_i) of messages M_i under keys A_i, with
+ * h_i = SHA-512(R_i || A_i || M_i) mod l and random 128-bit weights z_i,
+ *
+ *   8 * (sum(z_i * R_i) + sum((z_i * h_i) * A_i) - (sum(z_i * s_i)) * B)
+ *
+ * is the identity if every signature is valid. Otherwise it is the identity
+ * only with probability about 2^-128. The sum is one multi-scalar
+ * multiplication of 2n + 1 points, computed with Pippenger's bucket method,
+ * which costs much less than the n double scalar multiplications that
+ * |GFp_ed25519_verify| would do.
+ *
+ * That is the cofactored check of RFC 8032, section 5.1.7, whereas
+ * |GFp_ed25519_verify| accepts only when s_i * B - h_i * A_i encodes to R_i.
+ * The two differ for signatures whose R_i or A_i has a small-order
+ * component, which only the holder of the private key can make. So that the
+ * batch accepts only what |GFp_ed25519_verify| accepts, signatures whose R_i
+ * or A_i has small order are verified on their own instead of entering the
+ * sum, and the fast path drops the multiplication by 8: it accepts only when
+ * the sum itself is the identity, with z_i * h_i reduced mod 8 * l rather
+ * than mod l so that it multiplies any small-order component of A_i
+ * correctly. Each z_i is made odd, so a single
+ * signature with a small-order component can't bring the sum to the
+ * identity. Several of them can cancel each other out for some weights, so
+ * the batch may accept a set of such signatures that |GFp_ed25519_verify|
+ * would reject; telling them apart exactly would need a subgroup check of
+ * every R_i and A_i, which costs about as much as verifying them one by
+ * one. */
+
+/* The window sizes, in bits, that the multi-scalar multiplication chooses
+ * from. The scalars are less than 8 * l < 2^256; signed digits need one
+ * more digit for the final carry. */
+#define ED25519_BATCH_MIN_WINDOW 4
+#define ED25519_BATCH_MAX_WINDOW 10
+#define ED25519_BATCH_DIGITS(window) ((256 + (window) - 1) / (window) + 1)
+#define ED25519_BATCH_MAX_DIGITS ED25519_BATCH_DIGITS(ED25519_BATCH_MIN_WINDOW)
+
+typedef struct {
+  ge_cached point;
+  int16_t digits[ED25519_BATCH_MAX_DIGITS];
+} ED25519_BATCH_POINT;
+
+/* ed25519_batch_window returns the window size that minimizes the number of
+ * point additions for |num_points| points: one per point and two per bucket
+ * in each window. */
+static unsigned ed25519_batch_window(size_t num_points) {
+  unsigned best = ED25519_BATCH_MIN_WINDOW;
+  size_t best_cost = SIZE_MAX;
+  for (unsigned window = ED25519_BATCH_MIN_WINDOW;
+       window <= ED25519_BATCH_MAX_WINDOW; ++window) {
+    size_t cost =
+        ED25519_BATCH_DIGITS(window) * (num_points + ((size_t)1 << window));
+    if (cost < best_cost) {
+      best = window;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+/* ed25519_batch_recode writes the signed base-2^|window| digits of the
+ * scalar |k| to |digits|. Each digit is in
+ * [-2^(window - 1), 2^(window - 1)). */
+static void ed25519_batch_recode(int16_t *digits, const uint8_t k[32],
+                                 unsigned window) {
+  unsigned num_digits = ED25519_BATCH_DIGITS(window);
+  int32_t carry = 0;
+  for (unsigned i = 0; i < num_digits; ++i) {
+    unsigned bit = i * window;
+    uint32_t w = 0;
+    if (bit < 256) {
+      unsigned byte = bit / 8;
+      uint32_t v = k[byte];
+      if (byte + 1 < 32) {
+        v |= (uint32_t)k[byte + 1] << 8;
+      }
+      if (byte + 2 < 32) {
+        v |= (uint32_t)k[byte + 2] << 16;
+      }
+      w = (v >> (bit % 8)) & ((UINT32_C(1) << window) - 1);
+    }
+    int32_t digit = (int32_t)w + carry;
+    carry = (digit + (INT32_C(1) << (window - 1))) >> window;
+    digits[i] = (int16_t)(digit - (carry << window));
+  }
+  assert(carry == 0);
+}
+
+/* ed25519_batch_reduce_mod_8l sets |zh| to |z| * |h| mod 8 * l, where |h| is
+ * reduced mod l. The cofactorless batch equation needs z_i * h_i * A_i to
+ * keep the small-order component of A_i, which reducing mod l alone would
+ * scramble. */
+static void ed25519_batch_reduce_mod_8l(uint8_t zh[32], const uint8_t z[32],
+                                        const uint8_t h[32]) {
+  static const uint8_t kZero[32] = { 0 };
+  static const uint8_t kOrder[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7,
+    0xa2, 0xde, 0xf9, 0xde, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+  };
+  sc_muladd(zh, z, h, kZero);
+
+  /* Add the multiple of l, which is 5 mod 8, that makes |zh| agree with
+   * z * h mod 8. 5 is its own inverse mod 8. */
+  unsigned m = (((unsigned)z[0] * h[0] - zh[0]) * 5) & 7;
+  unsigned carry = 0;
+  for (size_t i = 0; i < 32; ++i) {
+    carry += zh[i] + m * kOrder[i];
+    zh[i] = (uint8_t)carry;
+    carry >>= 8;
+  }
+  assert(carry == 0);
+}
+
+/* ed25519_batch_msm sets |out| to the sum of |points[i].point| times the
+ * scalars recoded in |points[i].digits|. |buckets| must have room for
+ * 2^(|window| - 1) points. */
+static void ed25519_batch_msm(ge_p3 *out, const ED25519_BATCH_POINT *points,
+                              size_t num_points, unsigned window,
+                              ge_p3 *buckets) {
+  size_t num_buckets = (size_t)1 << (window - 1);
+  ge_p1p1 t;
+  ge_p2 p2;
+  ge_cached cached;
+
+  ge_p3_0(out);
+  for (unsigned i = ED25519_BATCH_DIGITS(window); i-- > 0;) {
+    for (size_t j = 0; j < num_buckets; ++j) {
+      ge_p3_0(&buckets[j]);
+    }
+    for (size_t j = 0; j < num_points; ++j) {
+      int digit = points[j].digits[i];
+      if (digit > 0) {
+        x25519_ge_add(&t, &buckets[digit - 1], &points[j].point);
+        x25519_ge_p1p1_to_p3(&buckets[digit - 1], &t);
+      } else if (digit < 0) {
+        x25519_ge_sub(&t, &buckets[-digit - 1], &points[j].point);
+        x25519_ge_p1p1_to_p3(&buckets[-digit - 1], &t);
+      }
+    }
+
+    /* sum(k * buckets[k - 1]) as a running sum of running sums. */
+    ge_p3 sum;
+    ge_p3 total;
+    ge_p3_0(&sum);
+    ge_p3_0(&total);
+    for (size_t j = num_buckets; j-- > 0;) {
+      x25519_ge_p3_to_cached(&cached, &buckets[j]);
+      x25519_ge_add(&t, &sum, &cached);
+      x25519_ge_p1p1_to_p3(&sum, &t);
+      x25519_ge_p3_to_cached(&cached, &sum);
+      x25519_ge_add(&t, &total, &cached);
+      x25519_ge_p1p1_to_p3(&total, &t);
+    }
+
+    ge_p3_dbl(&t, out);
+    for (unsigned j = 1; j < window; ++j) {
+      x25519_ge_p1p1_to_p2(&p2, &t);
+      ge_p2_dbl(&t, &p2);
+    }
+    x25519_ge_p1p1_to_p3(out, &t);
+    x25519_ge_p3_to_cached(&cached, &total);
+    x25519_ge_add(&t, out, &cached);
+    x25519_ge_p1p1_to_p3(out, &t);
+  }
+}
+
+static uint8_t *ed25519_batch_aligned_scratch(uint8_t *scratch) {
+  return scratch + ((0 - (uintptr_t)scratch) & (alignof(ge_p3) - 1));
+}
+
+size_t GFp_ed25519_verify_batch_scratch_len(size_t num) {
+  size_t num_points = 2 * num + 1;
+  unsigned window = ed25519_batch_window(num_points);
+  return (alignof(ge_p3) - 1) + num_points * sizeof(ED25519_BATCH_POINT) +
+         ((size_t)1 << (window - 1)) * sizeof(ge_p3);
+}
+
+/* GFp_ed25519_verify_batch verifies |num| signatures at once, as described
+ * above. |weights| must be 16 * |num| fresh random bytes, and |scratch| must
+ * be at least |GFp_ed25519_verify_batch_scratch_len(num)| bytes. It sets
+ * |out_valid[i]| to one if signature |i| is valid and to zero otherwise. When
+ * the batch doesn't verify, each signature is checked with
+ * |GFp_ed25519_verify| to find the invalid ones. It returns one if all the
+ * signatures are valid and zero otherwise. */
+int GFp_ed25519_verify_batch(uint8_t *out_valid, uint8_t *scratch,
+                             size_t scratch_len,
+                             const uint8_t *const messages[],
+                             const size_t message_lens[],
+                             const uint8_t *const signatures[],
+                             const uint8_t *const public_keys[],
+                             const uint8_t *weights, size_t num) {
+  memset(out_valid, 0, num);
+  if (scratch_len < GFp_ed25519_verify_batch_scratch_len(num)) {
+    return 0;
+  }
+
+  ED25519_BATCH_POINT *points =
+      (ED25519_BATCH_POINT *)ed25519_batch_aligned_scratch(scratch);
+  size_t num_points = 0;
+  unsigned window = ed25519_batch_window(2 * num + 1);
+
+  uint8_t zs_sum[32] = { 0 };
+  int all_valid = 1;
+
+  for (size_t i = 0; i < num; ++i) {
+    const uint8_t *signature = signatures[i];
+    ge_p3 A;
+    ge_p3 R;
+    if ((signature[63] & 224) != 0 ||
+        x25519_ge_frombytes_vartime(&A, public_keys[i]) != 0 ||
+        x25519_ge_frombytes_vartime(&R, signature) != 0 ||
+        !ed25519_is_canonical_point(signature, &R)) {
+      all_valid = 0;
+      continue;
+    }
+    if (ed25519_is_small_order(&A) || ed25519_is_small_order(&R)) {
+      out_valid[i] = (uint8_t)GFp_ed25519_verify(
+          messages[i], message_lens[i], signature, public_keys[i]);
+      all_valid &= out_valid[i];
+      continue;
+    }
+    out_valid[i] = 2;
+
+    uint8_t h[SHA512_DIGEST_LENGTH];
+    GFp_SHA512_4(h, sizeof(h), signature, 32, public_keys[i], 32, messages[i],
+                 message_lens[i], NULL, 0);
+    x25519_sc_reduce(h);
+
+    uint8_t z[32] = { 0 };
+    memcpy(z, weights + 16 * i, 16);
+    z[0] |= 1;
+    uint8_t zh[32];
+    ed25519_batch_reduce_mod_8l(zh, z, h);
+    sc_muladd(zs_sum, z, signature + 32, zs_sum);
+
+    x25519_ge_p3_to_cached(&points[num_points].point, &R);
+    ed25519_batch_recode(points[num_points].digits, z, window);
+    ++num_points;
+    x25519_ge_p3_to_cached(&points[num_points].point, &A);
+    ed25519_batch_recode(points[num_points].digits, zh, window);
+    ++num_points;
+  }
+
+  /* -B. */
+  static const uint8_t kOne[32] = { 1 };
+  ge_p3 B;
+  x25519_ge_scalarmult_base(&B, kOne);
+  fe_neg(B.X, B.X);
+  fe_neg(B.T, B.T);
+  x25519_ge_p3_to_cached(&points[num_points].point, &B);
+  ed25519_batch_recode(points[num_points].digits, zs_sum, window);
+  ++num_points;
+
+  ge_p3 sum;
+  ed25519_batch_msm(&sum, points, num_points, window,
+                    (ge_p3 *)((uint8_t *)points +
+                              (2 * num + 1) * sizeof(ED25519_BATCH_POINT)));
+
+  int sum_is_identity = ed25519_is_identity(sum.X, sum.Y, sum.Z);
+
+  all_valid = 1;
+  for (size_t i = 0; i < num; ++i) {
+    if (out_valid[i] == 2) {
+      out_valid[i] = sum_is_identity
+          ? 1
+          : (uint8_t)GFp_ed25519_verify(messages[i], message_lens[i],
+                                        signatures[i], public_keys[i]);
+    }
+    all_valid &= out_valid[i];
+  }
+  return all_valid;
+}
+
 
 #if defined(BORINGSSL_X25519_X86_64)
 
@@ -147,6 +147,41 @@ extern "C" {
 void GFp_cpuid_setup(void);
 #endif
 
+/* GFp_dispatch_setup chooses, once, the implementations of the primitives
+ * whose choice is made in C, based on the capabilities recorded by
+ * |GFp_cpuid_setup|, which must be called first where it exists. Until it is
+ * called, portable implementations are used. */
+void GFp_dispatch_setup(void);
+
+/* GFp_chacha20_dispatch_setup chooses the implementation of the four-lane
+ * ChaCha20 core for this CPU. It is called once, by |GFp_dispatch_setup|. */
+void GFp_chacha20_dispatch_setup(void);
+
+/* IMPLEMENTATION_NAMES holds the names of the implementations that are used on
+ * this CPU, e.g. "aesni" for AES or "avx2" for ChaCha20. The strings are
+ * static. */
+typedef struct {
+  const char *aes;
+  const char *ghash;
+  const char *aes_gcm;
+  const char *chacha20;
+  const char *poly1305;
+  const char *p256;
+  const char *bn_mul_mont;
+} IMPLEMENTATION_NAMES;
+
+/* GFp_implementation_names fills in |*out|. */
+void GFp_implementation_names(IMPLEMENTATION_NAMES *out);
+
+/* GFp_parallel_for_f is the type of the functions with which the caller lends
+ * threads to the parallel AEAD entry points, which have none of their own. It
+ * must call |task(task_arg, i)| once for every |i| < |num_tasks|, on any
+ * threads and in any order, and return only after all of those calls have
+ * returned. |executor| is passed through unchanged. */
+typedef void (*GFp_parallel_for_f)(void *executor, size_t num_tasks,
+                                   void (*task)(void *task_arg, size_t i),
+                                   void *task_arg);
+
 #define OPENSSL_LITTLE_ENDIAN 1
 #define OPENSSL_BIG_ENDIAN 2
 
@@ -289,6 +324,12 @@ static inline uint32_t from_le_u32_ptr(const uint8_t *data) {
          ((uint32_t)data[3] << 24);
 }
 
+/* from_le_u64_ptr returns the 64-bit little-endian-encoded value at |data|. */
+static inline uint64_t from_le_u64_ptr(const uint8_t *data) {
+  return ((uint64_t)from_le_u32_ptr(data)) |
+         ((uint64_t)from_le_u32_ptr(data + 4) << 32);
+}
+
 /* from_be_u64_ptr returns the 64-bit big-endian-encoded value at |data|. */
 static inline uint64_t from_be_u64_ptr(const uint8_t *data) {
 #if defined(__clang__) || defined(_MSC_VER)
@@ -373,6 +414,15 @@ static inline uint64_t from_be_u64(uint64_t x) {
   return x;
 }
 
+/* to_le_u32_ptr stores the little-endian-encoded representation of |value| in
+ * the 4 bytes at |out|. */
+static inline void to_le_u32_ptr(uint8_t out[4], uint32_t value) {
+  out[0] = (uint8_t)value;
+  out[1] = (uint8_t)(value >> 8);
+  out[2] = (uint8_t)(value >> 16);
+  out[3] = (uint8_t)(value >> 24);
+}
+
 /* to_le_u64_ptr stores the little-endian-encoded representation of |value| in
  * the 8 bytes at |out|. */
 static inline void to_le_u64_ptr(uint8_t out[8], uint64_t value) {
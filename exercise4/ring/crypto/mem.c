@@ -56,6 +56,8 @@
 
 #include <openssl/mem.h>
 
+#include <string.h>
+
 int GFp_memcmp(const void *in_a, const void *in_b, size_t len) {
   const uint8_t *a = in_a;
   const uint8_t *b = in_b;
@@ -67,3 +69,17 @@ int GFp_memcmp(const void *in_a, const void *in_b, size_t len) {
 
   return x;
 }
+
+void GFp_cleanse(void *ptr, size_t len) {
+#if defined(_MSC_VER)
+  volatile uint8_t *p = ptr;
+  while (len-- > 0) {
+    *p++ = 0;
+  }
+#else
+  memset(ptr, 0, len);
+  /* As in glibc's |explicit_bzero|, the empty asm statement makes the
+   * compiler assume that the zeros are read. */
+  __asm__ __volatile__("" : : "r"(ptr) : "memory");
+#endif
+}
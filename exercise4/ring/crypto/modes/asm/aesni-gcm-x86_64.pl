@@ -54,7 +54,10 @@ open OUT,"| \"$^X\" \"$xlate\" $flavour \"$output\"";
 
 if ($avx>1) {{{
 
-($inp,$out,$len,$key,$ivp,$Xip)=("%rdi","%rsi","%rdx","%rcx","%r8","%r9");
+($inp,$out,$len,$key,$ivp,$Htbl)=("%rdi","%rsi","%rdx","%rcx","%r8","%r9");
+# The seventh argument, |Xi|, is passed on the stack. It is loaded relative
+# to %rax, which holds the value of %rsp on entry.
+$Xi_arg=$win64?"56(%rax)":"8(%rax)";
 
 ($Ii,$T1,$T2,$Hkey,
  $Z0,$Z1,$Z2,$Z3,$Xi) = map("%xmm$_",(0..8));
@@ -86,7 +89,7 @@ _aesni_ctr32_ghash_6x:
 .Loop6x:
 	add		\$`6<<24`,$counter
 	jc		.Lhandle_ctr32		# discard $inout[1-5]?
-	vmovdqu		0x00-0x20($Xip),$Hkey	# $Hkey^1
+	vmovdqu		0x00-0x20($Htbl),$Hkey	# $Hkey^1
 	  vpaddb	$T2,$inout5,$T1		# next counter value
 	  vpxor		$rndkey,$inout1,$inout1
 	  vpxor		$rndkey,$inout2,$inout2
@@ -126,7 +129,7 @@ _aesni_ctr32_ghash_6x:
 	setnc		%r12b
 	vpclmulqdq	\$0x11,$Hkey,$Z3,$Z3
 	  vaesenc	$T2,$inout2,$inout2
-	vmovdqu		0x10-0x20($Xip),$Hkey	# $Hkey^2
+	vmovdqu		0x10-0x20($Htbl),$Hkey	# $Hkey^2
 	neg		%r12
 	  vaesenc	$T2,$inout3,$inout3
 	 vpxor		$Z1,$Z2,$Z2
@@ -153,7 +156,7 @@ _aesni_ctr32_ghash_6x:
 	mov		%r13,0x20+8(%rsp)
 	  vaesenc	$rndkey,$inout4,$inout4
 	mov		%r12,0x28+8(%rsp)
-	vmovdqu		0x30-0x20($Xip),$Z1	# borrow $Z1 for $Hkey^3
+	vmovdqu		0x30-0x20($Htbl),$Z1	# borrow $Z1 for $Hkey^3
 	  vaesenc	$rndkey,$inout5,$inout5
 
 	  vmovups	0x30-0x80($key),$rndkey
@@ -171,7 +174,7 @@ _aesni_ctr32_ghash_6x:
 	  vaesenc	$rndkey,$inout3,$inout3
 	  vaesenc	$rndkey,$inout4,$inout4
 	 vpxor		$T1,$Z0,$Z0
-	vmovdqu		0x40-0x20($Xip),$T1	# borrow $T1 for $Hkey^4
+	vmovdqu		0x40-0x20($Htbl),$T1	# borrow $T1 for $Hkey^4
 	  vaesenc	$rndkey,$inout5,$inout5
 
 	  vmovups	0x40-0x80($key),$rndkey
@@ -193,7 +196,7 @@ _aesni_ctr32_ghash_6x:
 	  vaesenc	$rndkey,$inout4,$inout4
 	mov		%r12,0x38+8(%rsp)
 	 vpxor		$T2,$Z0,$Z0
-	vmovdqu		0x60-0x20($Xip),$T2	# borrow $T2 for $Hkey^5
+	vmovdqu		0x60-0x20($Htbl),$T2	# borrow $T2 for $Hkey^5
 	  vaesenc	$rndkey,$inout5,$inout5
 
 	  vmovups	0x50-0x80($key),$rndkey
@@ -215,7 +218,7 @@ _aesni_ctr32_ghash_6x:
 	  vaesenc	$rndkey,$inout4,$inout4
 	mov		%r12,0x48+8(%rsp)
 	 vpxor		$Hkey,$Z0,$Z0
-	 vmovdqu	0x70-0x20($Xip),$Hkey	# $Hkey^6
+	 vmovdqu	0x70-0x20($Htbl),$Hkey	# $Hkey^6
 	  vaesenc	$rndkey,$inout5,$inout5
 
 	  vmovups	0x60-0x80($key),$rndkey
@@ -317,7 +320,7 @@ _aesni_ctr32_ghash_6x:
 	  vmovdqu	0x30($const),$Z1	# borrow $Z1, .Ltwo_lsb
 	  vpaddd	0x40($const),$Z2,$inout1	# .Lone_lsb
 	  vpaddd	$Z1,$Z2,$inout2
-	vmovdqu		0x00-0x20($Xip),$Hkey	# $Hkey^1
+	vmovdqu		0x00-0x20($Htbl),$Hkey	# $Hkey^1
 	  vpaddd	$Z1,$inout1,$inout3
 	  vpshufb	$Ii,$inout1,$inout1
 	  vpaddd	$Z1,$inout2,$inout4
@@ -399,7 +402,7 @@ ___
 #
 # size_t GFp_aesni_gcm_[en|de]crypt(const void *inp, void *out, size_t len,
 #		const AES_KEY *key, unsigned char iv[16],
-#		struct { u128 Xi,H,Htbl[9]; } *Xip);
+#		const u128 Htbl[9], unsigned char Xi[16]);
 $code.=<<___;
 .globl	GFp_aesni_gcm_decrypt
 .type	GFp_aesni_gcm_decrypt,\@function,6
@@ -443,11 +446,12 @@ $code.=<<___;
 	lea		.Lbswap_mask(%rip),$const
 	lea		-0x80($key),$in0	# borrow $in0
 	mov		\$0xf80,$end0		# borrow $end0
-	vmovdqu		($Xip),$Xi		# load Xi
+	mov		$Xi_arg,%r12		# borrow %r12 for Xi pointer
+	vmovdqu		(%r12),$Xi		# load Xi
 	and		\$-128,%rsp		# ensure stack alignment
 	vmovdqu		($const),$Ii		# borrow $Ii for .Lbswap_mask
 	lea		0x80($key),$key		# size optimization
-	lea		0x20+0x20($Xip),$Xip	# size optimization
+	lea		0x20($Htbl),$Htbl		# size optimization
 	mov		0xf0-0x80($key),$rounds
 	vpshufb		$Ii,$Xi,$Xi
 
@@ -500,7 +504,8 @@ $code.=<<___;
 	vmovups		$inout5,-0x10($out)
 
 	vpshufb		($const),$Xi,$Xi	# .Lbswap_mask
-	vmovdqu		$Xi,-0x40($Xip)		# output Xi
+	mov		$Xi_arg,%r12
+	vmovdqu		$Xi,(%r12)		# output Xi
 
 	vzeroupper
 ___
@@ -707,8 +712,9 @@ $code.=<<___;
 
 	call		_aesni_ctr32_6x
 
-	vmovdqu		($Xip),$Xi		# load Xi
-	lea		0x20+0x20($Xip),$Xip	# size optimization
+	mov		$Xi_arg,%r12		# borrow %r12 for Xi pointer
+	vmovdqu		(%r12),$Xi		# load Xi
+	lea		0x20($Htbl),$Htbl		# size optimization
 	sub		\$12,$len
 	mov		\$0x60*2,$ret
 	vpshufb		$Ii,$Xi,$Xi
@@ -716,9 +722,9 @@ $code.=<<___;
 	call		_aesni_ctr32_ghash_6x
 	vmovdqu		0x20(%rsp),$Z3		# I[5]
 	 vmovdqu	($const),$Ii		# borrow $Ii for .Lbswap_mask
-	vmovdqu		0x00-0x20($Xip),$Hkey	# $Hkey^1
+	vmovdqu		0x00-0x20($Htbl),$Hkey	# $Hkey^1
 	vpunpckhqdq	$Z3,$Z3,$T1
-	vmovdqu		0x20-0x20($Xip),$rndkey	# borrow $rndkey for $HK
+	vmovdqu		0x20-0x20($Htbl),$rndkey	# borrow $rndkey for $HK
 	 vmovups	$inout0,-0x60($out)	# save output
 	 vpshufb	$Ii,$inout0,$inout0	# but keep bswapped copy
 	vpxor		$Z3,$T1,$T1
@@ -738,7 +744,7 @@ ___
 
 $code.=<<___;
 	 vmovdqu	0x30(%rsp),$Z2		# I[4]
-	 vmovdqu	0x10-0x20($Xip),$Ii	# borrow $Ii for $Hkey^2
+	 vmovdqu	0x10-0x20($Htbl),$Ii	# borrow $Ii for $Hkey^2
 	 vpunpckhqdq	$Z2,$Z2,$T2
 	vpclmulqdq	\$0x00,$Hkey,$Z3,$Z1
 	 vpxor		$Z2,$T2,$T2
@@ -747,19 +753,19 @@ $code.=<<___;
 
 	 vmovdqu	0x40(%rsp),$T3		# I[3]
 	vpclmulqdq	\$0x00,$Ii,$Z2,$Z0
-	 vmovdqu	0x30-0x20($Xip),$Hkey	# $Hkey^3
+	 vmovdqu	0x30-0x20($Htbl),$Hkey	# $Hkey^3
 	vpxor		$Z1,$Z0,$Z0
 	 vpunpckhqdq	$T3,$T3,$Z1
 	vpclmulqdq	\$0x11,$Ii,$Z2,$Z2
 	 vpxor		$T3,$Z1,$Z1
 	vpxor		$Z3,$Z2,$Z2
 	vpclmulqdq	\$0x10,$HK,$T2,$T2
-	 vmovdqu	0x50-0x20($Xip),$HK
+	 vmovdqu	0x50-0x20($Htbl),$HK
 	vpxor		$T1,$T2,$T2
 
 	 vmovdqu	0x50(%rsp),$T1		# I[2]
 	vpclmulqdq	\$0x00,$Hkey,$T3,$Z3
-	 vmovdqu	0x40-0x20($Xip),$Ii	# borrow $Ii for $Hkey^4
+	 vmovdqu	0x40-0x20($Htbl),$Ii	# borrow $Ii for $Hkey^4
 	vpxor		$Z0,$Z3,$Z3
 	 vpunpckhqdq	$T1,$T1,$Z0
 	vpclmulqdq	\$0x11,$Hkey,$T3,$T3
@@ -770,19 +776,19 @@ $code.=<<___;
 
 	 vmovdqu	0x60(%rsp),$T2		# I[1]
 	vpclmulqdq	\$0x00,$Ii,$T1,$Z2
-	 vmovdqu	0x60-0x20($Xip),$Hkey	# $Hkey^5
+	 vmovdqu	0x60-0x20($Htbl),$Hkey	# $Hkey^5
 	vpxor		$Z3,$Z2,$Z2
 	 vpunpckhqdq	$T2,$T2,$Z3
 	vpclmulqdq	\$0x11,$Ii,$T1,$T1
 	 vpxor		$T2,$Z3,$Z3
 	vpxor		$T3,$T1,$T1
 	vpclmulqdq	\$0x10,$HK,$Z0,$Z0
-	 vmovdqu	0x80-0x20($Xip),$HK
+	 vmovdqu	0x80-0x20($Htbl),$HK
 	vpxor		$Z1,$Z0,$Z0
 
 	 vpxor		0x70(%rsp),$Xi,$Xi	# accumulate I[0]
 	vpclmulqdq	\$0x00,$Hkey,$T2,$Z1
-	 vmovdqu	0x70-0x20($Xip),$Ii	# borrow $Ii for $Hkey^6
+	 vmovdqu	0x70-0x20($Htbl),$Ii	# borrow $Ii for $Hkey^6
 	 vpunpckhqdq	$Xi,$Xi,$T3
 	vpxor		$Z2,$Z1,$Z1
 	vpclmulqdq	\$0x11,$Hkey,$T2,$T2
@@ -792,17 +798,17 @@ $code.=<<___;
 	vpxor		$Z0,$Z3,$Z0
 
 	vpclmulqdq	\$0x00,$Ii,$Xi,$Z2
-	 vmovdqu	0x00-0x20($Xip),$Hkey	# $Hkey^1
+	 vmovdqu	0x00-0x20($Htbl),$Hkey	# $Hkey^1
 	 vpunpckhqdq	$inout5,$inout5,$T1
 	vpclmulqdq	\$0x11,$Ii,$Xi,$Xi
 	 vpxor		$inout5,$T1,$T1
 	vpxor		$Z1,$Z2,$Z1
 	vpclmulqdq	\$0x10,$HK,$T3,$T3
-	 vmovdqu	0x20-0x20($Xip),$HK
+	 vmovdqu	0x20-0x20($Htbl),$HK
 	vpxor		$T2,$Xi,$Z3
 	vpxor		$Z0,$T3,$Z2
 
-	 vmovdqu	0x10-0x20($Xip),$Ii	# borrow $Ii for $Hkey^2
+	 vmovdqu	0x10-0x20($Htbl),$Ii	# borrow $Ii for $Hkey^2
 	  vpxor		$Z1,$Z3,$T3		# aggregated Karatsuba post-processing
 	vpclmulqdq	\$0x00,$Hkey,$inout5,$Z0
 	  vpxor		$T3,$Z2,$Z2
@@ -816,7 +822,7 @@ $code.=<<___;
 	  vpxor		$Z2,$Z3,$Z3
 
 	vpclmulqdq	\$0x00,$Ii,$inout4,$Z1
-	 vmovdqu	0x30-0x20($Xip),$Hkey	# $Hkey^3
+	 vmovdqu	0x30-0x20($Htbl),$Hkey	# $Hkey^3
 	vpxor		$Z0,$Z1,$Z1
 	 vpunpckhqdq	$inout3,$inout3,$T3
 	vpclmulqdq	\$0x11,$Ii,$inout4,$inout4
@@ -824,11 +830,11 @@ $code.=<<___;
 	vpxor		$inout5,$inout4,$inout4
 	  vpalignr	\$8,$Xi,$Xi,$inout5	# 1st phase
 	vpclmulqdq	\$0x10,$HK,$T2,$T2
-	 vmovdqu	0x50-0x20($Xip),$HK
+	 vmovdqu	0x50-0x20($Htbl),$HK
 	vpxor		$T1,$T2,$T2
 
 	vpclmulqdq	\$0x00,$Hkey,$inout3,$Z0
-	 vmovdqu	0x40-0x20($Xip),$Ii	# borrow $Ii for $Hkey^4
+	 vmovdqu	0x40-0x20($Htbl),$Ii	# borrow $Ii for $Hkey^4
 	vpxor		$Z1,$Z0,$Z0
 	 vpunpckhqdq	$inout2,$inout2,$T1
 	vpclmulqdq	\$0x11,$Hkey,$inout3,$inout3
@@ -842,7 +848,7 @@ $code.=<<___;
 	  vxorps	$inout5,$Xi,$Xi
 
 	vpclmulqdq	\$0x00,$Ii,$inout2,$Z1
-	 vmovdqu	0x60-0x20($Xip),$Hkey	# $Hkey^5
+	 vmovdqu	0x60-0x20($Htbl),$Hkey	# $Hkey^5
 	vpxor		$Z0,$Z1,$Z1
 	 vpunpckhqdq	$inout1,$inout1,$T2
 	vpclmulqdq	\$0x11,$Ii,$inout2,$inout2
@@ -850,7 +856,7 @@ $code.=<<___;
 	  vpalignr	\$8,$Xi,$Xi,$inout5	# 2nd phase
 	vpxor		$inout3,$inout2,$inout2
 	vpclmulqdq	\$0x10,$HK,$T1,$T1
-	 vmovdqu	0x80-0x20($Xip),$HK
+	 vmovdqu	0x80-0x20($Htbl),$HK
 	vpxor		$T3,$T1,$T1
 
 	  vxorps	$Z3,$inout5,$inout5
@@ -858,7 +864,7 @@ $code.=<<___;
 	  vxorps	$inout5,$Xi,$Xi
 
 	vpclmulqdq	\$0x00,$Hkey,$inout1,$Z0
-	 vmovdqu	0x70-0x20($Xip),$Ii	# borrow $Ii for $Hkey^6
+	 vmovdqu	0x70-0x20($Htbl),$Ii	# borrow $Ii for $Hkey^6
 	vpxor		$Z1,$Z0,$Z0
 	 vpunpckhqdq	$Xi,$Xi,$T3
 	vpclmulqdq	\$0x11,$Hkey,$inout1,$inout1
@@ -894,7 +900,8 @@ ___
 }
 $code.=<<___;
 	vpshufb		($const),$Xi,$Xi	# .Lbswap_mask
-	vmovdqu		$Xi,-0x40($Xip)		# output Xi
+	mov		$Xi_arg,%r12
+	vmovdqu		$Xi,(%r12)		# output Xi
 
 	vzeroupper
 ___
@@ -939,13 +946,330 @@ $code.=<<___;
 .asciz	"AES-NI GCM module for x86_64, CRYPTOGAMS by <appro\@openssl.org>"
 .align	64
 ___
+}}} else {{{
+$code=<<___;	# assembler is too old
+.text
+
+.globl	GFp_aesni_gcm_encrypt
+.type	GFp_aesni_gcm_encrypt,\@abi-omnipotent
+GFp_aesni_gcm_encrypt:
+	xor	%eax,%eax
+	ret
+.size	GFp_aesni_gcm_encrypt,.-GFp_aesni_gcm_encrypt
+
+.globl	GFp_aesni_gcm_decrypt
+.type	GFp_aesni_gcm_decrypt,\@abi-omnipotent
+GFp_aesni_gcm_decrypt:
+	xor	%eax,%eax
+	ret
+.size	GFp_aesni_gcm_decrypt,.-GFp_aesni_gcm_decrypt
+___
+}}}
+
+######################################################################
+#
+# SSE4.1 AES-NI-CTR+GHASH stitch.
+#
+# The code above requires AVX and MOVBE. Processors that only have
+# AES-NI and PCLMULQDQ would otherwise make two passes over the data,
+# one for CTR and one for GHASH. The code below interleaves the
+# aggregated 4x GHASH from ghash-x86_64.pl with the AES rounds of four
+# counter blocks, so that the multiplications execute in the shadow of
+# the aesenc latency. It uses the H^1..H^4 table computed by
+# GFp_gcm_init_clmul.
+#
+# size_t GFp_aesni_gcm_sse_[en|de]crypt(const void *inp, void *out,
+#		size_t len, const AES_KEY *key, unsigned char iv[16],
+#		const u128 Htbl[16], unsigned char Xi[16]);
+#
+# Both functions process the largest multiple of 64 bytes of |len|,
+# update |iv| and |Xi| accordingly and return the number of bytes
+# processed.
+{
+my ($inp,$out,$len,$key,$ivp,$Htbl)=("%rdi","%rsi","%rdx","%rcx","%r8","%r9");
+my $Xi_arg=$win64?"56(%rax)":"8(%rax)";
+
+my ($B0,$B1,$B2,$B3,$rndkey,$Xi,$Xl,$Xh,$Xm,$Hkey,$HK,
+    $T1,$T2,$T3,$bswap,$iv) = map("%xmm$_",(0..15));
+my @B=($B0,$B1,$B2,$B3);
+
+# %rax must hold %rsp on entry for as long as the frame is live; it is
+# what gcm_se_handler unwinds from.
+my ($counter,$rounds,$Xip,$lastkey,$ret)=("%ebx","%ebp","%r12","%r13","%r10");
+my $ctr="%r11d";
+
+# Returns the instructions that fold the four blocks at |$src|+|$bias|
+# into $Xi: Xi = (Xi+I[0])*H^4 + I[1]*H^3 + I[2]*H^2 + I[3]*H.
+sub sse_ghash_4x {
+my ($src,$bias)=@_;
+my @H=(	["0x40","0x50","\$0x10"],	# H^4, Karatsuba "salt" high
+	["0x30","0x50","\$0x00"],	# H^3, Karatsuba "salt" low
+	["0x10","0x20","\$0x10"],	# H^2
+	["0x00","0x20","\$0x00"]);	# H^1
+my @insns;
+
+    for (my $i=0; $i<4; $i++) {
+	my ($h,$hk,$sel)=@{$H[$i]};
+	my $I=sprintf("%d(%s)",16*$i+$bias,$src);
+	if ($i==0) {
+	    push @insns,
+		"movdqu	$I,$T1",
+		"pshufb	$bswap,$T1",
+		"pxor	$T1,$Xi",
+		"movdqu	$h($Htbl),$Hkey",
+		"movdqu	$hk($Htbl),$HK",
+		"movdqa	$Xi,$Xl",
+		"movdqa	$Xi,$Xh",
+		"pshufd	\$0b01001110,$Xi,$Xm",
+		"pxor	$Xi,$Xm",
+		"pclmulqdq	\$0x00,$Hkey,$Xl",
+		"pclmulqdq	\$0x11,$Hkey,$Xh",
+		"pclmulqdq	$sel,$HK,$Xm";
+	} else {
+	    push @insns,
+		"movdqu	$I,$T1",
+		"pshufb	$bswap,$T1",
+		"movdqu	$h($Htbl),$Hkey";
+	    push @insns,
+		"movdqu	$hk($Htbl),$HK"		if ($hk ne $H[$i-1]->[1]);
+	    push @insns,
+		"movdqa	$T1,$T2",
+		"pshufd	\$0b01001110,$T1,$T3",
+		"pxor	$T1,$T3",
+		"pclmulqdq	\$0x00,$Hkey,$T1",
+		"pclmulqdq	\$0x11,$Hkey,$T2",
+		"pclmulqdq	$sel,$HK,$T3",
+		"pxor	$T1,$Xl",
+		"pxor	$T2,$Xh",
+		"pxor	$T3,$Xm";
+	}
+    }
+    push @insns,				# Karatsuba post-processing
+	"pxor	$Xl,$Xm",
+	"pxor	$Xh,$Xm",
+	"movdqa	$Xm,$T1",
+	"psrldq	\$8,$T1",
+	"pslldq	\$8,$Xm",
+	"pxor	$T1,$Xh",
+	"pxor	$Xm,$Xl",
+	# reduction_alg9, 1st phase
+	"movdqa	$Xl,$T2",
+	"movdqa	$Xl,$T1",
+	"psllq	\$5,$Xl",
+	"pxor	$Xl,$T1",
+	"psllq	\$1,$Xl",
+	"pxor	$T1,$Xl",
+	"psllq	\$57,$Xl",
+	"movdqa	$Xl,$T1",
+	"pslldq	\$8,$Xl",
+	"psrldq	\$8,$T1",
+	"pxor	$T2,$Xl",
+	"pxor	$T1,$Xh",
+	# 2nd phase
+	"movdqa	$Xl,$T2",
+	"psrlq	\$1,$Xl",
+	"pxor	$T2,$Xh",
+	"pxor	$Xl,$T2",
+	"psrlq	\$5,$Xl",
+	"pxor	$T2,$Xl",
+	"psrlq	\$1,$Xl",
+	"pxor	$Xh,$Xl",
+	"movdqa	$Xl,$Xi";
+    @insns;
+}
+
+# Encrypts the four counter blocks starting at $counter, interleaving
+# |@ghash| with the first nine rounds. |$sfx| makes the local label
+# unique.
+sub sse_aes_4x {
+my ($sfx,@ghash)=@_;
+my $per=int((@ghash+35)/36);		# per aesenc, rounds 1-9
+
+$code.="	movups	0x00($key),$rndkey\n";
+    for (my $i=0; $i<4; $i++) {
+	$code.="	lea	$i(%rbx),$ctr\n"	if ($i);	# %rbx is $counter
+	$code.="	mov	$counter,$ctr\n"	if (!$i);
+	$code.=<<___;
+	movdqa	$iv,$B[$i]
+	bswap	$ctr
+	pinsrd	\$3,$ctr,$B[$i]
+	pxor	$rndkey,$B[$i]
+___
+    }
+$code.="	add	\$4,$counter\n";
+    for (my $r=1; $r<10; $r++) {
+	$code.="	movups	`16*$r`($key),$rndkey\n";
+	foreach my $b (@B) {
+	    $code.="	aesenc	$rndkey,$b\n";
+	    foreach (splice(@ghash,0,$per)) { $code.="	 $_\n"; }
+	}
+    }
+    foreach (@ghash) { $code.="	$_\n"; }
+$code.=<<___;
+	cmp	\$9,$rounds
+	je	.Lsse_last_$sfx
+___
+    for (my $r=10; $r<14; $r++) {
+	$code.="	movups	`16*$r`($key),$rndkey\n";
+	foreach my $b (@B) { $code.="	aesenc	$rndkey,$b\n"; }
+    }
+$code.=<<___;
+.Lsse_last_$sfx:
+	movups	($lastkey),$rndkey
+	aesenclast	$rndkey,$B0
+	aesenclast	$rndkey,$B1
+	aesenclast	$rndkey,$B2
+	aesenclast	$rndkey,$B3
+	movdqu	0x00($inp),$T1
+	movdqu	0x10($inp),$T2
+	movdqu	0x20($inp),$T3
+	movdqu	0x30($inp),$rndkey
+	pxor	$T1,$B0
+	pxor	$T2,$B1
+	pxor	$T3,$B2
+	pxor	$rndkey,$B3
+	movdqu	$B0,0x00($out)
+	movdqu	$B1,0x10($out)
+	movdqu	$B2,0x20($out)
+	movdqu	$B3,0x30($out)
+	lea	0x40($inp),$inp
+	lea	0x40($out),$out
+___
+}
+
+sub sse_prologue {
+my $dir=shift;
+$code.=<<___;
+.globl	GFp_aesni_gcm_sse_$dir
+.type	GFp_aesni_gcm_sse_$dir,\@function,6
+.align	32
+GFp_aesni_gcm_sse_$dir:
+	xor	$ret,$ret
+	cmp	\$0x40,$len			# minimal accepted length
+	jb	.Lgcm_sse_${dir}_abort
+
+	lea	(%rsp),%rax			# save stack pointer
+	push	%rbx
+	push	%rbp
+	push	%r12
+	push	%r13
+	push	%r14
+	push	%r15
+___
+$code.=<<___ if ($win64);
+	lea	-0xa8(%rsp),%rsp
+	movaps	%xmm6,-0xd8(%rax)
+	movaps	%xmm7,-0xc8(%rax)
+	movaps	%xmm8,-0xb8(%rax)
+	movaps	%xmm9,-0xa8(%rax)
+	movaps	%xmm10,-0x98(%rax)
+	movaps	%xmm11,-0x88(%rax)
+	movaps	%xmm12,-0x78(%rax)
+	movaps	%xmm13,-0x68(%rax)
+	movaps	%xmm14,-0x58(%rax)
+	movaps	%xmm15,-0x48(%rax)
+___
+$code.=<<___;
+.Lgcm_sse_${dir}_body:
+	movdqu	($ivp),$iv			# input counter value
+	mov	12($ivp),$counter
+	bswap	$counter
+	mov	$Xi_arg,$Xip
+	movdqu	($Xip),$Xi			# load Xi
+	movdqa	.Lsse_bswap_mask(%rip),$bswap
+	mov	240($key),$rounds
+	mov	$rounds,%r14d
+	shl	\$4,%r14
+	lea	16($key,%r14),$lastkey		# last round key
+	pshufb	$bswap,$Xi
+	and	\$-0x40,$len
+	mov	$len,$ret
+___
+}
+
+sub sse_epilogue {
+my $dir=shift;
+$code.=<<___;
+	pshufb	$bswap,$Xi
+	movdqu	$Xi,($Xip)			# output Xi
+	bswap	$counter
+	mov	$counter,12($ivp)		# output counter value
+___
+$code.=<<___ if ($win64);
+	movaps	-0xd8(%rax),%xmm6
+	movaps	-0xc8(%rax),%xmm7
+	movaps	-0xb8(%rax),%xmm8
+	movaps	-0xa8(%rax),%xmm9
+	movaps	-0x98(%rax),%xmm10
+	movaps	-0x88(%rax),%xmm11
+	movaps	-0x78(%rax),%xmm12
+	movaps	-0x68(%rax),%xmm13
+	movaps	-0x58(%rax),%xmm14
+	movaps	-0x48(%rax),%xmm15
+___
+$code.=<<___;
+	mov	-48(%rax),%r15
+	mov	-40(%rax),%r14
+	mov	-32(%rax),%r13
+	mov	-24(%rax),%r12
+	mov	-16(%rax),%rbp
+	mov	-8(%rax),%rbx
+	lea	(%rax),%rsp			# restore %rsp
+.Lgcm_sse_${dir}_abort:
+	mov	$ret,%rax			# return value
+	ret
+.size	GFp_aesni_gcm_sse_$dir,.-GFp_aesni_gcm_sse_$dir
+___
+}
+
+# Decryption hashes each chunk of ciphertext while it is decrypted.
+&sse_prologue("decrypt");
+$code.=<<___;
+.align	32
+.Lgcm_sse_dec_loop:
+___
+	&sse_aes_4x("dec",&sse_ghash_4x($inp,0));
+$code.=<<___;
+	sub	\$0x40,$len
+	jnz	.Lgcm_sse_dec_loop
+___
+&sse_epilogue("decrypt");
+
+# Encryption hashes each chunk of ciphertext while the next one is
+# encrypted, so the first chunk is only encrypted and the last one only
+# hashed.
+&sse_prologue("encrypt");
+	&sse_aes_4x("enc0");
+$code.=<<___;
+	sub	\$0x40,$len
+	jz	.Lgcm_sse_enc_tail
+.align	32
+.Lgcm_sse_enc_loop:
+___
+	&sse_aes_4x("enc",&sse_ghash_4x($out,-0x40));
+$code.=<<___;
+	sub	\$0x40,$len
+	jnz	.Lgcm_sse_enc_loop
+.Lgcm_sse_enc_tail:
+___
+	foreach (&sse_ghash_4x($out,-0x40)) { $code.="	$_\n"; }
+&sse_epilogue("encrypt");
+
+$code.=<<___;
+.align	64
+.Lsse_bswap_mask:
+	.byte	15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0
+.align	64
+___
+}
+
 if ($win64) {
 $rec="%rcx";
 $frame="%rdx";
 $context="%r8";
 $disp="%r9";
 
-$code.=<<___
+$code.=<<___;
 .extern	__imp_RtlVirtualUnwind
 .type	gcm_se_handler,\@abi-omnipotent
 .align	16
@@ -1041,15 +1365,28 @@ gcm_se_handler:
 
 .section	.pdata
 .align	4
+___
+$code.=<<___ if ($avx>1);
 	.rva	.LSEH_begin_GFp_aesni_gcm_decrypt
 	.rva	.LSEH_end_GFp_aesni_gcm_decrypt
 	.rva	.LSEH_gcm_dec_info
 
 	.rva	.LSEH_begin_GFp_aesni_gcm_encrypt
 	.rva	.LSEH_end_GFp_aesni_gcm_encrypt
-	.rva	.LSEH_GFp_gcm_enc_info
+	.rva	.LSEH_gcm_enc_info
+___
+$code.=<<___;
+	.rva	.LSEH_begin_GFp_aesni_gcm_sse_decrypt
+	.rva	.LSEH_end_GFp_aesni_gcm_sse_decrypt
+	.rva	.LSEH_gcm_sse_dec_info
+
+	.rva	.LSEH_begin_GFp_aesni_gcm_sse_encrypt
+	.rva	.LSEH_end_GFp_aesni_gcm_sse_encrypt
+	.rva	.LSEH_gcm_sse_enc_info
 .section	.xdata
 .align	8
+___
+$code.=<<___ if ($avx>1);
 .LSEH_gcm_dec_info:
 	.byte	9,0,0,0
 	.rva	gcm_se_handler
@@ -1059,26 +1396,17 @@ gcm_se_handler:
 	.rva	gcm_se_handler
 	.rva	.Lgcm_enc_body,.Lgcm_enc_abort
 ___
-}
-}}} else {{{
-$code=<<___;	# assembler is too old
-.text
-
-.globl	GFp_aesni_gcm_encrypt
-.type	GFp_aesni_gcm_encrypt,\@abi-omnipotent
-GFp_aesni_gcm_encrypt:
-	xor	%eax,%eax
-	ret
-.size	GFp_aesni_gcm_encrypt,.-GFp_aesni_gcm_encrypt
-
-.globl	GFp_aesni_gcm_decrypt
-.type	GFp_aesni_gcm_decrypt,\@abi-omnipotent
-GFp_aesni_gcm_decrypt:
-	xor	%eax,%eax
-	ret
-.size	GFp_aesni_gcm_decrypt,.-GFp_aesni_gcm_decrypt
+$code.=<<___;
+.LSEH_gcm_sse_dec_info:
+	.byte	9,0,0,0
+	.rva	gcm_se_handler
+	.rva	.Lgcm_sse_decrypt_body,.Lgcm_sse_decrypt_abort
+.LSEH_gcm_sse_enc_info:
+	.byte	9,0,0,0
+	.rva	gcm_se_handler
+	.rva	.Lgcm_sse_encrypt_body,.Lgcm_sse_encrypt_abort
 ___
-}}}
+}
 
 $code =~ s/\`([^\`]*)\`/eval($1)/gem;
 
@@ -65,6 +65,16 @@
 #define GHASH_ASM
 #endif
 
+/* GHASH_NOHW is defined when the fallback GHASH implementation, used when
+ * there are no suitable instructions, is the constant-time one below instead
+ * of the 4-bit tables. That is the case on all 64-bit targets, including
+ * x86-64 without PCLMULQDQ, where the 4-bit asm is somewhat faster but leaks
+ * H through its table lookups. 32-bit targets keep the 4-bit tables, as they
+ * don't have the 64-bit multiplier that it needs to be competitive. */
+#if defined(OPENSSL_64_BIT)
+#define GHASH_NOHW
+#endif
+
 
 #define PACK(s) ((size_t)(s) << (sizeof(size_t) * 8 - 16))
 #define REDUCE1BIT(V)                                                  \
@@ -84,6 +94,8 @@
 // bits of a |size_t|.
 static const size_t kSizeTWithoutLower4Bits = (size_t) -16;
 
+#if !defined(GHASH_NOHW)
+
 static void gcm_init_4bit(u128 Htable[16], const uint64_t H[2]) {
   u128 V;
 
@@ -134,7 +146,7 @@ static void gcm_init_4bit(u128 Htable[16], const uint64_t H[2]) {
 #endif
 }
 
-#if !defined(GHASH_ASM) || defined(OPENSSL_AARCH64)
+#if !defined(GHASH_ASM)
 static const size_t rem_4bit[16] = {
     PACK(0x0000), PACK(0x1C20), PACK(0x3840), PACK(0x2460),
     PACK(0x7080), PACK(0x6CA0), PACK(0x48C0), PACK(0x54E0),
@@ -247,8 +259,8 @@ static void GFp_gcm_ghash_4bit(uint8_t Xi[16], const u128 Htable[16],
       Z.lo ^= Htable[nlo].lo;
     }
 
-    Xi[0] = from_be_u64(Z.hi);
-    Xi[1] = from_be_u64(Z.lo);
+    to_be_u64_ptr(Xi, Z.hi);
+    to_be_u64_ptr(Xi + 8, Z.lo);
   } while (inp += 16, len -= 16);
 }
 #else /* GHASH_ASM */
@@ -257,15 +269,212 @@ void GFp_gcm_ghash_4bit(uint8_t Xi[16], const u128 Htable[16],
                         const uint8_t *inp, size_t len);
 #endif
 
-#define GCM_MUL(ctx, Xi) GFp_gcm_gmult_4bit(ctx->Xi, ctx->Htable)
-#if defined(GHASH_ASM)
+#endif /* !GHASH_NOHW */
+
+#if defined(GHASH_NOHW)
+
+/* Constant-time, portable GHASH.
+ *
+ * The 4-bit table code indexes |Htable| with secret data. This
+ * implementation instead multiplies with integer multiplication, masking the
+ * operands so that only every fourth bit is set and the carries of the
+ * integer products land in bits that are masked off afterwards. GHASH is
+ * computed in terms of POLYVAL (RFC 8452), which avoids the extra shift that
+ * the bit-reflected GHASH representation would need after each
+ * multiplication; see slides 16-19 of
+ * https://crypto.stanford.edu/RealWorldCrypto/slides/gueron.pdf. */
+
+#if !defined(_MSC_VER) && defined(OPENSSL_64_BIT)
+
+/* gcm_mul64_nohw sets |*out_lo| and |*out_hi| to the carry-less product of
+ * |a| and |b|. */
+static void gcm_mul64_nohw(uint64_t *out_lo, uint64_t *out_hi, uint64_t a,
+                           uint64_t b) {
+  /* With one bit in every four, a 64x64-bit product can have sixteen terms in
+   * one position, which would carry into the next one. The bottom four bits of
+   * |a| are masked off, leaving at most fifteen, and handled separately. */
+  uint64_t a0 = a & UINT64_C(0x1111111111111110);
+  uint64_t a1 = a & UINT64_C(0x2222222222222220);
+  uint64_t a2 = a & UINT64_C(0x4444444444444440);
+  uint64_t a3 = a & UINT64_C(0x8888888888888880);
+
+  uint64_t b0 = b & UINT64_C(0x1111111111111111);
+  uint64_t b1 = b & UINT64_C(0x2222222222222222);
+  uint64_t b2 = b & UINT64_C(0x4444444444444444);
+  uint64_t b3 = b & UINT64_C(0x8888888888888888);
+
+  uint128_t c0 = (a0 * (uint128_t)b0) ^ (a1 * (uint128_t)b3) ^
+                 (a2 * (uint128_t)b2) ^ (a3 * (uint128_t)b1);
+  uint128_t c1 = (a0 * (uint128_t)b1) ^ (a1 * (uint128_t)b0) ^
+                 (a2 * (uint128_t)b3) ^ (a3 * (uint128_t)b2);
+  uint128_t c2 = (a0 * (uint128_t)b2) ^ (a1 * (uint128_t)b1) ^
+                 (a2 * (uint128_t)b0) ^ (a3 * (uint128_t)b3);
+  uint128_t c3 = (a0 * (uint128_t)b3) ^ (a1 * (uint128_t)b2) ^
+                 (a2 * (uint128_t)b1) ^ (a3 * (uint128_t)b0);
+
+  /* The bottom four bits of |a|, times |b|. */
+  uint64_t a0_mask = UINT64_C(0) - (a & 1);
+  uint64_t a1_mask = UINT64_C(0) - ((a >> 1) & 1);
+  uint64_t a2_mask = UINT64_C(0) - ((a >> 2) & 1);
+  uint64_t a3_mask = UINT64_C(0) - ((a >> 3) & 1);
+  uint128_t extra = (uint128_t)(a0_mask & b) ^
+                    ((uint128_t)(a1_mask & b) << 1) ^
+                    ((uint128_t)(a2_mask & b) << 2) ^
+                    ((uint128_t)(a3_mask & b) << 3);
+
+  *out_lo = ((uint64_t)c0 & UINT64_C(0x1111111111111111)) ^
+            ((uint64_t)c1 & UINT64_C(0x2222222222222222)) ^
+            ((uint64_t)c2 & UINT64_C(0x4444444444444444)) ^
+            ((uint64_t)c3 & UINT64_C(0x8888888888888888)) ^
+            (uint64_t)extra;
+  *out_hi = ((uint64_t)(c0 >> 64) & UINT64_C(0x1111111111111111)) ^
+            ((uint64_t)(c1 >> 64) & UINT64_C(0x2222222222222222)) ^
+            ((uint64_t)(c2 >> 64) & UINT64_C(0x4444444444444444)) ^
+            ((uint64_t)(c3 >> 64) & UINT64_C(0x8888888888888888)) ^
+            (uint64_t)(extra >> 64);
+}
+
+#else
+
+/* gcm_mul32_nohw returns the carry-less product of |a| and |b|. With one bit
+ * in every four, at most eight terms land in one position, so nothing carries
+ * into the neighbouring positions. */
+static uint64_t gcm_mul32_nohw(uint32_t a, uint32_t b) {
+  uint32_t a0 = a & 0x11111111;
+  uint32_t a1 = a & 0x22222222;
+  uint32_t a2 = a & 0x44444444;
+  uint32_t a3 = a & 0x88888888;
+
+  uint32_t b0 = b & 0x11111111;
+  uint32_t b1 = b & 0x22222222;
+  uint32_t b2 = b & 0x44444444;
+  uint32_t b3 = b & 0x88888888;
+
+  uint64_t c0 = (a0 * (uint64_t)b0) ^ (a1 * (uint64_t)b3) ^
+                (a2 * (uint64_t)b2) ^ (a3 * (uint64_t)b1);
+  uint64_t c1 = (a0 * (uint64_t)b1) ^ (a1 * (uint64_t)b0) ^
+                (a2 * (uint64_t)b3) ^ (a3 * (uint64_t)b2);
+  uint64_t c2 = (a0 * (uint64_t)b2) ^ (a1 * (uint64_t)b1) ^
+                (a2 * (uint64_t)b0) ^ (a3 * (uint64_t)b3);
+  uint64_t c3 = (a0 * (uint64_t)b3) ^ (a1 * (uint64_t)b2) ^
+                (a2 * (uint64_t)b1) ^ (a3 * (uint64_t)b0);
+
+  return (c0 & UINT64_C(0x1111111111111111)) |
+         (c1 & UINT64_C(0x2222222222222222)) |
+         (c2 & UINT64_C(0x4444444444444444)) |
+         (c3 & UINT64_C(0x8888888888888888));
+}
+
+/* gcm_mul64_nohw sets |*out_lo| and |*out_hi| to the carry-less product of
+ * |a| and |b|, using Karatsuba over 32-bit halves. */
+static void gcm_mul64_nohw(uint64_t *out_lo, uint64_t *out_hi, uint64_t a,
+                           uint64_t b) {
+  uint32_t a0 = (uint32_t)a, a1 = (uint32_t)(a >> 32);
+  uint32_t b0 = (uint32_t)b, b1 = (uint32_t)(b >> 32);
+  uint64_t lo = gcm_mul32_nohw(a0, b0);
+  uint64_t hi = gcm_mul32_nohw(a1, b1);
+  uint64_t mid = gcm_mul32_nohw(a0 ^ a1, b0 ^ b1) ^ lo ^ hi;
+  *out_lo = lo ^ (mid << 32);
+  *out_hi = hi ^ (mid >> 32);
+}
+
+#endif
+
+/* gcm_init_nohw stores H * x, in the POLYVAL field, in |Htable[0]|. This is
+ * mulX_POLYVAL from Appendix A of RFC 8452, the same transformation that
+ * |GFp_gcm_init_clmul| applies. The rest of |Htable| is unused. */
+static void gcm_init_nohw(u128 Htable[16], const uint64_t H[2]) {
+  uint64_t carry;
+
+  Htable[0].lo = H[1];
+  Htable[0].hi = H[0];
+
+  carry = UINT64_C(0) - (Htable[0].hi >> 63);
+  Htable[0].hi = (Htable[0].hi << 1) | (Htable[0].lo >> 63);
+  Htable[0].lo <<= 1;
+
+  /* The polynomial is 1 + x^121 + x^126 + x^127 + x^128. */
+  Htable[0].lo ^= carry & 1;
+  Htable[0].hi ^= carry & UINT64_C(0xc200000000000000);
+}
+
+/* gcm_polyval_nohw sets |*lo|, |*hi| to their product with |H| in the POLYVAL
+ * field. */
+static void gcm_polyval_nohw(uint64_t *lo, uint64_t *hi, const u128 *H) {
+  uint64_t r0, r1, r2, r3, mid0, mid1;
+
+  /* Karatsuba: three 64x64-bit multiplications instead of four. */
+  gcm_mul64_nohw(&r0, &r1, *lo, H->lo);
+  gcm_mul64_nohw(&r2, &r3, *hi, H->hi);
+  gcm_mul64_nohw(&mid0, &mid1, *lo ^ *hi, H->lo ^ H->hi);
+  mid0 ^= r0 ^ r2;
+  mid1 ^= r1 ^ r3;
+  r2 ^= mid1;
+  r1 ^= mid0;
+
+  /* Multiply the 256-bit product by x^-128 and reduce, using
+   * x^-128 = x^-7 + x^-2 + x^-1 + 1. The bits that the x^-7, x^-2 and x^-1
+   * terms shift past x^0 are folded into |r1| first so that one reduction is
+   * enough. */
+  r1 ^= (r0 << 63) ^ (r0 << 62) ^ (r0 << 57);
+
+  r2 ^= r0;
+  r3 ^= r1;
+
+  r2 ^= r0 >> 1;
+  r2 ^= r1 << 63;
+  r3 ^= r1 >> 1;
+
+  r2 ^= r0 >> 2;
+  r2 ^= r1 << 62;
+  r3 ^= r1 >> 2;
+
+  r2 ^= r0 >> 7;
+  r2 ^= r1 << 57;
+  r3 ^= r1 >> 7;
+
+  *lo = r2;
+  *hi = r3;
+}
+
+static void gcm_gmult_nohw(uint8_t Xi[16], const u128 Htable[16]) {
+  /* Byte-reversing the GHASH state gives the POLYVAL state. */
+  uint64_t lo = from_be_u64_ptr(Xi + 8);
+  uint64_t hi = from_be_u64_ptr(Xi);
+  gcm_polyval_nohw(&lo, &hi, &Htable[0]);
+  to_be_u64_ptr(Xi, hi);
+  to_be_u64_ptr(Xi + 8, lo);
+}
+
+static void gcm_ghash_nohw(uint8_t Xi[16], const u128 Htable[16],
+                           const uint8_t *inp, size_t len) {
+  uint64_t lo = from_be_u64_ptr(Xi + 8);
+  uint64_t hi = from_be_u64_ptr(Xi);
+
+  assert(len % 16 == 0);
+  while (len >= 16) {
+    lo ^= from_be_u64_ptr(inp + 8);
+    hi ^= from_be_u64_ptr(inp);
+    gcm_polyval_nohw(&lo, &hi, &Htable[0]);
+    inp += 16;
+    len -= 16;
+  }
+
+  to_be_u64_ptr(Xi, hi);
+  to_be_u64_ptr(Xi + 8, lo);
+}
+
+#endif /* GHASH_NOHW */
+
+/* GCM_MUL and GHASH call the functions that were chosen for the key; see
+ * |GHASH_IMPL|. They expect |gcm_gmult_p| and |gcm_ghash_p| to be in scope. */
+#define GCM_MUL(ctx, Xi) (*gcm_gmult_p)(ctx->Xi, ctx->gcm_key->Htable)
 #define GHASH(ctx, in, len) \
-    GFp_gcm_ghash_4bit((ctx)->Xi, (ctx)->Htable, in, len)
+    (*gcm_ghash_p)(ctx->Xi, ctx->gcm_key->Htable, in, len)
 /* GHASH_CHUNK is "stride parameter" missioned to mitigate cache
  * trashing effect. In other words idea is to hash data while it's
  * still in L1 cache after encryption pass... */
 #define GHASH_CHUNK (3 * 1024)
-#endif
 
 
 #if defined(GHASH_ASM)
@@ -273,31 +482,41 @@ void GFp_gcm_ghash_4bit(uint8_t Xi[16], const u128 Htable[16],
 #if defined(OPENSSL_X86) || defined(OPENSSL_X86_64)
 
 #define GHASH_ASM_X86_OR_64
-#define GCM_FUNCREF_4BIT
 void GFp_gcm_init_clmul(u128 Htable[16], const uint64_t Xi[2]);
 void GFp_gcm_gmult_clmul(uint8_t Xi[16], const u128 Htable[16]);
 void GFp_gcm_ghash_clmul(uint8_t Xi[16], const u128 Htable[16],
                          const uint8_t *inp, size_t len);
 
-#if defined(OPENSSL_X86)
-#define GFp_gcm_init_avx GFp_gcm_init_clmul
-#define GFp_gcm_gmult_avx GFp_gcm_gmult_clmul
-#define GFp_gcm_ghash_avx GFp_gcm_ghash_clmul
-#else
-void GFp_gcm_init_avx(u128 Htable[16], const uint64_t Xi[2]);
-void GFp_gcm_gmult_avx(uint8_t Xi[16], const u128 Htable[16]);
-void GFp_gcm_ghash_avx(uint8_t Xi[16], const u128 Htable[16], const uint8_t *in,
-                       size_t len);
+static int clmul_capable(void) {
+  return GFp_ia32cap_P[0] & (1 << 24) &&  /* check FXSR bit */
+    GFp_ia32cap_P[1] & (1 << 1);  /* check PCLMULQDQ bit */
+}
+
+/* ghash-x86_64.pl and aesni-gcm-x86_64.pl are generated with |$avx = 0|, so
+ * |GFp_gcm_*_avx| are the CLMUL code and |GFp_aesni_gcm_encrypt| and
+ * |GFp_aesni_gcm_decrypt| process nothing. They aren't used. */
+
+#if defined(OPENSSL_X86_64)
 #define AESNI_GCM
-static int aesni_gcm_enabled(GCM128_CONTEXT *ctx, aes_ctr_f stream) {
+
+/* aesni_gcm_sse_stitch is set by |GFp_gcm128_dispatch_setup| when the CPU
+ * has SSE4.1 as well as CLMUL. */
+static int aesni_gcm_sse_stitch = 0;
+
+/* aesni_gcm_sse_enabled returns one if the SSE4.1 stitched AES-NI CTR and
+ * GHASH code can be used. It works on the table computed by
+ * |GFp_gcm_init_clmul|. */
+static int aesni_gcm_sse_enabled(GCM128_CONTEXT *ctx, aes_ctr_f stream) {
   return stream == GFp_aesni_ctr32_encrypt_blocks &&
-         ctx->ghash == GFp_gcm_ghash_avx;
+         ctx->gcm_key->ghash == GFp_gcm_ghash_clmul && aesni_gcm_sse_stitch;
 }
 
-size_t GFp_aesni_gcm_encrypt(const uint8_t *in, uint8_t *out, size_t len,
-                             const void *key, uint8_t ivec[16], uint8_t Xi[16]);
-size_t GFp_aesni_gcm_decrypt(const uint8_t *in, uint8_t *out, size_t len,
-                             const void *key, uint8_t ivec[16], uint8_t Xi[16]);
+size_t GFp_aesni_gcm_sse_encrypt(const uint8_t *in, uint8_t *out, size_t len,
+                                 const void *key, uint8_t ivec[16],
+                                 const u128 Htable[16], uint8_t Xi[16]);
+size_t GFp_aesni_gcm_sse_decrypt(const uint8_t *in, uint8_t *out, size_t len,
+                                 const void *key, uint8_t ivec[16],
+                                 const u128 Htable[16], uint8_t Xi[16]);
 #endif
 
 #if defined(OPENSSL_X86)
@@ -317,7 +536,6 @@ void GFp_gcm_ghash_4bit_x86(uint8_t Xi[16], const u128 Htable[16],
 
 #if __ARM_MAX_ARCH__ >= 8
 #define ARM_PMULL_ASM
-#define GCM_FUNCREF_4BIT
 void GFp_gcm_init_v8(u128 Htable[16], const uint64_t Xi[2]);
 void GFp_gcm_gmult_v8(uint8_t Xi[16], const u128 Htable[16]);
 void GFp_gcm_ghash_v8(uint8_t Xi[16], const u128 Htable[16], const uint8_t *inp,
@@ -325,7 +543,6 @@ void GFp_gcm_ghash_v8(uint8_t Xi[16], const u128 Htable[16], const uint8_t *inp,
 #endif
 
 #if defined(OPENSSL_ARM) && __ARM_MAX_ARCH__ >= 7
-#define GCM_FUNCREF_4BIT
 /* 32-bit ARM also has support for doing GCM with NEON instructions. */
 void GFp_gcm_init_neon(u128 Htable[16], const uint64_t Xi[2]);
 void GFp_gcm_gmult_neon(uint8_t Xi[16], const u128 Htable[16]);
@@ -337,364 +554,416 @@ void GFp_gcm_ghash_neon(uint8_t Xi[16], const u128 Htable[16],
 
 #endif /* GHASH_ASM */
 
-#ifdef GCM_FUNCREF_4BIT
-#undef GCM_MUL
-#define GCM_MUL(ctx, Xi) (*gcm_gmult_p)(ctx->Xi, ctx->Htable)
-#ifdef GHASH
-#undef GHASH
-#define GHASH(ctx, in, len) (*gcm_ghash_p)(ctx->Xi, ctx->Htable, in, len)
-#endif
-#endif
-
-static void gcm128_init_htable(u128 Htable[GCM128_HTABLE_LEN],
-                               const uint64_t H[2]);
-
-void GFp_gcm128_init_serialized(
-    uint8_t serialized_ctx[GCM128_SERIALIZED_LEN], const AES_KEY *key,
-    aes_block_f block) {
-  static const alignas(16) uint8_t ZEROS[16] = { 0 };
-  uint8_t H_be[16];
-  (*block)(ZEROS, H_be, key);
-
-  /* H is stored in host byte order */
-  alignas(16) uint64_t H[2];
-  H[0] = from_be_u64_ptr(H_be);
-  H[1] = from_be_u64_ptr(H_be + 8);
-
-  alignas(16) u128 Htable[GCM128_HTABLE_LEN];
-  gcm128_init_htable(Htable, H);
-
-  OPENSSL_COMPILE_ASSERT(sizeof(Htable) == GCM128_SERIALIZED_LEN,
-                         GCM128_SERIALIZED_LEN_is_wrong);
-
-  memcpy(serialized_ctx, Htable, GCM128_SERIALIZED_LEN);
-}
-
-static void gcm128_init_htable(u128 Htable[GCM128_HTABLE_LEN],
-                               const uint64_t H[2]) {
-  /* Keep in sync with |gcm128_init_gmult_ghash|. */
+/* GHASH_IMPL is one GHASH implementation: the function that computes the
+ * table of multiples of H in the format its other functions expect, and
+ * those functions. */
+typedef struct {
+  void (*init)(u128 Htable[GCM128_HTABLE_LEN], const uint64_t H[2]);
+  gcm128_gmult_f gmult;
+  gcm128_ghash_f ghash;
+  const char *name;
+} GHASH_IMPL;
 
 #if defined(GHASH_ASM_X86_OR_64)
-  if (GFp_gcm_clmul_enabled()) {
-    if (((GFp_ia32cap_P[1] >> 22) & 0x41) == 0x41) { /* AVX+MOVBE */
-      GFp_gcm_init_avx(Htable, H);
-    } else {
-      GFp_gcm_init_clmul(Htable, H);
-    }
-    return;
-  }
+static const GHASH_IMPL kGhashImplClmul = {
+  GFp_gcm_init_clmul, GFp_gcm_gmult_clmul, GFp_gcm_ghash_clmul, "clmul",
+};
 #endif
+
+#if defined(GHASH_ASM_X86)
+static const GHASH_IMPL kGhashImplMmx = {
+  gcm_init_4bit, GFp_gcm_gmult_4bit_mmx, GFp_gcm_ghash_4bit_mmx, "4bit-mmx",
+};
+static const GHASH_IMPL kGhashImplX86 = {
+  gcm_init_4bit, GFp_gcm_gmult_4bit_x86, GFp_gcm_ghash_4bit_x86, "4bit-x86",
+};
+#endif
+
 #if defined(ARM_PMULL_ASM)
-  if (GFp_is_ARMv8_PMULL_capable()) {
-    GFp_gcm_init_v8(Htable, H);
-    return;
-  }
+static const GHASH_IMPL kGhashImplV8 = {
+  GFp_gcm_init_v8, GFp_gcm_gmult_v8, GFp_gcm_ghash_v8, "pmull",
+};
 #endif
-#if defined(OPENSSL_ARM)
-  if (GFp_is_NEON_capable()) {
-    GFp_gcm_init_neon(Htable, H);
-    return;
-  }
+
+#if defined(GHASH_ASM) && defined(OPENSSL_ARM)
+static const GHASH_IMPL kGhashImplNeon = {
+  GFp_gcm_init_neon, GFp_gcm_gmult_neon, GFp_gcm_ghash_neon, "neon",
+};
 #endif
 
-  gcm_init_4bit(Htable, H);
-}
+#if defined(GHASH_ASM_X86)
+#define GHASH_IMPL_DEFAULT kGhashImplX86
+#elif defined(GHASH_NOHW)
+static const GHASH_IMPL kGhashImplNoHw = {
+  gcm_init_nohw, gcm_gmult_nohw, gcm_ghash_nohw, "nohw",
+};
+#define GHASH_IMPL_DEFAULT kGhashImplNoHw
+#else
+static const GHASH_IMPL kGhashImpl4bit = {
+  gcm_init_4bit, GFp_gcm_gmult_4bit, GFp_gcm_ghash_4bit, "4bit",
+};
+#define GHASH_IMPL_DEFAULT kGhashImpl4bit
+#endif
 
-static void gcm128_init_gmult_ghash(GCM128_CONTEXT *ctx) {
-  /* Keep in sync with |gcm128_init_htable|. */
+/* ghash_impl is the implementation chosen by |GFp_gcm128_dispatch_setup|.
+ * The CPU capabilities are only inspected there, once; key setup just copies
+ * the functions from |ghash_impl| into the |GCM128_KEY|. */
+static const GHASH_IMPL *ghash_impl = &GHASH_IMPL_DEFAULT;
 
+void GFp_gcm128_dispatch_setup(void) {
+#if defined(AESNI_GCM)
+  aesni_gcm_sse_stitch = 0;
+#endif
 #if defined(GHASH_ASM_X86_OR_64)
-  if (GFp_gcm_clmul_enabled()) {
-    if (((GFp_ia32cap_P[1] >> 22) & 0x41) == 0x41) { /* AVX+MOVBE */
-      ctx->gmult = GFp_gcm_gmult_avx;
-      ctx->ghash = GFp_gcm_ghash_avx;
-    } else {
-      ctx->gmult = GFp_gcm_gmult_clmul;
-      ctx->ghash = GFp_gcm_ghash_clmul;
-    }
+  if (clmul_capable()) {
+#if defined(AESNI_GCM)
+    aesni_gcm_sse_stitch =
+        (GFp_ia32cap_P[1] & (1 << 19)) != 0; /* check SSE4.1 bit */
+#endif
+    ghash_impl = &kGhashImplClmul;
     return;
   }
 #endif
 #if defined(GHASH_ASM_X86)
   if (GFp_ia32cap_P[0] & (1 << 25)) { /* check SSE bit */
-    ctx->gmult = GFp_gcm_gmult_4bit_mmx;
-    ctx->ghash = GFp_gcm_ghash_4bit_mmx;
-    return;
-  } else {
-    ctx->gmult = GFp_gcm_gmult_4bit_x86;
-    ctx->ghash = GFp_gcm_ghash_4bit_x86;
+    ghash_impl = &kGhashImplMmx;
     return;
   }
 #endif
 #if defined(ARM_PMULL_ASM)
   if (GFp_is_ARMv8_PMULL_capable()) {
-    ctx->gmult = GFp_gcm_gmult_v8;
-    ctx->ghash = GFp_gcm_ghash_v8;
+    ghash_impl = &kGhashImplV8;
     return;
   }
 #endif
-#if defined(OPENSSL_ARM)
+#if defined(GHASH_ASM) && defined(OPENSSL_ARM)
   if (GFp_is_NEON_capable()) {
-    ctx->gmult = GFp_gcm_gmult_neon;
-    ctx->ghash = GFp_gcm_ghash_neon;
+    ghash_impl = &kGhashImplNeon;
     return;
   }
 #endif
 
-#if !defined(GHASH_ASM_X86)
-  ctx->gmult = GFp_gcm_gmult_4bit;
-  ctx->ghash = GFp_gcm_ghash_4bit;
+  /* Without CLMUL, PMULL or NEON, 64-bit targets use the constant-time nohw
+   * code. This is deliberate: on x86-64 the 4-bit asm would be faster (about
+   * 460 MB/s against 370 MB/s), but its table lookups leak H, so it is no
+   * longer used there. Only 32-bit targets still use 4-bit tables. */
+  ghash_impl = &GHASH_IMPL_DEFAULT;
+}
+
+const char *GFp_gcm128_impl_name(void) {
+  return ghash_impl->name;
+}
+
+/* gcm128_init_key_with_h sets up |gcm_key| for GHASH with the key |H|, which
+ * is in host byte order. */
+static void gcm128_init_key_with_h(GCM128_KEY *gcm_key, const uint64_t H[2],
+                                   aes_block_f block, aes_ecb_f ecb) {
+  const GHASH_IMPL *impl = ghash_impl;
+  (*impl->init)(gcm_key->Htable, H);
+  gcm_key->H.hi = H[0];
+  gcm_key->H.lo = H[1];
+  gcm_key->gmult = impl->gmult;
+  gcm_key->ghash = impl->ghash;
+  gcm_key->block = block;
+  gcm_key->ecb = ecb;
+}
+
+int GFp_gcm128_key_use_nohw(GCM128_KEY *gcm_key) {
+#if defined(GHASH_NOHW)
+  const uint64_t H[2] = { gcm_key->H.hi, gcm_key->H.lo };
+  (*kGhashImplNoHw.init)(gcm_key->Htable, H);
+  gcm_key->gmult = kGhashImplNoHw.gmult;
+  gcm_key->ghash = kGhashImplNoHw.ghash;
+  return 1;
+#else
+  (void)gcm_key;
+  return 0;
 #endif
 }
 
-void GFp_gcm128_init(GCM128_CONTEXT *ctx, const AES_KEY *key,
-                        aes_block_f block,
-                        const uint8_t serialized_ctx[GCM128_SERIALIZED_LEN],
-                        const uint8_t *iv) {
-  uint32_t ctr = 1;
+void GFp_gcm128_init_key(GCM128_KEY *gcm_key, const AES_KEY *key,
+                         aes_block_f block, aes_ecb_f ecb) {
+  static const alignas(16) uint8_t ZEROS[16] = { 0 };
+  uint8_t H_be[16];
+  (*block)(ZEROS, H_be, key);
 
-  memset(ctx, 0, sizeof(*ctx));
-  memcpy(ctx->Yi, iv, 12);
-  to_be_u32_ptr(ctx->Yi + 12, ctr);
-  (block)(ctx->Yi, ctx->EK0, key);
-  ++ctr;
-  to_be_u32_ptr(ctx->Yi + 12, ctr);
+  /* H is stored in host byte order */
+  alignas(16) uint64_t H[2];
+  H[0] = from_be_u64_ptr(H_be);
+  H[1] = from_be_u64_ptr(H_be + 8);
+
+  gcm128_init_key_with_h(gcm_key, H, block, ecb);
+}
 
-  OPENSSL_COMPILE_ASSERT(sizeof(ctx->Htable) == GCM128_SERIALIZED_LEN,
-                         GCM128_SERIALIZED_LEN_is_wrong);
+const size_t GFp_GCM128_KEY_LEN = sizeof(GCM128_KEY);
 
-  memcpy(ctx->Htable, serialized_ctx, GCM128_SERIALIZED_LEN);
-  ctx->block = block;
-  gcm128_init_gmult_ghash(ctx);
+void GFp_gcm128_init(GCM128_CONTEXT *ctx, const GCM128_KEY *gcm_key,
+                     const AES_KEY *key, const uint8_t *iv) {
+  alignas(16) uint8_t Y0[16];
+  alignas(16) uint8_t EK0[16];
+  memcpy(Y0, iv, 12);
+  to_be_u32_ptr(Y0 + 12, 1);
+  (*gcm_key->block)(Y0, EK0, key);
+  GFp_gcm128_init_with_ek0(ctx, gcm_key, iv, EK0);
 }
 
-int GFp_gcm128_aad(GCM128_CONTEXT *ctx, const uint8_t *aad, size_t len) {
-  assert(ctx->len.u[0] == 0);
-  assert(ctx->len.u[1] == 0);
+void GFp_gcm128_init_with_ek0(GCM128_CONTEXT *ctx, const GCM128_KEY *gcm_key,
+                              const uint8_t *iv, const uint8_t EK0[16]) {
+  memset(ctx, 0, sizeof(*ctx));
+  memcpy(ctx->Yi, iv, 12);
+  to_be_u32_ptr(ctx->Yi + 12, 2);
+  memcpy(ctx->EK0, EK0, 16);
+  ctx->gcm_key = gcm_key;
+}
 
-#ifdef GCM_FUNCREF_4BIT
-  gcm128_gmult_f gcm_gmult_p = ctx->gmult;
-#endif
+int GFp_gcm128_aad(GCM128_CONTEXT *ctx, const uint8_t *aad, size_t len) {
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
 
-  ctx->len.u[0] = len;
-  if (ctx->len.u[0] > (UINT64_C(1) << 61)) {
+  if (ctx->len.u[1] != 0) {
+    /* All of the AAD must come before any of the plaintext or ciphertext. */
     return 0;
   }
 
-  if (len > 0) {
-    for (;;) {
-      for (size_t i = 0; i < 16 && i < len; ++i) {
-        ctx->Xi[i] ^= aad[i];
-      }
+  uint64_t alen = ctx->len.u[0] + len;
+  if (alen > (UINT64_C(1) << 61) || alen < len) {
+    return 0;
+  }
+  ctx->len.u[0] = alen;
+
+  unsigned n = ctx->ares;
+  if (n) {
+    while (n && len) {
+      ctx->Xi[n] ^= *(aad++);
+      --len;
+      n = (n + 1) % 16;
+    }
+    if (n == 0) {
       GCM_MUL(ctx, Xi);
-      if (len <= 16) {
-        break;
-      }
-      aad += 16;
-      len -= 16;
+    } else {
+      ctx->ares = n;
+      return 1;
     }
   }
 
+  size_t bulk = len & kSizeTWithoutLower4Bits;
+  if (bulk != 0) {
+    GHASH(ctx, aad, bulk);
+    aad += bulk;
+    len -= bulk;
+  }
+
+  if (len) {
+    n = (unsigned int)len;
+    for (size_t i = 0; i < len; ++i) {
+      ctx->Xi[i] ^= aad[i];
+    }
+  }
+
+  ctx->ares = n;
   return 1;
 }
 
+/* GCM128_BATCH_BLOCKS is the number of counter blocks that
+ * |gcm128_ctr_xor| encrypts at a time. */
+#define GCM128_BATCH_BLOCKS 8
+
+/* gcm128_keystream sets |ks| to the encryptions of the next |blocks| counter
+ * blocks and advances the counter in |ctx->Yi| past them. The blocks are
+ * encrypted together when the key has a multi-block function. */
+static void gcm128_keystream(GCM128_CONTEXT *ctx, const AES_KEY *key,
+                             uint8_t *ks, size_t blocks) {
+  uint32_t ctr = from_be_u32_ptr(ctx->Yi + 12);
+  for (size_t i = 0; i < blocks; ++i) {
+    memcpy(ks + (16 * i), ctx->Yi, 12);
+    to_be_u32_ptr(ks + (16 * i) + 12, ctr + (uint32_t)i);
+  }
+  to_be_u32_ptr(ctx->Yi + 12, ctr + (uint32_t)blocks);
+
+  if (ctx->gcm_key->ecb != NULL) {
+    (*ctx->gcm_key->ecb)(ks, ks, blocks, key);
+  } else {
+    for (size_t i = 0; i < blocks; ++i) {
+      (*ctx->gcm_key->block)(ks + (16 * i), ks + (16 * i), key);
+    }
+  }
+}
+
+/* gcm128_ctr_xor encrypts or decrypts |blocks| whole blocks from |in| to
+ * |out| in CTR mode, a batch of keystream at a time and a word at a time.
+ * |in| and |out| may be equal. */
+static void gcm128_ctr_xor(GCM128_CONTEXT *ctx, const AES_KEY *key,
+                           const uint8_t *in, uint8_t *out, size_t blocks) {
+  alignas(16) uint8_t ks[GCM128_BATCH_BLOCKS * 16];
+  while (blocks > 0) {
+    size_t todo = blocks < GCM128_BATCH_BLOCKS ? blocks : GCM128_BATCH_BLOCKS;
+    gcm128_keystream(ctx, key, ks, todo);
+    for (size_t i = 0; i < todo * 16; i += sizeof(size_t)) {
+      size_t a, b;
+      memcpy(&a, in + i, sizeof(a));
+      memcpy(&b, ks + i, sizeof(b));
+      a ^= b;
+      memcpy(out + i, &a, sizeof(a));
+    }
+    in += todo * 16;
+    out += todo * 16;
+    blocks -= todo;
+  }
+}
+
 int GFp_gcm128_encrypt(GCM128_CONTEXT *ctx, const AES_KEY *key,
                           const unsigned char *in, unsigned char *out,
                           size_t len) {
-  assert(ctx->len.u[1] == 0);
-
-  unsigned int ctr;
-  size_t i;
-  aes_block_f block = ctx->block;
-#ifdef GCM_FUNCREF_4BIT
-  gcm128_gmult_f gcm_gmult_p = ctx->gmult;
-#ifdef GHASH
-  gcm128_ghash_f gcm_ghash_p = ctx->ghash;
-#endif
-#endif
+  unsigned int n;
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
 
-  ctx->len.u[1] = len;
-  if (ctx->len.u[1] > ((UINT64_C(1) << 36) - 32)) {
+  uint64_t mlen = ctx->len.u[1] + len;
+  if (mlen > ((UINT64_C(1) << 36) - 32) || mlen < len) {
     return 0;
   }
+  ctx->len.u[1] = mlen;
 
-  ctr = from_be_u32_ptr(ctx->Yi + 12);
+  if (ctx->ares) {
+    /* First call to encrypt finalizes GHASH(AAD) */
+    GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
+  }
 
-#if defined(GHASH) && defined(GHASH_CHUNK)
-  while (len >= GHASH_CHUNK) {
-    size_t j = GHASH_CHUNK;
-
-    while (j) {
-      (*block)(ctx->Yi, ctx->EKi, key);
-      ++ctr;
-      to_be_u32_ptr(ctx->Yi + 12, ctr);
-      for (i = 0; i < 16; ++i) {
-        out[i] = in[i] ^ ctx->EKi[i];
-      }
-      out += 16;
-      in += 16;
-      j -= 16;
+  n = ctx->mres;
+  if (n) {
+    while (n && len) {
+      ctx->Xi[n] ^= *(out++) = *(in++) ^ ctx->EKi[n];
+      --len;
+      n = (n + 1) % 16;
     }
-    GHASH(ctx, out - GHASH_CHUNK, GHASH_CHUNK);
-    len -= GHASH_CHUNK;
-  }
-  i = len & kSizeTWithoutLower4Bits;
-  if (i != 0) {
-    size_t j = i;
-
-    while (len >= 16) {
-      (*block)(ctx->Yi, ctx->EKi, key);
-      ++ctr;
-      to_be_u32_ptr(ctx->Yi + 12, ctr);
-      for (i = 0; i < 16; ++i) {
-        out[i] = in[i] ^ ctx->EKi[i];
-      }
-      out += 16;
-      in += 16;
-      len -= 16;
+    if (n == 0) {
+      GCM_MUL(ctx, Xi);
+    } else {
+      ctx->mres = n;
+      return 1;
     }
-    GHASH(ctx, out - j, j);
   }
-#else
+
   while (len >= 16) {
-    (*block)(ctx->Yi, ctx->EKi, key);
-    ++ctr;
-    to_be_u32_ptr(ctx->Yi + 12, ctr);
-    for (i = 0; i < 16; ++i) {
-      ctx->Xi[i] ^= out[i] = in[i] ^ ctx->EKi[i];
-    }
-    GCM_MUL(ctx, Xi);
-    out += 16;
-    in += 16;
-    len -= 16;
+    size_t chunk = len < GHASH_CHUNK ? (len & kSizeTWithoutLower4Bits)
+                                     : GHASH_CHUNK;
+    gcm128_ctr_xor(ctx, key, in, out, chunk / 16);
+    GHASH(ctx, out, chunk);
+    in += chunk;
+    out += chunk;
+    len -= chunk;
   }
-#endif
   if (len) {
-    (*block)(ctx->Yi, ctx->EKi, key);
-    ++ctr;
-    to_be_u32_ptr(ctx->Yi + 12, ctr);
-    size_t n = 0;
+    gcm128_keystream(ctx, key, ctx->EKi, 1);
     while (len--) {
       ctx->Xi[n] ^= out[n] = in[n] ^ ctx->EKi[n];
       ++n;
     }
-    GCM_MUL(ctx, Xi);
   }
 
+  ctx->mres = n;
   return 1;
 }
 
 int GFp_gcm128_decrypt(GCM128_CONTEXT *ctx, const AES_KEY *key,
                           const unsigned char *in, unsigned char *out,
                           size_t len) {
-  assert(ctx->len.u[1] == 0);
-
-  unsigned int ctr;
-  size_t i;
-  aes_block_f block = ctx->block;
-#ifdef GCM_FUNCREF_4BIT
-  gcm128_gmult_f gcm_gmult_p = ctx->gmult;
-#ifdef GHASH
-  gcm128_ghash_f gcm_ghash_p = ctx->ghash;
-#endif
-#endif
+  unsigned int n;
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
 
-  ctx->len.u[1] = len;
-  if (ctx->len.u[1] > ((UINT64_C(1) << 36) - 32)) {
+  uint64_t mlen = ctx->len.u[1] + len;
+  if (mlen > ((UINT64_C(1) << 36) - 32) || mlen < len) {
     return 0;
   }
+  ctx->len.u[1] = mlen;
 
-  ctr = from_be_u32_ptr(ctx->Yi + 12);
-
-#if defined(GHASH) && defined(GHASH_CHUNK)
-  while (len >= GHASH_CHUNK) {
-    size_t j = GHASH_CHUNK;
+  if (ctx->ares) {
+    /* First call to decrypt finalizes GHASH(AAD) */
+    GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
+  }
 
-    GHASH(ctx, in, GHASH_CHUNK);
-    while (j) {
-      (*block)(ctx->Yi, ctx->EKi, key);
-      ++ctr;
-      to_be_u32_ptr(ctx->Yi + 12, ctr);
-      for (i = 0; i < 16; ++i) {
-        out[i] = in[i] ^ ctx->EKi[i];
-      }
-      out += 16;
-      in += 16;
-      j -= 16;
+  n = ctx->mres;
+  if (n) {
+    while (n && len) {
+      uint8_t c = *(in++);
+      *(out++) = c ^ ctx->EKi[n];
+      ctx->Xi[n] ^= c;
+      --len;
+      n = (n + 1) % 16;
     }
-    len -= GHASH_CHUNK;
-  }
-  i = len & kSizeTWithoutLower4Bits;
-  if (i != 0) {
-    GHASH(ctx, in, i);
-    while (len >= 16) {
-      (*block)(ctx->Yi, ctx->EKi, key);
-      ++ctr;
-      to_be_u32_ptr(ctx->Yi + 12, ctr);
-      for (i = 0; i < 16; ++i) {
-        out[i] = in[i] ^ ctx->EKi[i];
-      }
-      out += 16;
-      in += 16;
-      len -= 16;
+    if (n == 0) {
+      GCM_MUL(ctx, Xi);
+    } else {
+      ctx->mres = n;
+      return 1;
     }
   }
-#else
+
   while (len >= 16) {
-    (*block)(ctx->Yi, ctx->EKi, key);
-    ++ctr;
-    to_be_u32_ptr(ctx->Yi + 12, ctr);
-    for (i = 0; i < 16; ++i) {
-      size_t c = in[i];
-      out[i] = c ^ ctx->EKi[i];
-      ctx->Xi[i] ^= c;
-    }
-    GCM_MUL(ctx, Xi);
-    out += 16;
-    in += 16;
-    len -= 16;
+    size_t chunk = len < GHASH_CHUNK ? (len & kSizeTWithoutLower4Bits)
+                                     : GHASH_CHUNK;
+    GHASH(ctx, in, chunk);
+    gcm128_ctr_xor(ctx, key, in, out, chunk / 16);
+    in += chunk;
+    out += chunk;
+    len -= chunk;
   }
-#endif
   if (len) {
-    (*block)(ctx->Yi, ctx->EKi, key);
-    ++ctr;
-    to_be_u32_ptr(ctx->Yi + 12, ctr);
-    size_t n = 0;
+    gcm128_keystream(ctx, key, ctx->EKi, 1);
     while (len--) {
       uint8_t c = in[n];
       ctx->Xi[n] ^= c;
       out[n] = c ^ ctx->EKi[n];
       ++n;
     }
-    GCM_MUL(ctx, Xi);
   }
 
+  ctx->mres = n;
   return 1;
 }
 
 int GFp_gcm128_encrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
                                 const uint8_t *in, uint8_t *out, size_t len,
                                 aes_ctr_f stream) {
-  assert(ctx->len.u[1] == 0);
+  unsigned int n, ctr;
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
 
-  unsigned int ctr;
-#ifdef GCM_FUNCREF_4BIT
-  gcm128_gmult_f gcm_gmult_p = ctx->gmult;
-#ifdef GHASH
-  gcm128_ghash_f gcm_ghash_p = ctx->ghash;
-#endif
-#endif
-
-  ctx->len.u[1] = len;
-  if (ctx->len.u[1] > ((UINT64_C(1) << 36) - 32)) {
+  uint64_t mlen = ctx->len.u[1] + len;
+  if (mlen > ((UINT64_C(1) << 36) - 32) || mlen < len) {
     return 0;
   }
+  ctx->len.u[1] = mlen;
+
+  if (ctx->ares) {
+    /* First call to encrypt finalizes GHASH(AAD) */
+    GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
+  }
+
+  n = ctx->mres;
+  if (n) {
+    while (n && len) {
+      ctx->Xi[n] ^= *(out++) = *(in++) ^ ctx->EKi[n];
+      --len;
+      n = (n + 1) % 16;
+    }
+    if (n == 0) {
+      GCM_MUL(ctx, Xi);
+    } else {
+      ctx->mres = n;
+      return 1;
+    }
+  }
 
 #if defined(AESNI_GCM)
-  if (aesni_gcm_enabled(ctx, stream)) {
-    /* |aesni_gcm_encrypt| may not process all the input given to it. It may
-     * not process *any* of its input if it is deemed too small. */
-    size_t bulk = GFp_aesni_gcm_encrypt(in, out, len, key, ctx->Yi, ctx->Xi);
+  if (aesni_gcm_sse_enabled(ctx, stream)) {
+    /* |GFp_aesni_gcm_sse_encrypt| processes whole 64-byte chunks only. */
+    size_t bulk = GFp_aesni_gcm_sse_encrypt(in, out, len, key, ctx->Yi,
+                                            ctx->gcm_key->Htable, ctx->Xi);
     in += bulk;
     out += bulk;
     len -= bulk;
@@ -703,7 +972,6 @@ int GFp_gcm128_encrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
 
   ctr = from_be_u32_ptr(ctx->Yi + 12);
 
-#if defined(GHASH)
   while (len >= GHASH_CHUNK) {
     (*stream)(in, out, GHASH_CHUNK / 16, key, ctx->Yi);
     ctr += GHASH_CHUNK / 16;
@@ -713,7 +981,6 @@ int GFp_gcm128_encrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
     in += GHASH_CHUNK;
     len -= GHASH_CHUNK;
   }
-#endif
   size_t i = len & kSizeTWithoutLower4Bits;
   if (i != 0) {
     size_t j = i / 16;
@@ -723,57 +990,64 @@ int GFp_gcm128_encrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
     to_be_u32_ptr(ctx->Yi + 12, ctr);
     in += i;
     len -= i;
-#if defined(GHASH)
     GHASH(ctx, out, i);
     out += i;
-#else
-    while (j--) {
-      for (i = 0; i < 16; ++i) {
-        ctx->Xi[i] ^= out[i];
-      }
-      GCM_MUL(ctx, Xi);
-      out += 16;
-    }
-#endif
   }
   if (len) {
-    (*ctx->block)(ctx->Yi, ctx->EKi, key);
+    (*ctx->gcm_key->block)(ctx->Yi, ctx->EKi, key);
     ++ctr;
     to_be_u32_ptr(ctx->Yi + 12, ctr);
-    size_t n = 0;
     while (len--) {
       ctx->Xi[n] ^= out[n] = in[n] ^ ctx->EKi[n];
       ++n;
     }
-    GCM_MUL(ctx, Xi);
   }
 
+  ctx->mres = n;
   return 1;
 }
 
 int GFp_gcm128_decrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
                                 const uint8_t *in, uint8_t *out, size_t len,
                                 aes_ctr_f stream) {
-  assert(ctx->len.u[1] == 0);
+  unsigned int n, ctr;
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
 
-  unsigned int ctr;
-#ifdef GCM_FUNCREF_4BIT
-  gcm128_gmult_f gcm_gmult_p = ctx->gmult;
-#ifdef GHASH
-  gcm128_ghash_f gcm_ghash_p = ctx->ghash;
-#endif
-#endif
-
-  ctx->len.u[1] = len;
-  if (ctx->len.u[1] > ((UINT64_C(1) << 36) - 32)) {
+  uint64_t mlen = ctx->len.u[1] + len;
+  if (mlen > ((UINT64_C(1) << 36) - 32) || mlen < len) {
     return 0;
   }
+  ctx->len.u[1] = mlen;
+
+  if (ctx->ares) {
+    /* First call to decrypt finalizes GHASH(AAD) */
+    GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
+  }
+
+  n = ctx->mres;
+  if (n) {
+    while (n && len) {
+      uint8_t c = *(in++);
+      *(out++) = c ^ ctx->EKi[n];
+      ctx->Xi[n] ^= c;
+      --len;
+      n = (n + 1) % 16;
+    }
+    if (n == 0) {
+      GCM_MUL(ctx, Xi);
+    } else {
+      ctx->mres = n;
+      return 1;
+    }
+  }
 
 #if defined(AESNI_GCM)
-  if (aesni_gcm_enabled(ctx, stream)) {
-    /* |aesni_gcm_decrypt| may not process all the input given to it. It may
-     * not process *any* of its input if it is deemed too small. */
-    size_t bulk = GFp_aesni_gcm_decrypt(in, out, len, key, ctx->Yi, ctx->Xi);
+  if (aesni_gcm_sse_enabled(ctx, stream)) {
+    /* |GFp_aesni_gcm_sse_decrypt| processes whole 64-byte chunks only. */
+    size_t bulk = GFp_aesni_gcm_sse_decrypt(in, out, len, key, ctx->Yi,
+                                            ctx->gcm_key->Htable, ctx->Xi);
     in += bulk;
     out += bulk;
     len -= bulk;
@@ -782,7 +1056,6 @@ int GFp_gcm128_decrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
 
   ctr = from_be_u32_ptr(ctx->Yi + 12);
 
-#if defined(GHASH)
   while (len >= GHASH_CHUNK) {
     GHASH(ctx, in, GHASH_CHUNK);
     (*stream)(in, out, GHASH_CHUNK / 16, key, ctx->Yi);
@@ -792,25 +1065,11 @@ int GFp_gcm128_decrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
     in += GHASH_CHUNK;
     len -= GHASH_CHUNK;
   }
-#endif
   size_t i = len & kSizeTWithoutLower4Bits;
   if (i != 0) {
     size_t j = i / 16;
 
-#if defined(GHASH)
     GHASH(ctx, in, i);
-#else
-    while (j--) {
-      size_t k;
-      for (k = 0; k < 16; ++k) {
-        ctx->Xi[k] ^= in[k];
-      }
-      GCM_MUL(ctx, Xi);
-      in += 16;
-    }
-    j = i / 16;
-    in -= i;
-#endif
     (*stream)(in, out, j, key, ctx->Yi);
     ctr += (unsigned int)j;
     to_be_u32_ptr(ctx->Yi + 12, ctr);
@@ -819,28 +1078,209 @@ int GFp_gcm128_decrypt_ctr32(GCM128_CONTEXT *ctx, const AES_KEY *key,
     len -= i;
   }
   if (len) {
-    (*ctx->block)(ctx->Yi, ctx->EKi, key);
+    (*ctx->gcm_key->block)(ctx->Yi, ctx->EKi, key);
     ++ctr;
     to_be_u32_ptr(ctx->Yi + 12, ctr);
-    size_t n = 0;
     while (len--) {
       uint8_t c = in[n];
       ctx->Xi[n] ^= c;
       out[n] = c ^ ctx->EKi[n];
       ++n;
     }
+  }
+
+  ctx->mres = n;
+  return 1;
+}
+
+int GFp_gcm128_encrypt_keystream(GCM128_CONTEXT *ctx, const uint8_t *in,
+                                 uint8_t *out, size_t len,
+                                 const uint8_t *keystream) {
+  assert(ctx->len.u[1] == 0);
+
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
+
+  ctx->len.u[1] = len;
+  if (ctx->len.u[1] > ((UINT64_C(1) << 36) - 32)) {
+    return 0;
+  }
+
+  if (ctx->ares) {
+    /* First call to encrypt finalizes GHASH(AAD) */
+    GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
+  }
+
+  unsigned int ctr = from_be_u32_ptr(ctx->Yi + 12);
+  ctr += (unsigned int)((len + 15) / 16);
+  to_be_u32_ptr(ctx->Yi + 12, ctr);
+
+  size_t i = len & kSizeTWithoutLower4Bits;
+  if (i != 0) {
+    for (size_t k = 0; k < i; ++k) {
+      out[k] = in[k] ^ keystream[k];
+    }
+    GHASH(ctx, out, i);
+    in += i;
+    out += i;
+    keystream += i;
+    len -= i;
+  }
+  for (size_t n = 0; n < len; ++n) {
+    ctx->Xi[n] ^= out[n] = in[n] ^ keystream[n];
+  }
+
+  ctx->mres = (unsigned int)len;
+  return 1;
+}
+
+int GFp_gcm128_decrypt_keystream(GCM128_CONTEXT *ctx, const uint8_t *in,
+                                 uint8_t *out, size_t len,
+                                 const uint8_t *keystream) {
+  assert(ctx->len.u[1] == 0);
+
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+  gcm128_ghash_f gcm_ghash_p = ctx->gcm_key->ghash;
+
+  ctx->len.u[1] = len;
+  if (ctx->len.u[1] > ((UINT64_C(1) << 36) - 32)) {
+    return 0;
+  }
+
+  if (ctx->ares) {
+    /* First call to decrypt finalizes GHASH(AAD) */
+    GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
+  }
+
+  unsigned int ctr = from_be_u32_ptr(ctx->Yi + 12);
+  ctr += (unsigned int)((len + 15) / 16);
+  to_be_u32_ptr(ctx->Yi + 12, ctr);
+
+  size_t i = len & kSizeTWithoutLower4Bits;
+  if (i != 0) {
+    GHASH(ctx, in, i);
+    for (size_t k = 0; k < i; ++k) {
+      out[k] = in[k] ^ keystream[k];
+    }
+    in += i;
+    out += i;
+    keystream += i;
+    len -= i;
+  }
+  for (size_t n = 0; n < len; ++n) {
+    uint8_t c = in[n];
+    ctx->Xi[n] ^= c;
+    out[n] = c ^ keystream[n];
+  }
+
+  ctx->mres = (unsigned int)len;
+  return 1;
+}
+
+/* gcm128_mul sets |*Z| to |*X| * |*Y| in GF(2^128), with the GCM bit order,
+ * one bit of |*X| at a time. It doesn't use a table, so it works for any |*Y|
+ * and it runs in constant time, but it is slow; it is only used to combine
+ * the results of |GFp_gcm128_fork|ed chunks. */
+static void gcm128_mul(u128 *Z, const u128 *X, const u128 *Y) {
+  u128 V = *Y;
+  u128 R = { 0, 0 };
+  for (unsigned i = 0; i < 128; ++i) {
+    uint64_t word = i < 64 ? X->hi : X->lo;
+    uint64_t mask = 0 - ((word >> (63 - (i % 64))) & 1);
+    R.hi ^= V.hi & mask;
+    R.lo ^= V.lo & mask;
+    REDUCE1BIT(V);
+  }
+  *Z = R;
+}
+
+/* gcm128_pow sets |*Z| to |*X| raised to the power |n|. |n| is public. */
+static void gcm128_pow(u128 *Z, const u128 *X, uint64_t n) {
+  u128 R = { UINT64_C(1) << 63, 0 }; /* One, in the GCM bit order. */
+  u128 P = *X;
+  while (n != 0) {
+    if (n & 1) {
+      gcm128_mul(&R, &R, &P);
+    }
+    n >>= 1;
+    if (n != 0) {
+      gcm128_mul(&P, &P, &P);
+    }
+  }
+  *Z = R;
+}
+
+void GFp_gcm128_fork(GCM128_CONTEXT *chunk, const GCM128_CONTEXT *ctx,
+                     uint64_t block_offset) {
+  assert(ctx->mres == 0);
+
+  memcpy(chunk, ctx, sizeof(*chunk));
+  memset(chunk->Xi, 0, sizeof(chunk->Xi));
+  chunk->len.u[0] = 0;
+  chunk->len.u[1] = 0;
+  chunk->mres = 0;
+  chunk->ares = 0;
+
+  uint32_t ctr = from_be_u32_ptr(ctx->Yi + 12);
+  ctr += (uint32_t)block_offset;
+  to_be_u32_ptr(chunk->Yi + 12, ctr);
+}
+
+int GFp_gcm128_join(GCM128_CONTEXT *ctx, const GCM128_CONTEXT *chunk) {
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+
+  assert(chunk->gcm_key == ctx->gcm_key);
+  assert(chunk->ares == 0);
+
+  if (ctx->mres != 0) {
+    /* Only the last chunk may end in a partial block. */
+    return 0;
+  }
+
+  uint64_t mlen = ctx->len.u[1] + chunk->len.u[1];
+  if (mlen > ((UINT64_C(1) << 36) - 32) || mlen < chunk->len.u[1]) {
+    return 0;
+  }
+  ctx->len.u[1] = mlen;
+
+  if (ctx->ares) {
     GCM_MUL(ctx, Xi);
+    ctx->ares = 0;
   }
 
+  /* The chunk's GHASH started from zero; the serial computation would have
+   * started from |ctx->Xi|, which contributes |ctx->Xi| * H^n, where |n| is
+   * the number of whole blocks in the chunk. A trailing partial block has
+   * been added to |chunk->Xi| but not multiplied by H, just as it would have
+   * been in |ctx->Xi|. */
+  u128 Hn;
+  gcm128_pow(&Hn, &ctx->gcm_key->H, chunk->len.u[1] / 16);
+  u128 X;
+  X.hi = from_be_u64_ptr(ctx->Xi);
+  X.lo = from_be_u64_ptr(ctx->Xi + 8);
+  gcm128_mul(&X, &X, &Hn);
+  to_be_u64_ptr(ctx->Xi, X.hi);
+  to_be_u64_ptr(ctx->Xi + 8, X.lo);
+  for (size_t i = 0; i < 16; ++i) {
+    ctx->Xi[i] ^= chunk->Xi[i];
+  }
+
+  memcpy(ctx->Yi, chunk->Yi, sizeof(ctx->Yi));
+  memcpy(ctx->EKi, chunk->EKi, sizeof(ctx->EKi));
+  ctx->mres = chunk->mres;
   return 1;
 }
 
 void GFp_gcm128_tag(GCM128_CONTEXT *ctx, uint8_t tag[16]) {
   uint64_t alen = ctx->len.u[0] << 3;
   uint64_t clen = ctx->len.u[1] << 3;
-#ifdef GCM_FUNCREF_4BIT
-  gcm128_gmult_f gcm_gmult_p = ctx->gmult;
-#endif
+  gcm128_gmult_f gcm_gmult_p = ctx->gcm_key->gmult;
+
+  if (ctx->mres || ctx->ares) {
+    GCM_MUL(ctx, Xi);
+  }
 
   uint8_t a_c_len[16];
   to_be_u64_ptr(a_c_len, alen);
@@ -855,11 +1295,87 @@ void GFp_gcm128_tag(GCM128_CONTEXT *ctx, uint8_t tag[16]) {
   }
 }
 
+/* POLYVAL is computed with the GHASH implementation, using the identity
+ *
+ *   POLYVAL(H, X_1, ..., X_n) =
+ *       ByteReverse(GHASH(mulX_GHASH(ByteReverse(H)), ByteReverse(X_1), ...,
+ *                         ByteReverse(X_n)))
+ *
+ * from RFC 8452, Appendix A. The accumulator is kept in the GHASH domain, i.e.
+ * byte-reversed, until |GFp_polyval_finish|. */
+
+static void polyval_byte_reverse(uint8_t out[16], const uint8_t in[16]) {
+  for (size_t i = 0; i < 16; ++i) {
+    out[i] = in[15 - i];
+  }
+}
+
+void GFp_polyval_init_key(GCM128_KEY *key, const uint8_t H[16]) {
+  uint8_t H_rev[16];
+  polyval_byte_reverse(H_rev, H);
+
+  /* mulX_GHASH. */
+  u128 V;
+  V.hi = from_be_u64_ptr(H_rev);
+  V.lo = from_be_u64_ptr(H_rev + 8);
+  REDUCE1BIT(V);
+
+  alignas(16) uint64_t H_ghash[2];
+  H_ghash[0] = V.hi;
+  H_ghash[1] = V.lo;
+  gcm128_init_key_with_h(key, H_ghash, NULL, NULL);
+}
+
+void GFp_polyval_init(POLYVAL_CONTEXT *ctx, const GCM128_KEY *key) {
+  memset(ctx->S, 0, sizeof(ctx->S));
+  ctx->key = key;
+}
+
+/* POLYVAL_CHUNK is the number of bytes that are byte-reversed into a buffer
+ * on the stack and then passed to the GHASH function together. */
+#define POLYVAL_CHUNK (32 * 16)
+
+void GFp_polyval_update_padded(POLYVAL_CONTEXT *ctx, const uint8_t *in,
+                               size_t len) {
+  alignas(16) uint8_t buf[POLYVAL_CHUNK];
+
+  while (len > 0) {
+    size_t todo = len < sizeof(buf) ? len : sizeof(buf);
+    size_t blocks = (todo + 15) / 16;
+    for (size_t i = 0; i < blocks; ++i) {
+      const uint8_t *block = in + (i * 16);
+      uint8_t padded[16];
+      if (todo - (i * 16) < 16) {
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, block, todo - (i * 16));
+        block = padded;
+      }
+      polyval_byte_reverse(buf + (i * 16), block);
+    }
+    (*ctx->key->ghash)(ctx->S, ctx->key->Htable, buf, blocks * 16);
+    in += todo;
+    len -= todo;
+  }
+}
+
+void GFp_polyval_finish(const POLYVAL_CONTEXT *ctx, uint8_t out[16]) {
+  polyval_byte_reverse(out, ctx->S);
+}
+
 #if defined(OPENSSL_X86) || defined(OPENSSL_X86_64)
 int GFp_gcm_clmul_enabled(void) {
-#ifdef GHASH_ASM
-  return GFp_ia32cap_P[0] & (1 << 24) &&  /* check FXSR bit */
-    GFp_ia32cap_P[1] & (1 << 1);  /* check PCLMULQDQ bit */
+#if defined(GHASH_ASM_X86_OR_64)
+  return ghash_impl == &kGhashImplClmul;
+#else
+  return 0;
+#endif
+}
+#endif
+
+#if defined(OPENSSL_X86_64)
+int GFp_gcm_aesni_sse_stitch_enabled(void) {
+#if defined(AESNI_GCM)
+  return ghash_impl == &kGhashImplClmul && aesni_gcm_sse_stitch;
 #else
   return 0;
 #endif
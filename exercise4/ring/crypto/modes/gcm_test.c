@@ -0,0 +1,307 @@
+/* Copyright (c) 2016, Google Inc.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/aes.h>
+
+#include "internal.h"
+
+
+int bssl_gcm_test_main(void);
+
+/* These are provided by aes.c. */
+int GFp_aes_nohw_set_encrypt_key(const uint8_t *key, unsigned bits,
+                                 AES_KEY *aeskey);
+void GFp_aes_nohw_encrypt(const uint8_t *in, uint8_t *out, const AES_KEY *key);
+void GFp_aes_nohw_ecb_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                     size_t blocks, const AES_KEY *key);
+
+/* The AES implementations that the tests use. The nohw one has a
+ * multi-block function, so with it |GFp_gcm128_encrypt| and
+ * |GFp_gcm128_decrypt| encrypt batches of counter blocks at a time instead
+ * of one block at a time. */
+typedef struct {
+  int (*set_key)(const uint8_t *key, unsigned bits, AES_KEY *aeskey);
+  aes_block_f block;
+  aes_ecb_f ecb;
+  const char *name;
+} AES_TEST_IMPL;
+
+static const AES_TEST_IMPL kAesImpls[] = {
+  { GFp_AES_set_encrypt_key, GFp_AES_encrypt, NULL, "table AES" },
+  { GFp_aes_nohw_set_encrypt_key, GFp_aes_nohw_encrypt,
+    GFp_aes_nohw_ecb_encrypt_blocks, "nohw AES" },
+};
+
+/* Test case 4 from the GCM specification. The 60-byte message is long enough
+ * that the GHASH implementation's multi-block function is used, so this
+ * catches a wrong |ghash| even where the single-block |gmult| is right. On
+ * 32-bit targets without assembly that is |GFp_gcm_ghash_4bit|, which used to
+ * truncate its output words to bytes. */
+static const uint8_t kKey[16] = {
+  0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+  0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+};
+
+static const uint8_t kIV[12] = {
+  0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+};
+
+static const uint8_t kAD[20] = {
+  0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed,
+  0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xab, 0xad, 0xda, 0xd2,
+};
+
+static const uint8_t kPlaintext[60] = {
+  0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5,
+  0xaf, 0xf5, 0x26, 0x9a, 0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+  0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72, 0x1c, 0x3c, 0x0c, 0x95,
+  0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+  0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39,
+};
+
+static const uint8_t kCiphertext[60] = {
+  0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7,
+  0x84, 0xd0, 0xd4, 0x9c, 0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0,
+  0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e, 0x21, 0xd5, 0x14, 0xb2,
+  0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+  0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91,
+};
+
+static const uint8_t kTag[16] = {
+  0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb,
+  0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47,
+};
+
+/* The 191-byte messages below are from aes_128_gcm_tests.txt and
+ * aes_256_gcm_tests.txt. They are eleven whole blocks, more than one batch of
+ * the counter blocks that |GFp_gcm128_encrypt| and |GFp_gcm128_decrypt|
+ * encrypt together, and a partial block. */
+static const uint8_t kLong128Key[16] = {
+  0xe7, 0x88, 0xcc, 0xb0, 0x93, 0x0c, 0x60, 0xe0,
+  0xb5, 0x41, 0x38, 0xc3, 0x31, 0x93, 0x0d, 0xd5,
+};
+
+static const uint8_t kLong128IV[12] = {
+  0xe1, 0xff, 0xc1, 0x80, 0x6d, 0xfc, 0x98, 0xe2, 0xe0, 0x1f, 0x29, 0x4e,
+};
+
+static const uint8_t kLong128AD[13] = {
+  0x7c, 0x1f, 0x4d, 0xc5, 0x67, 0x43, 0x6f, 0x14, 0x7d, 0x1b, 0xa6, 0x1e,
+  0x33,
+};
+
+static const uint8_t kLong128Plaintext[191] = {
+  0xfa, 0x7d, 0x11, 0x92, 0x45, 0xcf, 0x6c, 0xfd, 0xe9, 0x57, 0x04, 0x1e,
+  0x3f, 0x84, 0x46, 0x4c, 0x26, 0x56, 0xf8, 0xea, 0x18, 0x82, 0xab, 0x67,
+  0xfb, 0x54, 0xf1, 0x06, 0xb8, 0x57, 0x4e, 0x61, 0x8c, 0xb6, 0xee, 0xae,
+  0x20, 0x60, 0x1b, 0xbf, 0x5a, 0xed, 0x6c, 0xca, 0xf0, 0x43, 0xbd, 0xed,
+  0xc0, 0xf7, 0xe1, 0x6f, 0xe2, 0x73, 0x18, 0xc6, 0x79, 0xdc, 0x41, 0x5c,
+  0x4c, 0xb0, 0xcf, 0x10, 0x18, 0x31, 0x7d, 0x7e, 0xa2, 0x84, 0xc0, 0xfe,
+  0x8e, 0x98, 0xff, 0x6c, 0xf1, 0xc7, 0x83, 0xac, 0xa7, 0x3d, 0x2f, 0xec,
+  0x65, 0x1c, 0xef, 0xa6, 0x8d, 0x5b, 0xf1, 0x6c, 0xc4, 0x71, 0x96, 0x62,
+  0x44, 0xb5, 0x25, 0x8a, 0xf1, 0x83, 0x43, 0xc2, 0x2d, 0x1e, 0x26, 0x8c,
+  0x6a, 0x58, 0x83, 0x93, 0x83, 0xf2, 0x4b, 0xe9, 0xca, 0xc3, 0x19, 0x10,
+  0xe1, 0x9a, 0x69, 0xbe, 0x48, 0xe3, 0x88, 0x5f, 0xba, 0x0b, 0x4e, 0x5a,
+  0x36, 0xa4, 0x8d, 0x13, 0xde, 0x48, 0x48, 0xb3, 0x83, 0x3d, 0xa3, 0xa9,
+  0xfc, 0xdc, 0x9c, 0xee, 0x3a, 0xb0, 0x7d, 0x0b, 0x1b, 0x60, 0x0f, 0xdb,
+  0x00, 0x4e, 0x8f, 0x10, 0x20, 0xfb, 0x61, 0x76, 0x9a, 0x30, 0x86, 0xf9,
+  0x4b, 0xdd, 0xcd, 0x68, 0x64, 0xbf, 0xcb, 0xf6, 0xba, 0xc3, 0x8b, 0x84,
+  0xdb, 0x2d, 0x04, 0x9f, 0xe4, 0x77, 0x4d, 0x4a, 0x14, 0xf9, 0x92,
+};
+
+static const uint8_t kLong128Ciphertext[191] = {
+  0xe6, 0x00, 0x18, 0xfc, 0xa1, 0x17, 0xd0, 0x76, 0xca, 0x01, 0x34, 0x8d,
+  0x42, 0x24, 0xfb, 0x05, 0xeb, 0x29, 0x80, 0x06, 0xe6, 0xa7, 0x0c, 0x20,
+  0x06, 0x20, 0x10, 0xd0, 0x92, 0x9b, 0xdf, 0xad, 0x92, 0x58, 0x60, 0xef,
+  0x1a, 0x12, 0xea, 0x4f, 0x9b, 0x7b, 0x3e, 0xba, 0x02, 0x22, 0x71, 0x31,
+  0xbb, 0xcb, 0x64, 0xba, 0xb9, 0xa6, 0xec, 0x04, 0xb3, 0xb1, 0xf3, 0xdb,
+  0x83, 0x9c, 0xbf, 0x31, 0xee, 0x3d, 0x9f, 0x5d, 0x1e, 0x53, 0x18, 0x3a,
+  0xb3, 0xf1, 0x82, 0x43, 0x82, 0x17, 0xbb, 0x0a, 0xf9, 0x92, 0x4f, 0xe4,
+  0xbb, 0xd4, 0x44, 0x41, 0x25, 0xa5, 0x71, 0xd8, 0x69, 0x1b, 0xd9, 0x83,
+  0x9d, 0x19, 0x47, 0x5f, 0xa7, 0x41, 0x63, 0xfe, 0xcc, 0x78, 0x9d, 0xa6,
+  0x45, 0xe8, 0x42, 0xbf, 0xa8, 0x59, 0xc0, 0x8f, 0x82, 0x6b, 0x34, 0xf0,
+  0x8f, 0x68, 0xb0, 0x8d, 0xa3, 0x7b, 0x33, 0x14, 0x85, 0x72, 0x18, 0xb8,
+  0x08, 0x51, 0x2b, 0xc5, 0x43, 0xa5, 0xb8, 0xb8, 0x76, 0x6b, 0x17, 0x70,
+  0x25, 0x92, 0x42, 0xb7, 0xcd, 0xeb, 0xb3, 0x92, 0x9e, 0x15, 0xcc, 0x5f,
+  0xc3, 0xf3, 0x4b, 0x68, 0x94, 0xb1, 0x76, 0x65, 0xd8, 0x72, 0x4f, 0x98,
+  0xf7, 0x77, 0xb8, 0xf8, 0x65, 0xef, 0x8b, 0xd4, 0x4e, 0x8b, 0x63, 0xcb,
+  0xe6, 0x76, 0x69, 0xcc, 0x13, 0xef, 0x40, 0x78, 0x1e, 0x55, 0x43,
+};
+
+static const uint8_t kLong128Tag[16] = {
+  0x28, 0xe2, 0x67, 0xae, 0xdc, 0x82, 0x4f, 0x76,
+  0x7c, 0xd2, 0x9f, 0x92, 0x3a, 0xcb, 0x55, 0x09,
+};
+
+static const uint8_t kLong256Key[32] = {
+  0xf9, 0xe4, 0xbe, 0x4c, 0xf4, 0xe3, 0xdc, 0x33,
+  0x46, 0x74, 0xa6, 0x2e, 0x9c, 0xf2, 0x39, 0x24,
+  0x0f, 0x7b, 0xcd, 0x97, 0xf4, 0xd9, 0xea, 0x6e,
+  0x73, 0x21, 0x5c, 0x75, 0xda, 0x17, 0xe7, 0xa4,
+};
+
+static const uint8_t kLong256IV[12] = {
+  0xae, 0x57, 0xba, 0x21, 0x85, 0x34, 0xa4, 0x06, 0x95, 0x5e, 0x07, 0xe3,
+};
+
+static const uint8_t kLong256AD[13] = {
+  0xd8, 0x11, 0xa3, 0x21, 0xfa, 0x06, 0xea, 0xd4, 0xab, 0x46, 0x82, 0x25,
+  0x5d,
+};
+
+static const uint8_t kLong256Plaintext[191] = {
+  0x0b, 0x46, 0x8f, 0x01, 0x1c, 0x41, 0xa1, 0x6c, 0xdc, 0x6d, 0x95, 0xad,
+  0xd0, 0x56, 0xa3, 0x5a, 0x44, 0x57, 0x9d, 0x4e, 0x5d, 0xc1, 0x61, 0xb7,
+  0xed, 0xbd, 0x0b, 0xd4, 0x09, 0xf1, 0xed, 0x7a, 0x5b, 0xe4, 0x3e, 0x5b,
+  0x37, 0x21, 0x94, 0x05, 0x6e, 0x1d, 0x13, 0xab, 0xe5, 0xd8, 0x62, 0xa6,
+  0xe4, 0x45, 0x60, 0xb9, 0x2e, 0x6a, 0x9a, 0x16, 0xd4, 0x46, 0x7a, 0x24,
+  0xc8, 0x75, 0x3f, 0xfd, 0x34, 0x94, 0xaf, 0xb9, 0x87, 0x64, 0x8e, 0x6c,
+  0x53, 0xb0, 0xcc, 0xef, 0xd9, 0xef, 0x81, 0x61, 0x60, 0xa9, 0x99, 0x6c,
+  0x49, 0x99, 0x4d, 0x47, 0xe2, 0x96, 0x58, 0x7e, 0xfc, 0x31, 0xe5, 0x73,
+  0x3d, 0x1d, 0x4a, 0xa3, 0x36, 0x52, 0x76, 0xa8, 0x34, 0xef, 0x29, 0x01,
+  0xd6, 0xe3, 0xe8, 0x94, 0x61, 0x4a, 0xaf, 0xef, 0xd5, 0x97, 0x63, 0x50,
+  0xbf, 0x76, 0x0e, 0x6a, 0xcb, 0x6e, 0xc8, 0xe4, 0x20, 0x48, 0x75, 0xa1,
+  0x6b, 0x32, 0x34, 0xc1, 0xb7, 0xa2, 0x92, 0x6a, 0x02, 0xfb, 0x81, 0x46,
+  0x8f, 0xf1, 0x0a, 0xca, 0xfc, 0xac, 0xc4, 0x3b, 0x12, 0xad, 0x03, 0x71,
+  0x5f, 0x73, 0xcf, 0x59, 0x84, 0xdd, 0x9b, 0x3b, 0x4d, 0x4d, 0xb1, 0xc0,
+  0x85, 0x90, 0x6d, 0xb0, 0x86, 0x80, 0x31, 0x7e, 0x93, 0x65, 0x13, 0x85,
+  0xe4, 0x1f, 0x57, 0x0f, 0x85, 0x04, 0x9f, 0x1a, 0xde, 0x89, 0xe3,
+};
+
+static const uint8_t kLong256Ciphertext[191] = {
+  0xf7, 0xa7, 0xc4, 0x80, 0x8d, 0x27, 0x48, 0x57, 0x66, 0x61, 0xd6, 0xed,
+  0xb3, 0x85, 0xf4, 0xf3, 0xb3, 0x88, 0x54, 0x2a, 0xf3, 0x43, 0x8d, 0x3e,
+  0x90, 0x13, 0xe7, 0x7a, 0xe8, 0xa9, 0x80, 0xea, 0x59, 0x85, 0x86, 0x4d,
+  0x1d, 0xe2, 0xd0, 0x0c, 0x0a, 0xa2, 0xe5, 0x63, 0x05, 0x41, 0xb5, 0xab,
+  0x80, 0x2d, 0x19, 0x34, 0xe9, 0x5e, 0x87, 0x34, 0x6c, 0xe0, 0x6f, 0x61,
+  0x58, 0x03, 0x2e, 0x0c, 0xc2, 0xe8, 0x06, 0x26, 0x08, 0xd3, 0xc9, 0xb4,
+  0xad, 0xfe, 0xa6, 0x18, 0x21, 0xde, 0xa0, 0x63, 0x64, 0x45, 0xb5, 0x5b,
+  0x8b, 0x60, 0x4d, 0x6f, 0x96, 0x39, 0xd3, 0x8f, 0xd2, 0x46, 0x4d, 0x56,
+  0x32, 0xae, 0xbe, 0x1b, 0x75, 0x22, 0x4b, 0xd3, 0x96, 0x83, 0x0a, 0xe0,
+  0x8b, 0xe3, 0x44, 0x24, 0x1d, 0x5e, 0x2a, 0x6e, 0x21, 0xdf, 0x9d, 0x9a,
+  0x83, 0xce, 0xb2, 0x9e, 0x7a, 0x02, 0xa2, 0xa1, 0x5b, 0x06, 0x11, 0xed,
+  0x9d, 0xfe, 0x68, 0x3f, 0xa4, 0x82, 0xef, 0xaa, 0xea, 0x36, 0x3a, 0x83,
+  0x85, 0xa6, 0xe4, 0xc2, 0xbb, 0x27, 0xd1, 0x95, 0x4e, 0xbe, 0xc1, 0x67,
+  0xd3, 0xe3, 0x31, 0x61, 0x31, 0x56, 0xcc, 0x95, 0x54, 0x6c, 0x23, 0xae,
+  0x0d, 0x39, 0x75, 0x4f, 0xa2, 0x3f, 0x92, 0xd4, 0xae, 0x7b, 0xa7, 0x80,
+  0xb2, 0x0e, 0x2c, 0x61, 0x77, 0x77, 0x5f, 0xc2, 0xb3, 0x27, 0x10,
+};
+
+static const uint8_t kLong256Tag[16] = {
+  0x77, 0x59, 0xfa, 0xc9, 0xd9, 0xc4, 0xf5, 0x17,
+  0x1d, 0x3e, 0x2d, 0xf7, 0x66, 0xb6, 0xa4, 0xd4,
+};
+
+typedef struct {
+  const char *name;
+  const uint8_t *key;
+  size_t key_len;
+  const uint8_t *iv;
+  const uint8_t *ad;
+  size_t ad_len;
+  const uint8_t *plaintext;
+  const uint8_t *ciphertext;
+  size_t len;
+  const uint8_t *tag;
+} GCM_TEST_VECTOR;
+
+static const GCM_TEST_VECTOR kVectors[] = {
+  { "test case 4", kKey, sizeof(kKey), kIV, kAD, sizeof(kAD), kPlaintext,
+    kCiphertext, sizeof(kPlaintext), kTag },
+  { "AES-128, 191 bytes", kLong128Key, sizeof(kLong128Key), kLong128IV,
+    kLong128AD, sizeof(kLong128AD), kLong128Plaintext, kLong128Ciphertext,
+    sizeof(kLong128Plaintext), kLong128Tag },
+  { "AES-256, 191 bytes", kLong256Key, sizeof(kLong256Key), kLong256IV,
+    kLong256AD, sizeof(kLong256AD), kLong256Plaintext, kLong256Ciphertext,
+    sizeof(kLong256Plaintext), kLong256Tag },
+};
+
+/* test_gcm runs |v| through |GFp_gcm128_encrypt| or |GFp_gcm128_decrypt|
+ * with |aes|. With |nohw_ghash|, the constant-time portable GHASH is used instead of the
+ * one chosen for this CPU, which is usually faster; targets that don't have
+ * it skip those tests. */
+static int test_gcm(const GCM_TEST_VECTOR *v, const AES_TEST_IMPL *aes,
+                    int encrypt, int nohw_ghash) {
+  const char *op = encrypt ? "encrypt" : "decrypt";
+  const char *ghash = nohw_ghash ? "nohw GHASH" : "default GHASH";
+
+  AES_KEY aes_key;
+  if ((*aes->set_key)(v->key, (unsigned)(v->key_len * 8), &aes_key) != 0) {
+    fprintf(stderr, "%s, %s: key setup failed.\n", v->name, aes->name);
+    return 1;
+  }
+
+  GCM128_KEY gcm_key;
+  GFp_gcm128_init_key(&gcm_key, &aes_key, aes->block, aes->ecb);
+  if (nohw_ghash && !GFp_gcm128_key_use_nohw(&gcm_key)) {
+    return 0;
+  }
+
+  GCM128_CONTEXT ctx;
+  GFp_gcm128_init(&ctx, &gcm_key, &aes_key, v->iv);
+
+  uint8_t out[256];
+  if (v->len > sizeof(out)) {
+    fprintf(stderr, "%s: message too long.\n", v->name);
+    return 1;
+  }
+  if (!GFp_gcm128_aad(&ctx, v->ad, v->ad_len) ||
+      !(encrypt ? GFp_gcm128_encrypt(&ctx, &aes_key, v->plaintext, out,
+                                     v->len)
+                : GFp_gcm128_decrypt(&ctx, &aes_key, v->ciphertext, out,
+                                     v->len))) {
+    fprintf(stderr, "%s, %s, %s, %s: GCM operation failed.\n", v->name,
+            aes->name, ghash, op);
+    return 1;
+  }
+
+  uint8_t tag[16];
+  GFp_gcm128_tag(&ctx, tag);
+
+  int num_failed = 0;
+  if (memcmp(out, encrypt ? v->ciphertext : v->plaintext, v->len) != 0) {
+    fprintf(stderr, "%s, %s, %s, %s: wrong output.\n", v->name, aes->name,
+            ghash, op);
+    ++num_failed;
+  }
+  if (memcmp(tag, v->tag, sizeof(tag)) != 0) {
+    fprintf(stderr, "%s, %s, %s, %s: wrong tag.\n", v->name, aes->name,
+            ghash, op);
+    ++num_failed;
+  }
+  return num_failed;
+}
+
+int bssl_gcm_test_main(void) {
+  int num_failed = 0;
+  for (size_t i = 0; i < sizeof(kVectors) / sizeof(kVectors[0]); ++i) {
+    for (size_t j = 0; j < sizeof(kAesImpls) / sizeof(kAesImpls[0]); ++j) {
+      for (int nohw_ghash = 0; nohw_ghash <= 1; ++nohw_ghash) {
+        num_failed += test_gcm(&kVectors[i], &kAesImpls[j], 1, nohw_ghash);
+        num_failed += test_gcm(&kVectors[i], &kAesImpls[j], 0, nohw_ghash);
+      }
+    }
+  }
+
+  if (!num_failed) {
+    return EXIT_SUCCESS;
+  }
+
+  fprintf(stdout, "%d tests failed!\n", num_failed);
+  return EXIT_FAILURE;
+}
@@ -62,6 +62,11 @@ extern "C" {
 typedef void (*aes_block_f)(const uint8_t in[16], uint8_t out[16],
                             const AES_KEY *key);
 
+/* aes_ecb_f is the type of a function that encrypts |blocks| independent
+ * blocks with AES. */
+typedef void (*aes_ecb_f)(const uint8_t *in, uint8_t *out, size_t blocks,
+                          const AES_KEY *key);
+
 
 /* GCM definitions */
 typedef struct { uint64_t hi,lo; } u128;
@@ -72,11 +77,24 @@ typedef void (*gcm128_ghash_f)(uint8_t Xi[16], const u128 Htable[16],
 
 #define GCM128_HTABLE_LEN 16
 
-#define GCM128_SERIALIZED_LEN (GCM128_HTABLE_LEN * 16)
+/* GCM128_KEY holds the parts of the GCM state that depend only on the key:
+ * the pre-computed table of multiples of H and the GHASH and block functions
+ * that were chosen to go with it. It is computed once, by
+ * |GFp_gcm128_init_key|, and is then used in place by every message under
+ * that key. */
+typedef struct {
+  u128 Htable[GCM128_HTABLE_LEN];
+  u128 H; /* In host byte order, for |GFp_gcm128_join|. */
+  gcm128_gmult_f gmult;
+  gcm128_ghash_f ghash;
+  aes_block_f block;
+  aes_ecb_f ecb; /* NULL if |block| is the only block function. */
+} GCM128_KEY;
 
 /* This differs from OpenSSL's |gcm128_context| in that it does not have the
- * |key| pointer, in order to make it |memcpy|-friendly. See openssl/modes.h
- * for more info. */
+ * |key| pointer, in order to make it |memcpy|-friendly, and in that the
+ * per-key state is not copied into it but referenced through |gcm_key|. See
+ * openssl/modes.h for more info. */
 struct gcm128_context {
   /* Following 6 names follow names in GCM specification */
   alignas(16) uint8_t Yi[16];
@@ -86,25 +104,29 @@ struct gcm128_context {
     uint64_t u[2];
   } len;
   alignas(16) uint8_t Xi[16];
-  alignas(16) struct {
-    uint64_t u[2];
-  } H_unused;
 
-  /* Relative position of Xi, H and pre-computed Htable is used in some
-   * assembler modules, i.e. don't change the order! */
-  u128 Htable[GCM128_HTABLE_LEN];
+  /* |mres| and |ares| are the number of bytes of the current partial block
+   * of ciphertext and AAD, respectively, that have been absorbed into |Xi|
+   * but not yet multiplied by H. They allow the message and the AAD to be
+   * passed in pieces of any length. */
+  unsigned int mres, ares;
 
-  gcm128_gmult_f gmult;
-  gcm128_ghash_f ghash;
-  aes_block_f block;
+  /* The per-key state. It must outlive the context. */
+  const GCM128_KEY *gcm_key;
 };
 
 #if defined(OPENSSL_X86) || defined(OPENSSL_X86_64)
-/* crypto_gcm_clmul_enabled returns one if the CLMUL implementation of GCM is
- * used. */
+/* GFp_gcm_clmul_enabled returns one if |GFp_gcm128_dispatch_setup| chose the
+ * CLMUL implementation of GHASH. */
 int GFp_gcm_clmul_enabled(void);
 #endif
 
+#if defined(OPENSSL_X86_64)
+/* GFp_gcm_aesni_sse_stitch_enabled returns one if AES-GCM with AES-NI uses
+ * the SSE4.1 code that computes CTR and GHASH together. */
+int GFp_gcm_aesni_sse_stitch_enabled(void);
+#endif
+
 
 /* CTR. */
 
@@ -122,30 +144,61 @@ typedef void (*aes_ctr_f)(const uint8_t *in, uint8_t *out, size_t blocks,
 
 typedef struct gcm128_context GCM128_CONTEXT;
 
-OPENSSL_EXPORT void GFp_gcm128_init_serialized(
-    uint8_t serialized_ctx[GCM128_SERIALIZED_LEN], const AES_KEY *key,
-    aes_block_f block);
-
-OPENSSL_EXPORT void GFp_gcm128_init(
-    GCM128_CONTEXT *ctx, const AES_KEY *key, aes_block_f block,
-    const uint8_t serialized_ctx[GCM128_SERIALIZED_LEN], const uint8_t *iv);
+/* GFp_gcm128_dispatch_setup chooses the GHASH implementation for this CPU. It
+ * is called once, by |GFp_dispatch_setup|. */
+void GFp_gcm128_dispatch_setup(void);
+
+/* GFp_gcm128_impl_name returns the name of the chosen GHASH implementation. */
+const char *GFp_gcm128_impl_name(void);
+
+/* GFp_gcm128_init_key computes the per-key state for GCM with the block cipher
+ * |block| under |key|. |ecb|, which may be NULL, is a multi-block version of
+ * |block| that |GFp_gcm128_encrypt| and |GFp_gcm128_decrypt| use to encrypt
+ * several counter blocks at a time. */
+OPENSSL_EXPORT void GFp_gcm128_init_key(GCM128_KEY *gcm_key, const AES_KEY *key,
+                                        aes_block_f block, aes_ecb_f ecb);
+
+/* GFp_gcm128_key_use_nohw switches |gcm_key|, which must have been set up by
+ * |GFp_gcm128_init_key|, to the constant-time portable GHASH, so that it can
+ * be tested on CPUs for which |GFp_gcm128_dispatch_setup| would choose
+ * something else. It returns one on success and zero, leaving |gcm_key|
+ * unchanged, on targets that don't have that implementation. */
+int GFp_gcm128_key_use_nohw(GCM128_KEY *gcm_key);
+
+/* GFp_gcm128_init prepares |ctx| for a message with IV |iv| under |gcm_key|,
+ * which must have been computed from |key| and must outlive |ctx|. */
+OPENSSL_EXPORT void GFp_gcm128_init(GCM128_CONTEXT *ctx,
+                                    const GCM128_KEY *gcm_key,
+                                    const AES_KEY *key, const uint8_t *iv);
+
+/* GFp_gcm128_init_with_ek0 is like |GFp_gcm128_init| except that the caller
+ * supplies |EK0|, the encryption of the initial counter block (|iv| followed by
+ * the 32-bit big-endian value one). This allows the caller to compute it
+ * together with other blocks. */
+OPENSSL_EXPORT void GFp_gcm128_init_with_ek0(GCM128_CONTEXT *ctx,
+                                             const GCM128_KEY *gcm_key,
+                                             const uint8_t *iv,
+                                             const uint8_t EK0[16]);
 
 /* GFp_gcm128_aad sets the authenticated data for an instance of GCM. This must
- * be called before and data is encrypted. It returns one on success and zero
- * otherwise. */
+ * be called before and data is encrypted. It may be called several times to
+ * pass the AAD in pieces. It returns one on success and zero otherwise. */
 OPENSSL_EXPORT int GFp_gcm128_aad(GCM128_CONTEXT *ctx, const uint8_t *aad,
                                   size_t len);
 
 /* GFp_gcm128_encrypt encrypts |len| bytes from |in| to |out|. The |key| must
- * be the same key that was passed to |GFp_gcm128_init|. It returns one on
- * success and zero otherwise. */
+ * be the same key that was passed to |GFp_gcm128_init|. The encryption
+ * functions, including the |_ctr32| variant, may be called several times to
+ * encrypt a message in pieces of any length. It returns one on success and
+ * zero otherwise. */
 OPENSSL_EXPORT int GFp_gcm128_encrypt(GCM128_CONTEXT *ctx, const AES_KEY *key,
                                       const uint8_t *in, uint8_t *out,
                                       size_t len);
 
 /* GFp_gcm128_decrypt decrypts |len| bytes from |in| to |out|. The |key| must
- * be the same key that was passed to |GFp_gcm128_init|. It returns one on
- * success and zero otherwise. */
+ * be the same key that was passed to |GFp_gcm128_init|. Like the encryption
+ * functions, it may be called several times. It returns one on success and
+ * zero otherwise. */
 OPENSSL_EXPORT int GFp_gcm128_decrypt(GCM128_CONTEXT *ctx, const AES_KEY *key,
                                       const uint8_t *in, uint8_t *out,
                                       size_t len);
@@ -168,10 +221,79 @@ OPENSSL_EXPORT int GFp_gcm128_decrypt_ctr32(GCM128_CONTEXT *ctx,
                                             const uint8_t *in, uint8_t *out,
                                             size_t len, aes_ctr_f stream);
 
+/* GFp_gcm128_encrypt_keystream encrypts |len| bytes from |in| to |out| by
+ * XORing them with |keystream|, which must hold the encryption of the next
+ * |(len + 15) / 16| counter blocks, e.g. as computed in a batch with other
+ * messages' counter blocks. Unlike the other encryption functions, it must be
+ * given the whole message in a single call. It returns one on success and
+ * zero otherwise. */
+OPENSSL_EXPORT int GFp_gcm128_encrypt_keystream(GCM128_CONTEXT *ctx,
+                                                const uint8_t *in,
+                                                uint8_t *out, size_t len,
+                                                const uint8_t *keystream);
+
+/* GFp_gcm128_decrypt_keystream is the decryption counterpart of
+ * |GFp_gcm128_encrypt_keystream|. */
+OPENSSL_EXPORT int GFp_gcm128_decrypt_keystream(GCM128_CONTEXT *ctx,
+                                                const uint8_t *in,
+                                                uint8_t *out, size_t len,
+                                                const uint8_t *keystream);
+
+/* GFp_gcm128_fork prepares |chunk| to encrypt or decrypt a piece of the same
+ * message as |ctx|, starting |block_offset| blocks after the current position
+ * of |ctx|, independently of |ctx| and of other chunks. This allows a large
+ * message to be split into chunks that are processed concurrently, each with
+ * the normal encryption or decryption functions. Every chunk but the last
+ * must have a length that is a multiple of 16 bytes.
+ *
+ * |ctx| is not modified, so several chunks may be forked from it at once. Its
+ * AAD must be complete and, if any data has been passed to it, it must end
+ * on a block boundary. */
+OPENSSL_EXPORT void GFp_gcm128_fork(GCM128_CONTEXT *chunk,
+                                    const GCM128_CONTEXT *ctx,
+                                    uint64_t block_offset);
+
+/* GFp_gcm128_join folds the result of |chunk|, which was forked from |ctx|,
+ * back into |ctx|, so that |ctx| is in the same state as if it had processed
+ * the chunk's data itself. Chunks must be joined in order, and each chunk's
+ * |block_offset| must equal the number of blocks in the chunks forked before
+ * it. The GHASH of the chunk is combined using H raised to the number of
+ * blocks in the chunk, so the cost of a join is logarithmic in the length of
+ * the chunk. It returns one on success and zero otherwise. */
+OPENSSL_EXPORT int GFp_gcm128_join(GCM128_CONTEXT *ctx,
+                                   const GCM128_CONTEXT *chunk);
+
 /* GFp_gcm128_tag calculates the authenticator and copies it into |tag|. */
 OPENSSL_EXPORT void GFp_gcm128_tag(GCM128_CONTEXT *ctx, uint8_t tag[16]);
 
 
+/* POLYVAL (RFC 8452), computed with the GHASH implementation. */
+
+typedef struct {
+  alignas(16) uint8_t S[16]; /* Byte-reversed, i.e. in the GHASH domain. */
+  const GCM128_KEY *key;
+} POLYVAL_CONTEXT;
+
+/* GFp_polyval_init_key sets up |key| for POLYVAL with the key |H|. Its
+ * |block| is NULL; it is only for use with the |GFp_polyval_*| functions. */
+OPENSSL_EXPORT void GFp_polyval_init_key(GCM128_KEY *key, const uint8_t H[16]);
+
+/* GFp_polyval_init prepares |ctx| to compute POLYVAL under |key|, which must
+ * outlive |ctx|. */
+OPENSSL_EXPORT void GFp_polyval_init(POLYVAL_CONTEXT *ctx,
+                                     const GCM128_KEY *key);
+
+/* GFp_polyval_update_padded absorbs |len| bytes from |in|. If |len| is not a
+ * multiple of 16, the last block is padded with zeros, so this must be called
+ * once for each field (e.g. AAD, plaintext) that is padded separately. */
+OPENSSL_EXPORT void GFp_polyval_update_padded(POLYVAL_CONTEXT *ctx,
+                                              const uint8_t *in, size_t len);
+
+/* GFp_polyval_finish writes the POLYVAL of the input so far to |out|. */
+OPENSSL_EXPORT void GFp_polyval_finish(const POLYVAL_CONTEXT *ctx,
+                                       uint8_t out[16]);
+
+
 #if !defined(OPENSSL_NO_ASM) && \
     (defined(OPENSSL_X86) || defined(OPENSSL_X86_64))
 void GFp_aesni_ctr32_encrypt_blocks(const uint8_t *in, uint8_t *out,
@@ -179,6 +301,11 @@ void GFp_aesni_ctr32_encrypt_blocks(const uint8_t *in, uint8_t *out,
                                     const uint8_t *ivec);
 #endif
 
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+void GFp_aesni_ecb_encrypt_blocks(const uint8_t *in, uint8_t *out,
+                                  size_t blocks, const AES_KEY *key);
+#endif
+
 #if defined(__cplusplus)
 } /* extern C */
 #endif
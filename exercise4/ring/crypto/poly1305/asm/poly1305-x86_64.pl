@@ -1971,6 +1971,174 @@ $code.=<<___;
 	ret
 .size	poly1305_blocks_avx2,.-poly1305_blocks_avx2
 ___
+
+########################################################################
+# GFp_poly1305_blocks_4x_avx2(lanes, in, num_blocks) runs four independent
+# Poly1305 computations side by side, one per 64-bit lane. |lanes| is a
+# 32-byte aligned array of 4-element vectors: h0-h4, r0-r4, 5*r1-5*r4 and
+# the pad bit (1<<24 or 0), all in base 2^26. Each lane absorbs
+# |num_blocks| 16-byte blocks from its own pointer in the 4-element array
+# |in|; the pointers themselves aren't updated. The caller checks for AVX2.
+{
+my ($lanes,$inp,$blocks)=("%rdi","%rsi","%rdx");
+my ($H0,$H1,$H2,$H3,$H4, $D0,$D1,$D2,$D3,$D4, $T,$MASK) =
+    map("%ymm$_",(0..11));
+my @in=("%rax","%r8","%r9","%r10");
+my $xframe = $win64 ? 0x68 : 0;
+
+sub R { 0xa0+0x20*shift; }		# offset of r[i]
+sub S { 0x140+0x20*(shift()-1); }	# offset of 5*r[i]
+
+$code.=<<___;
+.globl	GFp_poly1305_blocks_4x_avx2
+.hidden	GFp_poly1305_blocks_4x_avx2
+.type	GFp_poly1305_blocks_4x_avx2,\@function,3
+.align	32
+GFp_poly1305_blocks_4x_avx2:
+___
+$code.=<<___	if ($win64);
+	sub		\$$xframe,%rsp
+	vmovdqa		%xmm6,0x00(%rsp)
+	vmovdqa		%xmm7,0x10(%rsp)
+	vmovdqa		%xmm8,0x20(%rsp)
+	vmovdqa		%xmm9,0x30(%rsp)
+	vmovdqa		%xmm10,0x40(%rsp)
+	vmovdqa		%xmm11,0x50(%rsp)
+___
+$code.=<<___;
+	test		$blocks,$blocks
+	jz		.Lno_data_4x_avx2
+
+	mov		8*0($inp),@in[0]
+	mov		8*1($inp),@in[1]
+	mov		8*2($inp),@in[2]
+	mov		8*3($inp),@in[3]
+	vmovdqa		.Lmask26(%rip),$MASK
+	vmovdqa		0x00($lanes),$H0
+	vmovdqa		0x20($lanes),$H1
+	vmovdqa		0x40($lanes),$H2
+	vmovdqa		0x60($lanes),$H3
+	vmovdqa		0x80($lanes),$H4
+	jmp		.Loop_4x_avx2
+
+.align	32
+.Loop_4x_avx2:
+	################################################################
+	# load one block per lane and transpose to lo and hi halves
+	vmovdqu		(@in[0]),%x#$D0
+	vmovdqu		(@in[1]),%x#$D1
+	vinserti128	\$1,(@in[2]),$D0,$D0	# [lo0,hi0,lo2,hi2]
+	vinserti128	\$1,(@in[3]),$D1,$D1	# [lo1,hi1,lo3,hi3]
+	lea		16(@in[0]),@in[0]
+	lea		16(@in[1]),@in[1]
+	lea		16(@in[2]),@in[2]
+	lea		16(@in[3]),@in[3]
+	vpunpckhqdq	$D1,$D0,$D3		# [hi0,hi1,hi2,hi3]
+	vpunpcklqdq	$D1,$D0,$D2		# [lo0,lo1,lo2,lo3]
+
+	################################################################
+	# split into base 2^26 limbs and add to hash
+	vpand		$MASK,$D2,$T
+	vpaddq		$T,$H0,$H0
+	vpsrlq		\$26,$D2,$T
+	vpand		$MASK,$T,$T
+	vpaddq		$T,$H1,$H1
+	vpsrlq		\$52,$D2,$T
+	vpsllq		\$12,$D3,$D4
+	vpor		$D4,$T,$T
+	vpand		$MASK,$T,$T
+	vpaddq		$T,$H2,$H2
+	vpsrlq		\$14,$D3,$T
+	vpand		$MASK,$T,$T
+	vpaddq		$T,$H3,$H3
+	vpsrlq		\$40,$D3,$T
+	vpor		0x1c0($lanes),$T,$T	# padbit
+	vpaddq		$T,$H4,$H4
+
+	################################################################
+	# d0 = h0*r0 + h1*5*r4 + h2*5*r3 + h3*5*r2 + h4*5*r1
+	# d1 = h0*r1 + h1*r0   + h2*5*r4 + h3*5*r3 + h4*5*r2
+	# d2 = h0*r2 + h1*r1   + h2*r0   + h3*5*r4 + h4*5*r3
+	# d3 = h0*r3 + h1*r2   + h2*r1   + h3*r0   + h4*5*r4
+	# d4 = h0*r4 + h1*r3   + h2*r2   + h3*r1   + h4*r0
+	vpmuludq	`R(0)`($lanes),$H0,$D0
+	vpmuludq	`R(1)`($lanes),$H0,$D1
+	vpmuludq	`R(2)`($lanes),$H0,$D2
+	vpmuludq	`R(3)`($lanes),$H0,$D3
+	vpmuludq	`R(4)`($lanes),$H0,$D4
+___
+my @D=($D0,$D1,$D2,$D3,$D4);
+my @H=($H0,$H1,$H2,$H3,$H4);
+for my $i (1..4) {
+	for my $j (0..4) {
+		my $off = $j >= $i ? R($j-$i) : S(5+$j-$i);
+		$code.=<<___;
+	vpmuludq	$off($lanes),$H[$i],$T
+	vpaddq		$T,$D[$j],$D[$j]
+___
+	}
+}
+$code.=<<___;
+
+	################################################################
+	# lazy reduction, as in poly1305_blocks_avx2
+	vpsrlq		\$26,$D3,$T
+	vpand		$MASK,$D3,$H3
+	vpaddq		$T,$D4,$D4		# h3 -> h4
+
+	vpsrlq		\$26,$D0,$T
+	vpand		$MASK,$D0,$H0
+	vpaddq		$T,$D1,$D1		# h0 -> h1
+
+	vpsrlq		\$26,$D4,$T
+	vpand		$MASK,$D4,$H4
+
+	vpsrlq		\$26,$D1,$D0
+	vpand		$MASK,$D1,$H1
+	vpaddq		$D0,$D2,$D2		# h1 -> h2
+
+	vpaddq		$T,$H0,$H0
+	vpsllq		\$2,$T,$T
+	vpaddq		$T,$H0,$H0		# h4 -> h0
+
+	vpsrlq		\$26,$D2,$T
+	vpand		$MASK,$D2,$H2
+	vpaddq		$T,$H3,$H3		# h2 -> h3
+
+	vpsrlq		\$26,$H0,$T
+	vpand		$MASK,$H0,$H0
+	vpaddq		$T,$H1,$H1		# h0 -> h1
+
+	vpsrlq		\$26,$H3,$T
+	vpand		$MASK,$H3,$H3
+	vpaddq		$T,$H4,$H4		# h3 -> h4
+
+	dec		$blocks
+	jnz		.Loop_4x_avx2
+
+	vmovdqa		$H0,0x00($lanes)
+	vmovdqa		$H1,0x20($lanes)
+	vmovdqa		$H2,0x40($lanes)
+	vmovdqa		$H3,0x60($lanes)
+	vmovdqa		$H4,0x80($lanes)
+	vzeroupper
+
+.Lno_data_4x_avx2:
+___
+$code.=<<___	if ($win64);
+	vmovdqa		0x00(%rsp),%xmm6
+	vmovdqa		0x10(%rsp),%xmm7
+	vmovdqa		0x20(%rsp),%xmm8
+	vmovdqa		0x30(%rsp),%xmm9
+	vmovdqa		0x40(%rsp),%xmm10
+	vmovdqa		0x50(%rsp),%xmm11
+	add		\$$xframe,%rsp
+___
+$code.=<<___;
+	ret
+.size	GFp_poly1305_blocks_4x_avx2,.-GFp_poly1305_blocks_4x_avx2
+___
+}
 }
 $code.=<<___;
 .align	64
@@ -17,12 +17,21 @@
 
 #include <openssl/base.h>
 
+#include "../internal.h"
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
 
-typedef uint8_t poly1305_state[256];
+/* poly1305_state is storage for the state of one Poly1305 computation. The
+ * implementation keeps its state at the start of it, so it must be aligned
+ * like this type, but it has no pointers into itself and may be moved with
+ * |memcpy| between calls. */
+typedef union {
+  alignas(8) uint8_t opaque[256];
+  uint64_t u64[256 / 8];
+} poly1305_state;
 
 /* GFp_poly1305_init sets up |state| so that it can be used to calculate an
  * authentication tag with the one-time key |key|. Note that |key| is a
@@ -41,6 +50,58 @@ OPENSSL_EXPORT void GFp_poly1305_update(poly1305_state* state,
  * aligned. */
 OPENSSL_EXPORT void GFp_poly1305_finish(poly1305_state* state, uint8_t mac[16]);
 
+/* GFp_poly1305_dispatch_setup chooses whether |GFp_poly1305_multi| and
+ * |GFp_poly1305_partial_update| use the four-lane code on this CPU. It is
+ * called once, by |GFp_dispatch_setup|. */
+void GFp_poly1305_dispatch_setup(void);
+
+/* GFp_poly1305_partial_has_lanes returns one if |GFp_poly1305_partial_update|
+ * uses the four-lane code on this CPU and zero otherwise. */
+int GFp_poly1305_partial_has_lanes(void);
+
+/* GFp_poly1305_multi computes the tags of |num| independent messages. The
+ * |i|th message is |in_lens[i]| bytes at |ins[i]|, its one-time key is the 32
+ * bytes at |keys + 32 * i| and its tag is written to the 16 bytes at
+ * |macs + 16 * i|. With AVX2, four messages are processed in parallel, which
+ * is much faster than one at a time for short messages. */
+OPENSSL_EXPORT void GFp_poly1305_multi(uint8_t *macs, const uint8_t *keys,
+                                       const uint8_t *const ins[],
+                                       const size_t in_lens[], size_t num);
+
+/* A poly1305_partial is a Poly1305 evaluation of one piece of a message.
+ * Partials of consecutive pieces can be computed independently, e.g. on
+ * different threads, and then appended to each other in order; the result
+ * is the same as evaluating the whole message at once. Input is absorbed in
+ * whole 16-byte blocks, as in the ChaCha20-Poly1305 AEAD construction. */
+typedef struct {
+  uint32_t r[5];
+  uint32_t h[5];
+  uint64_t num_blocks;
+} poly1305_partial;
+
+/* GFp_poly1305_partial_init sets up |partial| for a piece of a message under
+ * the one-time key |key|. */
+OPENSSL_EXPORT void GFp_poly1305_partial_init(poly1305_partial *partial,
+                                              const uint8_t key[32]);
+
+/* GFp_poly1305_partial_update processes |in_len| bytes from |in|. |in_len|
+ * must be a multiple of 16. */
+OPENSSL_EXPORT void GFp_poly1305_partial_update(poly1305_partial *partial,
+                                                const uint8_t *in,
+                                                size_t in_len);
+
+/* GFp_poly1305_partial_append appends |next|, the partial of the piece of
+ * the message that immediately follows, to |partial|. It costs about
+ * 2 * log2(|next->num_blocks|) multiplications. */
+OPENSSL_EXPORT void GFp_poly1305_partial_append(
+    poly1305_partial *partial, const poly1305_partial *next);
+
+/* GFp_poly1305_partial_finish writes the tag of the message whose pieces
+ * have all been appended to |partial| to |mac|. */
+OPENSSL_EXPORT void GFp_poly1305_partial_finish(const poly1305_partial *partial,
+                                                uint8_t mac[16],
+                                                const uint8_t key[32]);
+
 
 #if defined(__cplusplus)
 }  /* extern C */
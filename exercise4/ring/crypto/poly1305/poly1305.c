@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include <openssl/cpu.h>
 #include <openssl/type_check.h>
 
 #include "../internal.h"
@@ -69,81 +70,623 @@ struct poly1305_state_st {
   } func;
 };
 
+/* The state is kept in place at the start of the caller's |poly1305_state|,
+ * so that |GFp_poly1305_update| doesn't have to copy it in and out on every
+ * call. */
+OPENSSL_COMPILE_ASSERT(alignof(struct poly1305_state_st) <=
+                           alignof(poly1305_state),
+                       poly1305_state_align_too_small);
 OPENSSL_COMPILE_ASSERT(sizeof(poly1305_state) >=
-                       sizeof(struct poly1305_state_st),
+                           sizeof(struct poly1305_state_st),
                        poly1305_state_too_small);
 
+static inline struct poly1305_state_st *poly1305_state_st(
+    poly1305_state *state) {
+  return (struct poly1305_state_st *)state;
+}
+
 
 void GFp_poly1305_init(poly1305_state *statep, const uint8_t key[32]) {
-  struct poly1305_state_st state;
+  struct poly1305_state_st *state = poly1305_state_st(statep);
 
   /* TODO XXX: It seems at least some implementations |poly1305_init| always
    * return the same value, so this conditional logic isn't always necessary.
    * And, for platforms that have such conditional logic also in the ASM code,
    * it seems it would be better to move the conditional logic out of the asm
    * and into the higher-level code. */
-  if (!GFp_poly1305_init_asm(state.opaque, key, &state.func)) {
-    state.func.blocks = GFp_poly1305_blocks;
-    state.func.emit = GFp_poly1305_emit;
+  if (!GFp_poly1305_init_asm(state->opaque, key, &state->func)) {
+    state->func.blocks = GFp_poly1305_blocks;
+    state->func.emit = GFp_poly1305_emit;
   }
 
-  state.buf_used = 0;
-  state.nonce[0] = U8TO32_LE(key + 16);
-  state.nonce[1] = U8TO32_LE(key + 20);
-  state.nonce[2] = U8TO32_LE(key + 24);
-  state.nonce[3] = U8TO32_LE(key + 28);
-
-  memset(statep, 0, sizeof(*statep));
-  memcpy(statep, &state, sizeof(state));
+  state->buf_used = 0;
+  state->nonce[0] = U8TO32_LE(key + 16);
+  state->nonce[1] = U8TO32_LE(key + 20);
+  state->nonce[2] = U8TO32_LE(key + 24);
+  state->nonce[3] = U8TO32_LE(key + 28);
 }
 
 void GFp_poly1305_update(poly1305_state *statep, const uint8_t *in,
                          size_t in_len) {
-  struct poly1305_state_st state;
-  memcpy(&state, statep, sizeof(state));
+  struct poly1305_state_st *state = poly1305_state_st(statep);
 
-  if (state.buf_used != 0) {
-    unsigned todo = 16 - state.buf_used;
+  if (state->buf_used != 0) {
+    unsigned todo = 16 - state->buf_used;
     if (todo > in_len) {
       todo = (unsigned)in_len;
     }
-    memcpy(state.buf + state.buf_used, in, todo);
-    state.buf_used += todo;
+    memcpy(state->buf + state->buf_used, in, todo);
+    state->buf_used += todo;
     in_len -= todo;
     in += todo;
 
-    if (state.buf_used == 16) {
-      state.func.blocks(state.opaque, state.buf, 16, 1 /* pad */);
-      state.buf_used = 0;
+    if (state->buf_used == 16) {
+      state->func.blocks(state->opaque, state->buf, 16, 1 /* pad */);
+      state->buf_used = 0;
     }
   }
 
   if (in_len >= 16) {
     size_t todo = in_len & ~0xf;
-    state.func.blocks(state.opaque, in, todo, 1 /* pad */);
+    state->func.blocks(state->opaque, in, todo, 1 /* pad */);
     in += todo;
     in_len &= 0xf;
   }
 
   if (in_len != 0) {
-    memcpy(state.buf, in, in_len);
-    state.buf_used = (unsigned)in_len;
+    memcpy(state->buf, in, in_len);
+    state->buf_used = (unsigned)in_len;
   }
-
-  memcpy(statep, &state, sizeof(state));
 }
 
 void GFp_poly1305_finish(poly1305_state *statep, uint8_t mac[16]) {
-  struct poly1305_state_st state;
-  memcpy(&state, statep, sizeof(state));
+  struct poly1305_state_st *state = poly1305_state_st(statep);
+
+  if (state->buf_used != 0) {
+    state->buf[state->buf_used] = 1;
+    memset(state->buf + state->buf_used + 1, 0, 16 - state->buf_used - 1);
+    state->func.blocks(state->opaque, state->buf, 16, 0 /* already padded */);
+  }
+
+  state->func.emit(state->opaque, mac, state->nonce);
+}
+
+/* Portable arithmetic modulo 2^130 - 5, in base 2^26 as in poly1305-donna.
+ * It is used to combine Poly1305 evaluations of different parts of a
+ * message, which the assembly language implementations can't do because
+ * their accumulators are opaque. Elements are only partially reduced: each
+ * limb is less than 2^27. */
+
+static const uint32_t kPoly1305Mask26 = 0x3ffffff;
+
+/* poly1305_donna_r sets |r| to the clamped first half of |key|. */
+static void poly1305_donna_r(uint32_t r[5], const uint8_t key[16]) {
+  uint32_t t0 = U8TO32_LE(key + 0);
+  uint32_t t1 = U8TO32_LE(key + 4);
+  uint32_t t2 = U8TO32_LE(key + 8);
+  uint32_t t3 = U8TO32_LE(key + 12);
+
+  r[0] = t0 & 0x3ffffff;
+  r[1] = ((t0 >> 26) | (t1 << 6)) & 0x3ffff03;
+  r[2] = ((t1 >> 20) | (t2 << 12)) & 0x3ffc0ff;
+  r[3] = ((t2 >> 14) | (t3 << 18)) & 0x3f03fff;
+  r[4] = (t3 >> 8) & 0x00fffff;
+}
+
+/* poly1305_donna_mul sets |h| to |a| * |b|. |h| may alias |a| or |b|. */
+static void poly1305_donna_mul(uint32_t h[5], const uint32_t a[5],
+                               const uint32_t b[5]) {
+  uint64_t b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3], b4 = b[4];
+  uint64_t s1 = b1 * 5, s2 = b2 * 5, s3 = b3 * 5, s4 = b4 * 5;
+  uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+
+  uint64_t d0 = a0 * b0 + a1 * s4 + a2 * s3 + a3 * s2 + a4 * s1;
+  uint64_t d1 = a0 * b1 + a1 * b0 + a2 * s4 + a3 * s3 + a4 * s2;
+  uint64_t d2 = a0 * b2 + a1 * b1 + a2 * b0 + a3 * s4 + a4 * s3;
+  uint64_t d3 = a0 * b3 + a1 * b2 + a2 * b1 + a3 * b0 + a4 * s4;
+  uint64_t d4 = a0 * b4 + a1 * b3 + a2 * b2 + a3 * b1 + a4 * b0;
+
+  d1 += d0 >> 26;
+  d2 += d1 >> 26;
+  d3 += d2 >> 26;
+  d4 += d3 >> 26;
+  uint64_t h0 = (d0 & kPoly1305Mask26) + (d4 >> 26) * 5;
+  h[0] = (uint32_t)h0 & kPoly1305Mask26;
+  h[1] = ((uint32_t)d1 & kPoly1305Mask26) + (uint32_t)(h0 >> 26);
+  h[2] = (uint32_t)d2 & kPoly1305Mask26;
+  h[3] = (uint32_t)d3 & kPoly1305Mask26;
+  h[4] = (uint32_t)d4 & kPoly1305Mask26;
+}
+
+/* poly1305_donna_add sets |h| to |h| + |a|. */
+static void poly1305_donna_add(uint32_t h[5], const uint32_t a[5]) {
+  uint32_t c = 0;
+  for (size_t i = 0; i < 5; ++i) {
+    h[i] += a[i] + c;
+    c = h[i] >> 26;
+    h[i] &= kPoly1305Mask26;
+  }
+  h[0] += c * 5;
+}
+
+/* poly1305_donna_pow sets |out| to |r|^|n|, for |n| > 0. */
+static void poly1305_donna_pow(uint32_t out[5], const uint32_t r[5],
+                               uint64_t n) {
+  assert(n > 0);
+  uint32_t base[5];
+  memcpy(base, r, sizeof(base));
+  while ((n & 1) == 0) {
+    poly1305_donna_mul(base, base, base);
+    n >>= 1;
+  }
+  memcpy(out, base, sizeof(base));
+  while ((n >>= 1) != 0) {
+    poly1305_donna_mul(base, base, base);
+    if ((n & 1) != 0) {
+      poly1305_donna_mul(out, out, base);
+    }
+  }
+}
+
+/* poly1305_donna_blocks absorbs |num_blocks| 16-byte blocks from |in| into
+ * |h|. Each block has |padbit| appended. */
+static void poly1305_donna_blocks(uint32_t h[5], const uint32_t r[5],
+                                  const uint8_t *in, size_t num_blocks,
+                                  uint32_t padbit) {
+  for (size_t i = 0; i < num_blocks; ++i, in += 16) {
+    uint32_t t0 = U8TO32_LE(in + 0);
+    uint32_t t1 = U8TO32_LE(in + 4);
+    uint32_t t2 = U8TO32_LE(in + 8);
+    uint32_t t3 = U8TO32_LE(in + 12);
+    h[0] += t0 & kPoly1305Mask26;
+    h[1] += ((t0 >> 26) | (t1 << 6)) & kPoly1305Mask26;
+    h[2] += ((t1 >> 20) | (t2 << 12)) & kPoly1305Mask26;
+    h[3] += ((t2 >> 14) | (t3 << 18)) & kPoly1305Mask26;
+    h[4] += (t3 >> 8) | (padbit << 24);
+    poly1305_donna_mul(h, h, r);
+  }
+}
+
+/* poly1305_donna_emit writes (|h| mod 2^130 - 5) + |nonce| mod 2^128 to
+ * |mac|. */
+static void poly1305_donna_emit(uint8_t mac[16], const uint32_t h_in[5],
+                                const uint8_t nonce[16]) {
+  uint32_t h0 = h_in[0], h1 = h_in[1], h2 = h_in[2], h3 = h_in[3],
+           h4 = h_in[4];
+
+  /* Fully carry h. Unlike in poly1305-donna, |h0| may not be reduced yet;
+   * |poly1305_donna_add| can leave it at 2^26 or a little more. */
+  uint32_t c;
+  c = h0 >> 26; h0 &= kPoly1305Mask26; h1 += c;
+  c = h1 >> 26; h1 &= kPoly1305Mask26; h2 += c;
+  c = h2 >> 26; h2 &= kPoly1305Mask26; h3 += c;
+  c = h3 >> 26; h3 &= kPoly1305Mask26; h4 += c;
+  c = h4 >> 26; h4 &= kPoly1305Mask26; h0 += c * 5;
+  c = h0 >> 26; h0 &= kPoly1305Mask26; h1 += c;
+
+  /* Compute h + -p and select it if it doesn't underflow. */
+  uint32_t g0 = h0 + 5;
+  c = g0 >> 26; g0 &= kPoly1305Mask26;
+  uint32_t g1 = h1 + c;
+  c = g1 >> 26; g1 &= kPoly1305Mask26;
+  uint32_t g2 = h2 + c;
+  c = g2 >> 26; g2 &= kPoly1305Mask26;
+  uint32_t g3 = h3 + c;
+  c = g3 >> 26; g3 &= kPoly1305Mask26;
+  uint32_t g4 = h4 + c - (1 << 26);
+
+  uint32_t mask = (g4 >> 31) - 1;
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+  h3 = (h3 & ~mask) | (g3 & mask);
+  h4 = (h4 & ~mask) | (g4 & mask);
+
+  /* h = (h + nonce) mod 2^128 */
+  uint64_t f;
+  f = (uint64_t)(h0 | (h1 << 26)) + U8TO32_LE(nonce + 0);
+  to_le_u32_ptr(mac + 0, (uint32_t)f);
+  f = (uint64_t)((h1 >> 6) | (h2 << 20)) + U8TO32_LE(nonce + 4) + (f >> 32);
+  to_le_u32_ptr(mac + 4, (uint32_t)f);
+  f = (uint64_t)((h2 >> 12) | (h3 << 14)) + U8TO32_LE(nonce + 8) + (f >> 32);
+  to_le_u32_ptr(mac + 8, (uint32_t)f);
+  f = (uint64_t)((h3 >> 18) | (h4 << 8)) + U8TO32_LE(nonce + 12) + (f >> 32);
+  to_le_u32_ptr(mac + 12, (uint32_t)f);
+}
+
+
+#if defined(OPENSSL_NO_ASM) || \
+    (!defined(OPENSSL_X86) && !defined(OPENSSL_X86_64) && \
+     !defined(OPENSSL_ARM) && !defined(OPENSSL_AARCH64))
+
+/* Portable implementations of the functions that are otherwise provided by
+ * the assembly language code. |GFp_poly1305_init_asm| returns zero so that
+ * |GFp_poly1305_init| uses |GFp_poly1305_blocks| and |GFp_poly1305_emit|.
+ * Where the compiler has a 64x64->128-bit multiplication, the accumulator is
+ * kept in base 2^44, as in the 64-bit poly1305-donna; otherwise the base
+ * 2^26 code above is used. */
+
+#if !defined(_MSC_VER) && defined(OPENSSL_64_BIT)
+
+typedef struct {
+  uint64_t r[3];
+  uint64_t h[3];
+} poly1305_c_state;
+
+static const uint64_t kPoly1305Mask42 = UINT64_C(0x3ffffffffff);
+static const uint64_t kPoly1305Mask44 = UINT64_C(0xfffffffffff);
+
+int GFp_poly1305_init_asm(void *ctx, const uint8_t key[16], void *out_func) {
+  (void)out_func;
+  poly1305_c_state *state = ctx;
+
+  uint64_t t0 = from_le_u64_ptr(key);
+  uint64_t t1 = from_le_u64_ptr(key + 8);
+  state->r[0] = t0 & UINT64_C(0xffc0fffffff);
+  state->r[1] = ((t0 >> 44) | (t1 << 20)) & UINT64_C(0xfffffc0ffff);
+  state->r[2] = (t1 >> 24) & UINT64_C(0x00ffffffc0f);
+  memset(state->h, 0, sizeof(state->h));
+  return 0;
+}
+
+void GFp_poly1305_blocks(void *ctx, const uint8_t *in, size_t len,
+                         uint32_t padbit) {
+  poly1305_c_state *state = ctx;
+  const uint64_t r0 = state->r[0], r1 = state->r[1], r2 = state->r[2];
+  const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+  const uint64_t hibit = (uint64_t)padbit << 40;
+  uint64_t h0 = state->h[0], h1 = state->h[1], h2 = state->h[2];
+
+  for (; len >= 16; len -= 16, in += 16) {
+    uint64_t t0 = from_le_u64_ptr(in);
+    uint64_t t1 = from_le_u64_ptr(in + 8);
+    h0 += t0 & kPoly1305Mask44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & kPoly1305Mask44;
+    h2 += ((t1 >> 24) & kPoly1305Mask42) | hibit;
+
+    uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 +
+                   (uint128_t)h2 * s1;
+    uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 +
+                   (uint128_t)h2 * s2;
+    uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 +
+                   (uint128_t)h2 * r0;
+
+    uint64_t c = (uint64_t)(d0 >> 44);
+    h0 = (uint64_t)d0 & kPoly1305Mask44;
+    d1 += c;
+    c = (uint64_t)(d1 >> 44);
+    h1 = (uint64_t)d1 & kPoly1305Mask44;
+    d2 += c;
+    c = (uint64_t)(d2 >> 42);
+    h2 = (uint64_t)d2 & kPoly1305Mask42;
+    h0 += c * 5;
+    c = h0 >> 44;
+    h0 &= kPoly1305Mask44;
+    h1 += c;
+  }
+
+  state->h[0] = h0;
+  state->h[1] = h1;
+  state->h[2] = h2;
+}
+
+void GFp_poly1305_emit(void *ctx, uint8_t mac[16], const uint32_t nonce[4]) {
+  const poly1305_c_state *state = ctx;
+  uint64_t h0 = state->h[0], h1 = state->h[1], h2 = state->h[2];
+
+  /* Fully carry h. */
+  uint64_t c;
+  c = h1 >> 44; h1 &= kPoly1305Mask44;
+  h2 += c; c = h2 >> 42; h2 &= kPoly1305Mask42;
+  h0 += c * 5; c = h0 >> 44; h0 &= kPoly1305Mask44;
+  h1 += c; c = h1 >> 44; h1 &= kPoly1305Mask44;
+  h2 += c; c = h2 >> 42; h2 &= kPoly1305Mask42;
+  h0 += c * 5; c = h0 >> 44; h0 &= kPoly1305Mask44;
+  h1 += c;
+
+  /* Compute h + -p and select it if it doesn't underflow. */
+  uint64_t g0 = h0 + 5;
+  c = g0 >> 44; g0 &= kPoly1305Mask44;
+  uint64_t g1 = h1 + c;
+  c = g1 >> 44; g1 &= kPoly1305Mask44;
+  uint64_t g2 = h2 + c - (UINT64_C(1) << 42);
+
+  uint64_t mask = (g2 >> 63) - 1;
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+
+  /* h = (h + nonce) mod 2^128 */
+  uint64_t t0 = nonce[0] | ((uint64_t)nonce[1] << 32);
+  uint64_t t1 = nonce[2] | ((uint64_t)nonce[3] << 32);
+  h0 += t0 & kPoly1305Mask44;
+  c = h0 >> 44; h0 &= kPoly1305Mask44;
+  h1 += (((t0 >> 44) | (t1 << 20)) & kPoly1305Mask44) + c;
+  c = h1 >> 44; h1 &= kPoly1305Mask44;
+  h2 += (t1 >> 24) + c;
+  h2 &= kPoly1305Mask42;
+
+  to_le_u64_ptr(mac, h0 | (h1 << 44));
+  to_le_u64_ptr(mac + 8, (h1 >> 20) | (h2 << 24));
+}
+
+#else
+
+typedef struct {
+  uint32_t r[5];
+  uint32_t h[5];
+} poly1305_c_state;
+
+int GFp_poly1305_init_asm(void *ctx, const uint8_t key[16], void *out_func) {
+  (void)out_func;
+  poly1305_c_state *state = ctx;
+  poly1305_donna_r(state->r, key);
+  memset(state->h, 0, sizeof(state->h));
+  return 0;
+}
+
+void GFp_poly1305_blocks(void *ctx, const uint8_t *in, size_t len,
+                         uint32_t padbit) {
+  poly1305_c_state *state = ctx;
+  poly1305_donna_blocks(state->h, state->r, in, len / 16, padbit);
+}
 
-  if (state.buf_used != 0) {
-    state.buf[state.buf_used] = 1;
-    memset(state.buf + state.buf_used + 1, 0, 16 - state.buf_used - 1);
-    state.func.blocks(state.opaque, state.buf, 16, 0 /* already padded */);
+void GFp_poly1305_emit(void *ctx, uint8_t mac[16], const uint32_t nonce[4]) {
+  const poly1305_c_state *state = ctx;
+  uint8_t nonce_bytes[16];
+  for (size_t i = 0; i < 4; ++i) {
+    to_le_u32_ptr(nonce_bytes + 4 * i, nonce[i]);
   }
+  poly1305_donna_emit(mac, state->h, nonce_bytes);
+}
+
+#endif
+
+OPENSSL_COMPILE_ASSERT(sizeof(poly1305_c_state) <= POLY1305_BLOCK_STATE_SIZE,
+                       poly1305_c_state_too_large);
+
+#endif
+
+
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+
+#define POLY1305_LANES 4
+
+static const uint32_t kPoly1305Zero[5] = { 0 };
+
+/* The four-lane state of |GFp_poly1305_blocks_4x_avx2|. Each element is a
+ * base 2^26 limb of the lane with the same index. */
+typedef struct {
+  alignas(32) uint64_t h[5][POLY1305_LANES];
+  uint64_t r[5][POLY1305_LANES];
+  uint64_t s[4][POLY1305_LANES]; /* 5 * r[1..4] */
+  uint64_t padbit[POLY1305_LANES];
+} poly1305_lanes;
+
+OPENSSL_COMPILE_ASSERT(sizeof(poly1305_lanes) == 0x1e0,
+                       poly1305_lanes_layout_mismatch);
+
+void GFp_poly1305_blocks_4x_avx2(poly1305_lanes *lanes,
+                                 const uint8_t *const in[POLY1305_LANES],
+                                 size_t num_blocks);
+
+static const uint64_t kPadBit = 1 << 24;
+
+/* poly1305_lanes_enabled is set by |GFp_poly1305_dispatch_setup| when the
+ * CPU has AVX2. */
+static int poly1305_lanes_enabled = 0;
+
+static void poly1305_lane_init(poly1305_lanes *lanes, size_t lane,
+                               const uint32_t h[5], const uint32_t r[5]) {
+  for (size_t i = 0; i < 5; ++i) {
+    lanes->h[i][lane] = h[i];
+    lanes->r[i][lane] = r[i];
+  }
+  for (size_t i = 1; i < 5; ++i) {
+    lanes->s[i - 1][lane] = (uint64_t)r[i] * 5;
+  }
+  lanes->padbit[lane] = kPadBit;
+}
+
+static void poly1305_lane_h(uint32_t h[5], const poly1305_lanes *lanes,
+                            size_t lane) {
+  for (size_t i = 0; i < 5; ++i) {
+    h[i] = (uint32_t)lanes->h[i][lane];
+  }
+}
+
+/* poly1305_multi_4x_avx2 computes the tags of |num| messages in four lanes.
+ * Whenever a lane's message runs out, its tag is written and the lane moves
+ * on to the next message, so messages of different lengths keep all four
+ * lanes busy. */
+static void poly1305_multi_4x_avx2(uint8_t *macs, const uint8_t *keys,
+                                   const uint8_t *const ins[],
+                                   const size_t in_lens[], size_t num) {
+  poly1305_lanes lanes;
+  const uint8_t *in[POLY1305_LANES];
+  size_t remaining[POLY1305_LANES];
+  size_t msg[POLY1305_LANES];
+  int active[POLY1305_LANES];
+  alignas(16) uint8_t last_block[POLY1305_LANES][16];
+
+  size_t next = 0;
+  for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+    active[lane] = 0;
+    remaining[lane] = 0;
+  }
+
+  for (;;) {
+    /* Retire finished lanes and start the next messages in them. Empty
+     * messages are finished right away. */
+    size_t num_active = 0;
+    size_t first_active = 0;
+    for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+      while (remaining[lane] == 0) {
+        if (active[lane]) {
+          uint32_t h[5];
+          poly1305_lane_h(h, &lanes, lane);
+          poly1305_donna_emit(macs + 16 * msg[lane], h,
+                              keys + 32 * msg[lane] + 16);
+          active[lane] = 0;
+        }
+        if (next == num) {
+          break;
+        }
+        msg[lane] = next++;
+        in[lane] = ins[msg[lane]];
+        remaining[lane] = in_lens[msg[lane]];
+        uint32_t r[5];
+        poly1305_donna_r(r, keys + 32 * msg[lane]);
+        poly1305_lane_init(&lanes, lane, kPoly1305Zero, r);
+        active[lane] = 1;
+      }
+      if (active[lane]) {
+        if (num_active == 0) {
+          first_active = lane;
+        }
+        ++num_active;
+      }
+    }
+    if (num_active == 0) {
+      break;
+    }
+
+    /* Run all the lanes for as many whole blocks as the shortest message
+     * has left. If that is none, run one block in which the lanes that are
+     * down to a partial block absorb it, padded. */
+    size_t num_blocks = SIZE_MAX;
+    for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+      if (active[lane] && remaining[lane] / 16 < num_blocks) {
+        num_blocks = remaining[lane] / 16;
+      }
+    }
+    if (num_blocks == 0) {
+      num_blocks = 1;
+      for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+        if (active[lane] && remaining[lane] < 16) {
+          memcpy(last_block[lane], in[lane], remaining[lane]);
+          last_block[lane][remaining[lane]] = 1;
+          memset(last_block[lane] + remaining[lane] + 1, 0,
+                 16 - remaining[lane] - 1);
+          in[lane] = last_block[lane];
+          remaining[lane] = 16;
+          lanes.padbit[lane] = 0;
+        }
+      }
+    }
+
+    /* Idle lanes hash a copy of an active lane's input and are ignored. */
+    const uint8_t *lane_in[POLY1305_LANES];
+    for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+      lane_in[lane] = active[lane] ? in[lane] : in[first_active];
+    }
+    GFp_poly1305_blocks_4x_avx2(&lanes, lane_in, num_blocks);
+
+    for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+      if (active[lane]) {
+        in[lane] += 16 * num_blocks;
+        remaining[lane] -= 16 * num_blocks;
+      }
+    }
+  }
+}
+
+#endif
+
+void GFp_poly1305_dispatch_setup(void) {
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+  poly1305_lanes_enabled = (GFp_ia32cap_P[2] & (1 << 5)) != 0; /* AVX2 */
+#endif
+}
+
+int GFp_poly1305_partial_has_lanes(void) {
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+  return poly1305_lanes_enabled;
+#else
+  return 0;
+#endif
+}
+
+void GFp_poly1305_multi(uint8_t *macs, const uint8_t *keys,
+                        const uint8_t *const ins[], const size_t in_lens[],
+                        size_t num) {
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+  if (poly1305_lanes_enabled) {
+    poly1305_multi_4x_avx2(macs, keys, ins, in_lens, num);
+    return;
+  }
+#endif
+
+  for (size_t i = 0; i < num; ++i) {
+    poly1305_state state;
+    alignas(16) uint8_t mac[16];
+    GFp_poly1305_init(&state, keys + 32 * i);
+    GFp_poly1305_update(&state, ins[i], in_lens[i]);
+    GFp_poly1305_finish(&state, mac);
+    memcpy(macs + 16 * i, mac, sizeof(mac));
+  }
+}
+
+void GFp_poly1305_partial_init(poly1305_partial *partial,
+                               const uint8_t key[32]) {
+  poly1305_donna_r(partial->r, key);
+  memset(partial->h, 0, sizeof(partial->h));
+  partial->num_blocks = 0;
+}
+
+void GFp_poly1305_partial_update(poly1305_partial *partial, const uint8_t *in,
+                                 size_t in_len) {
+  assert(in_len % 16 == 0);
+  size_t num_blocks = in_len / 16;
+  partial->num_blocks += num_blocks;
+
+#if !defined(OPENSSL_NO_ASM) && defined(OPENSSL_X86_64)
+  /* Long inputs are split into four runs that are hashed in the four lanes
+   * and then combined like partials. */
+  if (poly1305_lanes_enabled && num_blocks >= 4 * 16) {
+    size_t lane_blocks = num_blocks / POLY1305_LANES;
+    poly1305_lanes lanes;
+    const uint8_t *lane_in[POLY1305_LANES];
+    for (size_t lane = 0; lane < POLY1305_LANES; ++lane) {
+      poly1305_lane_init(&lanes, lane, lane == 0 ? partial->h : kPoly1305Zero,
+                         partial->r);
+      lane_in[lane] = in + 16 * lane_blocks * lane;
+    }
+    GFp_poly1305_blocks_4x_avx2(&lanes, lane_in, lane_blocks);
+
+    uint32_t r_n[5];
+    poly1305_donna_pow(r_n, partial->r, lane_blocks);
+    poly1305_lane_h(partial->h, &lanes, 0);
+    for (size_t lane = 1; lane < POLY1305_LANES; ++lane) {
+      uint32_t h[5];
+      poly1305_lane_h(h, &lanes, lane);
+      poly1305_donna_mul(partial->h, partial->h, r_n);
+      poly1305_donna_add(partial->h, h);
+    }
+    in += 16 * lane_blocks * POLY1305_LANES;
+    num_blocks -= lane_blocks * POLY1305_LANES;
+  }
+#endif
+
+  poly1305_donna_blocks(partial->h, partial->r, in, num_blocks, 1);
+}
+
+void GFp_poly1305_partial_append(poly1305_partial *partial,
+                                 const poly1305_partial *next) {
+  assert(memcmp(partial->r, next->r, sizeof(partial->r)) == 0);
+  if (next->num_blocks == 0) {
+    return;
+  }
+  uint32_t r_n[5];
+  poly1305_donna_pow(r_n, partial->r, next->num_blocks);
+  poly1305_donna_mul(partial->h, partial->h, r_n);
+  poly1305_donna_add(partial->h, next->h);
+  partial->num_blocks += next->num_blocks;
+}
 
-  state.func.emit(state.opaque, mac, state.nonce);
+void GFp_poly1305_partial_finish(const poly1305_partial *partial,
+                                 uint8_t mac[16], const uint8_t key[32]) {
+  poly1305_donna_emit(mac, partial->h, key + 16);
 }
 
 const size_t GFp_POLY1305_STATE_LEN = sizeof(struct poly1305_state_st);
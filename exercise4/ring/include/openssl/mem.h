@@ -85,6 +85,13 @@ extern "C" {
  * non-zero. */
 OPENSSL_EXPORT int GFp_memcmp(const void *a, const void *b, size_t len);
 
+/* GFp_cleanse zeros the |len| bytes at |ptr| in a way that the compiler won't
+ * remove as a dead store, for wiping secrets from memory that is about to go
+ * out of scope. */
+OPENSSL_EXPORT void GFp_cleanse(void *ptr, size_t len);
+
+#define OPENSSL_cleanse GFp_cleanse
+
 
 #if defined(__cplusplus)
 }  /* extern C */
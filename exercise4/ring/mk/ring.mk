@@ -32,6 +32,7 @@ RING_SRCS = $(addprefix $(RING_PREFIX), \
   crypto/bn/random.c \
   crypto/bn/rsaz_exp.c \
   crypto/bn/shift.c \
+  crypto/chacha/chacha.c \
   crypto/cipher/e_aes.c \
   crypto/crypto.c \
   crypto/curve25519/curve25519.c \
@@ -43,6 +44,7 @@ RING_SRCS = $(addprefix $(RING_PREFIX), \
   crypto/ec/wnaf.c \
   crypto/mem.c \
   crypto/modes/gcm.c \
+  crypto/poly1305/chacha20_poly1305.c \
   crypto/poly1305/poly1305.c \
   crypto/rand/sysrand.c \
   crypto/rsa/blinding.c \
@@ -132,6 +134,7 @@ RING_aarch64_SRCS = $(addprefix $(RING_PREFIX), \
 RING_TEST_SRCS = $(addprefix $(RING_PREFIX), \
   crypto/bn/bn_test.cc \
   crypto/constant_time_test.c \
+  crypto/modes/gcm_test.c \
   crypto/test/bn_test_convert.c \
   crypto/test/bn_test_lib.c \
   crypto/test/file_test.cc \
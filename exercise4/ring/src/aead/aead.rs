@@ -27,11 +27,17 @@
 
 mod chacha20_poly1305;
 mod aes_gcm;
+pub mod cipher;
+pub mod poly1305;
+pub mod quic;
 
-use {constant_time, error, init, polyfill};
+use {c, constant_time, error, init, polyfill};
 
 pub use self::chacha20_poly1305::CHACHA20_POLY1305;
-pub use self::aes_gcm::{AES_128_GCM, AES_256_GCM};
+pub use self::aes_gcm::{AES_128_GCM, AES_256_GCM, AES_128_GCM_SIV,
+                        AES_256_GCM_SIV, CompactOpeningKey, CompactSealingKey,
+                        KEYSTREAM_MAX_LEN, OpeningKeystream, OpeningStream,
+                        SealingKeystream, SealingStream};
 
 /// A key for authenticating and decrypting (&ldquo;opening&rdquo;)
 /// AEAD-protected data.
@@ -103,6 +109,7 @@ pub fn open_in_place(key: &OpeningKey, nonce: &[u8], in_prefix_len: usize,
     let (in_out, received_tag) =
         in_out.split_at_mut(in_prefix_len + ciphertext_len);
     let mut calculated_tag = [0u8; TAG_LEN];
+    calculated_tag.copy_from_slice(received_tag);
     try!((key.key.algorithm.open)(&key.key.ctx_buf, nonce, in_out,
                                   in_prefix_len, &mut calculated_tag, ad));
     try!(constant_time::verify_slices_are_equal(&calculated_tag, received_tag));
@@ -183,6 +190,339 @@ pub fn seal_in_place(key: &SealingKey, nonce: &[u8], in_out: &mut [u8],
     Ok(in_out_len + TAG_LEN)
 }
 
+/// Like `seal_in_place`, but reads the plaintext from `in_` and writes the
+/// ciphertext and tag to `out`, so a caller that keeps the plaintext doesn't
+/// have to copy it into the output buffer first.
+///
+/// `out` must be at least `key.algorithm.max_overhead_len()` bytes longer
+/// than `in_`. When `seal` returns `Ok(out_len)`, the encrypted and signed
+/// output is `out[..out_len]`.
+pub fn seal(key: &SealingKey, nonce: &[u8], in_: &[u8], out: &mut [u8],
+            ad: &[u8]) -> Result<usize, error::Unspecified> {
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    if out.len() < in_.len() + key.key.algorithm.max_overhead_len() {
+        return Err(error::Unspecified);
+    }
+    try!(check_per_nonce_max_bytes(in_.len()));
+    let (out, tag_out) = out.split_at_mut(in_.len());
+    let tag_out = try!(slice_as_array_ref_mut!(&mut tag_out[..TAG_LEN],
+                                               TAG_LEN));
+    match key.key.algorithm.seal_out_of_place {
+        Some(seal_out_of_place) => {
+            try!(seal_out_of_place(&key.key.ctx_buf, nonce, in_, out, tag_out,
+                                   ad));
+        },
+        None => {
+            out.copy_from_slice(in_);
+            try!((key.key.algorithm.seal)(&key.key.ctx_buf, nonce, out,
+                                          tag_out, ad));
+        },
+    }
+    Ok(in_.len() + TAG_LEN)
+}
+
+/// Lends threads to `seal_in_place_parallel` and `open_in_place_parallel`,
+/// which have none of their own.
+///
+/// This is unsafe to implement because the tasks write to the caller's
+/// buffer: memory safety depends on `parallel_for` doing exactly what it is
+/// documented to do.
+pub unsafe trait ParallelExecutor: Sync {
+    /// Calls `task(i)` exactly once for every `i` in `0..num_tasks`, on any
+    /// threads and in any order, and returns only after all of those calls
+    /// have returned. It must not panic.
+    fn parallel_for(&self, num_tasks: usize, task: &(Fn(usize) + Sync));
+}
+
+/// Like `seal_in_place`, but a long message may be split into chunks that are
+/// sealed concurrently on the threads of `executor`.
+///
+/// The message is split into at most `max_threads` chunks, each long enough
+/// that sealing it takes much longer than combining its tag with the others;
+/// shorter messages, and algorithms that don't support splitting, are sealed
+/// on the calling thread. The result is the same as that of `seal_in_place`.
+pub fn seal_in_place_parallel(key: &SealingKey, nonce: &[u8],
+                              in_out: &mut [u8], out_suffix_capacity: usize,
+                              ad: &[u8], max_threads: usize,
+                              executor: &ParallelExecutor)
+                              -> Result<usize, error::Unspecified> {
+    let seal_parallel = match key.key.algorithm.seal_parallel {
+        Some(seal_parallel) => seal_parallel,
+        None => {
+            return seal_in_place(key, nonce, in_out, out_suffix_capacity, ad);
+        },
+    };
+    if out_suffix_capacity < key.key.algorithm.max_overhead_len() {
+        return Err(error::Unspecified);
+    }
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    let in_out_len =
+        try!(in_out.len().checked_sub(out_suffix_capacity)
+                         .ok_or(error::Unspecified));
+    try!(check_per_nonce_max_bytes(in_out_len));
+    let (in_out, tag_out) = in_out.split_at_mut(in_out_len);
+    let tag_out = try!(slice_as_array_ref_mut!(tag_out, TAG_LEN));
+    try!(seal_parallel(&key.key.ctx_buf, nonce, in_out, tag_out, ad,
+                       max_threads, executor));
+    Ok(in_out_len + TAG_LEN)
+}
+
+/// Like `open_in_place` with an `in_prefix_len` of zero, but a long message
+/// may be split into chunks that are opened concurrently on the threads of
+/// `executor`, as for `seal_in_place_parallel`.
+pub fn open_in_place_parallel(key: &OpeningKey, nonce: &[u8],
+                              in_out: &mut [u8], ad: &[u8],
+                              max_threads: usize,
+                              executor: &ParallelExecutor)
+                              -> Result<usize, error::Unspecified> {
+    let open_parallel = match key.key.algorithm.open_parallel {
+        Some(open_parallel) => open_parallel,
+        None => { return open_in_place(key, nonce, 0, in_out, ad); },
+    };
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    let ciphertext_len =
+        try!(in_out.len().checked_sub(TAG_LEN).ok_or(error::Unspecified));
+    try!(check_per_nonce_max_bytes(ciphertext_len));
+    let (in_out, received_tag) = in_out.split_at_mut(ciphertext_len);
+    let mut calculated_tag = [0u8; TAG_LEN];
+    try!(open_parallel(&key.key.ctx_buf, nonce, in_out, &mut calculated_tag,
+                       ad, max_threads, executor));
+    try!(constant_time::verify_slices_are_equal(&calculated_tag, received_tag));
+    Ok(ciphertext_len)
+}
+
+// The type of `GFp_parallel_for_f` in crypto/internal.h.
+type ParallelFor =
+    unsafe extern fn(executor: *mut u8, num_tasks: c::size_t,
+                     task: unsafe extern fn(task_arg: *mut u8, i: c::size_t),
+                     task_arg: *mut u8);
+
+// A `ParallelFor` for the parallel C functions, for which `executor` is a
+// pointer to a `&ParallelExecutor`.
+unsafe extern fn parallel_for(executor: *mut u8, num_tasks: c::size_t,
+                              task: unsafe extern fn(task_arg: *mut u8,
+                                                     i: c::size_t),
+                              task_arg: *mut u8) {
+    // The C tasks work on disjoint parts of the message, so `task_arg` may
+    // be shared between threads.
+    struct TaskArg(*mut u8);
+    unsafe impl Sync for TaskArg {}
+
+    let executor = executor as *const &ParallelExecutor;
+    let task_arg = TaskArg(task_arg);
+    (*executor).parallel_for(num_tasks, &|i| {
+        assert!(i < num_tasks);
+        task(task_arg.0, i)
+    });
+}
+
+/// Computes the tag of `ad` alone, without encrypting anything.
+///
+/// The tag is the one that `seal_in_place` would produce for an empty
+/// plaintext with `ad` as the additional authenticated data, so for AES-GCM
+/// this is GMAC. It is written to `tag_out`, which must be exactly
+/// `MAX_OVERHEAD_LEN` bytes long. `nonce` must be unique for every use of the
+/// key, including its uses with `seal_in_place`.
+pub fn authenticate(key: &SealingKey, nonce: &[u8], ad: &[u8],
+                    tag_out: &mut [u8]) -> Result<(), error::Unspecified> {
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    let tag_out = try!(slice_as_array_ref_mut!(tag_out, TAG_LEN));
+    key.key.authenticate(nonce, ad, tag_out)
+}
+
+/// Checks, in constant time, that `tag` is the tag of `ad` alone, as computed
+/// by `authenticate`.
+pub fn verify(key: &OpeningKey, nonce: &[u8], ad: &[u8], tag: &[u8])
+              -> Result<(), error::Unspecified> {
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    let mut calculated_tag = [0u8; TAG_LEN];
+    try!(key.key.authenticate(nonce, ad, &mut calculated_tag));
+    constant_time::verify_slices_are_equal(&calculated_tag, tag)
+}
+
+/// One record of a batch for `seal_in_place_batch` or `open_in_place_batch`.
+pub struct BatchRecord<'a> {
+    /// The nonce. Like the nonce passed to `seal_in_place`, it must be unique
+    /// for every record sealed with the key.
+    pub nonce: &'a [u8],
+
+    /// The additional authenticated data, if any.
+    pub ad: &'a [u8],
+
+    /// The record, transformed in place. For sealing, this is the plaintext
+    /// followed by `MAX_OVERHEAD_LEN` bytes of room for the tag; for opening,
+    /// it is the ciphertext followed by the tag.
+    pub in_out: &'a mut [u8],
+}
+
+/// Seals a batch of records in place under one key, each with its own nonce
+/// and additional data.
+///
+/// Each record's `in_out` must end with exactly `MAX_OVERHEAD_LEN` bytes of
+/// room for the tag. When `seal_in_place_batch` returns `Ok(())`, every
+/// record's `in_out` holds its ciphertext followed by its tag, exactly as
+/// `seal_in_place` would have left it.
+///
+/// For AES-GCM, the keystream of consecutive short records is computed
+/// together, which is faster than sealing them one at a time. Other
+/// algorithms seal the records one after another.
+pub fn seal_in_place_batch(key: &SealingKey, records: &mut [BatchRecord])
+                           -> Result<(), error::Unspecified> {
+    for record in records.iter() {
+        try!(check_batch_record(record));
+    }
+    let algorithm = key.key.algorithm;
+    let mut tags = [[0u8; TAG_LEN]; BATCH_RECORDS];
+    for records in records.chunks_mut(BATCH_RECORDS) {
+        let tags = &mut tags[..records.len()];
+        match algorithm.seal_batch {
+            Some(seal_batch) => {
+                try!(seal_batch(&key.key.ctx_buf, records, tags));
+            },
+            None => {
+                for (record, tag) in records.iter_mut().zip(tags.iter_mut()) {
+                    let in_out_len = record.in_out.len() - TAG_LEN;
+                    let nonce =
+                        try!(slice_as_array_ref!(record.nonce, NONCE_LEN));
+                    try!((algorithm.seal)(&key.key.ctx_buf, nonce,
+                                          &mut record.in_out[..in_out_len],
+                                          tag, record.ad));
+                }
+            },
+        }
+        for (record, tag) in records.iter_mut().zip(tags.iter()) {
+            let in_out_len = record.in_out.len() - TAG_LEN;
+            record.in_out[in_out_len..].copy_from_slice(tag);
+        }
+    }
+    Ok(())
+}
+
+/// Authenticates and decrypts a batch of records in place under one key,
+/// each with its own nonce and additional data.
+///
+/// Each record's `in_out` is its ciphertext followed by its tag. When
+/// `open_in_place_batch` returns `Ok(())`, every record was authentic and
+/// the first `in_out.len() - MAX_OVERHEAD_LEN` bytes of each `in_out` are its
+/// plaintext. If any record is not authentic, an error is returned and none
+/// of the records' contents may be used; `open_in_place` can be used to find
+/// out which records are authentic.
+///
+/// For AES-GCM, the keystream of consecutive short records is computed
+/// together, which is faster than opening them one at a time. Other
+/// algorithms open the records one after another.
+pub fn open_in_place_batch(key: &OpeningKey, records: &mut [BatchRecord])
+                           -> Result<(), error::Unspecified> {
+    for record in records.iter() {
+        try!(check_batch_record(record));
+    }
+    let algorithm = key.key.algorithm;
+    let mut tags = [[0u8; TAG_LEN]; BATCH_RECORDS];
+    let mut result = Ok(());
+    for records in records.chunks_mut(BATCH_RECORDS) {
+        let tags = &mut tags[..records.len()];
+        match algorithm.open_batch {
+            Some(open_batch) => {
+                try!(open_batch(&key.key.ctx_buf, records, tags));
+            },
+            None => {
+                for (record, tag) in records.iter_mut().zip(tags.iter_mut()) {
+                    let in_out_len = record.in_out.len() - TAG_LEN;
+                    tag.copy_from_slice(&record.in_out[in_out_len..]);
+                    let nonce =
+                        try!(slice_as_array_ref!(record.nonce, NONCE_LEN));
+                    try!((algorithm.open)(&key.key.ctx_buf, nonce,
+                                          &mut record.in_out[..in_out_len], 0,
+                                          tag, record.ad));
+                }
+            },
+        }
+        for (record, tag) in records.iter().zip(tags.iter()) {
+            let in_out_len = record.in_out.len() - TAG_LEN;
+            if constant_time::verify_slices_are_equal(
+                    tag, &record.in_out[in_out_len..]).is_err() {
+                result = Err(error::Unspecified);
+            }
+        }
+    }
+    result
+}
+
+fn check_batch_record(record: &BatchRecord) -> Result<(), error::Unspecified> {
+    if record.nonce.len() != NONCE_LEN {
+        return Err(error::Unspecified);
+    }
+    let in_out_len =
+        try!(record.in_out.len().checked_sub(TAG_LEN)
+                                .ok_or(error::Unspecified));
+    check_per_nonce_max_bytes(in_out_len)
+}
+
+/// The number of records that `seal_in_place_batch` and `open_in_place_batch`
+/// pass to the algorithm at a time.
+const BATCH_RECORDS: usize = 16;
+
+/// Encrypts and signs (&ldquo;seals&rdquo;) data that is split into segments.
+///
+/// The plaintext is the concatenation of the `in_` segments and the
+/// ciphertext is written to the concatenation of the `out` segments, which
+/// may be split differently but must have the same total length. The
+/// additional authenticated data is the concatenation of the `ad` segments.
+/// The tag is written to `tag_out`, which must be exactly `MAX_OVERHEAD_LEN`
+/// bytes long. Each of `in_`, `out` and `ad` may have at most `MAX_SEGMENTS`
+/// segments.
+///
+/// Only AES-GCM supports scatter-gather sealing; other algorithms return an
+/// error.
+pub fn seal_sg(key: &SealingKey, nonce: &[u8], in_: &[&[u8]],
+               out: &mut [&mut [u8]], tag_out: &mut [u8], ad: &[&[u8]])
+               -> Result<(), error::Unspecified> {
+    let seal_sg = try!(key.key.algorithm.seal_sg.ok_or(error::Unspecified));
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    let tag_out = try!(slice_as_array_ref_mut!(tag_out, TAG_LEN));
+    try!(check_segments(in_, out, ad));
+    seal_sg(&key.key.ctx_buf, nonce, in_, out, tag_out, ad)
+}
+
+/// Authenticates and decrypts (&ldquo;opens&rdquo;) data that is split into
+/// segments.
+///
+/// The ciphertext is the concatenation of the `in_` segments, `tag` is its
+/// tag, and the plaintext is written to the concatenation of the `out`
+/// segments, as for `seal_sg`. If the ciphertext is not authentic, an error is
+/// returned and the contents of `out` must not be used.
+///
+/// Only AES-GCM supports scatter-gather opening; other algorithms return an
+/// error.
+pub fn open_sg(key: &OpeningKey, nonce: &[u8], in_: &[&[u8]],
+               out: &mut [&mut [u8]], tag: &[u8], ad: &[&[u8]])
+               -> Result<(), error::Unspecified> {
+    let open_sg = try!(key.key.algorithm.open_sg.ok_or(error::Unspecified));
+    let nonce = try!(slice_as_array_ref!(nonce, NONCE_LEN));
+    try!(check_segments(in_, out, ad));
+    let mut calculated_tag = [0u8; TAG_LEN];
+    try!(open_sg(&key.key.ctx_buf, nonce, in_, out, &mut calculated_tag, ad));
+    constant_time::verify_slices_are_equal(&calculated_tag, tag)
+}
+
+fn check_segments(in_: &[&[u8]], out: &[&mut [u8]], ad: &[&[u8]])
+                  -> Result<(), error::Unspecified> {
+    if in_.len() > MAX_SEGMENTS || out.len() > MAX_SEGMENTS ||
+       ad.len() > MAX_SEGMENTS {
+        return Err(error::Unspecified);
+    }
+    let in_len = in_.iter().fold(0, |acc, segment| acc + segment.len());
+    let out_len = out.iter().fold(0, |acc, segment| acc + segment.len());
+    if in_len != out_len {
+        return Err(error::Unspecified);
+    }
+    check_per_nonce_max_bytes(in_len)
+}
+
+/// The maximum number of segments in each of the input, output and additional
+/// data of `seal_sg` and `open_sg`.
+pub const MAX_SEGMENTS: usize = 16;
+
 /// `OpeningKey` and `SealingKey` are type-safety wrappers around `Key`, which
 /// does all the actual work via the C AEAD interface.
 ///
@@ -217,6 +557,17 @@ impl Key {
     /// The key's AEAD algorithm.
     #[inline(always)]
     fn algorithm(&self) -> &'static Algorithm { self.algorithm }
+
+    fn authenticate(&self, nonce: &[u8; NONCE_LEN], ad: &[u8],
+                    tag_out: &mut [u8; TAG_LEN])
+                    -> Result<(), error::Unspecified> {
+        match self.algorithm.authenticate {
+            Some(authenticate) =>
+                authenticate(&self.ctx_buf, nonce, ad, tag_out),
+            None => (self.algorithm.seal)(&self.ctx_buf, nonce, &mut [],
+                                          tag_out, ad),
+        }
+    }
 }
 
 /// An AEAD Algorithm.
@@ -231,11 +582,69 @@ pub struct Algorithm {
     seal: fn(ctx: &[u64; KEY_CTX_BUF_ELEMS], nonce: &[u8; NONCE_LEN],
               in_out: &mut [u8], tag_out: &mut [u8; TAG_LEN], ad: &[u8])
               -> Result<(), error::Unspecified>,
+    // `tag_out` holds the received tag on entry, for algorithms like
+    // AES-GCM-SIV that need it to decrypt and so check it themselves. On
+    // success it holds the calculated tag, which the caller compares with the
+    // received tag.
     open: fn(ctx: &[u64; KEY_CTX_BUF_ELEMS], nonce: &[u8; NONCE_LEN],
              in_out: &mut [u8], in_prefix_len: usize,
              tag_out: &mut [u8; TAG_LEN], ad: &[u8])
              -> Result<(), error::Unspecified>,
 
+    // Seal or open up to `BATCH_RECORDS` records, which have been checked
+    // with `check_batch_record`, writing the records' tags to `tags_out`.
+    // `None` if the records are just sealed or opened one at a time.
+    seal_batch: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                          records: &mut [BatchRecord],
+                          tags_out: &mut [[u8; TAG_LEN]])
+                          -> Result<(), error::Unspecified>>,
+    open_batch: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                          records: &mut [BatchRecord],
+                          tags_out: &mut [[u8; TAG_LEN]])
+                          -> Result<(), error::Unspecified>>,
+
+    // Seal or open segments that have been checked with `check_segments`,
+    // writing the tag to `tag_out`. `None` if the algorithm doesn't support
+    // scatter-gather lists.
+    seal_sg: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                       nonce: &[u8; NONCE_LEN], in_: &[&[u8]],
+                       out: &mut [&mut [u8]], tag_out: &mut [u8; TAG_LEN],
+                       ad: &[&[u8]]) -> Result<(), error::Unspecified>>,
+    open_sg: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                       nonce: &[u8; NONCE_LEN], in_: &[&[u8]],
+                       out: &mut [&mut [u8]], tag_out: &mut [u8; TAG_LEN],
+                       ad: &[&[u8]]) -> Result<(), error::Unspecified>>,
+
+    // Seal or open a message whose lengths have been checked, splitting it
+    // into at most `max_threads` chunks for `executor`. `None` if the
+    // algorithm doesn't support splitting messages.
+    seal_parallel: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                             nonce: &[u8; NONCE_LEN], in_out: &mut [u8],
+                             tag_out: &mut [u8; TAG_LEN], ad: &[u8],
+                             max_threads: usize,
+                             executor: &ParallelExecutor)
+                             -> Result<(), error::Unspecified>>,
+    open_parallel: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                             nonce: &[u8; NONCE_LEN], in_out: &mut [u8],
+                             tag_out: &mut [u8; TAG_LEN], ad: &[u8],
+                             max_threads: usize,
+                             executor: &ParallelExecutor)
+                             -> Result<(), error::Unspecified>>,
+
+    // Compute the tag of `ad` alone. `None` if that is done by sealing an
+    // empty plaintext.
+    authenticate: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                            nonce: &[u8; NONCE_LEN], ad: &[u8],
+                            tag_out: &mut [u8; TAG_LEN])
+                            -> Result<(), error::Unspecified>>,
+
+    // Seal `in_` into `out`, which has the same length. `None` if the
+    // plaintext is copied to `out` and sealed in place.
+    seal_out_of_place: Option<fn(ctx: &[u64; KEY_CTX_BUF_ELEMS],
+                                 nonce: &[u8; NONCE_LEN], in_: &[u8],
+                                 out: &mut [u8], tag_out: &mut [u8; TAG_LEN],
+                                 ad: &[u8]) -> Result<(), error::Unspecified>>,
+
     key_len: usize,
 }
 
@@ -291,8 +700,32 @@ fn check_per_nonce_max_bytes(in_out_len: usize)
 #[cfg(test)]
 mod tests {
     use super::super::{aead, error, test};
+    use core;
+    use std;
     use std::vec::Vec;
 
+    // Runs each task on a thread of its own and counts the tasks.
+    pub struct ThreadExecutor {
+        pub calls: std::sync::atomic::AtomicUsize,
+    }
+
+    unsafe impl aead::ParallelExecutor for ThreadExecutor {
+        fn parallel_for(&self, num_tasks: usize, task: &(Fn(usize) + Sync)) {
+            let _ = self.calls.fetch_add(num_tasks,
+                                         std::sync::atomic::Ordering::SeqCst);
+            // The threads are joined before returning, so `task` outlives
+            // them.
+            let task: &'static (Fn(usize) + Sync) =
+                unsafe { core::mem::transmute(task) };
+            let threads: Vec<_> = (0..num_tasks).map(|i| {
+                std::thread::spawn(move || task(i))
+            }).collect();
+            for thread in threads {
+                thread.join().unwrap();
+            }
+        }
+    }
+
     pub fn test_aead(aead_alg: &'static aead::Algorithm, file_path: &str) {
         test_aead_key_sizes(aead_alg);
         test_aead_nonce_sizes(aead_alg).unwrap();
@@ -318,8 +751,29 @@ mod tests {
                                                max_overhead_len, &ad);
             let o_key = try!(aead::OpeningKey::new(aead_alg, &key_bytes[..]));
 
+            // Without a plaintext, the tag authenticates just the AD.
+            if error.is_none() && plaintext.is_empty() {
+                let mut a_tag = [0u8; aead::TAG_LEN];
+                try!(aead::authenticate(&s_key, &nonce, &ad, &mut a_tag));
+                assert_eq!(&tag[..], &a_tag[..]);
+                try!(aead::verify(&o_key, &nonce, &ad, &tag));
+            }
+
             ct.extend(tag);
 
+            // Out of place, into a buffer with a byte to spare.
+            let mut out = vec![0u8; ct.len() + 1];
+            let out_result = aead::seal(&s_key, &nonce, &plaintext, &mut out,
+                                        &ad);
+            if error.is_none() {
+                assert_eq!(Ok(ct.len()), out_result);
+                assert_eq!(&ct[..], &out[..ct.len()]);
+                assert!(aead::seal(&s_key, &nonce, &plaintext,
+                                   &mut out[..(ct.len() - 1)], &ad).is_err());
+            } else {
+                assert_eq!(Err(error::Unspecified), out_result);
+            }
+
             // In release builds, test all prefix lengths from 0 to 4096 bytes.
             // Debug builds are too slow for this, so for those builds, only
             // test a smaller subset.
@@ -431,6 +885,91 @@ mod tests {
         });
     }
 
+    // Each test vector is batched together with other records under the same
+    // key, at a different position each time. There are more records than
+    // `aead::BATCH_RECORDS`, and they include a message that is too long to
+    // share the counter blocks of a batch of AES-GCM records.
+    pub fn test_aead_batch(aead_alg: &'static aead::Algorithm,
+                           file_path: &str) {
+        const OTHER_LENS: [usize; 6] = [0, 1, 16, 100, 2000, 17];
+
+        let mut position = 0;
+        test::from_file(file_path, |section, test_case| {
+            assert_eq!(section, "");
+            let key_bytes = test_case.consume_bytes("KEY");
+            let nonce = test_case.consume_bytes("NONCE");
+            let plaintext = test_case.consume_bytes("IN");
+            let ad = test_case.consume_bytes("AD");
+            let mut ct = test_case.consume_bytes("CT");
+            let tag = test_case.consume_bytes("TAG");
+            if test_case.consume_optional_string("FAILS").is_some() {
+                return Ok(());
+            }
+            ct.extend(tag);
+
+            let s_key = try!(aead::SealingKey::new(aead_alg, &key_bytes));
+            let o_key = try!(aead::OpeningKey::new(aead_alg, &key_bytes));
+
+            // The nonce, AD, plaintext, and ciphertext and tag of each record.
+            let mut records = Vec::new();
+            for i in 0..(aead::BATCH_RECORDS + 3) {
+                let other_nonce = vec![i as u8; aead::NONCE_LEN];
+                let other_ad = vec![i as u8; i];
+                let other_plaintext =
+                    vec![(i * 3) as u8; OTHER_LENS[i % OTHER_LENS.len()]];
+                let mut sealed = other_plaintext.clone();
+                sealed.extend_from_slice(&[0u8; aead::TAG_LEN]);
+                let _ = try!(aead::seal_in_place(&s_key, &other_nonce,
+                                                 &mut sealed, aead::TAG_LEN,
+                                                 &other_ad));
+                records.push((other_nonce, other_ad, other_plaintext, sealed));
+            }
+            records.insert(position % (records.len() + 1),
+                           (nonce, ad, plaintext, ct));
+            position += 1;
+
+            let mut in_outs: Vec<Vec<u8>> =
+                records.iter().map(|&(_, _, ref plaintext, _)| {
+                    let mut in_out = plaintext.clone();
+                    in_out.extend_from_slice(&[0u8; aead::TAG_LEN]);
+                    in_out
+                }).collect();
+            try!(aead::seal_in_place_batch(
+                &s_key, &mut batch_records(&records, &mut in_outs)));
+            for (record, in_out) in records.iter().zip(in_outs.iter()) {
+                assert_eq!(&record.3, in_out);
+            }
+
+            try!(aead::open_in_place_batch(
+                &o_key, &mut batch_records(&records, &mut in_outs)));
+            for (record, in_out) in records.iter().zip(in_outs.iter()) {
+                assert_eq!(&record.2[..], &in_out[..record.2.len()]);
+            }
+
+            // One forged record makes the whole batch fail.
+            let mut in_outs: Vec<Vec<u8>> =
+                records.iter().map(|record| record.3.clone()).collect();
+            let forged = position % in_outs.len();
+            let last = in_outs[forged].len() - 1;
+            in_outs[forged][last] ^= 1;
+            assert!(aead::open_in_place_batch(
+                &o_key, &mut batch_records(&records, &mut in_outs)).is_err());
+
+            Ok(())
+        });
+    }
+
+    fn batch_records<'a>(records: &'a [(Vec<u8>, Vec<u8>, Vec<u8>, Vec<u8>)],
+                         in_outs: &'a mut [Vec<u8>])
+                         -> Vec<aead::BatchRecord<'a>> {
+        records.iter().zip(in_outs.iter_mut())
+               .map(|(&(ref nonce, ref ad, _, _), in_out)| aead::BatchRecord {
+                   nonce: nonce,
+                   ad: ad,
+                   in_out: in_out,
+               }).collect()
+    }
+
     fn test_aead_key_sizes(aead_alg: &'static aead::Algorithm) {
         let key_len = aead_alg.key_len();
         let key_data = vec![0u8; key_len * 2];
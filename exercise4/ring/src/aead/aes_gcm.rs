@@ -12,24 +12,36 @@
 // OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
 // CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
-use {aead, bssl, c, error, polyfill};
+use {aead, bssl, c, constant_time, error, init, polyfill};
+use core;
 
 const AES_128_KEY_LEN: usize = 128 / 8;
 const AES_256_KEY_LEN: usize = 32; // 256 / 8
 
-pub const AES_KEY_CTX_BUF_LEN: usize = AES_KEY_BUF_LEN + GCM128_SERIALIZED_LEN;
+// Keep this in sync with `AES_GCM_KEY` in e_aes.c, which also holds the
+// `aes_ctr_f` function pointer.
+pub const AES_KEY_CTX_BUF_LEN: usize =
+    AES_KEY_BUF_LEN + GCM128_KEY_LEN + FN_PTR_MAX_LEN;
 
 // Keep this in sync with `AES_KEY` in aes.h.
-const AES_KEY_BUF_LEN: usize = (4 * 4 * (AES_MAX_ROUNDS + 1)) + 8;
+pub const AES_KEY_BUF_LEN: usize = (4 * 4 * (AES_MAX_ROUNDS + 1)) + 8;
 
 // Keep this in sync with `AES_MAXNR` in aes.h.
 const AES_MAX_ROUNDS: usize = 14;
 
-// Keep this in sync with `GCM128_SERIALIZED_LEN` in gcm.h.
-// TODO: test.
+// Keep this in sync with `GCM128_KEY` in modes/internal.h: `Htable` and `H`
+// followed by the `gmult`, `ghash`, `block` and `ecb` function pointers.
 // TODO: some implementations of GCM don't require the buffer to be this big.
 // We should shrink it down on those platforms since this is still huge.
-const GCM128_SERIALIZED_LEN: usize = 16 * 16;
+const GCM128_KEY_LEN: usize = (16 * 16) + 16 + (4 * FN_PTR_MAX_LEN);
+
+// The size of a C function pointer on the largest supported target.
+pub const FN_PTR_MAX_LEN: usize = 8;
+
+// Keep this in sync with `AES_CTR_KEY` in e_aes.c.
+pub const AES_CTR_KEY_BUF_LEN: usize = AES_KEY_BUF_LEN + FN_PTR_MAX_LEN;
+
+pub const AES_CTR_KEY_BUF_ELEMS: usize = (AES_CTR_KEY_BUF_LEN + 7) / 8;
 
 
 /// AES-128 in GCM mode with 128-bit tags and 96 bit nonces.
@@ -42,6 +54,14 @@ pub static AES_128_GCM: aead::Algorithm = aead::Algorithm {
     init: aes_gcm_init,
     seal: aes_gcm_seal,
     open: aes_gcm_open,
+    seal_batch: Some(aes_gcm_seal_batch),
+    open_batch: Some(aes_gcm_open_batch),
+    seal_sg: Some(aes_gcm_seal_sg),
+    open_sg: Some(aes_gcm_open_sg),
+    seal_parallel: Some(aes_gcm_seal_parallel),
+    open_parallel: Some(aes_gcm_open_parallel),
+    authenticate: Some(aes_gmac),
+    seal_out_of_place: Some(aes_gcm_seal_out_of_place),
 };
 
 /// AES-256 in GCM mode with 128-bit tags and 96 bit nonces.
@@ -54,6 +74,52 @@ pub static AES_256_GCM: aead::Algorithm = aead::Algorithm {
     init: aes_gcm_init,
     seal: aes_gcm_seal,
     open: aes_gcm_open,
+    seal_batch: Some(aes_gcm_seal_batch),
+    open_batch: Some(aes_gcm_open_batch),
+    seal_sg: Some(aes_gcm_seal_sg),
+    open_sg: Some(aes_gcm_open_sg),
+    seal_parallel: Some(aes_gcm_seal_parallel),
+    open_parallel: Some(aes_gcm_open_parallel),
+    authenticate: Some(aes_gmac),
+    seal_out_of_place: Some(aes_gcm_seal_out_of_place),
+};
+
+/// AES-128 in GCM-SIV mode (RFC 8452) with 128-bit tags and 96 bit nonces.
+///
+/// AES-GCM-SIV is resistant to nonce misuse: sealing two messages with the
+/// same nonce reveals only whether they, and their additional data, are
+/// equal. Sealing a message takes two passes over it.
+pub static AES_128_GCM_SIV: aead::Algorithm = aead::Algorithm {
+    key_len: AES_128_KEY_LEN,
+    init: aes_gcm_siv_init,
+    seal: aes_gcm_siv_seal,
+    open: aes_gcm_siv_open,
+    seal_batch: None,
+    open_batch: None,
+    seal_sg: None,
+    open_sg: None,
+    seal_parallel: None,
+    open_parallel: None,
+    authenticate: None,
+    seal_out_of_place: None,
+};
+
+/// AES-256 in GCM-SIV mode (RFC 8452) with 128-bit tags and 96 bit nonces.
+///
+/// See `AES_128_GCM_SIV`.
+pub static AES_256_GCM_SIV: aead::Algorithm = aead::Algorithm {
+    key_len: AES_256_KEY_LEN,
+    init: aes_gcm_siv_init,
+    seal: aes_gcm_siv_seal,
+    open: aes_gcm_siv_open,
+    seal_batch: None,
+    open_batch: None,
+    seal_sg: None,
+    open_sg: None,
+    seal_parallel: None,
+    open_parallel: None,
+    authenticate: None,
+    seal_out_of_place: None,
 };
 
 fn aes_gcm_init(ctx_buf: &mut [u8], key: &[u8])
@@ -75,6 +141,18 @@ fn aes_gcm_seal(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
     })
 }
 
+fn aes_gcm_seal_out_of_place(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                             nonce: &[u8; aead::NONCE_LEN], in_: &[u8],
+                             out: &mut [u8], tag: &mut [u8; aead::TAG_LEN],
+                             ad: &[u8]) -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    bssl::map_result(unsafe {
+        GFp_aes_gcm_seal_out_of_place(ctx.as_ptr(), out.as_mut_ptr(),
+                                      out.len(), tag, nonce, in_.as_ptr(),
+                                      ad.as_ptr(), ad.len())
+    })
+}
+
 fn aes_gcm_open(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
                 nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
                 in_prefix_len: usize, tag_out: &mut [u8; aead::TAG_LEN],
@@ -88,6 +166,698 @@ fn aes_gcm_open(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
     })
 }
 
+fn aes_gcm_seal_parallel(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                         nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
+                         tag_out: &mut [u8; aead::TAG_LEN], ad: &[u8],
+                         max_threads: usize,
+                         executor: &aead::ParallelExecutor)
+                         -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    let executor: *const &aead::ParallelExecutor = &executor;
+    bssl::map_result(unsafe {
+        GFp_aes_gcm_seal_parallel(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                  in_out.len(), tag_out, nonce, ad.as_ptr(),
+                                  ad.len(), max_threads,
+                                  Some(aead::parallel_for),
+                                  executor as *mut u8)
+    })
+}
+
+fn aes_gcm_open_parallel(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                         nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
+                         tag_out: &mut [u8; aead::TAG_LEN], ad: &[u8],
+                         max_threads: usize,
+                         executor: &aead::ParallelExecutor)
+                         -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    let executor: *const &aead::ParallelExecutor = &executor;
+    bssl::map_result(unsafe {
+        GFp_aes_gcm_open_parallel(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                  in_out.len(), tag_out, nonce,
+                                  in_out.as_ptr(), ad.as_ptr(), ad.len(),
+                                  max_threads, Some(aead::parallel_for),
+                                  executor as *mut u8)
+    })
+}
+
+fn aes_gmac(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+            nonce: &[u8; aead::NONCE_LEN], ad: &[u8],
+            tag_out: &mut [u8; aead::TAG_LEN])
+            -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    bssl::map_result(unsafe {
+        GFp_aes_gmac(ctx.as_ptr(), tag_out, nonce, ad.as_ptr(), ad.len())
+    })
+}
+
+fn aes_gcm_siv_init(ctx_buf: &mut [u8], key: &[u8])
+                    -> Result<(), error::Unspecified> {
+    bssl::map_result(unsafe {
+        GFp_aes_gcm_siv_init(ctx_buf.as_mut_ptr(), ctx_buf.len(), key.as_ptr(),
+                             key.len())
+    })
+}
+
+fn aes_gcm_siv_seal(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                    nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
+                    tag: &mut [u8; aead::TAG_LEN], ad: &[u8])
+                    -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    bssl::map_result(unsafe {
+        GFp_aes_gcm_siv_seal(ctx.as_ptr(), in_out.as_mut_ptr(), in_out.len(),
+                             tag, nonce, ad.as_ptr(), ad.len())
+    })
+}
+
+// The tag is an input to the decryption, so `GFp_aes_gcm_siv_open` checks the
+// received tag in `tag_out` itself, and leaves it as it is.
+fn aes_gcm_siv_open(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                    nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
+                    in_prefix_len: usize, tag_out: &mut [u8; aead::TAG_LEN],
+                    ad: &[u8]) -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    bssl::map_result(unsafe {
+        GFp_aes_gcm_siv_open(ctx.as_ptr(), in_out.as_mut_ptr(),
+                             in_out.len() - in_prefix_len, tag_out, nonce,
+                             in_out[in_prefix_len..].as_ptr(), ad.as_ptr(),
+                             ad.len())
+    })
+}
+
+fn aes_gcm_seal_batch(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                      records: &mut [aead::BatchRecord],
+                      tags_out: &mut [[u8; aead::TAG_LEN]])
+                      -> Result<(), error::Unspecified> {
+    aes_gcm_batch(ctx, records, tags_out, GFp_aes_gcm_seal_batch)
+}
+
+fn aes_gcm_open_batch(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                      records: &mut [aead::BatchRecord],
+                      tags_out: &mut [[u8; aead::TAG_LEN]])
+                      -> Result<(), error::Unspecified> {
+    aes_gcm_batch(ctx, records, tags_out, GFp_aes_gcm_open_batch)
+}
+
+fn aes_gcm_batch(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                 records: &mut [aead::BatchRecord],
+                 tags_out: &mut [[u8; aead::TAG_LEN]],
+                 f: unsafe extern fn(ctx_buf: *const u8,
+                                     records: *const AES_GCM_RECORD,
+                                     num_records: c::size_t) -> c::int)
+                 -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    let mut c_records = [AES_GCM_RECORD {
+        nonce: core::ptr::null(),
+        ad: core::ptr::null(),
+        ad_len: 0,
+        in_: core::ptr::null(),
+        out: core::ptr::null_mut(),
+        in_out_len: 0,
+        tag_out: core::ptr::null_mut(),
+    }; aead::BATCH_RECORDS];
+    assert!(records.len() <= c_records.len());
+    assert_eq!(records.len(), tags_out.len());
+    for ((record, tag_out), c_record) in
+            records.iter_mut().zip(tags_out.iter_mut())
+                   .zip(c_records.iter_mut()) {
+        let in_out_len = record.in_out.len() - aead::TAG_LEN;
+        *c_record = AES_GCM_RECORD {
+            nonce: record.nonce.as_ptr(),
+            ad: record.ad.as_ptr(),
+            ad_len: record.ad.len(),
+            in_: record.in_out.as_ptr(),
+            out: record.in_out.as_mut_ptr(),
+            in_out_len: in_out_len,
+            tag_out: tag_out.as_mut_ptr(),
+        };
+    }
+    bssl::map_result(unsafe {
+        f(ctx.as_ptr(), c_records.as_ptr(), records.len())
+    })
+}
+
+fn aes_gcm_seal_sg(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                   nonce: &[u8; aead::NONCE_LEN], in_: &[&[u8]],
+                   out: &mut [&mut [u8]], tag_out: &mut [u8; aead::TAG_LEN],
+                   ad: &[&[u8]]) -> Result<(), error::Unspecified> {
+    aes_gcm_sg(ctx, nonce, in_, out, tag_out, ad, GFp_aes_gcm_seal_sg)
+}
+
+fn aes_gcm_open_sg(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                   nonce: &[u8; aead::NONCE_LEN], in_: &[&[u8]],
+                   out: &mut [&mut [u8]], tag_out: &mut [u8; aead::TAG_LEN],
+                   ad: &[&[u8]]) -> Result<(), error::Unspecified> {
+    aes_gcm_sg(ctx, nonce, in_, out, tag_out, ad, GFp_aes_gcm_open_sg)
+}
+
+fn aes_gcm_sg(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+              nonce: &[u8; aead::NONCE_LEN], in_: &[&[u8]],
+              out: &mut [&mut [u8]], tag_out: &mut [u8; aead::TAG_LEN],
+              ad: &[&[u8]],
+              f: unsafe extern fn(ctx_buf: *const u8,
+                                  out: *const AEAD_SEGMENT,
+                                  num_out: c::size_t,
+                                  tag_out: &mut [u8; aead::TAG_LEN],
+                                  nonce: &[u8; aead::NONCE_LEN],
+                                  in_: *const AEAD_CONST_SEGMENT,
+                                  num_in: c::size_t,
+                                  ad: *const AEAD_CONST_SEGMENT,
+                                  num_ad: c::size_t) -> c::int)
+              -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    let c_out = AEAD_SEGMENT { base: core::ptr::null_mut(), len: 0 };
+    let mut c_out = [c_out; aead::MAX_SEGMENTS];
+    for (segment, c_segment) in out.iter_mut().zip(c_out.iter_mut()) {
+        *c_segment = AEAD_SEGMENT {
+            base: segment.as_mut_ptr(),
+            len: segment.len(),
+        };
+    }
+    let c_in = const_segments(in_);
+    let c_ad = const_segments(ad);
+    bssl::map_result(unsafe {
+        f(ctx.as_ptr(), c_out.as_ptr(), out.len(), tag_out, nonce,
+          c_in.as_ptr(), in_.len(), c_ad.as_ptr(), ad.len())
+    })
+}
+
+fn const_segments(segments: &[&[u8]])
+                  -> [AEAD_CONST_SEGMENT; aead::MAX_SEGMENTS] {
+    let c_segment = AEAD_CONST_SEGMENT { base: core::ptr::null(), len: 0 };
+    let mut c_segments = [c_segment; aead::MAX_SEGMENTS];
+    assert!(segments.len() <= c_segments.len());
+    for (segment, c_segment) in segments.iter().zip(c_segments.iter_mut()) {
+        *c_segment = AEAD_CONST_SEGMENT {
+            base: segment.as_ptr(),
+            len: segment.len(),
+        };
+    }
+    c_segments
+}
+
+/// Seals one AES-GCM message incrementally.
+///
+/// The additional authenticated data is passed first, in any number of calls
+/// to `update_ad`, then the plaintext, in any number of calls to
+/// `seal_in_place`, and then `finish` computes the tag. The pieces may have
+/// any length, and the result is the same as sealing the concatenated AD and
+/// plaintext with `aead::seal_in_place`.
+///
+/// The rest of the plaintext can also be sealed in chunks on different threads
+/// with `fork` and `join`.
+pub struct SealingStream<'a> {
+    stream: Stream<'a>,
+}
+
+impl<'a> SealingStream<'a> {
+    /// Starts sealing a message with `key`, which must be an `AES_128_GCM` or
+    /// `AES_256_GCM` key, and `nonce`, which must be unique for every message
+    /// sealed with the key.
+    pub fn new(key: &'a aead::SealingKey, nonce: &[u8])
+               -> Result<SealingStream<'a>, error::Unspecified> {
+        Ok(SealingStream { stream: try!(Stream::new(&key.key, nonce)) })
+    }
+
+    /// Passes the next piece of the additional authenticated data. All of the
+    /// AD must be passed before any of the plaintext.
+    pub fn update_ad(&mut self, ad: &[u8]) -> Result<(), error::Unspecified> {
+        self.stream.update_ad(ad)
+    }
+
+    /// Encrypts the next piece of the plaintext in place.
+    pub fn seal_in_place(&mut self, in_out: &mut [u8])
+                         -> Result<(), error::Unspecified> {
+        self.stream.crypt(in_out, GFp_aes_gcm_stream_encrypt)
+    }
+
+    /// Starts a stream for a chunk of the rest of the plaintext that begins
+    /// `block_offset` 16-byte blocks after the plaintext sealed so far. The
+    /// plaintext sealed so far must be a whole number of blocks. Every chunk
+    /// but the last must be a whole number of blocks too.
+    ///
+    /// The chunks may be sealed on different threads and must then be passed
+    /// to `join`, in order. Only `seal_in_place` may be used on a chunk.
+    pub fn fork(&mut self, block_offset: u64)
+                -> Result<SealingStream<'a>, error::Unspecified> {
+        Ok(SealingStream { stream: try!(self.stream.fork(block_offset)) })
+    }
+
+    /// Adds a chunk from `fork`, once all of its plaintext has been sealed,
+    /// to the tag. Chunks must be joined in the order of their offsets.
+    pub fn join(&mut self, chunk: SealingStream<'a>)
+                -> Result<(), error::Unspecified> {
+        self.stream.join(chunk.stream)
+    }
+
+    /// Writes the tag of the message to `tag_out`, which must be exactly
+    /// `aead::MAX_OVERHEAD_LEN` bytes long.
+    pub fn finish(mut self, tag_out: &mut [u8])
+                  -> Result<(), error::Unspecified> {
+        let tag_out = try!(slice_as_array_ref_mut!(tag_out, aead::TAG_LEN));
+        unsafe { GFp_aes_gcm_stream_finish(self.stream.as_mut_ptr(), tag_out) };
+        Ok(())
+    }
+}
+
+/// Opens one AES-GCM message incrementally.
+///
+/// This is used like `SealingStream`. The decrypted pieces are returned
+/// before the message has been authenticated, so they must not be used
+/// until `finish` has returned `Ok(())`.
+pub struct OpeningStream<'a> {
+    stream: Stream<'a>,
+}
+
+impl<'a> OpeningStream<'a> {
+    /// Starts opening a message with `key`, which must be an `AES_128_GCM`
+    /// or `AES_256_GCM` key, and `nonce`.
+    pub fn new(key: &'a aead::OpeningKey, nonce: &[u8])
+               -> Result<OpeningStream<'a>, error::Unspecified> {
+        Ok(OpeningStream { stream: try!(Stream::new(&key.key, nonce)) })
+    }
+
+    /// Passes the next piece of the additional authenticated data. All of the
+    /// AD must be passed before any of the ciphertext.
+    pub fn update_ad(&mut self, ad: &[u8]) -> Result<(), error::Unspecified> {
+        self.stream.update_ad(ad)
+    }
+
+    /// Decrypts the next piece of the ciphertext in place.
+    pub fn open_in_place(&mut self, in_out: &mut [u8])
+                         -> Result<(), error::Unspecified> {
+        self.stream.crypt(in_out, GFp_aes_gcm_stream_decrypt)
+    }
+
+    /// Like `SealingStream::fork`.
+    pub fn fork(&mut self, block_offset: u64)
+                -> Result<OpeningStream<'a>, error::Unspecified> {
+        Ok(OpeningStream { stream: try!(self.stream.fork(block_offset)) })
+    }
+
+    /// Like `SealingStream::join`.
+    pub fn join(&mut self, chunk: OpeningStream<'a>)
+                -> Result<(), error::Unspecified> {
+        self.stream.join(chunk.stream)
+    }
+
+    /// Checks, in constant time, that `tag` is the tag of the message.
+    pub fn finish(mut self, tag: &[u8]) -> Result<(), error::Unspecified> {
+        let tag = try!(slice_as_array_ref!(tag, aead::TAG_LEN));
+        bssl::map_result(unsafe {
+            GFp_aes_gcm_stream_verify(self.stream.as_mut_ptr(), tag)
+        })
+    }
+}
+
+// Storage for an `AES_GCM_STREAM`, which refers to the key context and must
+// be 16-byte aligned. Rust can't guarantee that alignment and the storage
+// moves whenever the stream does, so the stream is kept at the first
+// 16-byte-aligned address in `buf`, and moved there before each use if the
+// storage has moved. `AES_GCM_STREAM` may be moved with `memcpy`.
+struct Stream<'a> {
+    buf: [u64; STREAM_BUF_ELEMS],
+    offset: usize,
+    key: core::marker::PhantomData<&'a aead::Key>,
+}
+
+impl<'a> Stream<'a> {
+    fn new(key: &'a aead::Key, nonce: &[u8])
+           -> Result<Stream<'a>, error::Unspecified> {
+        if !is_aes_gcm(key.algorithm) {
+            return Err(error::Unspecified);
+        }
+        let nonce = try!(slice_as_array_ref!(nonce, aead::NONCE_LEN));
+        let ctx = polyfill::slice::u64_as_u8(&key.ctx_buf);
+        let mut stream = Stream::empty();
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_stream_init(stream.as_mut_ptr(), AES_GCM_STREAM_LEN,
+                                    ctx.as_ptr(), nonce)
+        }));
+        Ok(stream)
+    }
+
+    fn empty() -> Stream<'a> {
+        Stream {
+            buf: [0; STREAM_BUF_ELEMS],
+            offset: 0,
+            key: core::marker::PhantomData,
+        }
+    }
+
+    fn update_ad(&mut self, ad: &[u8]) -> Result<(), error::Unspecified> {
+        bssl::map_result(unsafe {
+            GFp_aes_gcm_stream_aad(self.as_mut_ptr(), ad.as_ptr(), ad.len())
+        })
+    }
+
+    fn crypt(&mut self, in_out: &mut [u8],
+             f: unsafe extern fn(stream_buf: *mut u8, in_: *const u8,
+                                 out: *mut u8, len: c::size_t) -> c::int)
+             -> Result<(), error::Unspecified> {
+        bssl::map_result(unsafe {
+            f(self.as_mut_ptr(), in_out.as_ptr(), in_out.as_mut_ptr(),
+              in_out.len())
+        })
+    }
+
+    fn fork(&mut self, block_offset: u64)
+            -> Result<Stream<'a>, error::Unspecified> {
+        let mut chunk = Stream::empty();
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_stream_fork(chunk.as_mut_ptr(), AES_GCM_STREAM_LEN,
+                                    self.as_mut_ptr(), block_offset)
+        }));
+        Ok(chunk)
+    }
+
+    fn join(&mut self, mut chunk: Stream<'a>)
+            -> Result<(), error::Unspecified> {
+        bssl::map_result(unsafe {
+            GFp_aes_gcm_stream_join(self.as_mut_ptr(), chunk.as_mut_ptr())
+        })
+    }
+
+    fn as_mut_ptr(&mut self) -> *mut u8 {
+        realign16(&mut self.buf, &mut self.offset, AES_GCM_STREAM_LEN)
+    }
+}
+
+// Returns the first 16-byte-aligned address in `buf`. The `len` bytes of the
+// C structure at `*offset` are moved there first if `buf` itself has moved
+// since the last call, which changes that address.
+fn realign16(buf: &mut [u64], offset: &mut usize, len: usize) -> *mut u8 {
+    let buf = buf.as_mut_ptr() as *mut u8;
+    let new_offset = (16 - ((buf as usize) % 16)) % 16;
+    unsafe {
+        if new_offset != *offset {
+            core::ptr::copy(buf.offset(*offset as isize),
+                            buf.offset(new_offset as isize), len);
+            *offset = new_offset;
+        }
+        buf.offset(new_offset as isize)
+    }
+}
+
+// Keep this in sync with `AES_GCM_STREAM` in e_aes.c: a `GCM128_CONTEXT`,
+// which is five blocks, two `unsigned int`s and a pointer, and a pointer to
+// the key, rounded up to a multiple of 16 bytes.
+const AES_GCM_STREAM_LEN: usize = (5 * 16) + 16 + 16;
+
+// Room for an `AES_GCM_STREAM` at any 16-byte-aligned offset.
+const STREAM_BUF_ELEMS: usize = (AES_GCM_STREAM_LEN + 8) / 8;
+
+/// An AES-GCM sealing key that holds only the raw key.
+///
+/// An `aead::SealingKey` holds the expanded AES key schedule and GHASH table,
+/// which take over 500 bytes. A `CompactSealingKey` takes 40 bytes and
+/// expands the key on the stack for each message instead. With AES-NI and
+/// CLMUL that costs roughly as much as sealing a few hundred bytes, so it
+/// suits servers with many mostly-idle connections, and not bulk transfers.
+pub struct CompactSealingKey {
+    key: CompactKey,
+}
+
+impl CompactSealingKey {
+    /// Like `aead::SealingKey::new`. `algorithm` must be `AES_128_GCM` or
+    /// `AES_256_GCM`.
+    pub fn new(algorithm: &'static aead::Algorithm, key_bytes: &[u8])
+               -> Result<CompactSealingKey, error::Unspecified> {
+        Ok(CompactSealingKey {
+            key: try!(CompactKey::new(algorithm, key_bytes)),
+        })
+    }
+
+    /// Like `aead::seal_in_place`.
+    pub fn seal_in_place(&self, nonce: &[u8], in_out: &mut [u8],
+                         out_suffix_capacity: usize, ad: &[u8])
+                         -> Result<usize, error::Unspecified> {
+        if out_suffix_capacity < aead::MAX_OVERHEAD_LEN {
+            return Err(error::Unspecified);
+        }
+        let nonce = try!(slice_as_array_ref!(nonce, aead::NONCE_LEN));
+        let in_out_len =
+            try!(in_out.len().checked_sub(out_suffix_capacity)
+                             .ok_or(error::Unspecified));
+        try!(aead::check_per_nonce_max_bytes(in_out_len));
+        let (in_out, tag_out) = in_out.split_at_mut(in_out_len);
+        let tag_out =
+            try!(slice_as_array_ref_mut!(&mut tag_out[..aead::TAG_LEN],
+                                         aead::TAG_LEN));
+        let ctx = polyfill::slice::u64_as_u8(&self.key.ctx_buf);
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_compact_seal(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                     in_out.len(), tag_out, nonce,
+                                     in_out.as_ptr(), ad.as_ptr(), ad.len())
+        }));
+        Ok(in_out_len + aead::TAG_LEN)
+    }
+}
+
+/// An AES-GCM opening key that holds only the raw key; see
+/// `CompactSealingKey`.
+pub struct CompactOpeningKey {
+    key: CompactKey,
+}
+
+impl CompactOpeningKey {
+    /// Like `aead::OpeningKey::new`. `algorithm` must be `AES_128_GCM` or
+    /// `AES_256_GCM`.
+    pub fn new(algorithm: &'static aead::Algorithm, key_bytes: &[u8])
+               -> Result<CompactOpeningKey, error::Unspecified> {
+        Ok(CompactOpeningKey {
+            key: try!(CompactKey::new(algorithm, key_bytes)),
+        })
+    }
+
+    /// Like `aead::open_in_place`.
+    pub fn open_in_place(&self, nonce: &[u8], in_prefix_len: usize,
+                         in_out: &mut [u8], ad: &[u8])
+                         -> Result<usize, error::Unspecified> {
+        let nonce = try!(slice_as_array_ref!(nonce, aead::NONCE_LEN));
+        let ciphertext_and_tag_len =
+            try!(in_out.len().checked_sub(in_prefix_len)
+                             .ok_or(error::Unspecified));
+        let ciphertext_len =
+            try!(ciphertext_and_tag_len.checked_sub(aead::TAG_LEN)
+                                       .ok_or(error::Unspecified));
+        try!(aead::check_per_nonce_max_bytes(ciphertext_len));
+        let (in_out, received_tag) =
+            in_out.split_at_mut(in_prefix_len + ciphertext_len);
+        let mut calculated_tag = [0u8; aead::TAG_LEN];
+        let ctx = polyfill::slice::u64_as_u8(&self.key.ctx_buf);
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_compact_open(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                     ciphertext_len, &mut calculated_tag,
+                                     nonce, in_out[in_prefix_len..].as_ptr(),
+                                     ad.as_ptr(), ad.len())
+        }));
+        try!(constant_time::verify_slices_are_equal(&calculated_tag,
+                                                    received_tag));
+        Ok(ciphertext_len)
+    }
+}
+
+struct CompactKey {
+    ctx_buf: [u64; COMPACT_KEY_BUF_ELEMS],
+}
+
+impl CompactKey {
+    fn new(algorithm: &'static aead::Algorithm, key_bytes: &[u8])
+           -> Result<CompactKey, error::Unspecified> {
+        if !is_aes_gcm(algorithm) || key_bytes.len() != algorithm.key_len() {
+            return Err(error::Unspecified);
+        }
+        // The key is expanded with the CPU's AES implementation later.
+        init::init_once();
+        let mut key = CompactKey { ctx_buf: [0; COMPACT_KEY_BUF_ELEMS] };
+        try!(bssl::map_result(unsafe {
+            let ctx_buf = polyfill::slice::u64_as_u8_mut(&mut key.ctx_buf);
+            GFp_aes_gcm_compact_init(ctx_buf.as_mut_ptr(), ctx_buf.len(),
+                                     key_bytes.as_ptr(), key_bytes.len())
+        }));
+        Ok(key)
+    }
+}
+
+// Keep this in sync with `AES_GCM_COMPACT_KEY` in e_aes.c: the raw key and
+// its length.
+const AES_GCM_COMPACT_KEY_LEN: usize = 32 + 8;
+
+const COMPACT_KEY_BUF_ELEMS: usize = (AES_GCM_COMPACT_KEY_LEN + 7) / 8;
+
+/// The length of the longest message whose keystream `SealingKeystream` and
+/// `OpeningKeystream` can hold.
+pub const KEYSTREAM_MAX_LEN: usize = 256;
+
+/// The AES-GCM keystream of one message, computed before the message arrives.
+///
+/// When the nonces are known before the messages, e.g. because they are
+/// sequential, all of the AES work can be done ahead of time, and
+/// `seal_in_place` then only does the XOR and the GHASH. The keystream can be
+/// used for one message only.
+pub struct SealingKeystream<'a> {
+    keystream: Keystream<'a>,
+}
+
+impl<'a> SealingKeystream<'a> {
+    /// Computes the keystream for a message of up to `max_in_out_len` bytes,
+    /// which must be at most `KEYSTREAM_MAX_LEN`, with `key`, which must be
+    /// an `AES_128_GCM` or `AES_256_GCM` key, and `nonce`, which must be
+    /// unique for every message sealed with the key.
+    pub fn new(key: &'a aead::SealingKey, nonce: &[u8], max_in_out_len: usize)
+               -> Result<SealingKeystream<'a>, error::Unspecified> {
+        Ok(SealingKeystream {
+            keystream: try!(Keystream::new(&key.key, nonce, max_in_out_len)),
+        })
+    }
+
+    /// Like `aead::seal_in_place`. The plaintext must be no longer than the
+    /// `max_in_out_len` that was passed to `new`.
+    pub fn seal_in_place(mut self, in_out: &mut [u8],
+                         out_suffix_capacity: usize, ad: &[u8])
+                         -> Result<usize, error::Unspecified> {
+        if out_suffix_capacity < aead::MAX_OVERHEAD_LEN {
+            return Err(error::Unspecified);
+        }
+        let in_out_len =
+            try!(in_out.len().checked_sub(out_suffix_capacity)
+                             .ok_or(error::Unspecified));
+        let (in_out, tag_out) = in_out.split_at_mut(in_out_len);
+        let tag_out =
+            try!(slice_as_array_ref_mut!(&mut tag_out[..aead::TAG_LEN],
+                                         aead::TAG_LEN));
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_seal_precomputed(self.keystream.as_mut_ptr(),
+                                         in_out.as_mut_ptr(), in_out.len(),
+                                         tag_out, in_out.as_ptr(),
+                                         ad.as_ptr(), ad.len())
+        }));
+        Ok(in_out_len + aead::TAG_LEN)
+    }
+}
+
+/// Like `SealingKeystream`, for opening one message.
+pub struct OpeningKeystream<'a> {
+    keystream: Keystream<'a>,
+}
+
+impl<'a> OpeningKeystream<'a> {
+    /// Like `SealingKeystream::new`.
+    pub fn new(key: &'a aead::OpeningKey, nonce: &[u8], max_in_out_len: usize)
+               -> Result<OpeningKeystream<'a>, error::Unspecified> {
+        Ok(OpeningKeystream {
+            keystream: try!(Keystream::new(&key.key, nonce, max_in_out_len)),
+        })
+    }
+
+    /// Like `aead::open_in_place`. The ciphertext, without the tag, must be
+    /// no longer than the `max_in_out_len` that was passed to `new`.
+    pub fn open_in_place(mut self, in_prefix_len: usize, in_out: &mut [u8],
+                         ad: &[u8]) -> Result<usize, error::Unspecified> {
+        let ciphertext_and_tag_len =
+            try!(in_out.len().checked_sub(in_prefix_len)
+                             .ok_or(error::Unspecified));
+        let ciphertext_len =
+            try!(ciphertext_and_tag_len.checked_sub(aead::TAG_LEN)
+                                       .ok_or(error::Unspecified));
+        let (in_out, received_tag) =
+            in_out.split_at_mut(in_prefix_len + ciphertext_len);
+        let mut calculated_tag = [0u8; aead::TAG_LEN];
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_open_precomputed(self.keystream.as_mut_ptr(),
+                                         in_out.as_mut_ptr(), ciphertext_len,
+                                         &mut calculated_tag,
+                                         in_out[in_prefix_len..].as_ptr(),
+                                         ad.as_ptr(), ad.len())
+        }));
+        try!(constant_time::verify_slices_are_equal(&calculated_tag,
+                                                    received_tag));
+        Ok(ciphertext_len)
+    }
+}
+
+// Storage for an `AES_GCM_PRECOMPUTED`, which refers to the key context and
+// must be 16-byte aligned, kept aligned like `Stream`.
+struct Keystream<'a> {
+    buf: [u64; KEYSTREAM_BUF_ELEMS],
+    offset: usize,
+    key: core::marker::PhantomData<&'a aead::Key>,
+}
+
+impl<'a> Keystream<'a> {
+    fn new(key: &'a aead::Key, nonce: &[u8], max_in_out_len: usize)
+           -> Result<Keystream<'a>, error::Unspecified> {
+        if !is_aes_gcm(key.algorithm) {
+            return Err(error::Unspecified);
+        }
+        let nonce = try!(slice_as_array_ref!(nonce, aead::NONCE_LEN));
+        let ctx = polyfill::slice::u64_as_u8(&key.ctx_buf);
+        let mut keystream = Keystream {
+            buf: [0; KEYSTREAM_BUF_ELEMS],
+            offset: 0,
+            key: core::marker::PhantomData,
+        };
+        try!(bssl::map_result(unsafe {
+            GFp_aes_gcm_precompute(keystream.as_mut_ptr(),
+                                   AES_GCM_PRECOMPUTED_LEN, ctx.as_ptr(),
+                                   nonce, max_in_out_len)
+        }));
+        Ok(keystream)
+    }
+
+    fn as_mut_ptr(&mut self) -> *mut u8 {
+        realign16(&mut self.buf, &mut self.offset, AES_GCM_PRECOMPUTED_LEN)
+    }
+}
+
+// Keep this in sync with `AES_GCM_PRECOMPUTED` in e_aes.c: the EK0 block and
+// the keystream blocks, then a pointer to the key, the nonce and a `size_t`,
+// rounded up to a multiple of 16 bytes.
+const AES_GCM_PRECOMPUTED_LEN: usize =
+    ((1 + (KEYSTREAM_MAX_LEN / 16)) * 16) + 32;
+
+// Room for an `AES_GCM_PRECOMPUTED` at any 16-byte-aligned offset.
+const KEYSTREAM_BUF_ELEMS: usize = (AES_GCM_PRECOMPUTED_LEN + 8) / 8;
+
+fn is_aes_gcm(algorithm: &aead::Algorithm) -> bool {
+    let algorithm: *const aead::Algorithm = algorithm;
+    let aes_128_gcm: *const aead::Algorithm = &AES_128_GCM;
+    let aes_256_gcm: *const aead::Algorithm = &AES_256_GCM;
+    algorithm == aes_128_gcm || algorithm == aes_256_gcm
+}
+
+// Keep this in sync with `AES_GCM_RECORD` in e_aes.c.
+#[allow(non_camel_case_types)]
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct AES_GCM_RECORD {
+    nonce: *const u8,
+    ad: *const u8,
+    ad_len: c::size_t,
+    in_: *const u8,
+    out: *mut u8,
+    in_out_len: c::size_t,
+    tag_out: *mut u8,
+}
+
+// Keep this in sync with `AEAD_SEGMENT` in cipher/internal.h.
+#[allow(non_camel_case_types)]
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct AEAD_SEGMENT {
+    base: *mut u8,
+    len: c::size_t,
+}
+
+// Keep this in sync with `AEAD_CONST_SEGMENT` in cipher/internal.h.
+#[allow(non_camel_case_types)]
+#[derive(Clone, Copy)]
+#[repr(C)]
+struct AEAD_CONST_SEGMENT {
+    base: *const u8,
+    len: c::size_t,
+}
+
 extern {
     fn GFp_aes_gcm_init(ctx_buf: *mut u8, ctx_buf_len: c::size_t,
                         key: *const u8, key_len: c::size_t) -> c::int;
@@ -103,15 +873,161 @@ extern {
                         tag_out: &mut [u8; aead::TAG_LEN],
                         nonce: &[u8; aead::NONCE_LEN], in_: *const u8,
                         ad: *const u8, ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_seal_batch(ctx_buf: *const u8,
+                              records: *const AES_GCM_RECORD,
+                              num_records: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_open_batch(ctx_buf: *const u8,
+                              records: *const AES_GCM_RECORD,
+                              num_records: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_seal_sg(ctx_buf: *const u8, out: *const AEAD_SEGMENT,
+                           num_out: c::size_t,
+                           tag_out: &mut [u8; aead::TAG_LEN],
+                           nonce: &[u8; aead::NONCE_LEN],
+                           in_: *const AEAD_CONST_SEGMENT, num_in: c::size_t,
+                           ad: *const AEAD_CONST_SEGMENT,
+                           num_ad: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_open_sg(ctx_buf: *const u8, out: *const AEAD_SEGMENT,
+                           num_out: c::size_t,
+                           tag_out: &mut [u8; aead::TAG_LEN],
+                           nonce: &[u8; aead::NONCE_LEN],
+                           in_: *const AEAD_CONST_SEGMENT, num_in: c::size_t,
+                           ad: *const AEAD_CONST_SEGMENT,
+                           num_ad: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_stream_init(stream_buf: *mut u8,
+                               stream_buf_len: c::size_t,
+                               ctx_buf: *const u8,
+                               nonce: &[u8; aead::NONCE_LEN]) -> c::int;
+
+    fn GFp_aes_gcm_stream_aad(stream_buf: *mut u8, ad: *const u8,
+                              ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_stream_encrypt(stream_buf: *mut u8, in_: *const u8,
+                                  out: *mut u8, len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_stream_decrypt(stream_buf: *mut u8, in_: *const u8,
+                                  out: *mut u8, len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_stream_finish(stream_buf: *mut u8,
+                                 tag_out: &mut [u8; aead::TAG_LEN]);
+
+    fn GFp_aes_gcm_stream_verify(stream_buf: *mut u8,
+                                 tag: &[u8; aead::TAG_LEN]) -> c::int;
+
+    fn GFp_aes_gcm_stream_fork(chunk_buf: *mut u8,
+                               chunk_buf_len: c::size_t,
+                               stream_buf: *const u8,
+                               block_offset: u64) -> c::int;
+
+    fn GFp_aes_gcm_stream_join(stream_buf: *mut u8,
+                               chunk_buf: *const u8) -> c::int;
+
+    fn GFp_aes_gmac(ctx_buf: *const u8, tag_out: &mut [u8; aead::TAG_LEN],
+                    nonce: &[u8; aead::NONCE_LEN], data: *const u8,
+                    data_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_seal_parallel(
+        ctx_buf: *const u8, in_out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        ad: *const u8, ad_len: c::size_t, max_threads: c::size_t,
+        parallel_for: Option<aead::ParallelFor>, executor: *mut u8) -> c::int;
+
+    fn GFp_aes_gcm_open_parallel(
+        ctx_buf: *const u8, out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        in_: *const u8, ad: *const u8, ad_len: c::size_t,
+        max_threads: c::size_t, parallel_for: Option<aead::ParallelFor>,
+        executor: *mut u8) -> c::int;
+
+    fn GFp_aes_gcm_seal_out_of_place(
+        ctx_buf: *const u8, out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        in_: *const u8, ad: *const u8, ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_compact_init(ctx_buf: *mut u8,
+                                ctx_buf_len: c::size_t, key: *const u8,
+                                key_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_compact_seal(
+        ctx_buf: *const u8, out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        in_: *const u8, ad: *const u8, ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_compact_open(
+        ctx_buf: *const u8, out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        in_: *const u8, ad: *const u8, ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_precompute(precomputed_buf: *mut u8,
+                              precomputed_buf_len: c::size_t,
+                              ctx_buf: *const u8,
+                              nonce: &[u8; aead::NONCE_LEN],
+                              max_in_out_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_seal_precomputed(precomputed_buf: *mut u8,
+                                    out: *mut u8, in_out_len: c::size_t,
+                                    tag_out: &mut [u8; aead::TAG_LEN],
+                                    in_: *const u8, ad: *const u8,
+                                    ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_open_precomputed(precomputed_buf: *mut u8,
+                                    out: *mut u8, in_out_len: c::size_t,
+                                    tag_out: &mut [u8; aead::TAG_LEN],
+                                    in_: *const u8, ad: *const u8,
+                                    ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_siv_init(ctx_buf: *mut u8, ctx_buf_len: c::size_t,
+                            key: *const u8, key_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_siv_seal(ctx_buf: *const u8, in_out: *mut u8,
+                            in_out_len: c::size_t,
+                            tag_out: &mut [u8; aead::TAG_LEN],
+                            nonce: &[u8; aead::NONCE_LEN], ad: *const u8,
+                            ad_len: c::size_t) -> c::int;
+
+    fn GFp_aes_gcm_siv_open(ctx_buf: *const u8, out: *mut u8,
+                            in_out_len: c::size_t,
+                            tag: &[u8; aead::TAG_LEN],
+                            nonce: &[u8; aead::NONCE_LEN], in_: *const u8,
+                            ad: *const u8, ad_len: c::size_t) -> c::int;
 }
 
 
 #[cfg(test)]
 mod tests {
-    use {c, test};
+    use {c, init, test};
+    use core;
+    use std;
+    use std::vec::Vec;
     use super::super::super::aead;
-    use super::super::tests::test_aead;
-    use super::AES_MAX_ROUNDS;
+    use super::super::tests::{test_aead, test_aead_batch, ThreadExecutor};
+    use super::{AES_CTR_KEY_BUF_LEN, AES_GCM_COMPACT_KEY_LEN,
+                AES_GCM_PRECOMPUTED_LEN, AES_GCM_STREAM_LEN,
+                AES_KEY_CTX_BUF_LEN, AES_MAX_ROUNDS, GCM128_KEY_LEN};
+
+    // The lengths are computed by hand for the largest target, so they may
+    // only be larger than the C structures, and only on 32-bit targets.
+    #[test]
+    pub fn test_key_lens() {
+        let gcm128_key_len = unsafe { GFp_GCM128_KEY_LEN };
+        let aes_gcm_key_len = unsafe { GFp_AES_GCM_KEY_LEN };
+        assert!(gcm128_key_len <= GCM128_KEY_LEN);
+        assert!(aes_gcm_key_len <= AES_KEY_CTX_BUF_LEN);
+        if cfg!(target_pointer_width = "64") {
+            assert_eq!(gcm128_key_len, GCM128_KEY_LEN);
+            assert_eq!(aes_gcm_key_len, AES_KEY_CTX_BUF_LEN);
+        }
+        assert_eq!(unsafe { GFp_AES_GCM_STREAM_LEN }, AES_GCM_STREAM_LEN);
+        assert_eq!(unsafe { GFp_AES_GCM_PRECOMPUTED_LEN },
+                   AES_GCM_PRECOMPUTED_LEN);
+        assert_eq!(unsafe { GFp_AES_GCM_COMPACT_KEY_LEN },
+                   AES_GCM_COMPACT_KEY_LEN);
+        assert!(unsafe { GFp_AES_CTR_KEY_LEN } <= AES_CTR_KEY_BUF_LEN);
+    }
 
     #[test]
     pub fn test_aes_gcm_128() {
@@ -123,6 +1039,616 @@ mod tests {
         test_aead(&aead::AES_256_GCM, "src/aead/aes_256_gcm_tests.txt");
     }
 
+    // Every x86-64 CPU with AES-NI and PCLMULQDQ also has SSE4.1, so this
+    // checks that the tests above run through the stitched AES-NI/SSE4.1 code
+    // on those CPUs.
+    #[test]
+    pub fn test_aes_gcm_sse41_stitch() {
+        let names = init::implementation_names();
+        if cfg!(target_arch = "x86_64") && names.aes == "aesni" &&
+           names.ghash == "clmul" {
+            assert_eq!(names.aes_gcm, "aesni-sse4.1");
+        } else {
+            assert_eq!(names.aes_gcm, "separate");
+        }
+    }
+
+    // A test case from the AES-GCM test vector files, for the functions that
+    // `aead::AES_128_GCM` and `aead::AES_256_GCM` don't use.
+    struct GcmTest {
+        key: Vec<u8>,
+        nonce: [u8; aead::NONCE_LEN],
+        plaintext: Vec<u8>,
+        ad: Vec<u8>,
+        ciphertext: Vec<u8>,
+        tag: [u8; aead::TAG_LEN],
+    }
+
+    // Returns the AES-128-GCM and AES-256-GCM test cases that are expected to
+    // succeed.
+    fn gcm_tests() -> Vec<GcmTest> {
+        let mut tests = Vec::new();
+        for file_path in &["src/aead/aes_128_gcm_tests.txt",
+                           "src/aead/aes_256_gcm_tests.txt"] {
+            test::from_file(file_path, |section, test_case| {
+                assert_eq!(section, "");
+                let key = test_case.consume_bytes("KEY");
+                let nonce = test_case.consume_bytes("NONCE");
+                let plaintext = test_case.consume_bytes("IN");
+                let ad = test_case.consume_bytes("AD");
+                let ciphertext = test_case.consume_bytes("CT");
+                let tag = test_case.consume_bytes("TAG");
+                if test_case.consume_optional_string("FAILS").is_some() {
+                    return Ok(());
+                }
+                tests.push(GcmTest {
+                    key: key,
+                    nonce: *slice_as_array_ref!(&nonce, aead::NONCE_LEN)
+                                .unwrap(),
+                    plaintext: plaintext,
+                    ad: ad,
+                    ciphertext: ciphertext,
+                    tag: *slice_as_array_ref!(&tag, aead::TAG_LEN).unwrap(),
+                });
+                Ok(())
+            });
+        }
+        tests
+    }
+
+    fn test_message(len: usize) -> std::vec::Vec<u8> {
+        (0..len).map(|i| (i * 7 + (i >> 8)) as u8).collect()
+    }
+
+    // The shortest message that the parallel functions split, one byte more
+    // than `AES_GCM_PARALLEL_MIN_CHUNK_LEN`.
+    const PARALLEL_MIN_LEN: usize = 64 * 1024 + 1;
+
+    #[test]
+    pub fn test_aes_gcm_parallel() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+
+        let nonce = [7u8; aead::NONCE_LEN];
+        let ad = test_message(13);
+
+        for key in &[&[0x42u8; 16][..], &[0x43u8; 32][..]] {
+            let algorithm = aes_gcm_algorithm(key);
+            let s_key = aead::SealingKey::new(algorithm, key).unwrap();
+            let o_key = aead::OpeningKey::new(algorithm, key).unwrap();
+
+            for &len in &[0, 1000, PARALLEL_MIN_LEN - 1, PARALLEL_MIN_LEN,
+                          PARALLEL_MIN_LEN + 1, (1 << 20) + 17] {
+                let mut plaintext = test_message(len);
+                plaintext.extend_from_slice(&[0u8; aead::TAG_LEN]);
+                let mut expected = plaintext.clone();
+                assert_eq!(Ok(len + aead::TAG_LEN),
+                           aead::seal_in_place(&s_key, &nonce, &mut expected,
+                                               aead::TAG_LEN, &ad));
+
+                for &max_threads in &[0, 1, 2, 3, 16, 64] {
+                    let executor =
+                        ThreadExecutor { calls: AtomicUsize::new(0) };
+
+                    let mut in_out = plaintext.clone();
+                    assert_eq!(Ok(len + aead::TAG_LEN),
+                               aead::seal_in_place_parallel(
+                                   &s_key, &nonce, &mut in_out, aead::TAG_LEN,
+                                   &ad, max_threads, &executor));
+                    assert_eq!(expected, in_out);
+
+                    assert_eq!(Ok(len),
+                               aead::open_in_place_parallel(
+                                   &o_key, &nonce, &mut in_out, &ad,
+                                   max_threads, &executor));
+                    assert_eq!(&plaintext[..len], &in_out[..len]);
+
+                    // Messages that fit in one minimum-length chunk, and calls
+                    // that allow only one thread, are never split.
+                    let calls = executor.calls.load(Ordering::SeqCst);
+                    if len < PARALLEL_MIN_LEN || max_threads < 2 {
+                        assert_eq!(0, calls);
+                    } else {
+                        assert!(calls >= 2 * 2);
+                        assert!(calls <= 2 * core::cmp::min(max_threads, 16));
+                    }
+
+                    // A forged tag is rejected.
+                    if max_threads == 2 {
+                        let mut in_out = expected.clone();
+                        in_out[len] ^= 1;
+                        assert!(aead::open_in_place_parallel(
+                            &o_key, &nonce, &mut in_out, &ad, max_threads,
+                            &executor).is_err());
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    pub fn test_aes_gcm_batch() {
+        test_aead_batch(&aead::AES_128_GCM, "src/aead/aes_128_gcm_tests.txt");
+        test_aead_batch(&aead::AES_256_GCM, "src/aead/aes_256_gcm_tests.txt");
+    }
+
+    // Splits `len` bytes into consecutive pieces, some of them empty, whose
+    // lengths cycle through `lens`. Returns the start and end of each piece.
+    fn split(len: usize, lens: &[usize]) -> Vec<(usize, usize)> {
+        let mut pieces = Vec::new();
+        let mut start = 0;
+        for &piece_len in lens.iter().cycle() {
+            if start == len {
+                break;
+            }
+            let end = core::cmp::min(start + piece_len, len);
+            pieces.push((start, end));
+            start = end;
+        }
+        pieces
+    }
+
+    const SPLIT_LENS: [&'static [usize]; 5] =
+        [&[16], &[1], &[15, 17], &[100, 0, 3], &[5000]];
+
+    // Like `split`, but with the pieces past `aead::MAX_SEGMENTS` merged into
+    // the last one.
+    fn split_sg(len: usize, lens: &[usize]) -> Vec<(usize, usize)> {
+        let mut pieces = split(len, lens);
+        if pieces.len() > aead::MAX_SEGMENTS {
+            pieces.truncate(aead::MAX_SEGMENTS);
+            pieces[aead::MAX_SEGMENTS - 1].1 = len;
+        }
+        pieces
+    }
+
+    fn segments<'a>(data: &'a [u8], pieces: &[(usize, usize)])
+                    -> Vec<&'a [u8]> {
+        pieces.iter().map(|&(start, end)| &data[start..end]).collect()
+    }
+
+    fn segments_mut<'a>(mut data: &'a mut [u8], pieces: &[(usize, usize)])
+                        -> Vec<&'a mut [u8]> {
+        let mut segments = Vec::new();
+        for &(start, end) in pieces {
+            let rest = data;
+            let (segment, rest) = rest.split_at_mut(end - start);
+            segments.push(segment);
+            data = rest;
+        }
+        segments
+    }
+
+    fn aes_gcm_algorithm(key: &[u8]) -> &'static aead::Algorithm {
+        if key.len() == 16 { &aead::AES_128_GCM } else { &aead::AES_256_GCM }
+    }
+
+    // Each test vector is sealed and opened with the input, output and AD
+    // split into segments in different ways, so that segment boundaries fall
+    // inside and at the ends of blocks.
+    #[test]
+    pub fn test_aes_gcm_sg() {
+        for t in gcm_tests() {
+            let algorithm = aes_gcm_algorithm(&t.key);
+            let s_key = aead::SealingKey::new(algorithm, &t.key).unwrap();
+            let o_key = aead::OpeningKey::new(algorithm, &t.key).unwrap();
+
+            for k in 0..SPLIT_LENS.len() {
+                let in_pieces = split_sg(t.plaintext.len(), SPLIT_LENS[k]);
+                let out_pieces =
+                    split_sg(t.plaintext.len(),
+                             SPLIT_LENS[(k + 1) % SPLIT_LENS.len()]);
+                let ad_pieces =
+                    split_sg(t.ad.len(),
+                             SPLIT_LENS[(k + 2) % SPLIT_LENS.len()]);
+                let ad = segments(&t.ad, &ad_pieces);
+
+                let mut out = vec![0u8; t.plaintext.len()];
+                let mut tag = [0u8; aead::TAG_LEN];
+                aead::seal_sg(&s_key, &t.nonce,
+                              &segments(&t.plaintext, &in_pieces),
+                              &mut segments_mut(&mut out, &out_pieces),
+                              &mut tag, &ad).unwrap();
+                assert_eq!(t.ciphertext, out);
+                assert_eq!(t.tag, tag);
+
+                let mut out = vec![0u8; t.ciphertext.len()];
+                aead::open_sg(&o_key, &t.nonce,
+                              &segments(&t.ciphertext, &in_pieces),
+                              &mut segments_mut(&mut out, &out_pieces),
+                              &t.tag, &ad).unwrap();
+                assert_eq!(t.plaintext, out);
+
+                let mut wrong_tag = t.tag;
+                wrong_tag[k] ^= 1;
+                assert!(aead::open_sg(&o_key, &t.nonce,
+                                      &segments(&t.ciphertext, &in_pieces),
+                                      &mut segments_mut(&mut out, &out_pieces),
+                                      &wrong_tag, &ad).is_err());
+            }
+        }
+
+        // Too many segments, and input and output of different lengths, are
+        // rejected.
+        let s_key = aead::SealingKey::new(&aead::AES_128_GCM, &[0; 16])
+            .unwrap();
+        let nonce = [0u8; aead::NONCE_LEN];
+        let input = [0u8; aead::MAX_SEGMENTS + 1];
+        let mut out = [0u8; aead::MAX_SEGMENTS + 1];
+        let mut tag = [0u8; aead::TAG_LEN];
+        let max = split(aead::MAX_SEGMENTS, &[1]);
+        let too_many = split(aead::MAX_SEGMENTS + 1, &[1]);
+        assert!(aead::seal_sg(&s_key, &nonce, &segments(&input, &max),
+                              &mut segments_mut(&mut out, &max), &mut tag,
+                              &segments(&input, &max)).is_ok());
+        assert!(aead::seal_sg(&s_key, &nonce, &segments(&input, &too_many),
+                              &mut segments_mut(&mut out, &max), &mut tag,
+                              &[]).is_err());
+        assert!(aead::seal_sg(&s_key, &nonce, &segments(&input, &max),
+                              &mut segments_mut(&mut out, &too_many), &mut tag,
+                              &[]).is_err());
+        assert!(aead::seal_sg(&s_key, &nonce, &[], &mut [], &mut tag,
+                              &segments(&input, &too_many)).is_err());
+        assert!(aead::seal_sg(&s_key, &nonce, &[&input[1..]], &mut [&mut out],
+                              &mut tag, &[]).is_err());
+    }
+
+    #[test]
+    pub fn test_aes_gcm_compact() {
+        // Only AES-128-GCM and AES-256-GCM keys of the right length are
+        // supported.
+        for &key_len in &[0, 15, 17, 24, 31, 33] {
+            let key = vec![1u8; key_len];
+            for algorithm in &[&aead::AES_128_GCM, &aead::AES_256_GCM] {
+                assert!(aead::CompactSealingKey::new(algorithm, &key)
+                            .is_err());
+                assert!(aead::CompactOpeningKey::new(algorithm, &key)
+                            .is_err());
+            }
+        }
+        assert!(aead::CompactSealingKey::new(&aead::AES_128_GCM, &[1u8; 32])
+                    .is_err());
+        assert!(aead::CompactSealingKey::new(&aead::CHACHA20_POLY1305,
+                                             &[1u8; 32]).is_err());
+
+        for t in gcm_tests() {
+            let algorithm = aes_gcm_algorithm(&t.key);
+            let s_key =
+                aead::CompactSealingKey::new(algorithm, &t.key).unwrap();
+            let o_key =
+                aead::CompactOpeningKey::new(algorithm, &t.key).unwrap();
+
+            let mut sealed = t.ciphertext.clone();
+            sealed.extend_from_slice(&t.tag);
+
+            let mut in_out = t.plaintext.clone();
+            in_out.extend_from_slice(&[0u8; aead::TAG_LEN]);
+            assert_eq!(Ok(sealed.len()),
+                       s_key.seal_in_place(&t.nonce, &mut in_out,
+                                           aead::TAG_LEN, &t.ad));
+            assert_eq!(sealed, in_out);
+
+            for &in_prefix_len in &[0, 5, 17] {
+                let mut in_out = vec![123u8; in_prefix_len];
+                in_out.extend_from_slice(&sealed);
+                assert_eq!(Ok(t.plaintext.len()),
+                           o_key.open_in_place(&t.nonce, in_prefix_len,
+                                               &mut in_out, &t.ad));
+                assert_eq!(&t.plaintext[..],
+                           &in_out[..t.plaintext.len()]);
+            }
+
+            let mut in_out = sealed.clone();
+            in_out[t.plaintext.len()] ^= 1;
+            assert!(o_key.open_in_place(&t.nonce, 0, &mut in_out, &t.ad)
+                         .is_err());
+        }
+    }
+
+    // Each test vector is sealed and opened with the AD and the input passed
+    // to the stream in pieces, split in different ways.
+    #[test]
+    pub fn test_aes_gcm_stream() {
+        for t in gcm_tests() {
+            let algorithm = aes_gcm_algorithm(&t.key);
+            let s_key = aead::SealingKey::new(algorithm, &t.key).unwrap();
+            let o_key = aead::OpeningKey::new(algorithm, &t.key).unwrap();
+
+            for k in 0..SPLIT_LENS.len() {
+                let ad_pieces = split(t.ad.len(), SPLIT_LENS[k]);
+                let in_pieces =
+                    split(t.plaintext.len(),
+                          SPLIT_LENS[(k + 1) % SPLIT_LENS.len()]);
+
+                // The streams are moved around between the pieces, to check
+                // that they still work at a different alignment.
+                let mut streams = Vec::new();
+                streams.push(aead::SealingStream::new(&s_key, &t.nonce)
+                                 .unwrap());
+                for &(start, end) in &ad_pieces {
+                    let mut stream = streams.pop().unwrap();
+                    stream.update_ad(&t.ad[start..end]).unwrap();
+                    streams.insert(0, stream);
+                }
+                let mut in_out = t.plaintext.clone();
+                for &(start, end) in &in_pieces {
+                    let mut stream = streams.pop().unwrap();
+                    stream.seal_in_place(&mut in_out[start..end]).unwrap();
+                    streams.insert(0, stream);
+                }
+                assert_eq!(t.ciphertext, in_out);
+                let mut tag = [0u8; aead::TAG_LEN];
+                streams.pop().unwrap().finish(&mut tag).unwrap();
+                assert_eq!(t.tag, tag);
+
+                let mut stream =
+                    aead::OpeningStream::new(&o_key, &t.nonce).unwrap();
+                for &(start, end) in &ad_pieces {
+                    stream.update_ad(&t.ad[start..end]).unwrap();
+                }
+                for &(start, end) in &in_pieces {
+                    stream.open_in_place(&mut in_out[start..end]).unwrap();
+                }
+                assert_eq!(t.plaintext, in_out);
+                if k % 2 == 0 {
+                    assert!(stream.finish(&t.tag).is_ok());
+                } else {
+                    let mut wrong_tag = t.tag;
+                    wrong_tag[k % aead::TAG_LEN] ^= 1;
+                    assert!(stream.finish(&wrong_tag).is_err());
+                }
+            }
+
+            // The AD can't follow the input.
+            if !t.plaintext.is_empty() {
+                let mut stream =
+                    aead::SealingStream::new(&s_key, &t.nonce).unwrap();
+                let mut in_out = t.plaintext.clone();
+                stream.seal_in_place(&mut in_out).unwrap();
+                assert!(stream.update_ad(&[0]).is_err());
+            }
+        }
+
+        // Only AES-GCM keys can be used.
+        let s_key = aead::SealingKey::new(&aead::CHACHA20_POLY1305, &[0; 32])
+            .unwrap();
+        assert!(aead::SealingStream::new(&s_key, &[0; aead::NONCE_LEN])
+                    .is_err());
+        let o_key = aead::OpeningKey::new(&aead::CHACHA20_POLY1305, &[0; 32])
+            .unwrap();
+        assert!(aead::OpeningStream::new(&o_key, &[0; aead::NONCE_LEN])
+                    .is_err());
+    }
+
+    // Each test vector is sealed and opened by processing a whole-block prefix
+    // of the input on the stream itself, forking the rest into chunks of 1, 3
+    // and 2 blocks, processing the chunks in reverse order, and joining them
+    // back in order.
+    #[test]
+    pub fn test_aes_gcm_stream_fork_join() {
+        const CHUNK_LENS: [usize; 3] = [16, 48, 32];
+
+        for t in gcm_tests() {
+            let algorithm = aes_gcm_algorithm(&t.key);
+            let s_key = aead::SealingKey::new(algorithm, &t.key).unwrap();
+            let o_key = aead::OpeningKey::new(algorithm, &t.key).unwrap();
+            let prefix_len = core::cmp::min(32, t.plaintext.len() / 16 * 16);
+            let chunks = split(t.plaintext.len() - prefix_len, &CHUNK_LENS);
+            let block_offsets: Vec<u64> =
+                chunks.iter().map(|&(start, _)| (start / 16) as u64).collect();
+
+            let mut stream =
+                aead::SealingStream::new(&s_key, &t.nonce).unwrap();
+            stream.update_ad(&t.ad).unwrap();
+            let mut in_out = t.plaintext.clone();
+            stream.seal_in_place(&mut in_out[..prefix_len]).unwrap();
+            let mut chunk_streams: Vec<_> =
+                block_offsets.iter().map(|&offset| stream.fork(offset).unwrap())
+                             .collect();
+            in_chunks(&mut in_out[prefix_len..], &chunks, &mut chunk_streams,
+                      |chunk, in_out| chunk.seal_in_place(in_out).unwrap());
+            for chunk in chunk_streams {
+                stream.join(chunk).unwrap();
+            }
+            assert_eq!(t.ciphertext, in_out);
+            let mut tag = [0u8; aead::TAG_LEN];
+            stream.finish(&mut tag).unwrap();
+            assert_eq!(t.tag, tag);
+
+            let mut stream =
+                aead::OpeningStream::new(&o_key, &t.nonce).unwrap();
+            stream.update_ad(&t.ad).unwrap();
+            stream.open_in_place(&mut in_out[..prefix_len]).unwrap();
+            let mut chunk_streams: Vec<_> =
+                block_offsets.iter().map(|&offset| stream.fork(offset).unwrap())
+                             .collect();
+            in_chunks(&mut in_out[prefix_len..], &chunks, &mut chunk_streams,
+                      |chunk, in_out| chunk.open_in_place(in_out).unwrap());
+            for chunk in chunk_streams {
+                stream.join(chunk).unwrap();
+            }
+            assert_eq!(t.plaintext, in_out);
+            stream.finish(&t.tag).unwrap();
+
+            // A stream can't be forked in the middle of a block.
+            if t.plaintext.len() % 16 != 0 {
+                let mut stream =
+                    aead::SealingStream::new(&s_key, &t.nonce).unwrap();
+                let mut in_out = t.plaintext.clone();
+                stream.seal_in_place(&mut in_out).unwrap();
+                assert!(stream.fork(0).is_err());
+            }
+        }
+    }
+
+    // Calls `f` with each chunk stream and its piece of `in_out`, in reverse
+    // order.
+    fn in_chunks<S, F>(in_out: &mut [u8], chunks: &[(usize, usize)],
+                       chunk_streams: &mut [S], f: F)
+                       where F: Fn(&mut S, &mut [u8]) {
+        for (&(start, end), chunk) in
+                chunks.iter().zip(chunk_streams.iter_mut()).rev() {
+            f(chunk, &mut in_out[start..end]);
+        }
+    }
+
+    // The keystreams are computed ahead of time for a queue of messages, as
+    // for sequential nonces, and moved around before they are used.
+    #[test]
+    pub fn test_aes_gcm_keystream() {
+        for t in gcm_tests() {
+            let algorithm = aes_gcm_algorithm(&t.key);
+            let s_key = aead::SealingKey::new(algorithm, &t.key).unwrap();
+            let o_key = aead::OpeningKey::new(algorithm, &t.key).unwrap();
+            let len = t.plaintext.len();
+            if len > aead::KEYSTREAM_MAX_LEN {
+                assert!(aead::SealingKeystream::new(&s_key, &t.nonce, len)
+                            .is_err());
+                assert!(aead::OpeningKeystream::new(&o_key, &t.nonce, len)
+                            .is_err());
+                continue;
+            }
+
+            let mut sealed = t.ciphertext.clone();
+            sealed.extend_from_slice(&t.tag);
+
+            const IN_PREFIX_LENS: [usize; 3] = [0, 5, 17];
+            let mut sealing = Vec::new();
+            let mut opening = Vec::new();
+            for &max_len in &[len, aead::KEYSTREAM_MAX_LEN] {
+                sealing.push(
+                    aead::SealingKeystream::new(&s_key, &t.nonce, max_len)
+                        .unwrap());
+                for _ in 0..(IN_PREFIX_LENS.len() + 1) {
+                    opening.push(
+                        aead::OpeningKeystream::new(&o_key, &t.nonce, max_len)
+                            .unwrap());
+                }
+            }
+
+            for keystream in sealing {
+                let mut in_out = t.plaintext.clone();
+                in_out.extend_from_slice(&[0u8; aead::TAG_LEN]);
+                assert_eq!(Ok(sealed.len()),
+                           keystream.seal_in_place(&mut in_out, aead::TAG_LEN,
+                                                   &t.ad));
+                assert_eq!(sealed, in_out);
+            }
+
+            let mut opening = opening.into_iter();
+            for _ in 0..2 {
+                for &in_prefix_len in &IN_PREFIX_LENS {
+                    let keystream = opening.next().unwrap();
+                    let mut in_out = vec![123u8; in_prefix_len];
+                    in_out.extend_from_slice(&sealed);
+                    assert_eq!(Ok(len),
+                               keystream.open_in_place(in_prefix_len,
+                                                       &mut in_out, &t.ad));
+                    assert_eq!(&t.plaintext[..], &in_out[..len]);
+                }
+
+                let keystream = opening.next().unwrap();
+                let mut in_out = sealed.clone();
+                in_out[len] ^= 1;
+                assert!(keystream.open_in_place(0, &mut in_out, &t.ad)
+                                 .is_err());
+            }
+
+            // Messages longer than the keystream are rejected.
+            if len > 0 {
+                let keystream =
+                    aead::SealingKeystream::new(&s_key, &t.nonce, len - 1)
+                        .unwrap();
+                let mut in_out = t.plaintext.clone();
+                in_out.extend_from_slice(&[0u8; aead::TAG_LEN]);
+                assert!(keystream.seal_in_place(&mut in_out, aead::TAG_LEN,
+                                                &t.ad).is_err());
+            }
+        }
+
+        // Only AES-GCM keys are supported.
+        let key = [0u8; 32];
+        let s_key =
+            aead::SealingKey::new(&aead::CHACHA20_POLY1305, &key).unwrap();
+        let nonce = [0u8; aead::NONCE_LEN];
+        assert!(aead::SealingKeystream::new(&s_key, &nonce, 16).is_err());
+    }
+
+    #[test]
+    pub fn test_aes_gmac() {
+        let check = |key: &[u8], nonce: &[u8], data: &[u8],
+                     expected_tag: &[u8]| {
+            let algorithm = aes_gcm_algorithm(key);
+            let s_key = aead::SealingKey::new(algorithm, key).unwrap();
+            let mut tag = [0u8; aead::TAG_LEN];
+            aead::authenticate(&s_key, nonce, data, &mut tag).unwrap();
+            assert_eq!(expected_tag, &tag[..]);
+
+            let o_key = aead::OpeningKey::new(algorithm, key).unwrap();
+            assert!(aead::verify(&o_key, nonce, data, expected_tag).is_ok());
+            tag[0] ^= 1;
+            assert!(aead::verify(&o_key, nonce, data, &tag).is_err());
+        };
+
+        test::from_file("src/aead/aes_gmac_tests.txt", |section, test_case| {
+            assert_eq!(section, "");
+            let key = test_case.consume_bytes("KEY");
+            let nonce = test_case.consume_bytes("NONCE");
+            let data = test_case.consume_bytes("IN");
+            let tag = test_case.consume_bytes("TAG");
+            check(&key, &nonce, &data, &tag);
+            Ok(())
+        });
+
+        // The AES-GCM test vectors with empty messages are GMAC test vectors.
+        for t in gcm_tests() {
+            if t.plaintext.is_empty() {
+                check(&t.key, &t.nonce, &t.ad, &t.tag);
+            }
+        }
+    }
+
+    #[test]
+    pub fn test_aes_gcm_siv_128() {
+        test_aead(&aead::AES_128_GCM_SIV,
+                  "src/aead/aes_128_gcm_siv_tests.txt");
+        test_aead_batch(&aead::AES_128_GCM_SIV,
+                        "src/aead/aes_128_gcm_siv_tests.txt");
+    }
+
+    #[test]
+    pub fn test_aes_gcm_siv_256() {
+        test_aead(&aead::AES_256_GCM_SIV,
+                  "src/aead/aes_256_gcm_siv_tests.txt");
+        test_aead_batch(&aead::AES_256_GCM_SIV,
+                        "src/aead/aes_256_gcm_siv_tests.txt");
+    }
+
+    // The tag is an input to the decryption, so a wrong tag must still be
+    // rejected even though `aead::open_in_place` compares the tag with
+    // itself.
+    #[test]
+    pub fn test_aes_gcm_siv_wrong_tag() {
+        for &(algorithm, key_len) in &[(&aead::AES_128_GCM_SIV, 16),
+                                       (&aead::AES_256_GCM_SIV, 32)] {
+            let key = vec![1u8; key_len];
+            let s_key = aead::SealingKey::new(algorithm, &key).unwrap();
+            let o_key = aead::OpeningKey::new(algorithm, &key).unwrap();
+            let nonce = [2u8; aead::NONCE_LEN];
+            for &len in &[0, 1, 16, 100] {
+                let mut sealed = vec![3u8; len + aead::TAG_LEN];
+                assert_eq!(Ok(len + aead::TAG_LEN),
+                           aead::seal_in_place(&s_key, &nonce, &mut sealed,
+                                               aead::TAG_LEN, b"ad"));
+                for i in 0..sealed.len() {
+                    let mut in_out = sealed.clone();
+                    in_out[i] ^= 0x80;
+                    assert!(aead::open_in_place(&o_key, &nonce, 0, &mut in_out,
+                                                b"ad").is_err());
+                }
+            }
+        }
+    }
+
     #[test]
     pub fn test_aes() {
         test::from_file("src/aead/aes_tests.txt", |section, test_case| {
@@ -165,6 +1691,116 @@ mod tests {
         })
     }
 
+    // The constant-time code in aes.c is only chosen on CPUs without AES
+    // instructions or a vector unit that the asm can use, so it is tested
+    // directly here, including batches of fewer than four blocks.
+    #[test]
+    pub fn test_aes_nohw() {
+        test::from_file("src/aead/aes_tests.txt", |section, test_case| {
+            assert_eq!(section, "");
+            let key = test_case.consume_bytes("Key");
+            let input = test_case.consume_bytes("Input");
+            let input = slice_as_array_ref!(&input, AES_BLOCK_SIZE).unwrap();
+            let expected_output = test_case.consume_bytes("Output");
+            let expected_output =
+                slice_as_array_ref!(&expected_output, AES_BLOCK_SIZE).unwrap();
+
+            let mut aes_key = AES_KEY {
+                rd_key: [0u32; 4 * (AES_MAX_ROUNDS + 1)],
+                rounds: 0,
+            };
+            let res = unsafe {
+                GFp_aes_nohw_set_encrypt_key(key.as_ptr(), key.len() * 8,
+                                             &mut aes_key)
+            };
+            assert_eq!(res, 0, "GFp_aes_nohw_set_encrypt_key failed.");
+
+            // The table-based key, for the CTR keystream blocks that have no
+            // test vector.
+            let mut table_key = AES_KEY {
+                rd_key: [0u32; 4 * (AES_MAX_ROUNDS + 1)],
+                rounds: 0,
+            };
+            let res = unsafe {
+                GFp_AES_set_encrypt_key(key.as_ptr(), key.len() * 8,
+                                        &mut table_key)
+            };
+            assert_eq!(res, 0, "GFp_AES_set_encrypt_key failed.");
+
+            // One block, into a separate buffer and in place.
+            let mut output_buf = [0u8; AES_BLOCK_SIZE];
+            unsafe {
+                GFp_aes_nohw_encrypt(input.as_ptr(), output_buf.as_mut_ptr(),
+                                     &aes_key);
+            }
+            assert_eq!(&output_buf[..], &expected_output[..]);
+            output_buf.copy_from_slice(&input[..]);
+            unsafe {
+                GFp_aes_nohw_encrypt(output_buf.as_ptr(),
+                                     output_buf.as_mut_ptr(), &aes_key);
+            }
+            assert_eq!(&output_buf[..], &expected_output[..]);
+
+            // ECB, in whole and partial batches, encrypting into a separate
+            // buffer and decrypting in place.
+            for num_blocks in 1..13 {
+                let len = num_blocks * AES_BLOCK_SIZE;
+                let blocks: Vec<u8> =
+                    input.iter().cycle().take(len).cloned().collect();
+                let expected: Vec<u8> =
+                    expected_output.iter().cycle().take(len).cloned()
+                        .collect();
+                let mut out = vec![0u8; len];
+                unsafe {
+                    GFp_aes_nohw_ecb_encrypt_blocks(blocks.as_ptr(),
+                                                    out.as_mut_ptr(),
+                                                    num_blocks, &aes_key);
+                }
+                assert_eq!(expected, out);
+                unsafe {
+                    GFp_aes_nohw_ecb_decrypt_blocks(out.as_ptr(),
+                                                    out.as_mut_ptr(),
+                                                    num_blocks, &aes_key);
+                }
+                assert_eq!(blocks, out);
+            }
+
+            // CTR over zeros, with the input as the first counter block, so
+            // that the first block of output is the test vector's output.
+            for num_blocks in 1..10 {
+                let zeros = vec![0u8; num_blocks * AES_BLOCK_SIZE];
+                let mut out = vec![0u8; num_blocks * AES_BLOCK_SIZE];
+                unsafe {
+                    GFp_aes_nohw_ctr32_encrypt_blocks(zeros.as_ptr(),
+                                                      out.as_mut_ptr(),
+                                                      num_blocks, &aes_key,
+                                                      input);
+                }
+                assert_eq!(&out[..AES_BLOCK_SIZE], &expected_output[..]);
+                for (i, block) in out.chunks(AES_BLOCK_SIZE).enumerate() {
+                    let mut counter = *input;
+                    let ctr = (u32::from(counter[12]) << 24) |
+                              (u32::from(counter[13]) << 16) |
+                              (u32::from(counter[14]) << 8) |
+                              u32::from(counter[15]);
+                    let ctr = ctr.wrapping_add(i as u32);
+                    for j in 0..4 {
+                        counter[12 + j] = (ctr >> (24 - 8 * j)) as u8;
+                    }
+                    let mut expected_block = [0u8; AES_BLOCK_SIZE];
+                    unsafe {
+                        GFp_AES_encrypt(counter.as_ptr(),
+                                        expected_block.as_mut_ptr(),
+                                        &table_key);
+                    }
+                    assert_eq!(block, &expected_block[..]);
+                }
+            }
+
+            Ok(())
+        })
+    }
+
     const AES_BLOCK_SIZE: usize = 16;
 
     // Keep this in sync with AES_KEY in aes.h.
@@ -178,5 +1814,26 @@ mod tests {
         fn GFp_AES_set_encrypt_key(key: *const u8, bits: usize,
                                    aes_key: *mut AES_KEY) -> c::int;
         fn GFp_AES_encrypt(in_: *const u8, out: *mut u8, key: *const AES_KEY);
+        fn GFp_aes_nohw_set_encrypt_key(key: *const u8, bits: usize,
+                                        aes_key: *mut AES_KEY) -> c::int;
+        fn GFp_aes_nohw_encrypt(in_: *const u8, out: *mut u8,
+                                key: *const AES_KEY);
+        fn GFp_aes_nohw_ctr32_encrypt_blocks(in_: *const u8, out: *mut u8,
+                                             blocks: c::size_t,
+                                             key: *const AES_KEY,
+                                             ivec: &[u8; 16]);
+        fn GFp_aes_nohw_ecb_encrypt_blocks(in_: *const u8, out: *mut u8,
+                                           blocks: c::size_t,
+                                           key: *const AES_KEY);
+        fn GFp_aes_nohw_ecb_decrypt_blocks(in_: *const u8, out: *mut u8,
+                                           blocks: c::size_t,
+                                           key: *const AES_KEY);
+
+        static GFp_GCM128_KEY_LEN: c::size_t;
+        static GFp_AES_GCM_KEY_LEN: c::size_t;
+        static GFp_AES_GCM_STREAM_LEN: c::size_t;
+        static GFp_AES_GCM_PRECOMPUTED_LEN: c::size_t;
+        static GFp_AES_GCM_COMPACT_KEY_LEN: c::size_t;
+        static GFp_AES_CTR_KEY_LEN: c::size_t;
     }
 }
@@ -14,12 +14,9 @@
 // OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
 // CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
-use {aead, c, error, polyfill};
-use core;
+use {aead, bssl, c, error, polyfill};
 
 const CHACHA20_KEY_LEN: usize = 256 / 8;
-const POLY1305_STATE_LEN: usize = 256;
-const POLY1305_KEY_LEN: usize = 32;
 
 
 /// ChaCha20-Poly1305 as described in [RFC 7539].
@@ -32,6 +29,14 @@ pub static CHACHA20_POLY1305: aead::Algorithm = aead::Algorithm {
     init: chacha20_poly1305_init,
     seal: chacha20_poly1305_seal,
     open: chacha20_poly1305_open,
+    seal_batch: None,
+    open_batch: None,
+    seal_sg: None,
+    open_sg: None,
+    seal_parallel: Some(chacha20_poly1305_seal_parallel),
+    open_parallel: Some(chacha20_poly1305_open_parallel),
+    authenticate: None,
+    seal_out_of_place: None,
 };
 
 /// Copies |key| into |ctx_buf|.
@@ -45,17 +50,12 @@ fn chacha20_poly1305_seal(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
                           nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
                           tag_out: &mut [u8; aead::TAG_LEN], ad: &[u8])
                           -> Result<(), error::Unspecified> {
-    let chacha20_key = try!(ctx_as_key(ctx));
-    let mut counter = make_counter(1, nonce);
-    debug_assert!(core::mem::align_of_val(chacha20_key) >= 4);
-    debug_assert!(core::mem::align_of_val(&counter) >= 4);
-    unsafe {
-        GFp_ChaCha20_ctr32(in_out.as_mut_ptr(), in_out.as_ptr(), in_out.len(),
-                           chacha20_key, &counter);
-    }
-    counter[0] = 0;
-    aead_poly1305(tag_out, chacha20_key, &counter, ad, in_out);
-    Ok(())
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    bssl::map_result(unsafe {
+        GFp_chacha20_poly1305_seal(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                   in_out.len(), tag_out, nonce, ad.as_ptr(),
+                                   ad.len())
+    })
 }
 
 fn chacha20_poly1305_open(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
@@ -63,159 +63,161 @@ fn chacha20_poly1305_open(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
                           in_prefix_len: usize,
                           tag_out: &mut [u8; aead::TAG_LEN], ad: &[u8])
                           -> Result<(), error::Unspecified> {
-    let chacha20_key = try!(ctx_as_key(ctx));
-    let mut counter = make_counter(0, nonce);
-    {
-        let ciphertext = &in_out[in_prefix_len..];
-        aead_poly1305(tag_out, chacha20_key, &counter, ad, ciphertext);
-    }
-    counter[0] = 1;
-    debug_assert!(core::mem::align_of_val(chacha20_key) >= 4);
-    debug_assert!(core::mem::align_of_val(&counter) >= 4);
-    unsafe {
-        // XXX: The x86 and at least one branch of the ARM assembly language
-        // code doesn't allow overlapping input and output unless they are
-        // exactly overlapping. TODO: Figure out which branch of the ARM code
-        // has this limitation and come up with a better solution.
-        //
-        // https://rt.openssl.org/Ticket/Display.html?id=4362
-        if cfg!(any(target_arch = "arm", target_arch = "x86")) &&
-           in_prefix_len != 0 {
-            GFp_ChaCha20_ctr32(in_out[in_prefix_len..].as_mut_ptr(),
-                               in_out[in_prefix_len..].as_ptr(),
-                               in_out.len() - in_prefix_len, chacha20_key,
-                               &counter);
-            core::ptr::copy(in_out[in_prefix_len..].as_ptr(),
-                            in_out.as_mut_ptr(), in_out.len() - in_prefix_len);
-        } else {
-            GFp_ChaCha20_ctr32(in_out.as_mut_ptr(),
-                               in_out[in_prefix_len..].as_ptr(),
-                               in_out.len() - in_prefix_len, chacha20_key,
-                               &counter);
-        }
-    }
-    Ok(())
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    bssl::map_result(unsafe {
+        GFp_chacha20_poly1305_open(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                   in_out.len() - in_prefix_len, tag_out,
+                                   nonce, in_out[in_prefix_len..].as_ptr(),
+                                   ad.as_ptr(), ad.len())
+    })
 }
 
-fn ctx_as_key(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS])
-              -> Result<&[u32; CHACHA20_KEY_LEN / 4], error::Unspecified> {
-    slice_as_array_ref!(
-        &polyfill::slice::u64_as_u32(ctx)[..(CHACHA20_KEY_LEN / 4)],
-        CHACHA20_KEY_LEN / 4)
+fn chacha20_poly1305_seal_parallel(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                                   nonce: &[u8; aead::NONCE_LEN],
+                                   in_out: &mut [u8],
+                                   tag_out: &mut [u8; aead::TAG_LEN],
+                                   ad: &[u8], max_threads: usize,
+                                   executor: &aead::ParallelExecutor)
+                                   -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    let executor: *const &aead::ParallelExecutor = &executor;
+    bssl::map_result(unsafe {
+        GFp_chacha20_poly1305_seal_parallel(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                            in_out.len(), tag_out, nonce,
+                                            ad.as_ptr(), ad.len(),
+                                            max_threads,
+                                            Some(aead::parallel_for),
+                                            executor as *mut u8)
+    })
 }
 
-#[inline]
-fn make_counter(counter: u32, nonce: &[u8; aead::NONCE_LEN]) -> [u32; 4] {
-    use polyfill::slice::u32_from_le_u8;
-    [counter.to_le(),
-     u32_from_le_u8(slice_as_array_ref!(&nonce[0..4], 4).unwrap()),
-     u32_from_le_u8(slice_as_array_ref!(&nonce[4..8], 4).unwrap()),
-     u32_from_le_u8(slice_as_array_ref!(&nonce[8..12], 4).unwrap())]
+fn chacha20_poly1305_open_parallel(ctx: &[u64; aead::KEY_CTX_BUF_ELEMS],
+                                   nonce: &[u8; aead::NONCE_LEN],
+                                   in_out: &mut [u8],
+                                   tag_out: &mut [u8; aead::TAG_LEN],
+                                   ad: &[u8], max_threads: usize,
+                                   executor: &aead::ParallelExecutor)
+                                   -> Result<(), error::Unspecified> {
+    let ctx = polyfill::slice::u64_as_u8(ctx);
+    let executor: *const &aead::ParallelExecutor = &executor;
+    bssl::map_result(unsafe {
+        GFp_chacha20_poly1305_open_parallel(ctx.as_ptr(), in_out.as_mut_ptr(),
+                                            in_out.len(), tag_out, nonce,
+                                            in_out.as_ptr(), ad.as_ptr(),
+                                            ad.len(), max_threads,
+                                            Some(aead::parallel_for),
+                                            executor as *mut u8)
+    })
 }
 
-type UpdateFn = fn(state: &mut [u8; POLY1305_STATE_LEN], ad: &[u8],
-                   ciphertext: &[u8]);
-
-fn aead_poly1305(tag_out: &mut [u8; aead::TAG_LEN],
-                 chacha20_key: &[u32; CHACHA20_KEY_LEN / 4],
-                 counter: &[u32; 4], ad: &[u8], ciphertext: &[u8]) {
-    debug_assert_eq!(counter[0], 0);
-    let mut poly1305_key = [0u8; POLY1305_KEY_LEN];
-    debug_assert!(core::mem::align_of_val(chacha20_key) >= 4);
-    debug_assert!(core::mem::align_of_val(&counter) >= 4);
-    unsafe {
-        GFp_ChaCha20_ctr32(poly1305_key.as_mut_ptr(), poly1305_key.as_ptr(),
-                           POLY1305_KEY_LEN, chacha20_key, &counter);
-    }
-    let mut ctx = [0u8; POLY1305_STATE_LEN];
-    poly1305_init(&mut ctx, &poly1305_key);
-    poly1305_update_padded_16(&mut ctx, ad);
-    poly1305_update_padded_16(&mut ctx, ciphertext);
-    poly1305_update_length(&mut ctx, ad.len());
-    poly1305_update_length(&mut ctx, ciphertext.len());
-    poly1305_finish(&mut ctx, tag_out);
+extern {
+    fn GFp_chacha20_poly1305_seal(ctx_buf: *const u8, in_out: *mut u8,
+                                  in_out_len: c::size_t,
+                                  tag_out: &mut [u8; aead::TAG_LEN],
+                                  nonce: &[u8; aead::NONCE_LEN],
+                                  ad: *const u8, ad_len: c::size_t)
+                                  -> c::int;
+
+    fn GFp_chacha20_poly1305_open(ctx_buf: *const u8, out: *mut u8,
+                                  in_out_len: c::size_t,
+                                  tag_out: &mut [u8; aead::TAG_LEN],
+                                  nonce: &[u8; aead::NONCE_LEN],
+                                  in_: *const u8, ad: *const u8,
+                                  ad_len: c::size_t) -> c::int;
+
+    fn GFp_chacha20_poly1305_seal_parallel(
+        ctx_buf: *const u8, in_out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        ad: *const u8, ad_len: c::size_t, max_threads: c::size_t,
+        parallel_for: Option<aead::ParallelFor>, executor: *mut u8) -> c::int;
+
+    fn GFp_chacha20_poly1305_open_parallel(
+        ctx_buf: *const u8, out: *mut u8, in_out_len: c::size_t,
+        tag_out: &mut [u8; aead::TAG_LEN], nonce: &[u8; aead::NONCE_LEN],
+        in_: *const u8, ad: *const u8, ad_len: c::size_t,
+        max_threads: c::size_t, parallel_for: Option<aead::ParallelFor>,
+        executor: *mut u8) -> c::int;
 }
 
-#[inline]
-fn poly1305_update_padded_16(state: &mut [u8; POLY1305_STATE_LEN],
-                                data: &[u8]) {
-    poly1305_update(state, data);
-    if data.len() % 16 != 0 {
-        static PADDING: [u8; 16] = [0u8; 16];
-        poly1305_update(state, &PADDING[..PADDING.len() - (data.len() % 16)])
+#[cfg(test)]
+mod tests {
+    use {aead, c, error, init, polyfill, test};
+    use core;
+    use std;
+    use super::CHACHA20_KEY_LEN;
+    use super::super::tests::ThreadExecutor;
+
+    // Keep this in sync with `poly1305_state` in poly1305/internal.h.
+    const POLY1305_STATE_LEN: usize = 256;
+    type Poly1305State = [u64; POLY1305_STATE_LEN / 8];
+    const POLY1305_KEY_LEN: usize = 32;
+
+    #[inline]
+    fn make_counter(counter: u32, nonce: &[u8; aead::NONCE_LEN]) -> [u32; 4] {
+        use polyfill::slice::u32_from_le_u8;
+        [counter.to_le(),
+         u32_from_le_u8(slice_as_array_ref!(&nonce[0..4], 4).unwrap()),
+         u32_from_le_u8(slice_as_array_ref!(&nonce[4..8], 4).unwrap()),
+         u32_from_le_u8(slice_as_array_ref!(&nonce[8..12], 4).unwrap())]
     }
-}
 
-/// Updates the Poly1305 context |ctx| with the 64-bit little-endian encoded
-/// length value |len|.
-#[inline]
-fn poly1305_update_length(ctx: &mut [u8; POLY1305_STATE_LEN], len: usize) {
-    let mut j = len;
-    let mut length_bytes = [0u8; 8];
-    for b in &mut length_bytes {
-        *b = j as u8;
-        j >>= 8;
+    #[inline(always)]
+    fn poly1305_init(state: &mut Poly1305State,
+                     key: &[u8; POLY1305_KEY_LEN]) {
+        unsafe {
+            GFp_poly1305_init(state, key)
+        }
     }
-    poly1305_update(ctx, &length_bytes);
-}
 
-
-#[inline(always)]
-fn poly1305_init(state: &mut [u8; POLY1305_STATE_LEN],
-                 key: &[u8; POLY1305_KEY_LEN]) {
-    unsafe {
-        GFp_poly1305_init(state, key)
+    // XXX: The BoringSSL code says that `poly1305_finish` requires a
+    // 16-byte-aligned output, but we're not ensuring 16-byte alignment
+    // because we can't in Rust yet. Where does this alignment requirement
+    // come from? TODO: address this.
+    #[inline(always)]
+    fn poly1305_finish(state: &mut Poly1305State,
+                       tag_out: &mut [u8; aead::TAG_LEN]) {
+        unsafe {
+            GFp_poly1305_finish(state, tag_out)
+        }
     }
-}
 
-// XXX: The BoringSSL code says that `poly1305_finish` requires a
-// 16-byte-aligned output, but we're not ensuring 16-byte alignment because we
-// can't in Rust yet. Where does this alignment requirement come from?
-// TODO: address this.
-#[inline(always)]
-fn poly1305_finish(state: &mut [u8; POLY1305_STATE_LEN],
-                   tag_out: &mut [u8; aead::TAG_LEN]) {
-    unsafe {
-        GFp_poly1305_finish(state, tag_out)
+    #[inline(always)]
+    fn poly1305_update(state: &mut Poly1305State, in_: &[u8]) {
+        unsafe {
+            GFp_poly1305_update(state, in_.as_ptr(), in_.len())
+        }
     }
-}
 
-#[inline(always)]
-fn poly1305_update(state: &mut [u8; POLY1305_STATE_LEN], in_: &[u8]) {
-    unsafe {
-        GFp_poly1305_update(state, in_.as_ptr(), in_.len())
+    #[test]
+    pub fn test_chacha20_poly1305() {
+        aead::tests::test_aead(&aead::CHACHA20_POLY1305,
+            "src/aead/chacha20_poly1305_tests.txt");
     }
-}
 
-extern {
-    fn GFp_ChaCha20_ctr32(out: *mut u8, in_: *const u8, in_len: c::size_t,
-                          key: &[u32; CHACHA20_KEY_LEN / 4],
-                          counter: &[u32; 4]);
-    fn GFp_poly1305_init(state: &mut [u8; POLY1305_STATE_LEN],
-                         key: &[u8; POLY1305_KEY_LEN]);
-    fn GFp_poly1305_finish(state: &mut [u8; POLY1305_STATE_LEN],
-                           mac: &mut [u8; aead::TAG_LEN]);
-    fn GFp_poly1305_update(state: &mut [u8; POLY1305_STATE_LEN],
-                           in_: *const u8, in_len: c::size_t);
-}
+    #[test]
+    pub fn test_chacha20_poly1305_sg_unsupported() {
+        let key = [0u8; 32];
+        let nonce = [0u8; aead::NONCE_LEN];
+        let mut tag = [0u8; aead::TAG_LEN];
+        let s_key = aead::SealingKey::new(&aead::CHACHA20_POLY1305, &key)
+            .unwrap();
+        assert!(aead::seal_sg(&s_key, &nonce, &[], &mut [], &mut tag, &[])
+                    .is_err());
+        let o_key = aead::OpeningKey::new(&aead::CHACHA20_POLY1305, &key)
+            .unwrap();
+        assert!(aead::open_sg(&o_key, &nonce, &[], &mut [], &tag, &[])
+                    .is_err());
+    }
 
-#[cfg(test)]
-mod tests {
-    use {aead, c, error, polyfill, test};
-    use core;
-    use super::{GFp_ChaCha20_ctr32, CHACHA20_KEY_LEN, make_counter,
-                POLY1305_STATE_LEN, POLY1305_KEY_LEN, poly1305_init,
-                poly1305_finish, poly1305_update};
     #[test]
-    pub fn test_chacha20_poly1305() {
-        aead::tests::test_aead(&aead::CHACHA20_POLY1305,
+    pub fn test_chacha20_poly1305_batch() {
+        aead::tests::test_aead_batch(&aead::CHACHA20_POLY1305,
             "src/aead/chacha20_poly1305_tests.txt");
     }
 
     #[test]
     pub fn test_poly1305_state_len() {
-        assert_eq!((POLY1305_STATE_LEN + 255) / 256,
-                   (unsafe { GFp_POLY1305_STATE_LEN } + 255) / 256);
+        assert!(unsafe { GFp_POLY1305_STATE_LEN } <= POLY1305_STATE_LEN);
     }
 
     // Adapted from BoringSSL's crypto/poly1305/poly1305_test.cc.
@@ -231,7 +233,7 @@ mod tests {
                                                    aead::TAG_LEN).unwrap();
 
             // Test single-shot operation.
-            let mut state = [0u8; POLY1305_STATE_LEN];
+            let mut state = [0u64; POLY1305_STATE_LEN / 8];
             let mut actual_mac = [0u8; aead::TAG_LEN];
             poly1305_init(&mut state, &key);
             poly1305_update(&mut state, &input);
@@ -239,7 +241,7 @@ mod tests {
             assert_eq!(expected_mac[..], actual_mac[..]);
 
             // Test streaming byte-by-byte.
-            let mut state = [0u8; POLY1305_STATE_LEN];
+            let mut state = [0u64; POLY1305_STATE_LEN / 8];
             let mut actual_mac = [0u8; aead::TAG_LEN];
             poly1305_init(&mut state, &key);
             for chunk in input.chunks(1) {
@@ -248,6 +250,20 @@ mod tests {
             poly1305_finish(&mut state, &mut actual_mac);
             assert_eq!(&expected_mac[..], &actual_mac[..]);
 
+            // Test that the state may be moved between calls.
+            let mut states = [[0u64; POLY1305_STATE_LEN / 8]; 2];
+            let mut current = 0;
+            poly1305_init(&mut states[current], &key);
+            for chunk in input.chunks(7) {
+                states[1 - current] = states[current];
+                states[current] = [0u64; POLY1305_STATE_LEN / 8];
+                current = 1 - current;
+                poly1305_update(&mut states[current], chunk);
+            }
+            let mut actual_mac = [0u8; aead::TAG_LEN];
+            poly1305_finish(&mut states[current], &mut actual_mac);
+            assert_eq!(&expected_mac[..], &actual_mac[..]);
+
             try!(test_poly1305_simd(0, key, &input, expected_mac));
             try!(test_poly1305_simd(16, key, &input, expected_mac));
             try!(test_poly1305_simd(32, key, &input, expected_mac));
@@ -257,10 +273,67 @@ mod tests {
         })
     }
 
+    // Keep this in sync with `poly1305_partial` in poly1305/internal.h.
+    #[allow(non_camel_case_types)]
+    #[repr(C)]
+    struct poly1305_partial {
+        r: [u32; 5],
+        h: [u32; 5],
+        num_blocks: u64,
+    }
+
+    fn poly1305_partial_new() -> poly1305_partial {
+        poly1305_partial { r: [0; 5], h: [0; 5], num_blocks: 0 }
+    }
+
+    // The partial API absorbs whole blocks only, so only the test vectors
+    // whose inputs are whole blocks apply. The pieces are computed
+    // independently and appended in order; pieces of 64 blocks or more use
+    // the AVX2 lanes where available.
+    #[test]
+    pub fn test_poly1305_partial() {
+        init::init_once();
+
+        test::from_file("src/aead/poly1305_test.txt", |section, test_case| {
+            assert_eq!(section, "");
+            let key = test_case.consume_bytes("Key");
+            let key = slice_as_array_ref!(&key, POLY1305_KEY_LEN).unwrap();
+            let input = test_case.consume_bytes("Input");
+            let expected_mac = test_case.consume_bytes("MAC");
+            if input.is_empty() || input.len() % 16 != 0 {
+                return Ok(());
+            }
+
+            for &piece_len in &[16, 3 * 16, 64 * 16, input.len()] {
+                let mut partial = poly1305_partial_new();
+                unsafe {
+                    GFp_poly1305_partial_init(&mut partial, key);
+                }
+                for piece in input.chunks(piece_len) {
+                    let mut next = poly1305_partial_new();
+                    unsafe {
+                        GFp_poly1305_partial_init(&mut next, key);
+                        GFp_poly1305_partial_update(&mut next, piece.as_ptr(),
+                                                    piece.len());
+                        GFp_poly1305_partial_append(&mut partial, &next);
+                    }
+                }
+                assert_eq!((input.len() / 16) as u64, partial.num_blocks);
+                let mut mac = [0u8; aead::TAG_LEN];
+                unsafe {
+                    GFp_poly1305_partial_finish(&partial, &mut mac, key);
+                }
+                assert_eq!(&expected_mac[..], &mac[..]);
+            }
+
+            Ok(())
+        })
+    }
+
     fn test_poly1305_simd(excess: usize, key: &[u8; POLY1305_KEY_LEN],
                           input: &[u8], expected_mac: &[u8; aead::TAG_LEN])
                           -> Result<(), error::Unspecified> {
-        let mut state = [0u8; POLY1305_STATE_LEN];
+        let mut state = [0u64; POLY1305_STATE_LEN / 8];
         poly1305_init(&mut state, &key);
 
         // Some implementations begin in non-SIMD mode and upgrade on demand.
@@ -373,7 +446,253 @@ mod tests {
         }
     }
 
+    // Keep this in sync with `CHACHA20_POLY1305_CHUNK` in
+    // poly1305/chacha20_poly1305.c.
+    const CHUNK_BUF_LEN: usize = 64;
+    type ChunkBuf = [u64; CHUNK_BUF_LEN / 8];
+
+    // The shortest message that the parallel functions split with the
+    // four-lane Poly1305 code, one byte more than
+    // `CHACHA20_POLY1305_PARALLEL_MIN_CHUNK_LEN`. Without it they need one
+    // more chunk's worth.
+    const PARALLEL_MIN_LEN: usize = 64 * 1024 + 1;
+
+    fn test_message(len: usize) -> std::vec::Vec<u8> {
+        (0..len).map(|i| (i * 7 + (i >> 8)) as u8).collect()
+    }
+
+    // Seals `in_out` in one piece and returns the tag.
+    fn seal_one_shot(key: &[u8; CHACHA20_KEY_LEN],
+                     nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
+                     ad: &[u8]) -> [u8; aead::TAG_LEN] {
+        let mut tag = [0u8; aead::TAG_LEN];
+        assert_eq!(1, unsafe {
+            GFp_chacha20_poly1305_seal(key.as_ptr(), in_out.as_mut_ptr(),
+                                       in_out.len(), &mut tag, nonce,
+                                       ad.as_ptr(), ad.len())
+        });
+        tag
+    }
+
+    // Seals (or opens) `in_out` in place in chunks of `chunk_len` bytes, one
+    // after the other, and combines them.
+    fn crypt_chunks(key: &[u8; CHACHA20_KEY_LEN],
+                    nonce: &[u8; aead::NONCE_LEN], in_out: &mut [u8],
+                    ad: &[u8], chunk_len: usize, seal: bool)
+                    -> Option<[u8; aead::TAG_LEN]> {
+        let mut chunk_bufs = std::vec::Vec::new();
+        for (i, chunk) in in_out.chunks_mut(chunk_len).enumerate() {
+            let mut chunk_buf: ChunkBuf = [0; CHUNK_BUF_LEN / 8];
+            let ok = unsafe {
+                GFp_chacha20_poly1305_crypt_chunk(
+                    &mut chunk_buf, CHUNK_BUF_LEN, key.as_ptr(), nonce,
+                    chunk.as_mut_ptr(), chunk.as_ptr(), chunk.len(),
+                    (i * chunk_len) as u64, if seal { 1 } else { 0 })
+            };
+            if ok != 1 {
+                return None;
+            }
+            chunk_bufs.push(chunk_buf);
+        }
+        finish_chunks(key, nonce, ad, &chunk_bufs)
+    }
+
+    fn finish_chunks(key: &[u8; CHACHA20_KEY_LEN],
+                     nonce: &[u8; aead::NONCE_LEN], ad: &[u8],
+                     chunk_bufs: &[ChunkBuf]) -> Option<[u8; aead::TAG_LEN]> {
+        let chunk_buf_ptrs: std::vec::Vec<*const ChunkBuf> =
+            chunk_bufs.iter().map(|chunk_buf| {
+                let ptr: *const ChunkBuf = chunk_buf;
+                ptr
+            }).collect();
+        let mut tag = [0u8; aead::TAG_LEN];
+        let ok = unsafe {
+            GFp_chacha20_poly1305_finish_chunks(
+                key.as_ptr(), &mut tag, nonce, ad.as_ptr(), ad.len(),
+                chunk_buf_ptrs.as_ptr(), chunk_buf_ptrs.len())
+        };
+        if ok == 1 { Some(tag) } else { None }
+    }
+
+    #[test]
+    pub fn test_chacha20_poly1305_chunks() {
+        let key = [0x42u8; CHACHA20_KEY_LEN];
+        let nonce = [7u8; aead::NONCE_LEN];
+        let ad = test_message(21);
+
+        for &len in &[0, 1, 63, 64, 65, 1000, 4096, 4096 + 13, 3 * 4096 + 100] {
+            let plaintext = test_message(len);
+            let mut expected = plaintext.clone();
+            let expected_tag = seal_one_shot(&key, &nonce, &mut expected, &ad);
+
+            for &chunk_len in &[64, 3 * 64, 4096, 4096 + 64, 1 << 20] {
+                let mut in_out = plaintext.clone();
+                let tag = crypt_chunks(&key, &nonce, &mut in_out, &ad,
+                                       chunk_len, true);
+                assert_eq!(Some(expected_tag), tag);
+                assert_eq!(expected, in_out);
+
+                let tag = crypt_chunks(&key, &nonce, &mut in_out, &ad,
+                                       chunk_len, false);
+                assert_eq!(Some(expected_tag), tag);
+                assert_eq!(plaintext, in_out);
+            }
+        }
+    }
+
+    #[test]
+    pub fn test_chacha20_poly1305_chunks_mismatched() {
+        let key = [0x42u8; CHACHA20_KEY_LEN];
+        let nonce = [7u8; aead::NONCE_LEN];
+        let mut in_out = test_message(3 * 64);
+
+        let mut chunk_bufs = [[0u64; CHUNK_BUF_LEN / 8]; 3];
+        for (i, chunk) in in_out.chunks_mut(64).enumerate() {
+            // The middle chunk is sealed under a different nonce.
+            let mut chunk_nonce = nonce;
+            if i == 1 {
+                chunk_nonce[0] ^= 1;
+            }
+            assert_eq!(1, unsafe {
+                GFp_chacha20_poly1305_crypt_chunk(
+                    &mut chunk_bufs[i], CHUNK_BUF_LEN, key.as_ptr(),
+                    &chunk_nonce, chunk.as_mut_ptr(), chunk.as_ptr(),
+                    chunk.len(), (i * 64) as u64, 1)
+            });
+        }
+        assert!(finish_chunks(&key, &nonce, &[], &chunk_bufs).is_none());
+
+        // Under a different key.
+        let other_key = [0x43u8; CHACHA20_KEY_LEN];
+        assert!(finish_chunks(&other_key, &nonce, &[], &chunk_bufs[..1])
+                    .is_none());
+        assert!(finish_chunks(&key, &nonce, &[], &chunk_bufs[..1]).is_some());
+
+        // With a chunk missing.
+        let gap = [chunk_bufs[0], chunk_bufs[2]];
+        assert!(finish_chunks(&key, &nonce, &[], &gap).is_none());
+
+        // With a misaligned offset.
+        let mut chunk_buf = [0u64; CHUNK_BUF_LEN / 8];
+        assert_eq!(0, unsafe {
+            GFp_chacha20_poly1305_crypt_chunk(
+                &mut chunk_buf, CHUNK_BUF_LEN, key.as_ptr(), &nonce,
+                in_out.as_mut_ptr(), in_out.as_ptr(), 64, 32, 1)
+        });
+    }
+
+    #[test]
+    pub fn test_chacha20_poly1305_parallel() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+
+        let key = [0x42u8; CHACHA20_KEY_LEN];
+        let s_key =
+            aead::SealingKey::new(&aead::CHACHA20_POLY1305, &key).unwrap();
+        let o_key =
+            aead::OpeningKey::new(&aead::CHACHA20_POLY1305, &key).unwrap();
+        let nonce = [7u8; aead::NONCE_LEN];
+        let ad = test_message(13);
+
+        for &len in &[0, 1000, PARALLEL_MIN_LEN - 1, PARALLEL_MIN_LEN,
+                      PARALLEL_MIN_LEN + 1, 2 * PARALLEL_MIN_LEN - 1,
+                      2 * PARALLEL_MIN_LEN, (1 << 20) + 17] {
+            let plaintext = test_message(len);
+            let mut expected = plaintext.clone();
+            let expected_tag = seal_one_shot(&key, &nonce, &mut expected, &ad);
+            expected.extend_from_slice(&expected_tag);
+
+            for &max_threads in &[0, 1, 2, 3, 16, 64] {
+                let executor = ThreadExecutor { calls: AtomicUsize::new(0) };
+
+                let mut in_out = plaintext.clone();
+                in_out.extend_from_slice(&[0u8; aead::TAG_LEN]);
+                assert_eq!(Ok(len + aead::TAG_LEN),
+                           aead::seal_in_place_parallel(
+                               &s_key, &nonce, &mut in_out, aead::TAG_LEN,
+                               &ad, max_threads, &executor));
+                assert_eq!(expected, in_out);
+
+                assert_eq!(Ok(len),
+                           aead::open_in_place_parallel(
+                               &o_key, &nonce, &mut in_out, &ad, max_threads,
+                               &executor));
+                assert_eq!(&plaintext[..], &in_out[..len]);
+
+                // Messages that fit in one minimum-length chunk, and calls
+                // that allow only one thread, are never split. Otherwise
+                // the split depends on the Poly1305 code this CPU uses, and
+                // `GFp_chacha20_poly1305_chunk_len` says what it is.
+                let calls = executor.calls.load(Ordering::SeqCst);
+                let max_chunks = core::cmp::min(max_threads, 16);
+                let chunk_len = unsafe {
+                    GFp_chacha20_poly1305_chunk_len(len, max_chunks)
+                };
+                if len < PARALLEL_MIN_LEN || max_threads < 2 {
+                    assert_eq!(len, chunk_len);
+                }
+                if chunk_len == len {
+                    assert_eq!(0, calls);
+                } else {
+                    let num_chunks = (len + chunk_len - 1) / chunk_len;
+                    assert!(num_chunks >= 2);
+                    assert!(num_chunks <= max_chunks);
+                    assert_eq!(2 * num_chunks, calls);
+                }
+
+                // A forged tag is rejected.
+                if max_threads == 2 {
+                    let mut in_out = expected.clone();
+                    in_out[len] ^= 1;
+                    assert!(aead::open_in_place_parallel(
+                        &o_key, &nonce, &mut in_out, &ad, max_threads,
+                        &executor).is_err());
+                }
+            }
+        }
+    }
+
+    extern {
+        fn GFp_chacha20_poly1305_seal(ctx_buf: *const u8, in_out: *mut u8,
+                                      in_out_len: c::size_t,
+                                      tag_out: &mut [u8; aead::TAG_LEN],
+                                      nonce: &[u8; aead::NONCE_LEN],
+                                      ad: *const u8, ad_len: c::size_t)
+                                      -> c::int;
+        fn GFp_chacha20_poly1305_chunk_len(in_out_len: c::size_t,
+                                           max_chunks: c::size_t)
+                                           -> c::size_t;
+        fn GFp_chacha20_poly1305_crypt_chunk(
+            chunk_buf: *mut ChunkBuf, chunk_buf_len: c::size_t,
+            ctx_buf: *const u8, nonce: &[u8; aead::NONCE_LEN], out: *mut u8,
+            in_: *const u8, len: c::size_t, offset: u64, seal: c::int)
+            -> c::int;
+        fn GFp_chacha20_poly1305_finish_chunks(
+            ctx_buf: *const u8, tag_out: &mut [u8; aead::TAG_LEN],
+            nonce: &[u8; aead::NONCE_LEN], ad: *const u8, ad_len: c::size_t,
+            chunk_bufs: *const *const ChunkBuf, num_chunks: c::size_t)
+            -> c::int;
+    }
+
     extern {
+        fn GFp_ChaCha20_ctr32(out: *mut u8, in_: *const u8,
+                              in_len: c::size_t,
+                              key: &[u32; CHACHA20_KEY_LEN / 4],
+                              counter: &[u32; 4]);
+        fn GFp_poly1305_init(state: &mut Poly1305State,
+                             key: &[u8; POLY1305_KEY_LEN]);
+        fn GFp_poly1305_finish(state: &mut Poly1305State,
+                               mac: &mut [u8; aead::TAG_LEN]);
+        fn GFp_poly1305_update(state: &mut Poly1305State,
+                               in_: *const u8, in_len: c::size_t);
+        fn GFp_poly1305_partial_init(partial: &mut poly1305_partial,
+                                     key: &[u8; POLY1305_KEY_LEN]);
+        fn GFp_poly1305_partial_update(partial: &mut poly1305_partial,
+                                       in_: *const u8, in_len: c::size_t);
+        fn GFp_poly1305_partial_append(partial: &mut poly1305_partial,
+                                       next: &poly1305_partial);
+        fn GFp_poly1305_partial_finish(partial: &poly1305_partial,
+                                       mac: &mut [u8; aead::TAG_LEN],
+                                       key: &[u8; POLY1305_KEY_LEN]);
         static GFp_POLY1305_STATE_LEN: c::size_t;
     }
 }
@@ -0,0 +1,400 @@
+// Copyright 2016 Brian Smith.
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+// SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+// OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+// CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+//! Unauthenticated AES modes.
+//!
+//! These modes provide confidentiality only. An attacker can modify the
+//! ciphertext without being detected, so they must only be used where
+//! integrity is provided some other way, or where it cannot be, as in a DRBG
+//! or in sector-level storage encryption. Use the AEAD algorithms in the
+//! parent module whenever possible.
+
+use {bssl, c, error, init, polyfill};
+use super::aes_gcm::{AES_CTR_KEY_BUF_ELEMS, AES_KEY_BUF_LEN,
+                     FN_PTR_MAX_LEN};
+
+/// The length of an AES-CTR counter block.
+pub const COUNTER_LEN: usize = 16;
+
+/// An AES-128 or AES-256 key for CTR mode.
+pub struct AesCtrKey {
+    ctx_buf: [u64; AES_CTR_KEY_BUF_ELEMS],
+}
+
+impl AesCtrKey {
+    /// Constructs an `AesCtrKey` from a 16-byte AES-128 key or a 32-byte
+    /// AES-256 key.
+    ///
+    /// C analog: `EVP_EncryptInit_ex` with `EVP_aes_128_ctr` or
+    /// `EVP_aes_256_ctr`.
+    pub fn new(key_bytes: &[u8]) -> Result<AesCtrKey, error::Unspecified> {
+        init::init_once();
+
+        let mut key = AesCtrKey { ctx_buf: [0; AES_CTR_KEY_BUF_ELEMS] };
+        try!(bssl::map_result(unsafe {
+            let ctx_buf = polyfill::slice::u64_as_u8_mut(&mut key.ctx_buf);
+            GFp_aes_ctr_init(ctx_buf.as_mut_ptr(), ctx_buf.len(),
+                             key_bytes.as_ptr(), key_bytes.len())
+        }));
+        Ok(key)
+    }
+
+    /// XORs `in_out` with the keystream that starts at the big-endian
+    /// `counter`, encrypting or decrypting it in place.
+    ///
+    /// `counter` is advanced past every block that was used, including a
+    /// final partial block, so consecutive calls with lengths that are
+    /// multiples of `COUNTER_LEN` continue the same keystream. The counter
+    /// carries across all 128 bits and wraps from 2^128 - 1 to zero.
+    pub fn encrypt_in_place(&self, counter: &mut [u8; COUNTER_LEN],
+                            in_out: &mut [u8]) {
+        let ctx = polyfill::slice::u64_as_u8(&self.ctx_buf);
+        unsafe {
+            GFp_aes_ctr_encrypt(ctx.as_ptr(), in_out.as_ptr(),
+                                in_out.as_mut_ptr(), in_out.len(), counter);
+        }
+    }
+
+    /// Like `encrypt_in_place`, but reads `in_` and writes the result to
+    /// `out`, which must have the same length.
+    pub fn encrypt(&self, counter: &mut [u8; COUNTER_LEN], in_: &[u8],
+                   out: &mut [u8]) -> Result<(), error::Unspecified> {
+        if in_.len() != out.len() {
+            return Err(error::Unspecified);
+        }
+        let ctx = polyfill::slice::u64_as_u8(&self.ctx_buf);
+        unsafe {
+            GFp_aes_ctr_encrypt(ctx.as_ptr(), in_.as_ptr(), out.as_mut_ptr(),
+                                out.len(), counter);
+        }
+        Ok(())
+    }
+
+    /// Fills `out` with the keystream that starts at `counter`, advancing
+    /// `counter` like `encrypt_in_place`.
+    pub fn keystream(&self, counter: &mut [u8; COUNTER_LEN], out: &mut [u8]) {
+        let ctx = polyfill::slice::u64_as_u8(&self.ctx_buf);
+        unsafe {
+            GFp_aes_ctr_keystream(ctx.as_ptr(), out.as_mut_ptr(), out.len(),
+                                  counter);
+        }
+    }
+}
+
+/// The length of an AES-XTS tweak.
+pub const TWEAK_LEN: usize = 16;
+
+/// A pair of AES-128 or AES-256 keys for XTS mode (IEEE 1619), for
+/// encrypting fixed-size units of data such as disk sectors.
+///
+/// Every data unit must be at least 16 bytes long. A final partial block is
+/// handled with ciphertext stealing, so the ciphertext is exactly as long as
+/// the plaintext.
+pub struct AesXtsKey {
+    ctx_buf: [u64; AES_XTS_KEY_BUF_ELEMS],
+}
+
+// Keep this in sync with `AES_XTS_KEY` in e_aes.c: three `AES_KEY`s and an
+// `AES_IMPL` pointer.
+const AES_XTS_KEY_BUF_LEN: usize = (3 * AES_KEY_BUF_LEN) + FN_PTR_MAX_LEN;
+
+const AES_XTS_KEY_BUF_ELEMS: usize = (AES_XTS_KEY_BUF_LEN + 7) / 8;
+
+impl AesXtsKey {
+    /// Constructs an `AesXtsKey` from a 32-byte pair of AES-128 keys or a
+    /// 64-byte pair of AES-256 keys. The first key of the pair encrypts the
+    /// data and the second the tweaks. The two keys must differ.
+    ///
+    /// C analog: `EVP_EncryptInit_ex` with `EVP_aes_128_xts` or
+    /// `EVP_aes_256_xts`.
+    pub fn new(key_bytes: &[u8]) -> Result<AesXtsKey, error::Unspecified> {
+        init::init_once();
+
+        let mut key = AesXtsKey { ctx_buf: [0; AES_XTS_KEY_BUF_ELEMS] };
+        try!(bssl::map_result(unsafe {
+            let ctx_buf = polyfill::slice::u64_as_u8_mut(&mut key.ctx_buf);
+            GFp_aes_xts_init(ctx_buf.as_mut_ptr(), ctx_buf.len(),
+                             key_bytes.as_ptr(), key_bytes.len())
+        }));
+        Ok(key)
+    }
+
+    /// Encrypts the data unit `in_out` in place with the 16-byte `tweak`,
+    /// which is usually the little-endian sector number.
+    pub fn encrypt_in_place(&self, tweak: &[u8; TWEAK_LEN], in_out: &mut [u8])
+                            -> Result<(), error::Unspecified> {
+        self.crypt(tweak, in_out.as_ptr(), in_out, GFp_aes_xts_encrypt)
+    }
+
+    /// Decrypts the data unit `in_out` in place; see `encrypt_in_place`.
+    pub fn decrypt_in_place(&self, tweak: &[u8; TWEAK_LEN], in_out: &mut [u8])
+                            -> Result<(), error::Unspecified> {
+        self.crypt(tweak, in_out.as_ptr(), in_out, GFp_aes_xts_decrypt)
+    }
+
+    /// Like `encrypt_in_place`, but reads `in_` and writes the result to
+    /// `out`, which must have the same length.
+    pub fn encrypt(&self, tweak: &[u8; TWEAK_LEN], in_: &[u8], out: &mut [u8])
+                   -> Result<(), error::Unspecified> {
+        if in_.len() != out.len() {
+            return Err(error::Unspecified);
+        }
+        self.crypt(tweak, in_.as_ptr(), out, GFp_aes_xts_encrypt)
+    }
+
+    /// Like `decrypt_in_place`, but reads `in_` and writes the result to
+    /// `out`, which must have the same length.
+    pub fn decrypt(&self, tweak: &[u8; TWEAK_LEN], in_: &[u8], out: &mut [u8])
+                   -> Result<(), error::Unspecified> {
+        if in_.len() != out.len() {
+            return Err(error::Unspecified);
+        }
+        self.crypt(tweak, in_.as_ptr(), out, GFp_aes_xts_decrypt)
+    }
+
+    /// Encrypts consecutive sectors of `sector_len` bytes each in place. The
+    /// tweak of each sector is its little-endian sector number, starting at
+    /// `first_sector` for the first sector of `in_out`, whose length must be
+    /// a multiple of `sector_len`. The tweaks of many sectors are encrypted
+    /// together, so this is faster than encrypting the sectors one at a time.
+    pub fn encrypt_sectors_in_place(&self, first_sector: u64,
+                                    sector_len: usize, in_out: &mut [u8])
+                                    -> Result<(), error::Unspecified> {
+        self.crypt_sectors(first_sector, sector_len, in_out.as_ptr(), in_out,
+                           GFp_aes_xts_encrypt_sectors)
+    }
+
+    /// Decrypts consecutive sectors in place; see `encrypt_sectors_in_place`.
+    pub fn decrypt_sectors_in_place(&self, first_sector: u64,
+                                    sector_len: usize, in_out: &mut [u8])
+                                    -> Result<(), error::Unspecified> {
+        self.crypt_sectors(first_sector, sector_len, in_out.as_ptr(), in_out,
+                           GFp_aes_xts_decrypt_sectors)
+    }
+
+    fn crypt(&self, tweak: &[u8; TWEAK_LEN], in_: *const u8, out: &mut [u8],
+             f: unsafe extern fn(ctx_buf: *const u8, in_: *const u8,
+                                 out: *mut u8, len: c::size_t,
+                                 tweak: &[u8; TWEAK_LEN]) -> c::int)
+             -> Result<(), error::Unspecified> {
+        let ctx = polyfill::slice::u64_as_u8(&self.ctx_buf);
+        bssl::map_result(unsafe {
+            f(ctx.as_ptr(), in_, out.as_mut_ptr(), out.len(), tweak)
+        })
+    }
+
+    fn crypt_sectors(&self, first_sector: u64, sector_len: usize,
+                     in_: *const u8, out: &mut [u8],
+                     f: unsafe extern fn(ctx_buf: *const u8, in_: *const u8,
+                                         out: *mut u8, sector_len: c::size_t,
+                                         num_sectors: c::size_t,
+                                         first_sector: u64) -> c::int)
+                     -> Result<(), error::Unspecified> {
+        if sector_len == 0 || out.len() % sector_len != 0 {
+            return Err(error::Unspecified);
+        }
+        let ctx = polyfill::slice::u64_as_u8(&self.ctx_buf);
+        bssl::map_result(unsafe {
+            f(ctx.as_ptr(), in_, out.as_mut_ptr(), sector_len,
+              out.len() / sector_len, first_sector)
+        })
+    }
+}
+
+extern {
+    fn GFp_aes_ctr_init(ctx_buf: *mut u8, ctx_buf_len: c::size_t,
+                        key: *const u8, key_len: c::size_t) -> c::int;
+
+    fn GFp_aes_ctr_encrypt(ctx_buf: *const u8, in_: *const u8, out: *mut u8,
+                           len: c::size_t, counter: &mut [u8; COUNTER_LEN]);
+
+    fn GFp_aes_ctr_keystream(ctx_buf: *const u8, out: *mut u8,
+                             len: c::size_t, counter: &mut [u8; COUNTER_LEN]);
+
+    fn GFp_aes_xts_init(ctx_buf: *mut u8, ctx_buf_len: c::size_t,
+                        key: *const u8, key_len: c::size_t) -> c::int;
+
+    fn GFp_aes_xts_encrypt(ctx_buf: *const u8, in_: *const u8, out: *mut u8,
+                           len: c::size_t, tweak: &[u8; TWEAK_LEN]) -> c::int;
+
+    fn GFp_aes_xts_decrypt(ctx_buf: *const u8, in_: *const u8, out: *mut u8,
+                           len: c::size_t, tweak: &[u8; TWEAK_LEN]) -> c::int;
+
+    fn GFp_aes_xts_encrypt_sectors(ctx_buf: *const u8, in_: *const u8,
+                                   out: *mut u8, sector_len: c::size_t,
+                                   num_sectors: c::size_t,
+                                   first_sector: u64) -> c::int;
+
+    fn GFp_aes_xts_decrypt_sectors(ctx_buf: *const u8, in_: *const u8,
+                                   out: *mut u8, sector_len: c::size_t,
+                                   num_sectors: c::size_t,
+                                   first_sector: u64) -> c::int;
+}
+
+#[cfg(test)]
+mod tests {
+    use test;
+    use std::vec::Vec;
+    use c;
+    use super::{AES_XTS_KEY_BUF_LEN, AesCtrKey, AesXtsKey, COUNTER_LEN,
+                TWEAK_LEN};
+
+    #[test]
+    pub fn test_key_lens() {
+        let aes_xts_key_len = unsafe { GFp_AES_XTS_KEY_LEN };
+        assert!(aes_xts_key_len <= AES_XTS_KEY_BUF_LEN);
+    }
+
+    // The counters in the test vectors carry across 2^32, 2^64, 2^96 and
+    // 2^128, including in the middle of a call and between calls.
+    #[test]
+    pub fn test_aes_ctr() {
+        for &key_len in &[0, 15, 17, 24, 31, 33] {
+            assert!(AesCtrKey::new(&vec![0u8; key_len]).is_err());
+        }
+
+        test::from_file("src/aead/aes_ctr_tests.txt", |section, test_case| {
+            assert_eq!(section, "");
+            let key = test_case.consume_bytes("KEY");
+            let counter = test_case.consume_bytes("COUNTER");
+            let counter = slice_as_array_ref!(&counter, COUNTER_LEN).unwrap();
+            let input = test_case.consume_bytes("IN");
+            let expected = test_case.consume_bytes("OUT");
+            let next_counter = test_case.consume_bytes("NEXT_COUNTER");
+            let next_counter =
+                slice_as_array_ref!(&next_counter, COUNTER_LEN).unwrap();
+
+            let key = AesCtrKey::new(&key).unwrap();
+
+            // In place, in one call and in pieces of whole blocks.
+            for &piece_len in &[input.len(), 16, 48, 32] {
+                let mut in_out = input.clone();
+                let mut ctr = *counter;
+                for piece in in_out.chunks_mut(piece_len) {
+                    key.encrypt_in_place(&mut ctr, piece);
+                }
+                assert_eq!(expected, in_out);
+                assert_eq!(next_counter, &ctr);
+            }
+
+            // Out of place, and decryption.
+            let mut out = vec![0u8; input.len()];
+            let mut ctr = *counter;
+            key.encrypt(&mut ctr, &expected, &mut out).unwrap();
+            assert_eq!(input, out);
+            assert_eq!(next_counter, &ctr);
+
+            let mut ctr = *counter;
+            assert!(key.encrypt(&mut ctr, &expected, &mut out[1..]).is_err());
+            assert_eq!(counter, &ctr);
+
+            let mut keystream = vec![0u8; input.len()];
+            let mut ctr = *counter;
+            key.keystream(&mut ctr, &mut keystream);
+            let xored = keystream.iter().zip(input.iter())
+                                 .map(|(k, i)| *k ^ *i).collect::<Vec<u8>>();
+            assert_eq!(expected, xored);
+            assert_eq!(next_counter, &ctr);
+
+            Ok(())
+        });
+    }
+
+    #[test]
+    pub fn test_aes_xts() {
+        // More than one batch of sectors in e_aes.c.
+        const NUM_SECTORS: usize = 33;
+
+        // Only pairs of AES-128 or AES-256 keys are supported, and the two
+        // keys of a pair must differ, unlike in IEEE 1619 vector 1.
+        for &key_len in &[0, 16, 31, 33, 48, 63, 65] {
+            let key = (0..key_len).map(|i| i as u8).collect::<Vec<u8>>();
+            assert!(AesXtsKey::new(&key).is_err());
+        }
+        for &key_len in &[32, 64] {
+            assert!(AesXtsKey::new(&vec![0u8; key_len]).is_err());
+        }
+
+        test::from_file("src/aead/aes_xts_tests.txt", |section, test_case| {
+            assert_eq!(section, "");
+            let key = test_case.consume_bytes("KEY");
+            let tweak = test_case.consume_bytes("TWEAK");
+            let tweak = slice_as_array_ref!(&tweak, TWEAK_LEN).unwrap();
+            let input = test_case.consume_bytes("IN");
+            let expected = test_case.consume_bytes("OUT");
+
+            let key = AesXtsKey::new(&key).unwrap();
+
+            // In place and out of place.
+            let mut in_out = input.clone();
+            key.encrypt_in_place(tweak, &mut in_out).unwrap();
+            assert_eq!(expected, in_out);
+            key.decrypt_in_place(tweak, &mut in_out).unwrap();
+            assert_eq!(input, in_out);
+
+            let mut out = vec![0u8; input.len()];
+            key.encrypt(tweak, &input, &mut out).unwrap();
+            assert_eq!(expected, out);
+            key.decrypt(tweak, &expected, &mut out).unwrap();
+            assert_eq!(input, out);
+            assert!(key.encrypt(tweak, &input, &mut out[1..]).is_err());
+
+            // Data units shorter than one block are rejected.
+            assert!(key.encrypt(tweak, &input[..15], &mut out[..15]).is_err());
+            assert!(key.decrypt_in_place(tweak, &mut out[..15]).is_err());
+
+            // Consecutive sectors, starting with the vector's, must match
+            // the sectors encrypted one at a time.
+            let first_sector = tweak[..8].iter().rev()
+                                         .fold(0u64, |acc, &b| {
+                                             (acc << 8) | (b as u64)
+                                         });
+            assert!(tweak[8..].iter().all(|&b| b == 0));
+            let sector_len = input.len();
+            let mut sectors = Vec::with_capacity(NUM_SECTORS * sector_len);
+            for i in 0..NUM_SECTORS {
+                sectors.extend((0..sector_len).map(|j| (i + j) as u8));
+            }
+            sectors[..sector_len].copy_from_slice(&input);
+            let mut in_out = sectors.clone();
+            key.encrypt_sectors_in_place(first_sector, sector_len, &mut in_out)
+               .unwrap();
+            assert_eq!(&expected[..], &in_out[..sector_len]);
+            for (i, sector) in sectors.chunks(sector_len).enumerate() {
+                let mut sector_tweak = [0u8; TWEAK_LEN];
+                let sector_number = first_sector + (i as u64);
+                for j in 0..8 {
+                    sector_tweak[j] = (sector_number >> (8 * j)) as u8;
+                }
+                key.encrypt(&sector_tweak, sector, &mut out).unwrap();
+                assert_eq!(&out[..], &in_out[(i * sector_len)..][..sector_len]);
+            }
+            key.decrypt_sectors_in_place(first_sector, sector_len, &mut in_out)
+               .unwrap();
+            assert_eq!(sectors, in_out);
+
+            // The sectors must fill the buffer exactly.
+            assert!(key.encrypt_sectors_in_place(first_sector, sector_len,
+                                                 &mut in_out[1..]).is_err());
+            assert!(key.encrypt_sectors_in_place(first_sector, 0, &mut in_out)
+                       .is_err());
+
+            Ok(())
+        });
+    }
+
+    extern {
+        static GFp_AES_XTS_KEY_LEN: c::size_t;
+    }
+}
@@ -0,0 +1,160 @@
+// Copyright 2016 Brian Smith.
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+// SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+// OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+// CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+//! The Poly1305 one-time authenticator ([RFC 7539, Section 2.5]).
+//!
+//! A Poly1305 key must never be used for more than one message; it is
+//! normally derived from a stream cipher, as in `CHACHA20_POLY1305`. Use the
+//! AEAD algorithms in the parent module whenever possible.
+//!
+//! `sign_multi` authenticates many independent messages at once, which is
+//! several times faster than authenticating short messages one at a time
+//! when the CPU supports AVX2.
+//!
+//! [RFC 7539, Section 2.5]: https://tools.ietf.org/html/rfc7539#section-2.5
+
+use {c, constant_time, error, init};
+use core;
+
+/// The length of a Poly1305 key.
+pub const KEY_LEN: usize = 32;
+
+/// The length of a Poly1305 tag.
+pub const TAG_LEN: usize = 16;
+
+/// Calculates the tag of `input` under the one-time key `key`.
+///
+/// C analog: `CRYPTO_poly1305_init`, `CRYPTO_poly1305_update` and
+/// `CRYPTO_poly1305_finish`.
+pub fn sign(key: &[u8; KEY_LEN], input: &[u8]) -> [u8; TAG_LEN] {
+    let mut tag = [[0u8; TAG_LEN]; 1];
+    sign_multi(&[*key], &[input], &mut tag).unwrap();
+    tag[0]
+}
+
+/// Calculates the tag of `input` under the one-time key `key` and checks it
+/// against `tag` in constant time.
+pub fn verify(key: &[u8; KEY_LEN], input: &[u8], tag: &[u8])
+              -> Result<(), error::Unspecified> {
+    constant_time::verify_slices_are_equal(&sign(key, input), tag)
+}
+
+/// Calculates the tags of many independent messages at once: `tags_out[i]`
+/// is set to the tag of `inputs[i]` under the one-time key `keys[i]`.
+///
+/// `keys`, `inputs` and `tags_out` must have the same length. The messages
+/// may have any lengths.
+pub fn sign_multi(keys: &[[u8; KEY_LEN]], inputs: &[&[u8]],
+                  tags_out: &mut [[u8; TAG_LEN]])
+                  -> Result<(), error::Unspecified> {
+    if inputs.len() != keys.len() || tags_out.len() != keys.len() {
+        return Err(error::Unspecified);
+    }
+    init::init_once();
+
+    // The C function takes arrays of input pointers and lengths, which are
+    // built on the stack `BATCH_LEN` messages at a time. Each batch keeps
+    // the lanes of the AVX2 code busy until its last few messages.
+    const BATCH_LEN: usize = 32;
+
+    for ((keys, inputs), tags_out) in keys.chunks(BATCH_LEN)
+                                          .zip(inputs.chunks(BATCH_LEN))
+                                          .zip(tags_out.chunks_mut(BATCH_LEN)) {
+        let mut ins = [core::ptr::null(); BATCH_LEN];
+        let mut in_lens = [0; BATCH_LEN];
+        for ((in_, in_len), input) in
+                ins.iter_mut().zip(in_lens.iter_mut()).zip(inputs) {
+            *in_ = input.as_ptr();
+            *in_len = input.len();
+        }
+        unsafe {
+            GFp_poly1305_multi(tags_out.as_mut_ptr() as *mut u8,
+                               keys.as_ptr() as *const u8, ins.as_ptr(),
+                               in_lens.as_ptr(), keys.len());
+        }
+    }
+    Ok(())
+}
+
+extern {
+    fn GFp_poly1305_multi(macs: *mut u8, keys: *const u8,
+                          ins: *const *const u8, in_lens: *const c::size_t,
+                          num: c::size_t);
+}
+
+#[cfg(test)]
+mod tests {
+    use test;
+    use std::vec::Vec;
+    use super::{KEY_LEN, TAG_LEN, sign, sign_multi, verify};
+
+    // The messages are given to `sign_multi` in different numbers and
+    // orders, so that each message meets the others in the lanes of the
+    // AVX2 code, and lanes are retired and refilled at different times.
+    #[test]
+    pub fn test_poly1305_multi() {
+        let mut keys = Vec::new();
+        let mut inputs = Vec::new();
+        let mut expected_tags = Vec::new();
+        test::from_file("src/aead/poly1305_test.txt", |section, test_case| {
+            assert_eq!(section, "");
+            let key = test_case.consume_bytes("Key");
+            let key = *slice_as_array_ref!(&key, KEY_LEN).unwrap();
+            let input = test_case.consume_bytes("Input");
+            let tag = test_case.consume_bytes("MAC");
+            let tag = *slice_as_array_ref!(&tag, TAG_LEN).unwrap();
+
+            assert_eq!(tag, sign(&key, &input));
+            assert!(verify(&key, &input, &tag).is_ok());
+            let mut bad_tag = tag;
+            bad_tag[TAG_LEN - 1] ^= 1;
+            assert!(verify(&key, &input, &bad_tag).is_err());
+            assert!(verify(&key, &input, &tag[..(TAG_LEN - 1)]).is_err());
+
+            keys.push(key);
+            inputs.push(input);
+            expected_tags.push(tag);
+            Ok(())
+        });
+
+        // `n + 40` is longer than one batch of `sign_multi`.
+        let n = inputs.len();
+        for start in 0..n {
+            for &num in &[0, 1, 3, 4, 5, 9, n, n + 40] {
+                let order = (0..num).map(|i| (start + (i * 11)) % n)
+                                    .collect::<Vec<usize>>();
+                let packed_keys: Vec<[u8; KEY_LEN]> =
+                    order.iter().map(|&i| keys[i]).collect();
+                let ins: Vec<&[u8]> =
+                    order.iter().map(|&i| &inputs[i][..]).collect();
+                let mut tags = vec![[0u8; TAG_LEN]; num];
+                assert!(sign_multi(&packed_keys, &ins, &mut tags).is_ok());
+                for (&i, tag) in order.iter().zip(&tags) {
+                    assert_eq!(&expected_tags[i], tag);
+                }
+            }
+        }
+    }
+
+    #[test]
+    pub fn test_poly1305_multi_lengths() {
+        let keys = [[0u8; KEY_LEN]; 2];
+        let inputs: [&[u8]; 2] = [b"a", b"b"];
+        let mut tags = [[0u8; TAG_LEN]; 2];
+        assert!(sign_multi(&keys[..1], &inputs, &mut tags).is_err());
+        assert!(sign_multi(&keys, &inputs[..1], &mut tags).is_err());
+        assert!(sign_multi(&keys, &inputs, &mut tags[..1]).is_err());
+        assert!(sign_multi(&[], &[], &mut []).is_ok());
+    }
+}
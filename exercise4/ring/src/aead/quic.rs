@@ -0,0 +1,329 @@
+// Copyright 2016 Brian Smith.
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHORS DISCLAIM ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+// SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+// OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+// CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+//! QUIC header protection.
+//!
+//! See [RFC 9001, Section 5.4]. A server handling many connections can
+//! compute the masks of all the packets it has received with one call to
+//! `new_masks`; the masks of packets under the same key, or under ChaCha20
+//! keys, are computed together.
+//!
+//! [RFC 9001, Section 5.4]: https://tools.ietf.org/html/rfc9001#section-5.4
+
+use {bssl, c, error, init, polyfill};
+use core;
+use super::aes_gcm::AES_CTR_KEY_BUF_ELEMS;
+
+/// The length of the ciphertext sample that a mask is computed from.
+pub const SAMPLE_LEN: usize = 16;
+
+/// The length of a header protection mask.
+pub const MASK_LEN: usize = 5;
+
+/// A QUIC header protection algorithm.
+pub struct Algorithm {
+    key_len: usize,
+    id: AlgorithmID,
+}
+
+impl Algorithm {
+    /// The length of the key.
+    #[inline(always)]
+    pub fn key_len(&self) -> usize { self.key_len }
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum AlgorithmID {
+    AES,
+    CHACHA20,
+}
+
+/// AES-128 header protection.
+pub static AES_128: Algorithm = Algorithm {
+    key_len: 16,
+    id: AlgorithmID::AES,
+};
+
+/// AES-256 header protection.
+pub static AES_256: Algorithm = Algorithm {
+    key_len: 32,
+    id: AlgorithmID::AES,
+};
+
+/// ChaCha20 header protection.
+pub static CHACHA20: Algorithm = Algorithm {
+    key_len: CHACHA20_KEY_LEN,
+    id: AlgorithmID::CHACHA20,
+};
+
+const CHACHA20_KEY_LEN: usize = 32;
+
+/// A key for generating QUIC header protection masks.
+pub struct HeaderProtectionKey {
+    algorithm: &'static Algorithm,
+    inner: KeyInner,
+}
+
+enum KeyInner {
+    // A context constructed by `GFp_aes_ctr_init`.
+    Aes([u64; AES_CTR_KEY_BUF_ELEMS]),
+
+    // A key in the form that `GFp_ChaCha20_ctr32` takes.
+    ChaCha20([u32; CHACHA20_KEY_LEN / 4]),
+}
+
+impl HeaderProtectionKey {
+    /// Constructs a `HeaderProtectionKey` for `algorithm` from `key_bytes`,
+    /// which must be `algorithm.key_len()` bytes long.
+    pub fn new(algorithm: &'static Algorithm, key_bytes: &[u8])
+               -> Result<HeaderProtectionKey, error::Unspecified> {
+        if key_bytes.len() != algorithm.key_len {
+            return Err(error::Unspecified);
+        }
+        init::init_once();
+
+        let inner = match algorithm.id {
+            AlgorithmID::AES => {
+                let mut ctx_buf = [0u64; AES_CTR_KEY_BUF_ELEMS];
+                try!(bssl::map_result(unsafe {
+                    let ctx_buf = polyfill::slice::u64_as_u8_mut(&mut ctx_buf);
+                    GFp_aes_ctr_init(ctx_buf.as_mut_ptr(), ctx_buf.len(),
+                                     key_bytes.as_ptr(), key_bytes.len())
+                }));
+                KeyInner::Aes(ctx_buf)
+            },
+            AlgorithmID::CHACHA20 => {
+                let mut key = [0u32; CHACHA20_KEY_LEN / 4];
+                for (i, k) in key.iter_mut().enumerate() {
+                    let b = slice_as_array_ref!(&key_bytes[(i * 4)..][..4], 4)
+                                .unwrap();
+                    *k = polyfill::slice::u32_from_le_u8(b);
+                }
+                KeyInner::ChaCha20(key)
+            },
+        };
+        Ok(HeaderProtectionKey { algorithm: algorithm, inner: inner })
+    }
+
+    /// The key's algorithm.
+    #[inline(always)]
+    pub fn algorithm(&self) -> &'static Algorithm { self.algorithm }
+
+    /// Computes the mask of the packet whose ciphertext sample is `sample`,
+    /// which must be `SAMPLE_LEN` bytes long.
+    pub fn new_mask(&self, sample: &[u8])
+                    -> Result<[u8; MASK_LEN], error::Unspecified> {
+        let sample = try!(slice_as_array_ref!(sample, SAMPLE_LEN));
+        let mut mask = [[0u8; MASK_LEN]; 1];
+        try!(new_masks(&[self], &[*sample], &mut mask));
+        Ok(mask[0])
+    }
+}
+
+/// Computes the masks of many packets at once: `masks_out[i]` is set to the
+/// mask of the packet with key `keys[i]` and ciphertext sample `samples[i]`.
+///
+/// `keys`, `samples` and `masks_out` must have the same length. Sorting the
+/// packets by connection, so that packets under the same key are next to
+/// each other, makes this faster.
+pub fn new_masks(keys: &[&HeaderProtectionKey], samples: &[[u8; SAMPLE_LEN]],
+                 masks_out: &mut [[u8; MASK_LEN]])
+                 -> Result<(), error::Unspecified> {
+    if samples.len() != keys.len() || masks_out.len() != keys.len() {
+        return Err(error::Unspecified);
+    }
+
+    // The C functions take an array of key pointers, which is built on the
+    // stack for each run of keys of the same kind, `BATCH_LEN` keys at a
+    // time. `BATCH_LEN` is a multiple of `AES_HP_BATCH_BLOCKS` in e_aes.c
+    // and of the four packets that chacha.c computes together.
+    const BATCH_LEN: usize = 32;
+
+    let mut i = 0;
+    while i < keys.len() {
+        let id = keys[i].algorithm.id;
+        let mut todo = 1;
+        while i + todo < keys.len() && todo < BATCH_LEN &&
+              keys[i + todo].algorithm.id == id {
+            todo += 1;
+        }
+        let samples = samples[i..].as_ptr() as *const u8;
+        let masks = masks_out[i..].as_mut_ptr() as *mut u8;
+        match id {
+            AlgorithmID::AES => {
+                let mut ctx_bufs = [core::ptr::null(); BATCH_LEN];
+                let run = &keys[i..][..todo];
+                for (ctx_buf, key) in ctx_bufs.iter_mut().zip(run) {
+                    if let KeyInner::Aes(ref buf) = key.inner {
+                        *ctx_buf = buf.as_ptr() as *const u8;
+                    }
+                }
+                unsafe {
+                    GFp_aes_hp_masks(ctx_bufs.as_ptr(), samples, masks, todo);
+                }
+            },
+            AlgorithmID::CHACHA20 => {
+                let mut chacha_keys = [core::ptr::null(); BATCH_LEN];
+                let run = &keys[i..][..todo];
+                for (k, key) in chacha_keys.iter_mut().zip(run) {
+                    if let KeyInner::ChaCha20(ref chacha_key) = key.inner {
+                        *k = chacha_key;
+                    }
+                }
+                unsafe {
+                    GFp_chacha20_hp_masks(chacha_keys.as_ptr(), samples,
+                                          masks, todo);
+                }
+            },
+        }
+        i += todo;
+    }
+    Ok(())
+}
+
+extern {
+    fn GFp_aes_ctr_init(ctx_buf: *mut u8, ctx_buf_len: c::size_t,
+                        key: *const u8, key_len: c::size_t) -> c::int;
+    fn GFp_aes_hp_masks(ctx_bufs: *const *const u8, samples: *const u8,
+                        masks: *mut u8, num: c::size_t);
+    fn GFp_chacha20_hp_masks(keys: *const *const [u32; CHACHA20_KEY_LEN / 4],
+                             samples: *const u8, masks: *mut u8,
+                             num: c::size_t);
+}
+
+#[cfg(test)]
+mod tests {
+    use test;
+    use std::vec::Vec;
+    use super::{AES_128, AES_256, CHACHA20, HeaderProtectionKey, MASK_LEN,
+                SAMPLE_LEN, new_masks};
+
+    struct TestCase {
+        key: HeaderProtectionKey,
+        sample: [u8; SAMPLE_LEN],
+        mask: [u8; MASK_LEN],
+    }
+
+    fn read_test_cases(file_path: &str) -> Vec<TestCase> {
+        let mut test_cases = Vec::new();
+        test::from_file(file_path, |section, test_case| {
+            assert_eq!(section, "");
+            let key_bytes = test_case.consume_bytes("KEY");
+            let sample = test_case.consume_bytes("SAMPLE");
+            let mask = test_case.consume_bytes("MASK");
+
+            let algorithm = if file_path.contains("chacha") {
+                &CHACHA20
+            } else if key_bytes.len() == AES_128.key_len() {
+                &AES_128
+            } else {
+                &AES_256
+            };
+            let key = HeaderProtectionKey::new(algorithm, &key_bytes).unwrap();
+            assert_eq!(&mask[..], &key.new_mask(&sample).unwrap()[..]);
+
+            test_cases.push(TestCase {
+                key: key,
+                sample: *slice_as_array_ref!(&sample, SAMPLE_LEN).unwrap(),
+                mask: *slice_as_array_ref!(&mask, MASK_LEN).unwrap(),
+            });
+            Ok(())
+        });
+        test_cases
+    }
+
+    // Checks `new_masks` on the packets `packets`, given as indexes into
+    // `test_cases`.
+    fn check_new_masks(test_cases: &[TestCase], packets: &[usize]) {
+        let keys: Vec<&HeaderProtectionKey> =
+            packets.iter().map(|&v| &test_cases[v].key).collect();
+        let samples: Vec<[u8; SAMPLE_LEN]> =
+            packets.iter().map(|&v| test_cases[v].sample).collect();
+        let mut masks = vec![[0u8; MASK_LEN]; packets.len()];
+        assert!(new_masks(&keys, &samples, &mut masks).is_ok());
+        for (&v, mask) in packets.iter().zip(&masks) {
+            assert_eq!(&test_cases[v].mask, mask);
+        }
+    }
+
+    #[test]
+    pub fn test_aes_hp_masks() {
+        let test_cases = read_test_cases("src/aead/aes_hp_tests.txt");
+
+        // Runs of packets under the same key, which are batched in e_aes.c;
+        // 40 and 33 are longer than one batch.
+        const RUN_LENS: [usize; 6] = [1, 40, 2, 1, 33, 5];
+        let mut packets = Vec::new();
+        for (i, &run_len) in RUN_LENS.iter().enumerate() {
+            for _ in 0..run_len {
+                packets.push(i % test_cases.len());
+            }
+        }
+        check_new_masks(&test_cases, &packets);
+    }
+
+    #[test]
+    pub fn test_chacha20_hp_masks() {
+        let test_cases = read_test_cases("src/aead/chacha_hp_tests.txt");
+
+        // Groups of four packets are computed together in chacha.c; try
+        // every number of packets up to three full groups and a partial one.
+        for num in 0..(3 * 4 + 3) {
+            let packets: Vec<usize> =
+                (0..num).map(|i| (i * 3) % test_cases.len()).collect();
+            check_new_masks(&test_cases, &packets);
+        }
+    }
+
+    #[test]
+    pub fn test_mixed_hp_masks() {
+        let mut test_cases = read_test_cases("src/aead/aes_hp_tests.txt");
+        let num_aes = test_cases.len();
+        test_cases.extend(read_test_cases("src/aead/chacha_hp_tests.txt"));
+
+        // Alternate between runs of AES and ChaCha20 packets, with a run
+        // longer than the batches of `new_masks`.
+        let mut packets = Vec::new();
+        for (i, &run_len) in [3, 1, 70, 5, 2, 4].iter().enumerate() {
+            for j in 0..run_len {
+                packets.push(if i % 2 == 0 {
+                    j % num_aes
+                } else {
+                    num_aes + (j % (test_cases.len() - num_aes))
+                });
+            }
+        }
+        check_new_masks(&test_cases, &packets);
+    }
+
+    #[test]
+    pub fn test_hp_lengths() {
+        let test_cases = read_test_cases("src/aead/chacha_hp_tests.txt");
+        let key = &test_cases[0].key;
+
+        assert!(HeaderProtectionKey::new(&AES_128, &[0u8; 32]).is_err());
+        assert!(HeaderProtectionKey::new(&AES_256, &[0u8; 16]).is_err());
+        assert!(HeaderProtectionKey::new(&CHACHA20, &[0u8; 16]).is_err());
+
+        assert!(key.new_mask(&[0u8; SAMPLE_LEN - 1]).is_err());
+        assert!(key.new_mask(&[0u8; SAMPLE_LEN + 1]).is_err());
+
+        let samples = [[0u8; SAMPLE_LEN]; 2];
+        let mut masks = [[0u8; MASK_LEN]; 2];
+        assert!(new_masks(&[key, key], &samples[..1], &mut masks).is_err());
+        assert!(new_masks(&[key, key], &samples, &mut masks[..1]).is_err());
+        assert!(new_masks(&[key], &samples, &mut masks).is_err());
+        assert!(new_masks(&[], &[], &mut []).is_ok());
+    }
+}
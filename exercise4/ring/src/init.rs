@@ -12,18 +12,126 @@
 // OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
 // CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
+use core;
+
 #[inline(always)]
-#[cfg(not(all(target_arch = "aarch64", target_os = "ios")))]
 pub fn init_once() {
     extern crate std;
     static INIT: std::sync::Once = std::sync::ONCE_INIT;
-    INIT.call_once(|| unsafe { GFp_cpuid_setup() });
+    INIT.call_once(|| unsafe {
+        cpuid_setup();
+        GFp_dispatch_setup();
+    });
+}
+
+/// The names of the implementations of the primitives that are used on this
+/// CPU, e.g. "aesni" for AES or "avx2" for ChaCha20.
+///
+/// These are only meant to be logged or printed, e.g. by benchmarks, and to
+/// check which code paths tests exercise; the set of names isn't stable.
+#[derive(Clone, Copy, Debug)]
+pub struct ImplementationNames {
+    /// AES.
+    pub aes: &'static str,
+
+    /// GHASH, for AES-GCM.
+    pub ghash: &'static str,
+
+    /// How AES-GCM combines AES and GHASH: "separate" passes, or stitched
+    /// code such as "aesni-sse4.1" that computes both in one pass.
+    pub aes_gcm: &'static str,
+
+    /// ChaCha20.
+    pub chacha20: &'static str,
+
+    /// Poly1305.
+    pub poly1305: &'static str,
+
+    /// P-256 field and point arithmetic.
+    pub p256: &'static str,
+
+    /// Montgomery multiplication, for RSA.
+    pub bn_mul_mont: &'static str,
+}
+
+/// Returns the names of the implementations that are used on this CPU.
+pub fn implementation_names() -> ImplementationNames {
+    init_once();
+    let mut names = IMPLEMENTATION_NAMES {
+        aes: core::ptr::null(),
+        ghash: core::ptr::null(),
+        aes_gcm: core::ptr::null(),
+        chacha20: core::ptr::null(),
+        poly1305: core::ptr::null(),
+        p256: core::ptr::null(),
+        bn_mul_mont: core::ptr::null(),
+    };
+    unsafe {
+        GFp_implementation_names(&mut names);
+        ImplementationNames {
+            aes: static_str(names.aes),
+            ghash: static_str(names.ghash),
+            aes_gcm: static_str(names.aes_gcm),
+            chacha20: static_str(names.chacha20),
+            poly1305: static_str(names.poly1305),
+            p256: static_str(names.p256),
+            bn_mul_mont: static_str(names.bn_mul_mont),
+        }
+    }
+}
+
+// The names are static, ASCII, NUL-terminated C strings.
+unsafe fn static_str(s: *const u8) -> &'static str {
+    let mut len = 0;
+    while *s.offset(len as isize) != 0 {
+        len += 1;
+    }
+    let bytes = core::slice::from_raw_parts(s, len);
+    core::str::from_utf8(bytes).unwrap()
+}
+
+// Needs to be kept in sync with `IMPLEMENTATION_NAMES` in `crypto/internal.h`.
+#[allow(non_camel_case_types)]
+#[repr(C)]
+struct IMPLEMENTATION_NAMES {
+    aes: *const u8,
+    ghash: *const u8,
+    aes_gcm: *const u8,
+    chacha20: *const u8,
+    poly1305: *const u8,
+    p256: *const u8,
+    bn_mul_mont: *const u8,
 }
 
 #[cfg(not(all(target_arch = "aarch64", target_os = "ios")))]
+unsafe fn cpuid_setup() { GFp_cpuid_setup() }
+
+// The capabilities of these targets are known statically.
+#[cfg(all(target_arch = "aarch64", target_os = "ios"))]
+unsafe fn cpuid_setup() {}
+
 extern {
+    #[cfg(not(all(target_arch = "aarch64", target_os = "ios")))]
     fn GFp_cpuid_setup();
+
+    fn GFp_dispatch_setup();
+
+    fn GFp_implementation_names(out: *mut IMPLEMENTATION_NAMES);
 }
 
-#[cfg(all(target_arch = "aarch64", target_os = "ios"))]
-pub fn init_once() {}
+#[cfg(test)]
+mod tests {
+    #[test]
+    fn test_implementation_names() {
+        let names = super::implementation_names();
+        for name in &[names.aes, names.ghash, names.aes_gcm, names.chacha20,
+                      names.poly1305, names.p256, names.bn_mul_mont] {
+            assert!(!name.is_empty());
+        }
+
+        assert!(["aesni", "aesv8", "bsaes", "vpaes", "nohw"]
+                    .contains(&names.aes));
+        assert!(["clmul", "4bit-mmx", "4bit-x86", "pmull", "neon", "nohw",
+                 "4bit"].contains(&names.ghash));
+    }
+}
@@ -147,6 +147,8 @@ mod limb;
 #[doc(hidden)]
 pub use limb::GFp_rand_mod;
 
+pub use init::{implementation_names, ImplementationNames};
+
 #[cfg(feature = "use_heap")]
 #[path = "rsa/rsa.rs"]
 mod rsa;
@@ -176,4 +178,5 @@ mod private {
 mod tests {
     bssl_test_rng!(test_bn, bssl_bn_test_main);
     bssl_test!(test_constant_time, bssl_constant_time_test_main);
+    bssl_test!(test_gcm, bssl_gcm_test_main);
 }
@@ -160,10 +160,15 @@ pub use ec::eddsa::{
 
     ED25519,
 
+    Ed25519BatchItem,
     Ed25519KeyPair,
-    Ed25519KeyPairBytes
+    Ed25519KeyPairBytes,
+    Ed25519PreparedPublicKey
 };
 
+#[cfg(feature = "use_heap")]
+pub use ec::eddsa::verify_ed25519_batch;
+
 #[cfg(all(feature = "rsa_signing", feature = "use_heap"))]
 pub use rsa::signing::{RSAKeyPair, RSASigningState};
 